@@ -0,0 +1,176 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "alloc_accounting.h"
+
+#ifdef RALINK_ALLOC_ACCOUNTING
+
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+
+
+// threads that can be in a hot path at the same time
+#define MAX_HOT_PATH_THREADS	32
+#define ALLOC_HEADER_MAGIC		'rAlc'
+
+
+// keeps the returned memory as aligned as malloc()'s
+typedef struct alloc_header {
+	uint32		magic;
+	int32		site;
+	uint64		size;
+} alloc_header;
+
+typedef struct site_counters {
+	vint64		allocations;
+	vint64		frees;
+	vint64		bytes;
+	vint64		freed_bytes;
+	vint64		hot_path_allocations;
+} site_counters;
+
+static site_counters sSites[RALINK_ALLOC_SITES];
+static vint32 sHotPathThreads[MAX_HOT_PATH_THREADS];
+static bool sAssertHotPath = false;
+
+static const char* kSiteNames[RALINK_ALLOC_SITES] = {
+	"untagged", "device", "device name", "firmware", "USB trace", "timeline",
+	"RX ring"
+};
+
+
+/*!	Keeps the counters, allocations may be made before init_driver() (the
+	host tools start the timeline first).
+*/
+void
+alloc_accounting_init()
+{
+	memset((void*)sHotPathThreads, 0, sizeof(sHotPathThreads));
+	sAssertHotPath = platform_get_bool_setting("assert_hot_path_allocations",
+		false);
+}
+
+
+void
+alloc_accounting_get_stats(ralink_alloc_stats* stats)
+{
+	for (int32 i = 0; i < RALINK_ALLOC_SITES; i++) {
+		site_counters& counters = sSites[i];
+		ralink_alloc_site_stats& site = stats->sites[i];
+		site.allocations = atomic_get64(&counters.allocations);
+		site.frees = atomic_get64(&counters.frees);
+		site.bytes = atomic_get64(&counters.bytes);
+		site.live_objects = site.allocations - site.frees;
+		site.live_bytes = site.bytes - atomic_get64(&counters.freed_bytes);
+		site.hot_path_allocations
+			= atomic_get64(&counters.hot_path_allocations);
+	}
+}
+
+
+static void
+check_hot_path(int32 site, size_t size)
+{
+	int32 thread = platform_thread_id();
+	for (int32 i = 0; i < MAX_HOT_PATH_THREADS; i++) {
+		if (atomic_get(&sHotPathThreads[i]) != thread)
+			continue;
+
+		atomic_add64(&sSites[site].hot_path_allocations, 1);
+		if (sAssertHotPath) {
+			char message[128];
+			snprintf(message, sizeof(message), "ralink_usb: %lu bytes "
+				"allocated for %s on a hot path", (unsigned long)size,
+				kSiteNames[site]);
+			platform_panic(message);
+		}
+		return;
+	}
+}
+
+
+static void
+count_allocation(int32 site, size_t size)
+{
+	atomic_add64(&sSites[site].allocations, 1);
+	atomic_add64(&sSites[site].bytes, size);
+	check_hot_path(site, size);
+}
+
+
+void*
+alloc_accounting_malloc(int32 site, size_t size)
+{
+	alloc_header* header
+		= (alloc_header*)malloc(sizeof(alloc_header) + size);
+	if (header == NULL)
+		return NULL;
+
+	header->magic = ALLOC_HEADER_MAGIC;
+	header->site = site;
+	header->size = size;
+	count_allocation(site, size);
+	return header + 1;
+}
+
+
+void
+alloc_accounting_free(void* pointer)
+{
+	if (pointer == NULL)
+		return;
+
+	alloc_header* header = (alloc_header*)pointer - 1;
+	if (header->magic != ALLOC_HEADER_MAGIC)
+		platform_panic("ralink_usb: freeing an unaccounted allocation");
+
+	header->magic = 0;
+	atomic_add64(&sSites[header->site].frees, 1);
+	atomic_add64(&sSites[header->site].freed_bytes, header->size);
+	free(header);
+}
+
+
+void
+alloc_accounting_count(size_t size)
+{
+	count_allocation(RALINK_ALLOC_UNTAGGED, size);
+}
+
+
+void
+alloc_accounting_uncount()
+{
+	atomic_add64(&sSites[RALINK_ALLOC_UNTAGGED].frees, 1);
+}
+
+
+/*!	Registers the calling thread in a free slot, returned in \a _slot, or
+	-1 if there is none; the hot path is not checked then.
+*/
+void
+alloc_accounting_enter_hot_path(int32* _slot)
+{
+	int32 thread = platform_thread_id();
+	for (int32 i = 0; i < MAX_HOT_PATH_THREADS; i++) {
+		if (atomic_test_and_set(&sHotPathThreads[i], thread, 0) == 0) {
+			*_slot = i;
+			return;
+		}
+	}
+	*_slot = -1;
+}
+
+
+void
+alloc_accounting_leave_hot_path(int32 slot)
+{
+	if (slot >= 0)
+		atomic_set(&sHotPathThreads[slot], 0);
+}
+
+#endif	// RALINK_ALLOC_ACCOUNTING
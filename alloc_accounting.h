@@ -0,0 +1,90 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef ALLOC_ACCOUNTING_H
+#define ALLOC_ACCOUNTING_H
+
+#include <SupportDefs.h>
+
+#include <stdlib.h>
+
+#include "ralink_ioctl.h"
+
+
+/*!	Optional accounting of the driver's heap use, built with
+	RALINK_ALLOC_ACCOUNTING (the host build defines it). Every allocation
+	site is tagged with one of the RALINK_ALLOC_* sites: malloc() sites go
+	through RALINK_MALLOC()/RALINK_FREE(), classes derive from
+	AccountedAllocation<site>, and what is left on the plain operator new of
+	kernel_cpp.h counts as RALINK_ALLOC_UNTAGGED.
+
+	Code that must not allocate (Read(), Write() and the transfer
+	callbacks) marks itself with RALINK_HOT_PATH(); allocations made by
+	the same thread meanwhile are counted per site, and panic if the
+	"assert_hot_path_allocations" driver setting is on.
+
+	Without RALINK_ALLOC_ACCOUNTING, all of it compiles to the plain
+	malloc(), free() and operators.
+*/
+
+
+#ifdef RALINK_ALLOC_ACCOUNTING
+
+void		alloc_accounting_init();
+void		alloc_accounting_get_stats(ralink_alloc_stats* stats);
+
+void*		alloc_accounting_malloc(int32 site, size_t size);
+void		alloc_accounting_free(void* pointer);
+// untagged allocations, whose size is unknown when they are freed
+void		alloc_accounting_count(size_t size);
+void		alloc_accounting_uncount();
+
+void		alloc_accounting_enter_hot_path(int32* _slot);
+void		alloc_accounting_leave_hot_path(int32 slot);
+
+
+template<int32 kSite>
+class AccountedAllocation {
+public:
+	static void*		operator new(size_t size)
+							{ return alloc_accounting_malloc(kSite, size); }
+	static void			operator delete(void* pointer)
+							{ alloc_accounting_free(pointer); }
+};
+
+
+/*!	Marks the scope it lives in as a hot path of the calling thread. */
+class HotPathScope {
+public:
+						HotPathScope()
+							{ alloc_accounting_enter_hot_path(&fSlot); }
+						~HotPathScope()
+							{ alloc_accounting_leave_hot_path(fSlot); }
+
+private:
+	int32				fSlot;
+};
+
+#define RALINK_MALLOC(site, size)	alloc_accounting_malloc((site), (size))
+#define RALINK_FREE(pointer)		alloc_accounting_free(pointer)
+#define RALINK_HOT_PATH(variable)	HotPathScope variable
+
+#else	// !RALINK_ALLOC_ACCOUNTING
+
+template<int32 kSite>
+class AccountedAllocation {
+};
+
+static inline void
+alloc_accounting_init()
+{
+}
+
+#define RALINK_MALLOC(site, size)	malloc(size)
+#define RALINK_FREE(pointer)		free(pointer)
+#define RALINK_HOT_PATH(variable)	do {} while (0)
+
+#endif	// !RALINK_ALLOC_ACCOUNTING
+
+#endif // ALLOC_ACCOUNTING_H
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "control_queue.h"
+
+#include "alloc_accounting.h"
+#include "driver.h"
+#include "if_runreg.h"
+#include "io_stats.h"
+#include "timeline.h"
+
+#include <ByteOrder.h>
+
+
+ControlBatch::ControlBatch()
+	:
+	fQueued(0),
+	fError(B_OK)
+{
+	fInitStatus = platform_sem_create(&fDone, 0, DRIVER_NAME"_control_batch");
+}
+
+
+ControlBatch::~ControlBatch()
+{
+	if (fInitStatus == B_OK) {
+		// the callbacks still reference the batch
+		Wait();
+		platform_sem_delete(fDone);
+	}
+}
+
+
+status_t
+ControlBatch::InitCheck() const
+{
+	return fInitStatus;
+}
+
+
+/*!	Waits until every request queued with this batch has completed and
+	returns the first error any of them reported since the previous Wait().
+*/
+status_t
+ControlBatch::Wait(bigtime_t timeout)
+{
+	TIMELINE_SCOPE(scope, TIMELINE_CONTROL, "control batch wait", fQueued);
+
+	if (fQueued > 0) {
+		status_t status = platform_sem_acquire(fDone, fQueued, timeout);
+		if (status != B_OK)
+			return status;
+		fQueued = 0;
+	}
+
+	return atomic_set(&fError, B_OK);
+}
+
+
+/*!	Waits until \a read, queued with this batch, has completed, and returns
+	its status. The requests queued after it may still be in flight.
+*/
+status_t
+ControlBatch::Wait(control_read& read, bigtime_t timeout)
+{
+	// every completion of the batch counts, so take them until it is ours
+	while (atomic_get(&read.done) == 0) {
+		if (fQueued == 0)
+			return B_BAD_VALUE;
+		status_t status = platform_sem_acquire(fDone, 1, timeout);
+		if (status != B_OK)
+			return status;
+		fQueued--;
+	}
+	return read.status;
+}
+
+
+//	#pragma mark -
+
+
+ControlQueue::ControlQueue(usb_device device, ralink_io_stats* stats)
+	:
+	fDevice(device),
+	fStats(stats),
+	fBusySlots(0)
+{
+	for (int32 i = 0; i < CONTROL_QUEUE_DEPTH; i++) {
+		fSlots[i].queue = this;
+		fSlots[i].index = i;
+	}
+
+	fInitStatus = platform_sem_create(&fSlotSem, CONTROL_QUEUE_DEPTH,
+		DRIVER_NAME"_control_queue");
+}
+
+
+ControlQueue::~ControlQueue()
+{
+	if (fInitStatus == B_OK) {
+		// all slots are free again once every request has completed
+		platform_sem_acquire(fSlotSem, CONTROL_QUEUE_DEPTH);
+		platform_sem_delete(fSlotSem);
+	}
+}
+
+
+status_t
+ControlQueue::InitCheck() const
+{
+	return fInitStatus;
+}
+
+
+void
+ControlQueue::SetDevice(usb_device device)
+{
+	fDevice = device;
+}
+
+
+status_t
+ControlQueue::QueueWrite2(ControlBatch& batch, uint16 reg, uint16 val)
+{
+	control_slot* slot = _AcquireSlot();
+	if (slot == NULL)
+		return B_ERROR;
+
+	// the value goes in the setup packet, there is no data stage, as in
+	// run_write_2()
+	slot->read = NULL;
+	return _Queue(batch, slot, RALINK_IO_WRITE_2,
+		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT, RT2870_WRITE_2, val, reg,
+		0, NULL);
+}
+
+
+status_t
+ControlQueue::QueueWrite(ControlBatch& batch, uint16 reg, uint32 val)
+{
+	control_slot* slot = _AcquireSlot();
+	if (slot == NULL)
+		return B_ERROR;
+
+	slot->read = NULL;
+	slot->data = B_HOST_TO_LENDIAN_INT32(val);
+	return _Queue(batch, slot, RALINK_IO_WRITE_REGION,
+		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT, RT2870_WRITE_REGION_1,
+		0, reg, sizeof(slot->data), &slot->data);
+}
+
+
+status_t
+ControlQueue::QueueWriteRegion(ControlBatch& batch, uint16 reg,
+	const uint8* buffer, uint16 length)
+{
+	control_slot* slot = _AcquireSlot();
+	if (slot == NULL)
+		return B_ERROR;
+
+	slot->read = NULL;
+	return _Queue(batch, slot, RALINK_IO_WRITE_REGION,
+		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT, RT2870_WRITE_REGION_1,
+		0, reg, length, (void*)buffer);
+}
+
+
+/*!	Queues a read of the 32-bit register \a reg into \a read. */
+status_t
+ControlQueue::QueueRead(ControlBatch& batch, uint16 reg, control_read* read)
+{
+	return _QueueRead(batch, read, RALINK_IO_READ_REGION,
+		RT2870_READ_REGION_1, reg, sizeof(uint32));
+}
+
+
+/*!	Queues a read of the 16-bit EEPROM word \a word into \a read. */
+status_t
+ControlQueue::QueueReadEEPROM(ControlBatch& batch, uint16 word,
+	control_read* read)
+{
+	return _QueueRead(batch, read, RALINK_IO_EEPROM_READ, RT2870_EEPROM_READ,
+		word * 2, sizeof(uint16));
+}
+
+
+control_slot*
+ControlQueue::_AcquireSlot()
+{
+	if (platform_sem_acquire(fSlotSem) != B_OK)
+		return NULL;
+
+	// the semaphore guarantees that at least one slot is free
+	for (int32 i = 0;; i = (i + 1) % CONTROL_QUEUE_DEPTH) {
+		int32 bit = 1 << i;
+		if ((atomic_or(&fBusySlots, bit) & bit) == 0)
+			return &fSlots[i];
+	}
+}
+
+
+void
+ControlQueue::_ReleaseSlot(control_slot* slot)
+{
+	atomic_and(&fBusySlots, ~(1 << slot->index));
+	platform_sem_release(fSlotSem);
+}
+
+
+status_t
+ControlQueue::_QueueRead(ControlBatch& batch, control_read* read, int32 type,
+	uint8 request, uint16 index, uint16 length)
+{
+	read->value = 0xffffffff;
+	read->status = B_OK;
+	read->done = 0;
+
+	control_slot* slot = _AcquireSlot();
+	if (slot == NULL) {
+		read->status = B_ERROR;
+		read->done = 1;
+		return B_ERROR;
+	}
+
+	slot->read = read;
+	slot->data = 0;
+	status_t status = _Queue(batch, slot, type,
+		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_IN, request, 0, index, length,
+		&slot->data);
+	if (status != B_OK) {
+		read->status = status;
+		read->done = 1;
+	}
+	return status;
+}
+
+
+status_t
+ControlQueue::_Queue(ControlBatch& batch, control_slot* slot, int32 type,
+	uint8 requestType, uint8 request, uint16 value, uint16 index,
+	uint16 length, void* data)
+{
+	status_t status = batch.InitCheck();
+	if (status == B_OK) {
+		slot->batch = &batch;
+		slot->type = type;
+		slot->request = request;
+		slot->request_value = value;
+		slot->request_index = index;
+		slot->length = length;
+		slot->start = platform_time();
+
+		status = platform_usb_queue_request(fDevice, requestType, request,
+			value, index, length, data, _Callback, slot);
+	}
+	if (status != B_OK) {
+		atomic_test_and_set(&batch.fError, status, B_OK);
+		_ReleaseSlot(slot);
+		return status;
+	}
+
+	batch.fQueued++;
+	return B_OK;
+}
+
+
+/*static*/ void
+ControlQueue::_Callback(void* cookie, status_t status, void* data,
+	size_t actualLength)
+{
+	RALINK_HOT_PATH(hotPath);
+	control_slot* slot = (control_slot*)cookie;
+	ControlQueue* queue = slot->queue;
+	ControlBatch* batch = slot->batch;
+	control_read* read = slot->read;
+
+	if (status == B_OK && read != NULL && actualLength != slot->length)
+		status = B_DEV_DATA_UNDERRUN;
+	if (status != B_OK)
+		atomic_test_and_set(&batch->fError, status, B_OK);
+
+	// WRITE_2 carries its payload in the setup packet
+	io_stats_record(queue->fStats, slot->type, status,
+		slot->type == RALINK_IO_WRITE_2 ? sizeof(uint16) : actualLength,
+		platform_time() - slot->start);
+	// one request replaces a WRITE_2 for every 16-bit word of the region
+	if (status == B_OK && slot->type == RALINK_IO_WRITE_REGION) {
+		io_stats_record_saved(queue->fStats, RALINK_IO_WRITE_REGION,
+			(slot->length + 1) / 2 - 1);
+	}
+	TIMELINE_SPAN(TIMELINE_CONTROL, timeline_io_name(slot->type),
+		TIMELINE_TRACK_CONTROL_SLOT(slot->index), slot->start, status,
+		slot->request, slot->request_value, slot->request_index,
+		slot->length);
+
+	if (read != NULL) {
+		// a 16-bit read leaves the upper half of the zeroed buffer alone
+		if (status == B_OK)
+			read->value = B_LENDIAN_TO_HOST_INT32(slot->data);
+		read->status = status;
+		atomic_set(&read->done, 1);
+	}
+
+	queue->_ReleaseSlot(slot);
+	// the batch may be gone as soon as its waiter wakes up
+	platform_sem_release(batch->fDone);
+}
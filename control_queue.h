@@ -0,0 +1,121 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef CONTROL_QUEUE_H
+#define CONTROL_QUEUE_H
+
+#include <USB3.h>
+#include <SupportDefs.h>
+
+#include "platform.h"
+#include "ralink_ioctl.h"
+
+
+// maximum number of vendor requests in flight on the control pipe
+#define CONTROL_QUEUE_DEPTH		16
+
+
+class ControlBatch;
+class ControlQueue;
+
+/*!	The result of one read queued on a ControlQueue, filled in when the
+	request completes; ControlBatch::Wait() waits for it.
+*/
+typedef struct control_read {
+	uint32				value;		// 0xffffffff unless status is B_OK
+	status_t			status;
+	vint32				done;
+} control_read;
+
+typedef struct control_slot {
+	ControlQueue*		queue;
+	ControlBatch*		batch;
+	control_read*		read;		// or NULL for a write
+	int32				index;
+	int32				type;		// RALINK_IO_* for the statistics
+	uint8				request;	// setup packet, for the timeline
+	uint16				request_value;
+	uint16				request_index;
+	uint16				length;
+	bigtime_t			start;
+	uint32				data;		// payload of QueueWrite(), read buffer
+} control_slot;
+
+
+/*!	The requests one caller queued on a ControlQueue. Wait() only waits for
+	those, and returns the first error they reported, so callers sharing
+	the queue do not see each other's failures. A batch must not go away
+	while requests are in flight, the destructor waits for them.
+*/
+class ControlBatch {
+public:
+						ControlBatch();
+						~ControlBatch();
+
+	status_t			InitCheck() const;
+
+	status_t			Wait(bigtime_t timeout = B_INFINITE_TIMEOUT);
+	status_t			Wait(control_read& read,
+							bigtime_t timeout = B_INFINITE_TIMEOUT);
+
+private:
+	friend class ControlQueue;
+
+	status_t			fInitStatus;
+	platform_sem		fDone;		// released once per completed request
+	int32				fQueued;	// since the last Wait(), caller only
+	vint32				fError;
+};
+
+
+/*!	Pipelines register reads and writes on the default control pipe.
+	Requests are queued into a ControlBatch and complete in submission
+	order; callers queue as many as they need, an init sequence included,
+	and then wait for the batch once, or for each read as its value is
+	needed. Buffers given to QueueWriteRegion() and the control_reads must
+	stay valid until then.
+*/
+class ControlQueue {
+public:
+						ControlQueue(usb_device device,
+							ralink_io_stats* stats = NULL);
+						~ControlQueue();
+
+	status_t			InitCheck() const;
+	void				SetDevice(usb_device device);
+
+	status_t			QueueWrite2(ControlBatch& batch, uint16 reg,
+							uint16 val);
+	status_t			QueueWrite(ControlBatch& batch, uint16 reg,
+							uint32 val);
+	status_t			QueueWriteRegion(ControlBatch& batch, uint16 reg,
+							const uint8* buffer, uint16 length);
+	status_t			QueueRead(ControlBatch& batch, uint16 reg,
+							control_read* read);
+	status_t			QueueReadEEPROM(ControlBatch& batch, uint16 word,
+							control_read* read);
+
+private:
+	control_slot*		_AcquireSlot();
+	void				_ReleaseSlot(control_slot* slot);
+	status_t			_QueueRead(ControlBatch& batch, control_read* read,
+							int32 type, uint8 request, uint16 index,
+							uint16 length);
+	status_t			_Queue(ControlBatch& batch, control_slot* slot,
+							int32 type, uint8 requestType, uint8 request,
+							uint16 value, uint16 index, uint16 length,
+							void* data);
+
+	static void			_Callback(void* cookie, status_t status, void* data,
+							size_t actualLength);
+
+	usb_device			fDevice;
+	ralink_io_stats*	fStats;
+	status_t			fInitStatus;
+	platform_sem		fSlotSem;
+	vint32				fBusySlots;
+	control_slot		fSlots[CONTROL_QUEUE_DEPTH];
+};
+
+#endif // CONTROL_QUEUE_H
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "datapath.h"
+
+#include <ByteOrder.h>
+
+#include <string.h>
+
+#include "if_runreg.h"
+
+
+// net80211's WME access categories, which are also the TX queue numbers
+enum {
+	ACCESS_CATEGORY_BE = 0,
+	ACCESS_CATEGORY_BK,
+	ACCESS_CATEGORY_VI,
+	ACCESS_CATEGORY_VO
+};
+
+static const uint8 kTIDToAccessCategory[8] = {
+	ACCESS_CATEGORY_BE, ACCESS_CATEGORY_BK, ACCESS_CATEGORY_BK,
+	ACCESS_CATEGORY_BE, ACCESS_CATEGORY_VI, ACCESS_CATEGORY_VI,
+	ACCESS_CATEGORY_VO, ACCESS_CATEGORY_VO
+};
+
+// rt2860_rates[] of if_runreg.h, without the net80211 PHY type
+const ralink_rate kRalinkRates[RALINK_RATE_COUNT] = {
+	{   2, 0, false, 0, 314, 314 },
+	{   4, 1, false, 1, 258, 162 },
+	{  11, 2, false, 2, 223, 127 },
+	{  22, 3, false, 3, 213, 117 },
+	{  12, 0, true,  4,  60,  60 },
+	{  18, 1, true,  4,  52,  52 },
+	{  24, 2, true,  6,  48,  48 },
+	{  36, 3, true,  6,  44,  44 },
+	{  48, 4, true,  8,  44,  44 },
+	{  72, 5, true,  8,  40,  40 },
+	{  96, 6, true,  8,  40,  40 },
+	{ 108, 7, true,  8,  40,  40 }
+};
+
+
+/*!	Builds the bulk OUT transfer for one 802.11 \a frame into \a buffer,
+	which needs RALINK_TX_OVERHEAD bytes more than the frame. Like run_tx(),
+	picks the rate and the TX queue (returned in \a _queue), requests an
+	ACK and fills in its duration unless the frame is multicast or QoS
+	"no ACK". The frame is copied, the caller's is left untouched.
+*/
+status_t
+datapath_build_tx(const ralink_tx_params* params, const uint8* frame,
+	uint16 length, uint8* buffer, size_t bufferSize, size_t* _transferLength,
+	uint8* _queue)
+{
+	if (length < RALINK_WLAN_HEADER_LENGTH || length > RALINK_MAX_TX_FRAME)
+		return B_BAD_VALUE;
+
+	bool data = (frame[0] & RALINK_FC0_TYPE_MASK) == RALINK_FC0_TYPE_DATA;
+	bool hasQoS = data && (frame[0] & RALINK_FC0_SUBTYPE_QOS) != 0;
+	bool addr4 = (frame[1] & RALINK_FC1_DIR_MASK) == RALINK_FC1_DIR_DSTODS;
+	uint16 headerLength = RALINK_WLAN_HEADER_LENGTH + (addr4 ? 6 : 0)
+		+ (hasQoS ? 2 : 0);
+	if (length < headerLength)
+		return B_BAD_VALUE;
+
+	// TXWI and frame are 32 bit aligned, a zero word ends the transfer
+	size_t dmaLength = (sizeof(rt2860_txwi) + length + 3) & ~(size_t)3;
+	size_t transferLength = sizeof(rt2870_txd) + dmaLength + sizeof(uint32);
+	if (transferLength > bufferSize)
+		return B_BUFFER_OVERFLOW;
+
+	uint16 qos = 0;
+	uint8 queue = ACCESS_CATEGORY_BE;
+	if (hasQoS) {
+		const uint8* qosField = frame + headerLength - 2;
+		qos = qosField[0] | qosField[1] << 8;
+		// like TID_TO_WME_AC(), the TSPEC TIDs 8-15 go to voice
+		queue = kTIDToAccessCategory[min_c(qos & RALINK_QOS_TID, 7)];
+	}
+
+	// addr1 starts at byte 4, its group bit tells multicast apart
+	bool multicast = (frame[4] & 0x01) != 0;
+	uint8 rateIndex = multicast || !data
+		? params->basic_rate_index : params->rate_index;
+	if (rateIndex >= RALINK_RATE_COUNT)
+		return B_BAD_VALUE;
+	const ralink_rate& rate = kRalinkRates[rateIndex];
+
+	rt2870_txd* txd = (rt2870_txd*)buffer;
+	rt2860_txwi* txwi = (rt2860_txwi*)(txd + 1);
+	uint8* payload = (uint8*)(txwi + 1);
+	memset(buffer, 0, sizeof(rt2870_txd) + sizeof(rt2860_txwi));
+	// the shared TX ring has the frame in place already
+	if (payload != frame)
+		memcpy(payload, frame, length);
+	memset(payload + length, 0, transferLength - sizeof(rt2870_txd)
+		- sizeof(rt2860_txwi) - length);
+
+	txd->len = B_HOST_TO_LENDIAN_INT16((uint16)dmaLength);
+	txd->flags = RT2860_TX_QSEL_EDCA;
+	txwi->wcid = multicast ? 0 : params->wcid;
+
+	if (!multicast && (!hasQoS
+			|| (qos & RALINK_QOS_ACKPOLICY) != RALINK_QOS_ACKPOLICY_NOACK)) {
+		txwi->xflags |= RT2860_TX_ACK;
+		const ralink_rate& control = kRalinkRates[rate.control_index];
+		uint16 duration = params->short_preamble
+			? control.short_ack_duration : control.long_ack_duration;
+		payload[2] = duration & 0xff;
+		payload[3] = duration >> 8;
+	}
+
+	// the header is 32 bit aligned if it has both or neither of the fourth
+	// address and the QoS field, otherwise the chip inserts L2 padding
+	uint8 pad = addr4 == hasQoS ? 0 : 2;
+	txwi->len = B_HOST_TO_LENDIAN_INT16(length - pad);
+
+	uint16 mcs = rate.mcs;
+	uint16 phy = RT2860_PHY_OFDM;
+	if (!rate.ofdm) {
+		phy = RT2860_PHY_CCK;
+		if (rateIndex != RT2860_RIDX_CCK1 && params->short_preamble)
+			mcs |= RT2860_PHY_SHPRE;
+	}
+	txwi->phy = B_HOST_TO_LENDIAN_INT16(phy | mcs);
+
+	// RTS/CTS or CTS-to-self protection
+	if (!multicast && (length + 4 > params->rts_threshold
+			|| (params->protection && rate.ofdm)))
+		txwi->txop = RT2860_TX_TXOP_HT;
+	else
+		txwi->txop = RT2860_TX_TXOP_BACKOFF;
+
+	if (!params->station && !hasQoS)
+		txwi->xflags |= RT2860_TX_NSEQ;
+
+	*_transferLength = transferLength;
+	*_queue = queue;
+	return B_OK;
+}
+
+
+/*!	Returns the RX chain with the highest RSSI among the first \a chains. */
+uint8
+datapath_max_rssi_chain(const uint8* rssi, uint8 chains)
+{
+	uint8 chain = 0;
+	if (chains > 1) {
+		if (rssi[1] > rssi[chain])
+			chain = 1;
+		if (chains > 2 && rssi[2] > rssi[chain])
+			chain = 2;
+	}
+	return chain;
+}
+
+
+/*!	Decodes one received frame, \a data points to its RXWI, and the RXD
+	follows \a dmaLength bytes later. Frames the chip flagged with a CRC,
+	ICV or MIC error are rejected with B_BAD_DATA, like in run_rx_frame().
+	Unlike there, the RXWI length is checked against the frame actually
+	present, as it is handed out without a copy.
+*/
+status_t
+datapath_parse_rx_frame(const uint8* data, uint32 dmaLength, uint8 chains,
+	ralink_rx_frame* frame)
+{
+	const rt2860_rxwi* rxwi = (const rt2860_rxwi*)data;
+	uint32 length = B_LENDIAN_TO_HOST_INT16(rxwi->len) & 0xfff;
+
+	uint32 flags;
+	memcpy(&flags, data + dmaLength, sizeof(flags));
+	flags = B_LENDIAN_TO_HOST_INT32(flags);
+	if ((flags & (RT2860_RX_CRCERR | RT2860_RX_ICVERR | RT2860_RX_MICERR))
+			!= 0)
+		return B_BAD_DATA;
+
+	if ((flags & RT2860_RX_L2PAD) != 0)
+		length += 2;
+	if (length < RALINK_WLAN_HEADER_LENGTH
+		|| sizeof(rt2860_rxwi) + length > dmaLength)
+		return B_BAD_DATA;
+
+	frame->data = data + sizeof(rt2860_rxwi);
+	frame->length = length;
+	frame->flags = flags;
+	frame->phy = B_LENDIAN_TO_HOST_INT16(rxwi->phy);
+	frame->key_index = rxwi->keyidx;
+	frame->antenna = datapath_max_rssi_chain(rxwi->rssi, chains);
+	frame->rssi = rxwi->rssi[frame->antenna];
+	return B_OK;
+}
+
+
+/*!	Splits a bulk IN \a transfer into its frames, the loop of
+	run_bulk_rx_callback(). Fills in up to \a maxFrames \a frames pointing
+	into the transfer and returns their number; bad frames, a corrupt DMA
+	length ending the transfer early and frames beyond \a maxFrames are
+	counted in \a _errors.
+*/
+int32
+datapath_deaggregate(const uint8* transfer, size_t length, uint8 chains,
+	ralink_rx_frame* frames, int32 maxFrames, uint32* _errors)
+{
+	int32 count = 0;
+	uint32 errors = 0;
+
+	if (length < sizeof(uint32) + sizeof(rt2860_rxwi) + sizeof(rt2870_rxd)) {
+		*_errors = 1;
+		return 0;
+	}
+
+	while (length > 8) {
+		uint32 dmaLength;
+		memcpy(&dmaLength, transfer, sizeof(dmaLength));
+		dmaLength = B_LENDIAN_TO_HOST_INT32(dmaLength) & 0xffff;
+		if (dmaLength == 0 || (dmaLength & 3) != 0 || dmaLength + 8 > length
+			|| count == maxFrames) {
+			errors++;
+			break;
+		}
+
+		if (datapath_parse_rx_frame(transfer + sizeof(uint32), dmaLength,
+				chains, &frames[count]) == B_OK)
+			count++;
+		else
+			errors++;
+
+		transfer += dmaLength + 8;
+		length -= dmaLength + 8;
+	}
+
+	*_errors = errors;
+	return count;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef DATAPATH_H
+#define DATAPATH_H
+
+#include <SupportDefs.h>
+
+
+/*!	The per-frame work of the datapath, ported from run_tx(),
+	run_set_tx_desc(), run_bulk_rx_callback(), run_rx_frame() and
+	run_maxrssi_chain() in if_run.c, without the mbufs and net80211: they
+	only look at and write plain buffers, so that they can be benchmarked
+	on the host (host/datapath_bench.cpp).
+
+	A bulk OUT transfer is [TXD][TXWI][802.11 frame][pad to 4][4 zero bytes],
+	a bulk IN transfer holds one or more [DMA length][RXWI][802.11 frame]
+	[pad to 4][RXD].
+*/
+
+
+// bulk IN transfer the driver queues; the chip closes an aggregate after
+// the frame that crosses USB_DMA_CFG RX_AGG_LMT, which is kept low enough
+// for the largest frame to fit behind it
+#define RALINK_MAX_RX_TRANSFER		16384
+// the largest RX frame with its overhead, a 3839 byte A-MSDU
+#define RALINK_MAX_RX_FRAME			4096
+// TXD, TXWI, padding and the trailing zero word around a TX frame
+#define RALINK_TX_OVERHEAD			(4 + 16 + 3 + 4)
+// the largest TX frame, the length field of the TXWI has 12 bits
+#define RALINK_MAX_TX_FRAME			0xfff
+// RXWI plus the DMA length word and the RXD around an RX frame
+#define RALINK_RX_OVERHEAD			(4 + 16 + 4)
+
+// 802.11 header fields the datapath looks at
+#define RALINK_WLAN_HEADER_LENGTH	24
+#define RALINK_FC0_TYPE_MASK		0x0c
+#define RALINK_FC0_TYPE_DATA		0x08
+#define RALINK_FC0_SUBTYPE_QOS		0x80
+#define RALINK_FC1_DIR_MASK			0x03
+#define RALINK_FC1_DIR_DSTODS		0x03
+#define RALINK_FC1_PROTECTED		0x40
+#define RALINK_QOS_TID				0x000f
+#define RALINK_QOS_ACKPOLICY		0x0060
+#define RALINK_QOS_ACKPOLICY_NOACK	0x0020
+
+// the legacy rates, indexed by RT2860_RIDX_*
+#define RALINK_RATE_COUNT			12
+
+
+typedef struct ralink_rate {
+	uint8		rate;			// in 500 kbit/s
+	uint8		mcs;
+	bool		ofdm;
+	uint8		control_index;	// rate index for the ACK
+	uint16		short_ack_duration;
+	uint16		long_ack_duration;
+} ralink_rate;
+
+extern const ralink_rate kRalinkRates[RALINK_RATE_COUNT];
+
+
+typedef struct ralink_tx_params {
+	uint8		rate_index;			// for unicast data frames
+	uint8		basic_rate_index;	// for multicast and management frames
+	uint8		wcid;				// of the peer, multicast uses 0
+	uint16		rts_threshold;
+	bool		short_preamble;
+	bool		protection;			// CTS protection of OFDM frames
+	bool		station;			// STA mode, the chip sets no sequence
+} ralink_tx_params;
+
+typedef struct ralink_rx_frame {
+	const uint8*	data;		// the 802.11 frame, inside the transfer
+	uint16		length;
+	uint32		flags;			// RT2860_RX_* of the RXD
+	uint16		phy;
+	uint8		key_index;
+	uint8		antenna;		// chain with the strongest signal
+	uint8		rssi;
+} ralink_rx_frame;
+
+
+status_t		datapath_build_tx(const ralink_tx_params* params,
+					const uint8* frame, uint16 length, uint8* buffer,
+					size_t bufferSize, size_t* _transferLength,
+					uint8* _queue);
+
+uint8			datapath_max_rssi_chain(const uint8* rssi, uint8 chains);
+status_t		datapath_parse_rx_frame(const uint8* data, uint32 dmaLength,
+					uint8 chains, ralink_rx_frame* frame);
+int32			datapath_deaggregate(const uint8* transfer, size_t length,
+					uint8 chains, ralink_rx_frame* frames, int32 maxFrames,
+					uint32* _errors);
+
+#endif // DATAPATH_H
@@ -1,5 +1,6 @@
 #include <Drivers.h>
 #include <KernelExport.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,9 +8,13 @@
 #include "lock.h"
 //#include <util/AutoLock.h>
 
+#include "alloc_accounting.h"
 #include "driver.h"
+#include "firmware.h"
+#include "io_stats.h"
 #include "ralink_usb.h"
 #include "kernel_cpp.h"
+#include "usb_trace.h"
 
 
 status_t	ralink_open(const char *name, uint32 flags, void **cookie);
@@ -27,8 +32,20 @@ int32 api_version = B_CUR_DRIVER_API_VERSION;
 usb_module_info* gUSBModule;
 char* gDeviceNames[MAX_DEVICES + 1];
 RalinkUSB* gDevicesList[MAX_DEVICES];
+// devices with a handle that has not been freed yet, by index
 int32 gOpenMask = 0;
 mutex gDriverLock;
+
+// read-only opens only monitor a device (like ralink_stat does), and may
+// come and go while the network stack owns it; they all share the handle
+// of their device
+typedef struct monitor_handle {
+	int32		index;
+} monitor_handle;
+
+static monitor_handle sMonitorHandles[MAX_DEVICES];
+static int32 sMonitorCount[MAX_DEVICES];
+static ralink_driver_lock_stats sLockStats;
 static usb_support_descriptor sDescriptor;
 static const char* sDeviceBaseName = "net/usb_ralink/";
 	
@@ -46,7 +63,102 @@ static usb_notify_hooks sNotifyHooks = {
 	&usb_ralink_device_added,
 	&usb_ralink_device_removed
 };
-		
+
+
+/*!	Holds gDriverLock for the rest of a device hook, and accounts how long
+	the hook waited for and held it in sLockStats (under the lock).
+*/
+class DriverLocker {
+public:
+	DriverLocker(int32 hook, bigtime_t hookStart)
+		:
+		fHook(hook),
+		fHookStart(hookStart)
+	{
+		bigtime_t start = system_time();
+		mutex_lock(&gDriverLock);
+		fLocked = system_time();
+		fWaitTime = fLocked - start;
+	}
+
+	~DriverLocker()
+	{
+		bigtime_t now = system_time();
+		bigtime_t holdTime = now - fLocked;
+		bigtime_t totalTime = now - fHookStart;
+
+		ralink_hook_stats& stats = sLockStats.hooks[fHook];
+		stats.calls++;
+		stats.wait_time += fWaitTime;
+		stats.max_wait_time = max_c(stats.max_wait_time, (uint64)fWaitTime);
+		stats.hold_time += holdTime;
+		stats.max_hold_time = max_c(stats.max_hold_time, (uint64)holdTime);
+		stats.total_time += totalTime;
+		stats.max_total_time = max_c(stats.max_total_time,
+			(uint64)totalTime);
+		stats.histogram[io_stats_bucket(totalTime)]++;
+
+		mutex_unlock(&gDriverLock);
+	}
+
+private:
+	int32				fHook;
+	bigtime_t			fHookStart;
+	bigtime_t			fLocked;
+	bigtime_t			fWaitTime;
+};
+
+
+
+static monitor_handle*
+as_monitor_handle(void* cookie)
+{
+	if (cookie < (void*)&sMonitorHandles[0]
+		|| cookie >= (void*)&sMonitorHandles[MAX_DEVICES])
+		return NULL;
+	return (monitor_handle*)cookie;
+}
+
+
+/*!	Monitors may only look at the statistics; anything not listed here,
+	including ops added later, is refused.
+*/
+static bool
+monitor_may_use(uint32 op)
+{
+	switch (op) {
+		case RALINK_GET_REGISTER_CACHE_STATS:
+		case RALINK_GET_EFUSE_STATS:
+		case RALINK_GET_POLL_STATS:
+		case RALINK_GET_IO_STATS:
+		case RALINK_GET_TRACE_RING:
+		case RALINK_GET_DEVICE_STATS:
+		case RALINK_GET_RX_AGGREGATION:
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+/*!	Deletes the device at \a index if it was unplugged and its last handle
+	has been freed. Must be called with gDriverLock held.
+*/
+static void
+put_device(int32 index)
+{
+	RalinkUSB* device = gDevicesList[index];
+	if ((gOpenMask & (1 << index)) != 0 || sMonitorCount[index] > 0
+		|| !device->IsRemoved())
+		return;
+
+	gDevicesList[index] = NULL;
+	delete device;
+	RALINK_FREE(gDeviceNames[index]);
+	gDeviceNames[index] = NULL;
+	TRACE("Device at %ld deleted.\n", index);
+}
+
 	
 RalinkUSB*
 lookup_and_create_device(usb_device device)
@@ -70,15 +182,18 @@ lookup_and_create_device(usb_device device)
 status_t
 usb_ralink_device_added(usb_device device, void **cookie)
 {
+	bigtime_t start = system_time();
 	TRACE_ALWAYS("usb_ralink_device_added()\n");
+	usb_trace_mark(USB_TRACE_MARK_ADDED, device);
 	
 	*cookie = NULL;
 
-	MutexLocker lock(gDriverLock); // released on exit
+	DriverLocker lock(RALINK_HOOK_DEVICE_ADDED, start); // released on exit
 
-	// check if this is a replug of an existing device first
+	// check if this is a replug of an unplugged, still open device first;
+	// the ones still plugged in are other adapters
 	for (int32 i = 0; i < MAX_DEVICES; i++) {
-		if (gDevicesList[i] == NULL)
+		if (gDevicesList[i] == NULL || !gDevicesList[i]->IsRemoved())
 			continue;
 
 		if (gDevicesList[i]->CompareAndReattach(device) != B_OK)
@@ -111,7 +226,8 @@ usb_ralink_device_added(usb_device device, void **cookie)
 			continue;
 
 		gDevicesList[i] = ralinkDevice;
-		gDeviceNames[i] = (char*)malloc(B_PATH_NAME_LENGTH);
+		gDeviceNames[i] = (char*)RALINK_MALLOC(RALINK_ALLOC_DEVICE_NAME,
+			B_PATH_NAME_LENGTH);
 		snprintf(gDeviceNames[i], B_PATH_NAME_LENGTH,
 			"%s%" B_PRId32, sDeviceBaseName, i);
 		*cookie = ralinkDevice;
@@ -131,21 +247,16 @@ usb_ralink_device_added(usb_device device, void **cookie)
 status_t
 usb_ralink_device_removed(void *cookie)
 {
-	MutexLocker lock(gDriverLock); // released on exit
+	bigtime_t start = system_time();
+	usb_trace_mark(USB_TRACE_MARK_REMOVED, 0);
+	DriverLocker lock(RALINK_HOOK_DEVICE_REMOVED, start); // released on exit
 
 	RalinkUSB* device = (RalinkUSB*)cookie;
 	for (int32 i = 0; i < MAX_DEVICES; i++) {
 		if (gDevicesList[i] == device) {
-			if (device->IsOpen()) {
-				// the device will be deleted upon being freed
-				device->Removed();
-			} else {
-				gDevicesList[i] = NULL;
-				delete device;
-				free(gDeviceNames[i]);
-				gDeviceNames[i] = NULL;
-				TRACE("Device at %ld deleted.\n", i);
-			}
+			// if it is still open, it will be deleted upon being freed
+			device->Removed();
+			put_device(i);
 			break;
 		}
 	}
@@ -175,10 +286,28 @@ init_driver()
 	if (status < B_OK)
 		return status;
 
+	// the trace is optional, the driver works without it
+	if (init_usb_trace(&gUSBModule) != B_OK)
+		TRACE_ALWAYS(DRIVER_NAME": could not start the USB trace\n");
+
+	status = init_firmware_cache();
+	if (status < B_OK) {
+		uninit_usb_trace();
+		put_module(B_USB_MODULE_NAME);
+		return status;
+	}
+
 	for (int32 i = 0; i < MAX_DEVICES; i++)
 		gDevicesList[i] = NULL;
 	for (int32 i = 0; i < MAX_DEVICES + 1; i++)
 		gDeviceNames[i] = NULL;
+	gOpenMask = 0;
+	for (int32 i = 0; i < MAX_DEVICES; i++) {
+		sMonitorHandles[i].index = i;
+		sMonitorCount[i] = 0;
+	}
+	memset(&sLockStats, 0, sizeof(sLockStats));
+	alloc_accounting_init();
 	
 	mutex_init(&gDriverLock, DRIVER_NAME"_devices");
 	
@@ -202,11 +331,13 @@ uninit_driver()
 	for (int32 i = 0; i < MAX_DEVICES; i++) {
 		delete gDevicesList[i];
 		gDevicesList[i] = NULL;
-		free(gDeviceNames[i]);
+		RALINK_FREE(gDeviceNames[i]);
 		gDeviceNames[i] = NULL;
 	}
 
 	mutex_destroy(&gDriverLock);
+	uninit_firmware_cache();
+	uninit_usb_trace();
 	put_module(B_USB_MODULE_NAME);
 
 	//release_settings();
@@ -226,7 +357,7 @@ find_device(const char *name)
 	TRACE(DRIVER_NAME": find device \"%s\"\n", name);
 
 	for (int32 i = 0; i < MAX_DEVICES; i++) {
-		if (strcmp(gDeviceNames[i], name) == 0)
+		if (gDeviceNames[i] != NULL && strcmp(gDeviceNames[i], name) == 0)
 			return &gDeviceHooks;
 	}
 
@@ -241,17 +372,32 @@ find_device(const char *name)
 status_t
 ralink_open(const char *name, uint32 flags, void **cookie)
 {
+	bigtime_t start = system_time();
 	TRACE(DRIVER_NAME": open device %s ", name);
-	MutexLocker lock(gDriverLock); // released on exit
+	DriverLocker lock(RALINK_HOOK_OPEN, start); // released on exit
 
 	*cookie = NULL;
 	status_t status = ENODEV;
-	char* slash = strrchr(name, '/');
-	int32 index = strtol(slash, NULL, 10);
+	const char* slash = strrchr(name, '/');
+	int32 index = slash != NULL ? strtol(slash + 1, NULL, 10) : -1;
 	TRACE(" index %d, ", index);
-	TRACE(" device pointer %p", gDevicesList[index]);
 	if (index >= 0 && index < MAX_DEVICES && gDevicesList[index]) {
-		status = gDevicesList[index]->Open(flags);
+		TRACE(" device pointer %p", gDevicesList[index]);
+		usb_trace_mark(USB_TRACE_MARK_OPEN, index);
+		if ((flags & O_ACCMODE) == O_RDONLY) {
+			sMonitorCount[index]++;
+			*cookie = &sMonitorHandles[index];
+			TRACE(" monitor\n");
+			return B_OK;
+		}
+
+		// a closed handle keeps the device until it is freed
+		if ((gOpenMask & (1 << index)) != 0)
+			status = B_BUSY;
+		else
+			status = gDevicesList[index]->Open(flags);
+		if (status == B_OK)
+			gOpenMask |= 1 << index;
 		*cookie = gDevicesList[index];
 	}
 
@@ -264,6 +410,10 @@ status_t
 ralink_close(void *cookie)
 {
 	TRACE((DRIVER_NAME": close device\n"));
+	usb_trace_mark(USB_TRACE_MARK_CLOSE, 0);
+	if (as_monitor_handle(cookie) != NULL)
+		return B_OK;
+
 	RalinkUSB* device = (RalinkUSB*)cookie;
 	return device->Close();
 }
@@ -272,20 +422,25 @@ ralink_close(void *cookie)
 status_t
 ralink_free(void *cookie)
 {
+	bigtime_t start = system_time();
 	//TRACE((DRIVER_NAME": free device\n"));
-	RalinkUSB* device = (RalinkUSB*)cookie;
+	DriverLocker lock(RALINK_HOOK_FREE, start); // released on exit
 
-	MutexLocker lock(gDriverLock); // released on exit
+	monitor_handle* monitor = as_monitor_handle(cookie);
+	if (monitor != NULL) {
+		sMonitorCount[monitor->index]--;
+		put_device(monitor->index);
+		return B_OK;
+	}
 
+	RalinkUSB* device = (RalinkUSB*)cookie;
 	status_t status = device->Free();
 	for (int32 i = 0; i < MAX_DEVICES; i++) {
 		if (gDevicesList[i] == device) {
-			// the device is removed already but as it was open the
+			gOpenMask &= ~(1 << i);
+			// the device may be removed already, but as it was open the
 			// removed hook has not deleted the object
-			/*gDevicesList[i] = NULL;
-			delete device;
-			
-			TRACE("Device at %ld deleted.\n", i);*/
+			put_device(i);
 			break;
 		}
 	}
@@ -297,6 +452,38 @@ status_t
 ralink_control(void *cookie, uint32 op, void *args, size_t length)
 {
 	TRACE(DRIVER_NAME": control device\n");
+	if (op == RALINK_GET_DRIVER_LOCK_STATS) {
+		// driver wide, so it is answered here rather than by the device
+		ralink_driver_lock_stats stats;
+		if (length < sizeof(stats))
+			return B_BAD_VALUE;
+		{
+			MutexLocker lock(gDriverLock);
+			stats = sLockStats;
+		}
+		return platform_copy_to_caller(args, &stats, sizeof(stats));
+	}
+	if (op == RALINK_GET_ALLOC_STATS) {
+#ifdef RALINK_ALLOC_ACCOUNTING
+		ralink_alloc_stats stats;
+		if (length < sizeof(stats))
+			return B_BAD_VALUE;
+		alloc_accounting_get_stats(&stats);
+		return platform_copy_to_caller(args, &stats, sizeof(stats));
+#else
+		return B_NOT_SUPPORTED;
+#endif
+	}
+
+	monitor_handle* monitor = as_monitor_handle(cookie);
+	if (monitor != NULL) {
+		if (!monitor_may_use(op))
+			return B_NOT_ALLOWED;
+
+		// the handle keeps the device in the list
+		return gDevicesList[monitor->index]->Control(op, args, length);
+	}
+
 	RalinkUSB *device = (RalinkUSB*)cookie;
 	return device->Control(op, args, length);
 }
@@ -306,6 +493,9 @@ status_t
 ralink_read(void *cookie, off_t position, void *buffer, size_t *numBytes)
 {
 	TRACE(DRIVER_NAME": read device\n");
+	if (as_monitor_handle(cookie) != NULL)
+		return B_NOT_ALLOWED;
+
 	RalinkUSB *device = (RalinkUSB*)cookie;
 	return device->Read(position, buffer, numBytes);
 }
@@ -315,6 +505,9 @@ status_t
 ralink_write(void *cookie, off_t position, const void *buffer, size_t *numBytes)
 {
 	TRACE(DRIVER_NAME": write device\n");
+	if (as_monitor_handle(cookie) != NULL)
+		return B_NOT_ALLOWED;
+
 	RalinkUSB* device = (RalinkUSB*)cookie;
 	return device->Write(position, buffer, numBytes);
 }
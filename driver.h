@@ -2,7 +2,6 @@
 #define _DRIVER_H_
 
 #include <SupportDefs.h>
-#include <KernelExport.h>
 #include <USB3.h>
 
 extern usb_module_info* gUSBModule;
@@ -14,13 +13,17 @@ extern usb_module_info* gUSBModule;
 #define MAX_DEVICES		3
 #define VENDOR_ID_RALINK	0x148f
 
-#define TRACE_RALINK
+// platform_haiku.h uses gUSBModule and DRIVER_NAME from above
+#include "platform.h"
+
+// text traces on every hook are for debug builds (-DTRACE_RALINK) only,
+// production builds record binary events instead, see trace_ring.h
 #ifdef TRACE_RALINK
-#define TRACE			dprintf
-#define TRACE_ALWAYS	dprintf
+#define TRACE			platform_log
+#define TRACE_ALWAYS	platform_log
 #else
-#define TRACE ;				/* nothing */
-#define TRACE_ALWAYS		dprintf
+#define TRACE(x...)		/* nothing */
+#define TRACE_ALWAYS	platform_log
 #endif
 
 #endif // _DRIVER_H_
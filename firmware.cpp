@@ -0,0 +1,159 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "firmware.h"
+
+#include "alloc_accounting.h"
+#include "driver.h"
+#include "lock.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "rt2870_firmware.h"
+
+
+static constexpr bool
+has_firmware_signature(const uint8* image)
+{
+	return image[0] == 0xff && image[1] == 0xff && image[2] == 0xff
+		&& image[3] == 0x02 && image[4] == 0x10 && image[5] == 0x28
+		&& image[6] == 0x02 && image[7] == 0x10;
+}
+
+static_assert(sizeof(kRT2870Firmware) == RALINK_FIRMWARE_SIZE,
+	"rt2870.bin has an unexpected size");
+static_assert(has_firmware_signature(kRT2870Firmware)
+		&& has_firmware_signature(kRT2870Firmware + RALINK_MICROCODE_SIZE),
+	"rt2870.bin lacks the 0xffffff0210280210 signature");
+
+
+// The firmware image is shared by all devices. By default it is the copy
+// embedded at build time; with "firmware_file true" in the driver settings
+// the first acquire_firmware() loads RALINK_FIRMWARE_PATH instead, which is
+// freed again when the last user releases it.
+static mutex sFirmwareLock;
+static const uint8* sFirmware = NULL;
+static uint8* sFirmwareFile = NULL;
+static int32 sFirmwareUsers = 0;
+
+
+static bool
+uses_rt3071_microcode(uint16 macVersion)
+{
+	/*
+	 * RT3071/RT3072 use a different firmware
+	 * run-rt2870 (8KB) contains both,
+	 * first half (4KB) is for rt2870,
+	 * last half is for rt3071.
+	 */
+	return macVersion != 0x2860 && macVersion != 0x2872
+		&& macVersion != 0x3070;
+}
+
+
+static status_t
+load_firmware(uint8** _image)
+{
+	TRACE_ALWAYS(DRIVER_NAME": selected firmware %s\n", RALINK_FIRMWARE_PATH);
+
+	uint8* buffer = (uint8*)RALINK_MALLOC(RALINK_ALLOC_FIRMWARE,
+		RALINK_FIRMWARE_SIZE);
+	if (buffer == NULL) {
+		TRACE_ALWAYS(DRIVER_NAME": no memory for firmware buffer\n");
+		return B_NO_MEMORY;
+	}
+
+	ssize_t size = platform_read_file(RALINK_FIRMWARE_PATH, buffer,
+		RALINK_FIRMWARE_SIZE);
+	if (size == B_ENTRY_NOT_FOUND) {
+		TRACE_ALWAYS(DRIVER_NAME": firmware file unavailable\n");
+		RALINK_FREE(buffer);
+		return B_ERROR;
+	}
+	if (size != RALINK_FIRMWARE_SIZE) {
+		TRACE_ALWAYS(DRIVER_NAME": invalid firmware size\n");
+		RALINK_FREE(buffer);
+		return B_ERROR;
+	}
+
+	/* cheap sanity check */
+	if (!has_firmware_signature(buffer)) {
+		TRACE_ALWAYS(DRIVER_NAME": firmware checksum failed\n");
+		RALINK_FREE(buffer);
+		return EINVAL;
+	}
+
+	*_image = buffer;
+	return B_OK;
+}
+
+
+status_t
+init_firmware_cache()
+{
+	return mutex_init(&sFirmwareLock, DRIVER_NAME"_firmware");
+}
+
+
+void
+uninit_firmware_cache()
+{
+	// all devices are gone by now
+	RALINK_FREE(sFirmwareFile);
+	sFirmwareFile = NULL;
+	sFirmware = NULL;
+	sFirmwareUsers = 0;
+	mutex_destroy(&sFirmwareLock);
+}
+
+
+/*!	Returns a read-only view of the microcode matching \a macVersion. The
+	image stays valid until the matching release_firmware() call.
+*/
+status_t
+acquire_firmware(uint16 macVersion, const uint8** _microcode)
+{
+	MutexLocker lock(sFirmwareLock); // released on exit
+
+	if (sFirmware == NULL) {
+		sFirmware = kRT2870Firmware;
+		if (platform_get_bool_setting("firmware_file", false)) {
+			if (load_firmware(&sFirmwareFile) == B_OK)
+				sFirmware = sFirmwareFile;
+			else {
+				TRACE_ALWAYS(DRIVER_NAME": using the embedded firmware "
+					"instead\n");
+			}
+		}
+	}
+
+	sFirmwareUsers++;
+	*_microcode = sFirmware;
+	if (uses_rt3071_microcode(macVersion))
+		*_microcode += RALINK_MICROCODE_SIZE;
+	return B_OK;
+}
+
+
+void
+release_firmware()
+{
+	MutexLocker lock(sFirmwareLock); // released on exit
+
+	if (--sFirmwareUsers > 0)
+		return;
+
+	RALINK_FREE(sFirmwareFile);
+	sFirmwareFile = NULL;
+	sFirmware = NULL;
+}
+
+
+const char*
+microcode_name(uint16 macVersion)
+{
+	return uses_rt3071_microcode(macVersion) ? "RT3071" : "RT2870";
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include <SupportDefs.h>
+
+
+// optional override of the embedded image, see firmware.cpp
+#define RALINK_FIRMWARE_PATH \
+	"/system/non-packaged/data/firmware/ralink/rt2870.bin"
+
+// rt2870.bin holds two microcode images of RALINK_MICROCODE_SIZE bytes
+#define RALINK_FIRMWARE_SIZE	8192
+#define RALINK_MICROCODE_SIZE	4096
+
+
+status_t		init_firmware_cache();
+void			uninit_firmware_cache();
+
+status_t		acquire_firmware(uint16 macVersion, const uint8** _microcode);
+void			release_firmware();
+
+const char*		microcode_name(uint16 macVersion);
+
+#endif // FIRMWARE_H
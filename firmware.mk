@@ -0,0 +1,10 @@
+# Turns the firmware image $< into the C++ header $@ that firmware.cpp
+# includes; shared by the driver makefile and host/Makefile
+define generate_firmware_header
+	@echo "// generated from $< by the makefile, do not edit" > $@
+	@echo "static constexpr uint8 kRT2870Firmware[] = {" >> $@
+	@od -A n -v -t x1 $< \
+		| sed -e 's/ *\([0-9a-f][0-9a-f]\)/0x\1, /g' -e 's/ $$//' \
+			-e 's/^/	/' >> $@
+	@echo "};" >> $@
+endef
@@ -0,0 +1,267 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*!	Bring-up latency benchmark: times usb_ralink_device_added(),
+	ralink_open() and the replug paths against the simulated RT3070, for
+	one or more per-transfer latencies, and reports the wall time, the
+	control transfers and the bytes each phase needed.
+*/
+
+
+#include <Drivers.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rt3070_model.h"
+#include "usb_sim.h"
+
+
+#define MAX_LATENCIES	16
+
+enum {
+	PHASE_ADDED,
+	PHASE_OPEN,
+	PHASE_REPLUG,
+	PHASE_COLD_REPLUG,
+	PHASE_COUNT
+};
+
+static const char* kPhaseNames[PHASE_COUNT] = {
+	"device_added", "open", "replug", "replug (cold)"
+};
+
+typedef struct phase_result {
+	bigtime_t	total;
+	bigtime_t	min;
+	bigtime_t	max;
+	uint64		transfers;
+	uint64		bytes;
+	uint32		runs;
+	uint32		failures;
+} phase_result;
+
+
+static void
+usage(const char* program)
+{
+	fprintf(stderr, "usage: %s [-l <latency us>[,<latency us>...]] "
+		"[-n <iterations>] [-e] [-c]\n"
+		"  -l  control transfer latencies to run, default 125,250,1000\n"
+		"  -n  iterations per latency, default 10\n"
+		"  -e  the simulated device has an EEPROM instead of an eFUSE\n"
+		"  -c  print CSV instead of a table\n", program);
+	exit(1);
+}
+
+
+static void
+begin_phase()
+{
+	usb_sim_reset_stats();
+}
+
+
+static void
+end_phase(phase_result* result, bigtime_t start, status_t status)
+{
+	bigtime_t elapsed = system_time() - start;
+
+	usb_sim_stats stats;
+	usb_sim_get_stats(&stats);
+
+	if (status != B_OK) {
+		result->failures++;
+		return;
+	}
+
+	if (result->runs == 0 || elapsed < result->min)
+		result->min = elapsed;
+	if (elapsed > result->max)
+		result->max = elapsed;
+	result->total += elapsed;
+	result->transfers += stats.control_transfers;
+	result->bytes += stats.control_bytes + stats.bulk_in_bytes
+		+ stats.bulk_out_bytes;
+	result->runs++;
+}
+
+
+/*!	One bring-up cycle of a freshly powered device: plug, open, replug with
+	the MCU still running, replug after a power loss, then tear down.
+*/
+static status_t
+run_iteration(RT3070Model* model, phase_result* results)
+{
+	model->PowerCycle();
+
+	begin_phase();
+	bigtime_t start = system_time();
+	usb_device device = usb_sim_attach(model);
+	const char** names = publish_devices();
+	status_t status = device != 0 && names[0] != NULL ? B_OK : B_ERROR;
+	end_phase(&results[PHASE_ADDED], start, status);
+	if (status != B_OK) {
+		usb_sim_detach(device);
+		return status;
+	}
+
+	char name[B_PATH_NAME_LENGTH];
+	snprintf(name, sizeof(name), "%s", names[0]);
+	device_hooks* hooks = find_device(name);
+	void* cookie = NULL;
+
+	begin_phase();
+	start = system_time();
+	status = hooks->open(name, O_RDWR, &cookie);
+	end_phase(&results[PHASE_OPEN], start, status);
+	if (status != B_OK) {
+		usb_sim_detach(device);
+		return status;
+	}
+
+	// the device stays open across both replugs, so the driver reattaches
+	// the same RalinkUSB object through CompareAndReattach()
+	begin_phase();
+	start = system_time();
+	usb_sim_detach(device);
+	device = usb_sim_attach(model);
+	end_phase(&results[PHASE_REPLUG], start,
+		device != 0 && model->MCUReady() ? B_OK : B_ERROR);
+
+	begin_phase();
+	start = system_time();
+	usb_sim_detach(device);
+	model->PowerCycle();
+	device = usb_sim_attach(model);
+	end_phase(&results[PHASE_COLD_REPLUG], start,
+		device != 0 && model->MCUReady() ? B_OK : B_ERROR);
+
+	hooks->close(cookie);
+	hooks->free(cookie);
+	usb_sim_detach(device);
+	return B_OK;
+}
+
+
+static void
+print_results(bigtime_t latency, uint32 iterations, const phase_result* results,
+	bool csv)
+{
+	if (!csv) {
+		printf("\ncontrol latency %lld us, %u iterations\n",
+			(long long)latency, iterations);
+		printf("%-16s %10s %10s %10s %10s %10s\n", "phase", "mean ms",
+			"min ms", "max ms", "transfers", "bytes");
+	}
+
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		const phase_result& result = results[i];
+		uint32 runs = result.runs > 0 ? result.runs : 1;
+		double mean = (double)result.total / runs / 1000.0;
+		if (csv) {
+			printf("%lld,%s,%.3f,%.3f,%.3f,%llu,%llu,%u\n",
+				(long long)latency, kPhaseNames[i], mean,
+				result.min / 1000.0, result.max / 1000.0,
+				(unsigned long long)(result.transfers / runs),
+				(unsigned long long)(result.bytes / runs), result.failures);
+			continue;
+		}
+
+		printf("%-16s %10.3f %10.3f %10.3f %10llu %10llu", kPhaseNames[i],
+			mean, result.min / 1000.0, result.max / 1000.0,
+			(unsigned long long)(result.transfers / runs),
+			(unsigned long long)(result.bytes / runs));
+		if (result.failures > 0)
+			printf("  (%u failed)", result.failures);
+		printf("\n");
+	}
+}
+
+
+int
+main(int argc, char** argv)
+{
+	bigtime_t latencies[MAX_LATENCIES] = { 125, 250, 1000 };
+	int32 latencyCount = 3;
+	uint32 iterations = 10;
+	bool csv = false;
+	rt3070_model_config config;
+	RT3070Model::DefaultConfig(&config);
+
+	int option;
+	while ((option = getopt(argc, argv, "l:n:ec")) != -1) {
+		switch (option) {
+			case 'l':
+			{
+				latencyCount = 0;
+				char* next = optarg;
+				while (*next != '\0' && latencyCount < MAX_LATENCIES) {
+					latencies[latencyCount++] = strtoll(next, &next, 0);
+					if (*next == ',')
+						next++;
+					else if (*next != '\0')
+						usage(argv[0]);
+				}
+				break;
+			}
+			case 'n':
+				iterations = strtoul(optarg, NULL, 0);
+				break;
+			case 'e':
+				config.efuse = false;
+				break;
+			case 'c':
+				csv = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (latencyCount == 0 || iterations == 0)
+		usage(argv[0]);
+
+	init_hardware();
+	if (init_driver() != B_OK) {
+		fprintf(stderr, "init_driver() failed\n");
+		return 1;
+	}
+
+	if (csv) {
+		printf("latency_us,phase,mean_ms,min_ms,max_ms,transfers,bytes,"
+			"failures\n");
+	} else
+		printf("%s ROM\n", config.efuse ? "eFUSE" : "EEPROM");
+
+	RT3070Model model(&config);
+	status_t result = B_OK;
+
+	for (int32 l = 0; l < latencyCount; l++) {
+		usb_sim_timing timing;
+		usb_sim_get_timing(&timing);
+		timing.control_latency = latencies[l];
+		usb_sim_set_timing(&timing);
+
+		phase_result results[PHASE_COUNT];
+		memset(results, 0, sizeof(results));
+
+		for (uint32 i = 0; i < iterations; i++) {
+			status_t status = run_iteration(&model, results);
+			if (status != B_OK) {
+				fprintf(stderr, "iteration %u failed: %#010x\n", i, status);
+				result = status;
+				break;
+			}
+		}
+
+		print_results(latencies[l], iterations, results, csv);
+	}
+
+	uninit_driver();
+	return result == B_OK ? 0 : 1;
+}
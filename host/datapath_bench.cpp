@@ -0,0 +1,378 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*!	Per-frame cost of the datapath kernels in datapath.cpp: TX descriptor
+	building, RX deaggregation and parsing, and the RSSI chain selection,
+	each run over synthetic corpora of mixed frame sizes and header layouts.
+	Reports nanoseconds per frame and frames per second.
+*/
+
+
+#include <OS.h>
+
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "datapath.h"
+#include "if_runreg.h"
+
+
+#define MAX_FRAME_LENGTH	1536
+#define RX_CHAINS			2
+
+enum {
+	FRAME_DATA = 0,			// FromDS data
+	FRAME_QOS,				// FromDS QoS data, some of it "no ACK"
+	FRAME_ADDR4,			// WDS data with the fourth address
+	FRAME_ADDR4_QOS,
+	FRAME_MULTICAST,		// group addressed data
+	FRAME_MANAGEMENT,		// beacon
+	FRAME_KINDS,
+	FRAME_MIXED = FRAME_KINDS
+};
+
+static const char* kKindNames[FRAME_KINDS + 1] = {
+	"data", "qos", "addr4", "addr4+qos", "multicast", "mgmt", "mixed"
+};
+
+typedef struct corpus_frame {
+	uint8*		data;
+	uint16		length;
+} corpus_frame;
+
+typedef struct rx_transfer {
+	uint8*		data;
+	size_t		length;
+	uint32		frames;
+} rx_transfer;
+
+static uint32 sRandom = 0x3070;
+// results are summed up here so that the kernels are not optimized away
+static volatile uint32 sSink;
+
+
+static void
+usage(const char* program)
+{
+	fprintf(stderr, "usage: %s [-f <frames>] [-n <passes>] [-c]\n"
+		"  -f  frames per corpus, default 4096\n"
+		"  -n  passes over each corpus, default 200\n"
+		"  -c  print CSV instead of a table\n", program);
+	exit(1);
+}
+
+
+static uint32
+random_number()
+{
+	// xorshift32, reproducible across runs
+	sRandom ^= sRandom << 13;
+	sRandom ^= sRandom >> 17;
+	sRandom ^= sRandom << 5;
+	return sRandom;
+}
+
+
+/*!	Two thirds small or large frames, the rest in between, like a mix of
+	TCP ACKs, full sized segments and everything else.
+*/
+static uint16
+random_length(uint16 minimum)
+{
+	uint16 length;
+	switch (random_number() % 3) {
+		case 0:
+			length = 64 + random_number() % 64;
+			break;
+		case 1:
+			length = 1400 + random_number() % (MAX_FRAME_LENGTH - 1400 + 1);
+			break;
+		default:
+			length = 128 + random_number() % (1400 - 128);
+			break;
+	}
+	return max_c(length, minimum);
+}
+
+
+static uint16
+header_length(int32 kind)
+{
+	switch (kind) {
+		case FRAME_QOS:
+			return RALINK_WLAN_HEADER_LENGTH + 2;
+		case FRAME_ADDR4:
+			return RALINK_WLAN_HEADER_LENGTH + 6;
+		case FRAME_ADDR4_QOS:
+			return RALINK_WLAN_HEADER_LENGTH + 8;
+		default:
+			return RALINK_WLAN_HEADER_LENGTH;
+	}
+}
+
+
+static void
+build_frame(uint8* frame, int32 kind, uint16 length)
+{
+	memset(frame, 0, length);
+	frame[0] = RALINK_FC0_TYPE_DATA;
+	frame[1] = 0x02;	// FromDS
+	switch (kind) {
+		case FRAME_QOS:
+			frame[0] |= RALINK_FC0_SUBTYPE_QOS;
+			break;
+		case FRAME_ADDR4:
+			frame[1] = RALINK_FC1_DIR_DSTODS;
+			break;
+		case FRAME_ADDR4_QOS:
+			frame[0] |= RALINK_FC0_SUBTYPE_QOS;
+			frame[1] = RALINK_FC1_DIR_DSTODS;
+			break;
+		case FRAME_MANAGEMENT:
+			frame[0] = 0x80;
+			frame[1] = 0;
+			break;
+	}
+
+	// addr1, 2 and 3, group addressed for multicast and beacons
+	for (int32 i = 4; i < 22; i++)
+		frame[i] = (uint8)random_number();
+	if (kind == FRAME_MULTICAST || kind == FRAME_MANAGEMENT)
+		frame[4] |= 0x01;
+	else
+		frame[4] &= ~0x01;
+
+	uint16 headerLength = header_length(kind);
+	if (kind == FRAME_QOS || kind == FRAME_ADDR4_QOS) {
+		uint16 qos = random_number() % 8;
+		if (random_number() % 4 == 0)
+			qos |= RALINK_QOS_ACKPOLICY_NOACK;
+		frame[headerLength - 2] = qos & 0xff;
+		frame[headerLength - 1] = qos >> 8;
+	}
+	for (uint16 i = headerLength; i < length; i++)
+		frame[i] = (uint8)i;
+}
+
+
+static corpus_frame*
+build_tx_corpus(int32 kind, uint32 count)
+{
+	corpus_frame* frames = (corpus_frame*)malloc(count * sizeof(corpus_frame));
+	for (uint32 i = 0; i < count; i++) {
+		int32 frameKind = kind == FRAME_MIXED
+			? random_number() % FRAME_KINDS : kind;
+		frames[i].length = random_length(header_length(frameKind));
+		frames[i].data = (uint8*)malloc(frames[i].length);
+		build_frame(frames[i].data, frameKind, frames[i].length);
+	}
+	return frames;
+}
+
+
+/*!	Packs the frames into bulk IN transfers like the chip does, as many as
+	fit into \a limit bytes each; a limit of 0 gives one frame per transfer.
+*/
+static rx_transfer*
+build_rx_corpus(int32 kind, uint32 frameCount, size_t limit,
+	uint32* _transferCount)
+{
+	rx_transfer* transfers
+		= (rx_transfer*)calloc(frameCount, sizeof(rx_transfer));
+	uint8 frame[MAX_FRAME_LENGTH];
+	uint32 transferCount = 0;
+
+	for (uint32 i = 0; i < frameCount; i++) {
+		int32 frameKind = kind == FRAME_MIXED
+			? random_number() % FRAME_KINDS : kind;
+		uint16 length = random_length(header_length(frameKind));
+		build_frame(frame, frameKind, length);
+
+		uint32 dmaLength = (sizeof(rt2860_rxwi) + length + 3) & ~3;
+		size_t size = sizeof(uint32) + dmaLength + sizeof(rt2870_rxd);
+		rx_transfer* transfer = &transfers[transferCount];
+		if (transfer->data != NULL
+			&& (limit == 0 || transfer->length + size > limit)) {
+			transfer = &transfers[++transferCount];
+		}
+		if (transfer->data == NULL)
+			transfer->data = (uint8*)malloc(RALINK_MAX_RX_TRANSFER);
+
+		uint8* buffer = transfer->data + transfer->length;
+		memset(buffer, 0, size);
+		uint32 tmp = htole32(dmaLength);
+		memcpy(buffer, &tmp, sizeof(tmp));
+		rt2860_rxwi* rxwi = (rt2860_rxwi*)(buffer + sizeof(uint32));
+		rxwi->wcid = 0xff;
+		rxwi->len = htole16(length);
+		rxwi->phy = htole16(RT2860_PHY_OFDM | (random_number() & 0x7));
+		for (int32 chain = 0; chain < 3; chain++)
+			rxwi->rssi[chain] = 0xc0 + (random_number() & 0x1f);
+		memcpy(rxwi + 1, frame, length);
+		tmp = htole32(RT2860_RX_UC2ME | RT2860_RX_MYBSS | RT2860_RX_DATA);
+		memcpy((uint8*)rxwi + dmaLength, &tmp, sizeof(tmp));
+
+		transfer->length += size;
+		transfer->frames++;
+	}
+
+	*_transferCount = transferCount + 1;
+	return transfers;
+}
+
+
+static void
+print_result(bool csv, const char* kernel, const char* corpus, uint64 frames,
+	bigtime_t elapsed)
+{
+	double nanoseconds = elapsed * 1000.0 / frames;
+	double rate = frames * 1000000.0 / max_c(elapsed, 1);
+	if (csv) {
+		printf("%s,%s,%llu,%.2f,%.0f\n", kernel, corpus,
+			(unsigned long long)frames, nanoseconds, rate);
+	} else {
+		printf("%-14s %-20s %10llu %10.2f %14.0f\n", kernel, corpus,
+			(unsigned long long)frames, nanoseconds, rate);
+	}
+}
+
+
+static void
+bench_tx(bool csv, int32 kind, uint32 count, uint32 passes)
+{
+	corpus_frame* frames = build_tx_corpus(kind, count);
+	uint8 buffer[MAX_FRAME_LENGTH + RALINK_TX_OVERHEAD];
+	ralink_tx_params params = {};
+	params.rate_index = 11;
+	params.basic_rate_index = RT2860_RIDX_CCK1;
+	params.wcid = 1;
+	params.rts_threshold = 2346;
+	params.short_preamble = true;
+	params.station = true;
+
+	bigtime_t start = system_time();
+	for (uint32 pass = 0; pass < passes; pass++) {
+		for (uint32 i = 0; i < count; i++) {
+			size_t transferLength;
+			uint8 queue;
+			if (datapath_build_tx(&params, frames[i].data, frames[i].length,
+					buffer, sizeof(buffer), &transferLength, &queue) == B_OK)
+				sSink += transferLength + queue + buffer[8];
+		}
+	}
+	print_result(csv, "build_tx", kKindNames[kind], (uint64)count * passes,
+		system_time() - start);
+
+	for (uint32 i = 0; i < count; i++)
+		free(frames[i].data);
+	free(frames);
+}
+
+
+static void
+bench_rx(bool csv, int32 kind, size_t limit, uint32 count, uint32 passes)
+{
+	uint32 transferCount;
+	rx_transfer* transfers = build_rx_corpus(kind, count, limit,
+		&transferCount);
+	ralink_rx_frame frames[RALINK_MAX_RX_TRANSFER / RALINK_RX_OVERHEAD];
+	uint64 parsed = 0;
+
+	bigtime_t start = system_time();
+	for (uint32 pass = 0; pass < passes; pass++) {
+		for (uint32 i = 0; i < transferCount; i++) {
+			uint32 errors;
+			int32 frameCount = datapath_deaggregate(transfers[i].data,
+				transfers[i].length, RX_CHAINS, frames, B_COUNT_OF(frames),
+				&errors);
+			for (int32 j = 0; j < frameCount; j++)
+				sSink += frames[j].length + frames[j].rssi;
+			parsed += frameCount;
+		}
+	}
+	bigtime_t elapsed = system_time() - start;
+
+	char corpus[32];
+	snprintf(corpus, sizeof(corpus), "%s/%s", kKindNames[kind],
+		limit != 0 ? "aggregated" : "single");
+	print_result(csv, "deaggregate", corpus, parsed, elapsed);
+	if (parsed != (uint64)count * passes)
+		fprintf(stderr, "%s: %llu frames lost\n", corpus,
+			(unsigned long long)((uint64)count * passes - parsed));
+
+	for (uint32 i = 0; i < transferCount; i++)
+		free(transfers[i].data);
+	free(transfers);
+}
+
+
+static void
+bench_max_rssi(bool csv, uint32 count, uint32 passes)
+{
+	uint8* rssi = (uint8*)malloc(count * 3);
+	for (uint32 i = 0; i < count * 3; i++)
+		rssi[i] = 0xc0 + (random_number() & 0x1f);
+
+	bigtime_t start = system_time();
+	for (uint32 pass = 0; pass < passes; pass++) {
+		for (uint32 i = 0; i < count; i++)
+			sSink += datapath_max_rssi_chain(rssi + i * 3, 3);
+	}
+	print_result(csv, "max_rssi_chain", "3 chains", (uint64)count * passes,
+		system_time() - start);
+	free(rssi);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	uint32 count = 4096;
+	uint32 passes = 200;
+	bool csv = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "f:n:c")) != -1) {
+		switch (option) {
+			case 'f':
+				count = strtoul(optarg, NULL, 0);
+				break;
+			case 'n':
+				passes = strtoul(optarg, NULL, 0);
+				break;
+			case 'c':
+				csv = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (count == 0 || passes == 0)
+		usage(argv[0]);
+
+	if (csv)
+		printf("kernel,corpus,frames,ns_per_frame,frames_per_second\n");
+	else {
+		printf("%-14s %-20s %10s %10s %14s\n", "kernel", "corpus", "frames",
+			"ns/frame", "frames/s");
+	}
+
+	for (int32 kind = 0; kind <= FRAME_MIXED; kind++)
+		bench_tx(csv, kind, count, passes);
+
+	const int32 kRXKinds[] = { FRAME_DATA, FRAME_QOS, FRAME_ADDR4_QOS,
+		FRAME_MIXED };
+	for (size_t i = 0; i < B_COUNT_OF(kRXKinds); i++) {
+		bench_rx(csv, kRXKinds[i], 0, count, passes);
+		bench_rx(csv, kRXKinds[i], RALINK_MAX_RX_TRANSFER, count, passes);
+	}
+
+	bench_max_rssi(csv, count, passes);
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _BYTEORDER_H
+#define _BYTEORDER_H
+
+/*! Host (Linux) stand-in for the Haiku header of the same name. */
+
+
+#include <SupportDefs.h>
+
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#	define B_HOST_IS_LENDIAN	1
+#	define B_HOST_IS_BENDIAN	0
+#	define B_LENDIAN_TO_HOST_INT16(x)	((uint16)(x))
+#	define B_LENDIAN_TO_HOST_INT32(x)	((uint32)(x))
+#	define B_LENDIAN_TO_HOST_INT64(x)	((uint64)(x))
+#	define B_BENDIAN_TO_HOST_INT16(x)	__builtin_bswap16(x)
+#	define B_BENDIAN_TO_HOST_INT32(x)	__builtin_bswap32(x)
+#	define B_BENDIAN_TO_HOST_INT64(x)	__builtin_bswap64(x)
+#else
+#	define B_HOST_IS_LENDIAN	0
+#	define B_HOST_IS_BENDIAN	1
+#	define B_LENDIAN_TO_HOST_INT16(x)	__builtin_bswap16(x)
+#	define B_LENDIAN_TO_HOST_INT32(x)	__builtin_bswap32(x)
+#	define B_LENDIAN_TO_HOST_INT64(x)	__builtin_bswap64(x)
+#	define B_BENDIAN_TO_HOST_INT16(x)	((uint16)(x))
+#	define B_BENDIAN_TO_HOST_INT32(x)	((uint32)(x))
+#	define B_BENDIAN_TO_HOST_INT64(x)	((uint64)(x))
+#endif
+
+#define B_HOST_TO_LENDIAN_INT16(x)	B_LENDIAN_TO_HOST_INT16(x)
+#define B_HOST_TO_LENDIAN_INT32(x)	B_LENDIAN_TO_HOST_INT32(x)
+#define B_HOST_TO_LENDIAN_INT64(x)	B_LENDIAN_TO_HOST_INT64(x)
+#define B_HOST_TO_BENDIAN_INT16(x)	B_BENDIAN_TO_HOST_INT16(x)
+#define B_HOST_TO_BENDIAN_INT32(x)	B_BENDIAN_TO_HOST_INT32(x)
+#define B_HOST_TO_BENDIAN_INT64(x)	B_BENDIAN_TO_HOST_INT64(x)
+
+#endif	/* _BYTEORDER_H */
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _DRIVERS_DRIVERS_H
+#define _DRIVERS_DRIVERS_H
+
+/*! Host (Linux) stand-in for the Haiku header of the same name. */
+
+
+#include <OS.h>
+
+#include <sys/types.h>
+
+
+#define B_CUR_DRIVER_API_VERSION	2
+
+enum {
+	B_GET_DEVICE_SIZE = 1,
+	B_SET_DEVICE_SIZE,
+	B_SET_NONBLOCKING_IO,
+	B_SET_BLOCKING_IO,
+	B_GET_READ_STATUS,
+	B_GET_WRITE_STATUS,
+	B_GET_GEOMETRY,
+	B_GET_DRIVER_FOR_DEVICE,
+	B_GET_PARTITION_INFO,
+
+	B_DEVICE_OP_CODES_END = 9999
+};
+
+typedef status_t (*device_open_hook)(const char* name, uint32 flags,
+	void** cookie);
+typedef status_t (*device_close_hook)(void* cookie);
+typedef status_t (*device_free_hook)(void* cookie);
+typedef status_t (*device_control_hook)(void* cookie, uint32 op, void* data,
+	size_t len);
+typedef status_t (*device_read_hook)(void* cookie, off_t position,
+	void* data, size_t* numBytes);
+typedef status_t (*device_write_hook)(void* cookie, off_t position,
+	const void* data, size_t* numBytes);
+
+typedef struct {
+	device_open_hook	open;
+	device_close_hook	close;
+	device_free_hook	free;
+	device_control_hook	control;
+	device_read_hook	read;
+	device_write_hook	write;
+	void*				select;
+	void*				deselect;
+	void*				read_pages;
+	void*				write_pages;
+} device_hooks;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the driver's entry points */
+status_t		init_hardware(void);
+const char**	publish_devices(void);
+device_hooks*	find_device(const char* name);
+status_t		init_driver(void);
+void			uninit_driver(void);
+
+extern int32	api_version;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _DRIVERS_DRIVERS_H */
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _KERNEL_EXPORT_H
+#define _KERNEL_EXPORT_H
+
+/*! Host (Linux) stand-in for the Haiku header of the same name. */
+
+
+#include <OS.h>
+
+#include <stdio.h>
+
+/* glibc declares its own dprintf(int fd, ...) */
+#define dprintf					host_dprintf
+
+
+typedef struct module_info {
+	const char*	name;
+	uint32		flags;
+	status_t	(*std_ops)(int32, ...);
+} module_info;
+
+/* the host programs stand in for userland, see platform_copy_to_caller() */
+#define IS_USER_ADDRESS(address)	((address) != NULL)
+
+#define B_KERNEL_READ_AREA		0x10
+#define B_KERNEL_WRITE_AREA		0x20
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		host_dprintf(const char* format, ...)
+				__attribute__((format(printf, 1, 2)));
+bool		set_dprintf_enabled(bool enabled);
+void		spin(bigtime_t microseconds);
+
+status_t	get_module(const char* path, module_info** _info);
+status_t	put_module(const char* path);
+
+status_t	user_memcpy(void* to, const void* from, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _KERNEL_EXPORT_H */
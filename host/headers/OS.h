@@ -0,0 +1,65 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _OS_H
+#define _OS_H
+
+/*! Host (Linux) stand-in for the Haiku header of the same name. */
+
+
+#include <SupportDefs.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#define B_OS_NAME_LENGTH		32
+#define B_PATH_NAME_LENGTH		1024
+#define B_PAGE_SIZE				4096
+#define B_INFINITE_TIMEOUT		(9223372036854775807LL)
+
+#define B_READ_ONLY				O_RDONLY
+
+typedef int32					area_id;
+typedef int32					sem_id;
+typedef int32					team_id;
+typedef int32					thread_id;
+
+/* semaphore flags */
+#define B_CAN_INTERRUPT			0x01
+#define B_CHECK_PERMISSION		0x04
+#define B_TIMEOUT				0x08
+#define B_RELATIVE_TIMEOUT		0x08
+#define B_ABSOLUTE_TIMEOUT		0x10
+#define B_DO_NOT_RESCHEDULE		0x02
+
+/* area address specifications, locking and protection */
+#define B_ANY_ADDRESS			0
+#define B_ANY_KERNEL_ADDRESS	4
+#define B_NO_LOCK				0
+#define B_FULL_LOCK				2
+#define B_READ_AREA				0x01
+#define B_WRITE_AREA			0x02
+#define B_CLONEABLE_AREA		0x100
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+status_t	snooze(bigtime_t amount);
+bigtime_t	system_time(void);
+
+/* areas are plain process memory on the host; a clone shares the address
+   of its source, and the memory goes away with the last of them */
+area_id		create_area(const char* name, void** _address, uint32 addressSpec,
+				size_t size, uint32 lock, uint32 protection);
+area_id		clone_area(const char* name, void** _address, uint32 addressSpec,
+				uint32 protection, area_id source);
+status_t	delete_area(area_id area);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _OS_H */
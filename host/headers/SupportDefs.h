@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _SUPPORT_DEFS_H
+#define _SUPPORT_DEFS_H
+
+/*! Host (Linux) stand-in for the Haiku header of the same name. Only what
+	the driver sources use is provided.
+*/
+
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+typedef int8_t				int8;
+typedef uint8_t				uint8;
+typedef int16_t				int16;
+typedef uint16_t			uint16;
+typedef int32_t				int32;
+typedef uint32_t			uint32;
+typedef int64_t				int64;
+typedef uint64_t			uint64;
+
+typedef volatile int32		vint32;
+typedef volatile int64		vint64;
+
+typedef int32				status_t;
+typedef int64				bigtime_t;
+typedef uintptr_t			addr_t;
+
+#define B_PRId32			PRId32
+#define B_PRIu32			PRIu32
+#define B_PRIx32			PRIx32
+#define B_PRId64			PRId64
+#define B_PRIu64			PRIu64
+
+/* Haiku error codes */
+#define B_GENERAL_ERROR_BASE	INT_MIN
+#define B_OS_ERROR_BASE			(B_GENERAL_ERROR_BASE + 0x1000)
+#define B_STORAGE_ERROR_BASE	(B_GENERAL_ERROR_BASE + 0x6000)
+#define B_DEVICE_ERROR_BASE		(B_GENERAL_ERROR_BASE + 0xa000)
+
+#define B_OK					((status_t)0)
+#define B_ERROR					(-1)
+#define B_NO_MEMORY				(B_GENERAL_ERROR_BASE + 0)
+#define B_IO_ERROR				(B_GENERAL_ERROR_BASE + 1)
+#define B_PERMISSION_DENIED		(B_GENERAL_ERROR_BASE + 2)
+#define B_BAD_INDEX				(B_GENERAL_ERROR_BASE + 3)
+#define B_BAD_TYPE				(B_GENERAL_ERROR_BASE + 4)
+#define B_BAD_VALUE				(B_GENERAL_ERROR_BASE + 5)
+#define B_MISMATCHED_VALUES		(B_GENERAL_ERROR_BASE + 6)
+#define B_NAME_NOT_FOUND		(B_GENERAL_ERROR_BASE + 7)
+#define B_NAME_IN_USE			(B_GENERAL_ERROR_BASE + 8)
+#define B_TIMED_OUT				(B_GENERAL_ERROR_BASE + 9)
+#define B_INTERRUPTED			(B_GENERAL_ERROR_BASE + 10)
+#define B_WOULD_BLOCK			(B_GENERAL_ERROR_BASE + 11)
+#define B_CANCELED				(B_GENERAL_ERROR_BASE + 12)
+#define B_NO_INIT				(B_GENERAL_ERROR_BASE + 13)
+#define B_BUSY					(B_GENERAL_ERROR_BASE + 14)
+#define B_NOT_ALLOWED			(B_GENERAL_ERROR_BASE + 15)
+#define B_BAD_DATA				(B_GENERAL_ERROR_BASE + 16)
+#define B_BUFFER_OVERFLOW		(B_GENERAL_ERROR_BASE + 17)
+#define B_NOT_SUPPORTED			(B_GENERAL_ERROR_BASE + 18)
+#define B_BAD_SEM_ID			(B_OS_ERROR_BASE + 0)
+#define B_NO_MORE_SEMS			(B_OS_ERROR_BASE + 1)
+#define B_BAD_ADDRESS			(B_OS_ERROR_BASE + 0x301)
+#define B_FILE_ERROR			(B_STORAGE_ERROR_BASE + 0)
+#define B_ENTRY_NOT_FOUND		(B_STORAGE_ERROR_BASE + 3)
+#define B_DEV_INVALID_IOCTL		(B_DEVICE_ERROR_BASE + 0)
+#define B_DEV_NO_MEMORY			(B_DEVICE_ERROR_BASE + 1)
+#define B_DEV_NOT_READY			(B_DEVICE_ERROR_BASE + 12)
+#define B_DEV_INVALID_PIPE		(B_DEVICE_ERROR_BASE + 19)
+#define B_DEV_STALLED			(B_DEVICE_ERROR_BASE + 21)
+#define B_DEV_DATA_UNDERRUN		(B_DEVICE_ERROR_BASE + 25)
+
+/* Haiku's POSIX error codes are negative and alias the ones above */
+#undef EINVAL
+#define EINVAL					B_BAD_VALUE
+#undef ENOMEM
+#define ENOMEM					B_NO_MEMORY
+#undef ETIMEDOUT
+#define ETIMEDOUT				B_TIMED_OUT
+#undef ENODEV
+#define ENODEV					(B_GENERAL_ERROR_BASE + 0x7019)
+
+#define min_c(a, b)				((a) > (b) ? (b) : (a))
+#define max_c(a, b)				((a) > (b) ? (a) : (b))
+#define B_COUNT_OF(a)			(sizeof(a) / sizeof(a[0]))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int32	atomic_add(vint32* value, int32 addValue);
+int32	atomic_and(vint32* value, int32 andValue);
+int32	atomic_or(vint32* value, int32 orValue);
+int32	atomic_get(vint32* value);
+int32	atomic_set(vint32* value, int32 newValue);
+int32	atomic_test_and_set(vint32* value, int32 newValue, int32 testAgainst);
+int64	atomic_add64(vint64* value, int64 addValue);
+int64	atomic_get64(vint64* value);
+int64	atomic_set64(vint64* value, int64 newValue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _SUPPORT_DEFS_H */
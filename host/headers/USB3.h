@@ -0,0 +1,204 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _USB3_H_
+#define _USB3_H_
+
+/*! Host (Linux) stand-in for the Haiku header of the same name. The module
+	itself is provided by the simulated bus in host/usb_sim.cpp.
+*/
+
+
+#include <KernelExport.h>
+
+#include <sys/uio.h>
+
+
+typedef uint32 usb_id;
+typedef usb_id usb_device;
+typedef usb_id usb_interface;
+typedef usb_id usb_pipe;
+
+typedef struct usb_endpoint_info usb_endpoint_info;
+typedef struct usb_interface_info usb_interface_info;
+typedef struct usb_interface_list usb_interface_list;
+typedef struct usb_configuration_info usb_configuration_info;
+
+typedef void (*usb_callback_func)(void* cookie, status_t status, void* data,
+	size_t actualLength);
+
+#define B_USB_MODULE_NAME		"bus_managers/usb/v3"
+
+/* request types */
+#define USB_REQTYPE_DEVICE_IN			0x80
+#define USB_REQTYPE_DEVICE_OUT			0x00
+#define USB_REQTYPE_INTERFACE_IN		0x81
+#define USB_REQTYPE_INTERFACE_OUT		0x01
+#define USB_REQTYPE_ENDPOINT_IN			0x82
+#define USB_REQTYPE_ENDPOINT_OUT		0x02
+#define USB_REQTYPE_OTHER_IN			0x83
+#define USB_REQTYPE_OTHER_OUT			0x03
+#define USB_REQTYPE_STANDARD			0x00
+#define USB_REQTYPE_CLASS				0x20
+#define USB_REQTYPE_VENDOR				0x40
+#define USB_REQTYPE_MASK				0x9f
+
+/* feature selectors */
+#define USB_FEATURE_ENDPOINT_HALT		0
+#define USB_FEATURE_DEVICE_WAKEUP		1
+
+/* endpoint descriptor fields */
+#define USB_ENDPOINT_ADDR_DIR_IN		0x80
+#define USB_ENDPOINT_ADDR_DIR_OUT		0x00
+#define USB_ENDPOINT_ATTR_CONTROL		0x00
+#define USB_ENDPOINT_ATTR_ISOCHRONOUS	0x01
+#define USB_ENDPOINT_ATTR_BULK			0x02
+#define USB_ENDPOINT_ATTR_INTERRUPT		0x03
+#define USB_ENDPOINT_ATTR_MASK			0x03
+
+typedef struct usb_device_descriptor {
+	uint8	length;
+	uint8	descriptor_type;
+	uint16	usb_version;
+	uint8	device_class;
+	uint8	device_subclass;
+	uint8	device_protocol;
+	uint8	max_packet_size_0;
+	uint16	vendor_id;
+	uint16	product_id;
+	uint16	device_version;
+	uint8	manufacturer;
+	uint8	product;
+	uint8	serial_number;
+	uint8	num_configurations;
+} __attribute__((packed)) usb_device_descriptor;
+
+typedef struct usb_interface_descriptor {
+	uint8	length;
+	uint8	descriptor_type;
+	uint8	interface_number;
+	uint8	alternate_setting;
+	uint8	num_endpoints;
+	uint8	interface_class;
+	uint8	interface_subclass;
+	uint8	interface_protocol;
+	uint8	interface;
+} __attribute__((packed)) usb_interface_descriptor;
+
+typedef struct usb_endpoint_descriptor {
+	uint8	length;
+	uint8	descriptor_type;
+	uint8	endpoint_address;
+	uint8	attributes;
+	uint16	max_packet_size;
+	uint8	interval;
+} __attribute__((packed)) usb_endpoint_descriptor;
+
+typedef struct usb_configuration_descriptor {
+	uint8	length;
+	uint8	descriptor_type;
+	uint16	total_length;
+	uint8	number_interfaces;
+	uint8	configuration_value;
+	uint8	configuration;
+	uint8	attributes;
+	uint8	max_power;
+} __attribute__((packed)) usb_configuration_descriptor;
+
+struct usb_endpoint_info {
+	usb_endpoint_descriptor*	descr;
+	usb_pipe					handle;
+};
+
+struct usb_interface_info {
+	usb_interface_descriptor*	descr;
+	usb_interface				handle;
+	size_t						endpoint_count;
+	usb_endpoint_info*			endpoint;
+	size_t						generic_count;
+	void**						generic;
+};
+
+struct usb_interface_list {
+	size_t						alt_count;
+	usb_interface_info*			alt;
+	usb_interface_info*			active;
+};
+
+struct usb_configuration_info {
+	usb_configuration_descriptor*	descr;
+	size_t							interface_count;
+	usb_interface_list*				interface;
+};
+
+typedef struct usb_support_descriptor {
+	uint8	dev_class;
+	uint8	dev_subclass;
+	uint8	dev_protocol;
+	uint16	vendor;
+	uint16	product;
+} usb_support_descriptor;
+
+typedef struct usb_notify_hooks {
+	status_t	(*device_added)(usb_device device, void** cookie);
+	status_t	(*device_removed)(void* cookie);
+} usb_notify_hooks;
+
+typedef struct usb_module_info {
+	module_info	binfo;
+
+	status_t	(*register_driver)(const char* driverName,
+					const usb_support_descriptor* supportDescriptors,
+					size_t supportDescriptorCount,
+					const char* optionalRepublishDriverName);
+	status_t	(*install_notify)(const char* driverName,
+					const usb_notify_hooks* hooks);
+	status_t	(*uninstall_notify)(const char* driverName);
+
+	const usb_device_descriptor* (*get_device_descriptor)(usb_device device);
+	const usb_configuration_info* (*get_nth_configuration)(usb_device device,
+					uint32 cfgNumber);
+	const usb_configuration_info* (*get_configuration)(usb_device device);
+	status_t	(*set_configuration)(usb_device device,
+					const usb_configuration_info* configuration);
+	status_t	(*set_alt_interface)(usb_device device,
+					const usb_interface_info* interface);
+
+	status_t	(*set_feature)(usb_id handle, uint16 selector);
+	status_t	(*clear_feature)(usb_id handle, uint16 selector);
+	status_t	(*get_status)(usb_id handle, uint16* status);
+	status_t	(*get_descriptor)(usb_device device, uint8 descriptorType,
+					uint8 index, uint16 languageID, void* data,
+					size_t dataLength, size_t* actualLength);
+
+	status_t	(*send_request)(usb_device device, uint8 requestType,
+					uint8 request, uint16 value, uint16 index,
+					uint16 length, void* data, size_t* actualLength);
+
+	status_t	(*queue_interrupt)(usb_pipe pipe, void* data,
+					size_t dataLength, usb_callback_func callback,
+					void* callbackCookie);
+	status_t	(*queue_bulk)(usb_pipe pipe, void* data, size_t dataLength,
+					usb_callback_func callback, void* callbackCookie);
+	status_t	(*queue_bulk_v)(usb_pipe pipe, struct iovec* vector,
+					size_t vectorCount, usb_callback_func callback,
+					void* callbackCookie);
+	status_t	(*queue_isochronous)(usb_pipe pipe, void* data,
+					size_t dataLength, void* packetDesc,
+					uint32 packetCount, uint32* startingFrameNumber,
+					uint32 flags, usb_callback_func callback,
+					void* callbackCookie);
+	status_t	(*queue_request)(usb_device device, uint8 requestType,
+					uint8 request, uint16 value, uint16 index,
+					uint16 length, void* data, usb_callback_func callback,
+					void* callbackCookie);
+
+	status_t	(*set_pipe_policy)(usb_pipe pipe, uint8 maxNumQueuedPackets,
+					uint16 maxBufferDurationMS, uint16 sampleSize);
+	status_t	(*cancel_queued_transfers)(usb_pipe pipe);
+
+	status_t	(*usb_ioctl)(uint32 opcode, void* buffer, size_t bufferSize);
+} usb_module_info;
+
+#endif	/* _USB3_H_ */
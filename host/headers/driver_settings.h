@@ -0,0 +1,35 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _DRIVER_SETTINGS_H
+#define _DRIVER_SETTINGS_H
+
+/*! Host (Linux) stand-in for the Haiku header of the same name. The host
+	has no settings files; the tools set parameters with
+	host_set_driver_parameter() before init_driver(), every other lookup
+	returns the default value.
+*/
+
+
+#include <SupportDefs.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void*		load_driver_settings(const char* driverName);
+status_t	unload_driver_settings(void* handle);
+bool		get_driver_boolean_parameter(void* handle, const char* key,
+				bool unknownValue, bool noArgValue);
+const char*	get_driver_parameter(void* handle, const char* key,
+				const char* unknownValue, const char* noArgValue);
+
+void		host_set_driver_parameter(const char* key, const char* value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _DRIVER_SETTINGS_H */
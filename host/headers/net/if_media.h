@@ -0,0 +1,15 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _NET_IF_MEDIA_H
+#define _NET_IF_MEDIA_H
+
+/*! Host (Linux) stand-in for the Haiku header of the same name. */
+
+
+#define IFM_ETHER		0x00000020
+#define IFM_IEEE80211	0x00000080
+#define IFM_ACTIVE		0x00000002
+
+#endif	/* _NET_IF_MEDIA_H */
@@ -0,0 +1,375 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*!	Hotplug storm: one thread per simulated RT3070 plugs it in, opens
+	random devices of the driver (its own or another thread's), issues an
+	ioctl, closes and frees them and unplugs it again, thousands of times
+	and all at once. Reports the latency of every hook as the caller sees
+	it, and how long the hooks waited for and held gDriverLock as the driver
+	accounts it (RALINK_GET_DRIVER_LOCK_STATS).
+*/
+
+
+#include <Drivers.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ether_driver.h"
+#include "ralink_ioctl.h"
+#include "rt3070_model.h"
+#include "usb_sim.h"
+
+
+// gDevicesList of the driver
+#define DRIVER_DEVICES	3
+#define MAX_WORKERS		8
+
+enum {
+	HOOK_ADDED,
+	HOOK_REMOVED,
+	HOOK_OPEN,
+	HOOK_CLOSE,
+	HOOK_FREE,
+	HOOK_COUNT
+};
+
+static const char* kHookNames[HOOK_COUNT] = {
+	"device_added", "device_removed", "open", "close", "free"
+};
+
+static const char* kDriverHookNames[RALINK_HOOKS] = {
+	"device_added", "device_removed", "open", "free"
+};
+
+typedef struct hook_samples {
+	bigtime_t*	latencies;
+	uint32		count;
+	uint32		capacity;
+	uint32		failures;
+} hook_samples;
+
+typedef struct worker {
+	pthread_t		thread;
+	RT3070Model*	model;
+	uint32			cycles;
+	uint32			opens;
+	uint32			random;
+	hook_samples	samples[HOOK_COUNT];
+} worker;
+
+static device_hooks* sHooks;
+
+
+static void
+usage(const char* program)
+{
+	fprintf(stderr, "usage: %s [-d <devices>] [-n <cycles>] [-o <opens>] "
+		"[-l <latency us>]\n"
+		"  -d  simulated devices, each plugged by its own thread, "
+			"default 3\n"
+		"  -n  plug cycles per device, default 1000\n"
+		"  -o  most opens per plug cycle, default 2\n"
+		"  -l  control transfer latency, default 0\n", program);
+	exit(1);
+}
+
+
+static uint32
+next_random(worker* self)
+{
+	// xorshift32, every thread has its own sequence
+	uint32 x = self->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	self->random = x;
+	return x;
+}
+
+
+static void
+add_sample(hook_samples* samples, bigtime_t start, bool failed)
+{
+	bigtime_t elapsed = system_time() - start;
+	if (failed)
+		samples->failures++;
+	if (samples->count < samples->capacity)
+		samples->latencies[samples->count++] = elapsed;
+}
+
+
+/*!	Opens, queries and closes a random device of the driver, which may just
+	be going away with the thread that plugged it in.
+*/
+static void
+open_random_device(worker* self)
+{
+	char name[B_PATH_NAME_LENGTH];
+	snprintf(name, sizeof(name), "net/usb_ralink/%u",
+		next_random(self) % DRIVER_DEVICES);
+
+	void* cookie = NULL;
+	bigtime_t start = system_time();
+	status_t status = sHooks->open(name, O_RDWR, &cookie);
+	add_sample(&self->samples[HOOK_OPEN], start, status != B_OK);
+	if (status != B_OK)
+		return;
+
+	uint8 address[6];
+	sHooks->control(cookie, ETHER_GETADDR, address, sizeof(address));
+
+	start = system_time();
+	status = sHooks->close(cookie);
+	add_sample(&self->samples[HOOK_CLOSE], start, status != B_OK);
+
+	start = system_time();
+	status = sHooks->free(cookie);
+	add_sample(&self->samples[HOOK_FREE], start, status != B_OK);
+}
+
+
+static void*
+worker_thread(void* data)
+{
+	worker* self = (worker*)data;
+
+	for (uint32 i = 0; i < self->cycles; i++) {
+		// a cold plug now and then, otherwise the MCU keeps running
+		if (next_random(self) % 8 == 0)
+			self->model->PowerCycle();
+
+		bigtime_t start = system_time();
+		usb_device device = usb_sim_attach(self->model);
+		add_sample(&self->samples[HOOK_ADDED], start, device == 0);
+
+		uint32 opens = self->opens > 0
+			? next_random(self) % (self->opens + 1) : 0;
+		for (uint32 j = 0; j < opens; j++)
+			open_random_device(self);
+
+		if (device == 0)
+			continue;
+
+		start = system_time();
+		usb_sim_detach(device);
+		add_sample(&self->samples[HOOK_REMOVED], start, false);
+	}
+
+	return NULL;
+}
+
+
+static int
+compare_latencies(const void* a, const void* b)
+{
+	bigtime_t first = *(const bigtime_t*)a;
+	bigtime_t second = *(const bigtime_t*)b;
+	return first < second ? -1 : first > second ? 1 : 0;
+}
+
+
+static void
+print_hook_latencies(worker* workers, int32 workerCount)
+{
+	printf("\nhook latency as seen by the caller, us\n");
+	printf("%-16s %8s %8s %10s %10s %10s %10s\n", "hook", "calls", "failed",
+		"mean", "p50", "p99", "max");
+
+	for (int32 h = 0; h < HOOK_COUNT; h++) {
+		uint32 count = 0;
+		uint32 failures = 0;
+		for (int32 w = 0; w < workerCount; w++) {
+			count += workers[w].samples[h].count;
+			failures += workers[w].samples[h].failures;
+		}
+		if (count == 0) {
+			printf("%-16s %8u\n", kHookNames[h], 0);
+			continue;
+		}
+
+		bigtime_t* latencies = (bigtime_t*)malloc(count * sizeof(bigtime_t));
+		if (latencies == NULL)
+			return;
+		uint32 index = 0;
+		bigtime_t total = 0;
+		for (int32 w = 0; w < workerCount; w++) {
+			const hook_samples& samples = workers[w].samples[h];
+			memcpy(latencies + index, samples.latencies,
+				samples.count * sizeof(bigtime_t));
+			index += samples.count;
+		}
+		for (uint32 i = 0; i < count; i++)
+			total += latencies[i];
+		qsort(latencies, count, sizeof(bigtime_t), &compare_latencies);
+
+		printf("%-16s %8u %8u %10.1f %10lld %10lld %10lld\n", kHookNames[h],
+			count, failures, (double)total / count,
+			(long long)latencies[count / 2],
+			(long long)latencies[(uint64)count * 99 / 100],
+			(long long)latencies[count - 1]);
+		free(latencies);
+	}
+}
+
+
+static void
+print_lock_stats(const ralink_driver_lock_stats& stats)
+{
+	printf("\ngDriverLock per hook, us\n");
+	printf("%-16s %8s %10s %10s %10s %10s %10s %10s\n", "hook", "calls",
+		"wait mean", "wait max", "hold mean", "hold max", "total mean",
+		"total max");
+
+	for (int32 h = 0; h < RALINK_HOOKS; h++) {
+		const ralink_hook_stats& hook = stats.hooks[h];
+		uint64 calls = hook.calls > 0 ? hook.calls : 1;
+		printf("%-16s %8llu %10.1f %10llu %10.1f %10llu %10.1f %10llu\n",
+			kDriverHookNames[h], (unsigned long long)hook.calls,
+			(double)hook.wait_time / calls,
+			(unsigned long long)hook.max_wait_time,
+			(double)hook.hold_time / calls,
+			(unsigned long long)hook.max_hold_time,
+			(double)hook.total_time / calls,
+			(unsigned long long)hook.max_total_time);
+	}
+}
+
+
+/*!	The lock statistics are driver wide, but only reachable through an open
+	device: plugs one in once the storm is over. Its device_added and open
+	show up in the statistics, after they were taken.
+*/
+static status_t
+get_lock_stats(RT3070Model* model, ralink_driver_lock_stats* stats)
+{
+	usb_device device = usb_sim_attach(model);
+	const char** names = publish_devices();
+	if (device == 0 || names[0] == NULL) {
+		usb_sim_detach(device);
+		return B_ERROR;
+	}
+
+	void* cookie = NULL;
+	status_t status = sHooks->open(names[0], O_RDWR, &cookie);
+	if (status == B_OK) {
+		status = sHooks->control(cookie, RALINK_GET_DRIVER_LOCK_STATS, stats,
+			sizeof(*stats));
+		sHooks->close(cookie);
+		sHooks->free(cookie);
+	}
+
+	usb_sim_detach(device);
+	return status;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	int32 workerCount = 3;
+	uint32 cycles = 1000;
+	uint32 opens = 2;
+	bigtime_t latency = 0;
+
+	int option;
+	while ((option = getopt(argc, argv, "d:n:o:l:")) != -1) {
+		switch (option) {
+			case 'd':
+				workerCount = strtol(optarg, NULL, 0);
+				break;
+			case 'n':
+				cycles = strtoul(optarg, NULL, 0);
+				break;
+			case 'o':
+				opens = strtoul(optarg, NULL, 0);
+				break;
+			case 'l':
+				latency = strtoll(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (workerCount < 1 || workerCount > MAX_WORKERS || cycles == 0)
+		usage(argv[0]);
+
+	init_hardware();
+	if (init_driver() != B_OK) {
+		fprintf(stderr, "init_driver() failed\n");
+		return 1;
+	}
+
+	usb_sim_timing timing;
+	usb_sim_get_timing(&timing);
+	timing.control_latency = latency;
+	usb_sim_set_timing(&timing);
+
+	rt3070_model_config config;
+	RT3070Model::DefaultConfig(&config);
+
+	// the hooks are the same for every device name
+	RT3070Model monitor(&config);
+	usb_device device = usb_sim_attach(&monitor);
+	const char** names = publish_devices();
+	sHooks = names[0] != NULL ? find_device(names[0]) : NULL;
+	usb_sim_detach(device);
+	if (sHooks == NULL) {
+		fprintf(stderr, "the driver did not take the device\n");
+		uninit_driver();
+		return 1;
+	}
+
+	worker workers[MAX_WORKERS];
+	memset(workers, 0, sizeof(workers));
+	for (int32 w = 0; w < workerCount; w++) {
+		worker& self = workers[w];
+		self.model = new RT3070Model(&config);
+		self.cycles = cycles;
+		self.opens = opens;
+		self.random = 0x9e3779b9 * (w + 1);
+		for (int32 h = 0; h < HOOK_COUNT; h++) {
+			hook_samples& samples = self.samples[h];
+			samples.capacity = h == HOOK_ADDED || h == HOOK_REMOVED
+				? cycles : cycles * opens;
+			samples.latencies = (bigtime_t*)malloc(
+				max_c(samples.capacity, 1) * sizeof(bigtime_t));
+		}
+	}
+
+	printf("%d devices, %u plug cycles each, up to %u opens per cycle, "
+		"control latency %lld us\n", (int)workerCount, cycles, opens,
+		(long long)latency);
+
+	bigtime_t start = system_time();
+	for (int32 w = 0; w < workerCount; w++)
+		pthread_create(&workers[w].thread, NULL, &worker_thread, &workers[w]);
+	for (int32 w = 0; w < workerCount; w++)
+		pthread_join(workers[w].thread, NULL);
+	bigtime_t elapsed = system_time() - start;
+
+	printf("storm took %.3f s\n", elapsed / 1000000.0);
+	print_hook_latencies(workers, workerCount);
+
+	ralink_driver_lock_stats stats;
+	status_t status = get_lock_stats(&monitor, &stats);
+	if (status == B_OK)
+		print_lock_stats(stats);
+	else
+		fprintf(stderr, "getting the lock statistics failed: %#010x\n", status);
+
+	for (int32 w = 0; w < workerCount; w++) {
+		for (int32 h = 0; h < HOOK_COUNT; h++)
+			free(workers[w].samples[h].latencies);
+		delete workers[w].model;
+	}
+
+	uninit_driver();
+	return status == B_OK ? 0 : 1;
+}
@@ -0,0 +1,398 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*!	The handful of Haiku kernel services the driver glue (driver.cpp,
+	usb_trace.cpp) and the simulation use; the chip logic itself runs on
+	platform_host.cpp.
+*/
+
+
+#include <KernelExport.h>
+#include <OS.h>
+#include <driver_settings.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "usb_sim.h"
+
+
+static bool sDprintfEnabled = false;
+static int sTraceOutput = -1;
+
+
+static void
+timespec_from_system_time(bigtime_t time, struct timespec* spec)
+{
+	spec->tv_sec = time / 1000000;
+	spec->tv_nsec = (time % 1000000) * 1000;
+}
+
+
+//	#pragma mark - time
+
+
+bigtime_t
+system_time(void)
+{
+	struct timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return (bigtime_t)spec.tv_sec * 1000000 + spec.tv_nsec / 1000;
+}
+
+
+status_t
+snooze(bigtime_t amount)
+{
+	if (amount <= 0)
+		return B_OK;
+
+	struct timespec spec;
+	timespec_from_system_time(amount, &spec);
+	while (nanosleep(&spec, &spec) != 0)
+		;
+	return B_OK;
+}
+
+
+void
+spin(bigtime_t microseconds)
+{
+	bigtime_t deadline = system_time() + microseconds;
+	while (system_time() < deadline)
+		;
+}
+
+
+//	#pragma mark - atomics
+
+
+int32
+atomic_add(vint32* value, int32 addValue)
+{
+	return __sync_fetch_and_add(value, addValue);
+}
+
+
+int32
+atomic_and(vint32* value, int32 andValue)
+{
+	return __sync_fetch_and_and(value, andValue);
+}
+
+
+int32
+atomic_or(vint32* value, int32 orValue)
+{
+	return __sync_fetch_and_or(value, orValue);
+}
+
+
+int32
+atomic_get(vint32* value)
+{
+	return __sync_fetch_and_add(value, 0);
+}
+
+
+int32
+atomic_set(vint32* value, int32 newValue)
+{
+	return __sync_lock_test_and_set(value, newValue);
+}
+
+
+int32
+atomic_test_and_set(vint32* value, int32 newValue, int32 testAgainst)
+{
+	return __sync_val_compare_and_swap(value, testAgainst, newValue);
+}
+
+
+int64
+atomic_add64(vint64* value, int64 addValue)
+{
+	return __sync_fetch_and_add(value, addValue);
+}
+
+
+int64
+atomic_get64(vint64* value)
+{
+	return __sync_fetch_and_add(value, 0);
+}
+
+
+int64
+atomic_set64(vint64* value, int64 newValue)
+{
+	return __sync_lock_test_and_set(value, newValue);
+}
+
+
+//	#pragma mark - misc
+
+
+/*!	Kernel output goes to stderr only if RALINK_SIM_TRACE is set in the
+	environment, so that benchmarks are not dominated by the driver traces.
+*/
+void
+host_dprintf(const char* format, ...)
+{
+	if (sTraceOutput < 0)
+		sTraceOutput = getenv("RALINK_SIM_TRACE") != NULL ? 1 : 0;
+	if (!sDprintfEnabled || sTraceOutput == 0)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+
+bool
+set_dprintf_enabled(bool enabled)
+{
+	bool previous = sDprintfEnabled;
+	sDprintfEnabled = enabled;
+	return previous;
+}
+
+
+status_t
+get_module(const char* path, module_info** _info)
+{
+	if (strcmp(path, B_USB_MODULE_NAME) != 0)
+		return B_NAME_NOT_FOUND;
+
+	*_info = (module_info*)usb_sim_module();
+	return B_OK;
+}
+
+
+status_t
+put_module(const char* path)
+{
+	return B_OK;
+}
+
+
+status_t
+user_memcpy(void* to, const void* from, size_t size)
+{
+	memcpy(to, from, size);
+	return B_OK;
+}
+
+
+//	#pragma mark - driver settings
+
+
+#define MAX_DRIVER_PARAMETERS	16
+
+struct host_parameter {
+	char*	key;
+	char*	value;
+};
+
+static host_parameter sParameters[MAX_DRIVER_PARAMETERS];
+static int32 sParameterCount = 0;
+
+
+static const host_parameter*
+lookup_parameter(const char* key)
+{
+	for (int32 i = 0; i < sParameterCount; i++) {
+		if (strcmp(sParameters[i].key, key) == 0)
+			return &sParameters[i];
+	}
+	return NULL;
+}
+
+
+void
+host_set_driver_parameter(const char* key, const char* value)
+{
+	for (int32 i = 0; i < sParameterCount; i++) {
+		if (strcmp(sParameters[i].key, key) == 0) {
+			free(sParameters[i].value);
+			sParameters[i].value = value != NULL ? strdup(value) : NULL;
+			return;
+		}
+	}
+
+	if (sParameterCount == MAX_DRIVER_PARAMETERS)
+		return;
+
+	sParameters[sParameterCount].key = strdup(key);
+	sParameters[sParameterCount].value = value != NULL ? strdup(value) : NULL;
+	sParameterCount++;
+}
+
+
+void*
+load_driver_settings(const char* driverName)
+{
+	// there are no settings files on the host, only what the tools set
+	return sParameterCount > 0 ? sParameters : NULL;
+}
+
+
+status_t
+unload_driver_settings(void* handle)
+{
+	return B_OK;
+}
+
+
+bool
+get_driver_boolean_parameter(void* handle, const char* key, bool unknownValue,
+	bool noArgValue)
+{
+	const host_parameter* parameter = handle != NULL
+		? lookup_parameter(key) : NULL;
+	if (parameter == NULL)
+		return unknownValue;
+	if (parameter->value == NULL)
+		return noArgValue;
+
+	return strcmp(parameter->value, "1") == 0
+		|| strcasecmp(parameter->value, "true") == 0
+		|| strcasecmp(parameter->value, "yes") == 0
+		|| strcasecmp(parameter->value, "on") == 0;
+}
+
+
+const char*
+get_driver_parameter(void* handle, const char* key, const char* unknownValue,
+	const char* noArgValue)
+{
+	const host_parameter* parameter = handle != NULL
+		? lookup_parameter(key) : NULL;
+	if (parameter == NULL)
+		return unknownValue;
+	return parameter->value != NULL ? parameter->value : noArgValue;
+}
+
+
+//	#pragma mark - areas
+
+
+#define MAX_AREAS	16
+
+struct host_area {
+	area_id		id;
+	void*		address;
+	size_t		size;
+	int32*		references;		// shared by an area and its clones
+};
+
+static host_area sAreas[MAX_AREAS];
+static area_id sNextArea = 1;
+static pthread_mutex_t sAreaLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static host_area*
+lookup_area(area_id id)
+{
+	for (int32 i = 0; i < MAX_AREAS; i++) {
+		if (sAreas[i].id == id)
+			return &sAreas[i];
+	}
+	return NULL;
+}
+
+
+static area_id
+add_area(void* address, size_t size, int32* references)
+{
+	host_area* area = lookup_area(0);
+	if (area == NULL)
+		return B_NO_MEMORY;
+
+	area->id = sNextArea++;
+	area->address = address;
+	area->size = size;
+	area->references = references;
+	(*references)++;
+	return area->id;
+}
+
+
+area_id
+create_area(const char* name, void** _address, uint32 addressSpec,
+	size_t size, uint32 lock, uint32 protection)
+{
+	if (size == 0 || size % B_PAGE_SIZE != 0)
+		return B_BAD_VALUE;
+
+	void* address = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	int32* references = (int32*)calloc(1, sizeof(int32));
+	if (address == MAP_FAILED || references == NULL) {
+		if (address != MAP_FAILED)
+			munmap(address, size);
+		free(references);
+		return B_NO_MEMORY;
+	}
+
+	pthread_mutex_lock(&sAreaLock);
+	area_id id = add_area(address, size, references);
+	pthread_mutex_unlock(&sAreaLock);
+
+	if (id < B_OK) {
+		munmap(address, size);
+		free(references);
+		return id;
+	}
+	*_address = address;
+	return id;
+}
+
+
+area_id
+clone_area(const char* name, void** _address, uint32 addressSpec,
+	uint32 protection, area_id source)
+{
+	pthread_mutex_lock(&sAreaLock);
+	host_area* area = source > 0 ? lookup_area(source) : NULL;
+	area_id id = B_BAD_VALUE;
+	if (area != NULL) {
+		id = add_area(area->address, area->size, area->references);
+		if (id >= B_OK)
+			*_address = area->address;
+	}
+	pthread_mutex_unlock(&sAreaLock);
+	return id;
+}
+
+
+status_t
+delete_area(area_id id)
+{
+	pthread_mutex_lock(&sAreaLock);
+	host_area* area = id > 0 ? lookup_area(id) : NULL;
+	if (area == NULL) {
+		pthread_mutex_unlock(&sAreaLock);
+		return B_BAD_VALUE;
+	}
+
+	host_area deleted = *area;
+	area->id = 0;
+	bool last = --(*deleted.references) == 0;
+	pthread_mutex_unlock(&sAreaLock);
+
+	if (last) {
+		munmap(deleted.address, deleted.size);
+		free(deleted.references);
+	}
+	return B_OK;
+}
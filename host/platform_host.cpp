@@ -0,0 +1,349 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*!	Linux implementation of the platform.h services, on pthreads, the
+	monotonic clock and stdio.
+*/
+
+
+#include "platform.h"
+
+#include <KernelExport.h>
+#include <driver_settings.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "driver.h"
+
+
+struct platform_semaphore {
+	pthread_mutex_t	lock;
+	pthread_cond_t	condition;
+	int32			count;
+};
+
+static int sLogOutput = -1;
+
+
+static void
+timespec_from_time(bigtime_t time, struct timespec* spec)
+{
+	spec->tv_sec = time / 1000000;
+	spec->tv_nsec = (time % 1000000) * 1000;
+}
+
+
+//	#pragma mark - USB
+
+
+const usb_device_descriptor*
+platform_usb_device_descriptor(usb_device device)
+{
+	return gUSBModule->get_device_descriptor(device);
+}
+
+
+const usb_configuration_info*
+platform_usb_configuration(usb_device device, uint32 index)
+{
+	return gUSBModule->get_nth_configuration(device, index);
+}
+
+
+status_t
+platform_usb_set_configuration(usb_device device,
+	const usb_configuration_info* config)
+{
+	return gUSBModule->set_configuration(device, config);
+}
+
+
+status_t
+platform_usb_request(usb_device device, uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data,
+	size_t* actualLength)
+{
+	return gUSBModule->send_request(device, requestType, request, value,
+		index, length, data, actualLength);
+}
+
+
+status_t
+platform_usb_queue_request(usb_device device, uint8 requestType,
+	uint8 request, uint16 value, uint16 index, uint16 length, void* data,
+	usb_callback_func callback, void* cookie)
+{
+	return gUSBModule->queue_request(device, requestType, request, value,
+		index, length, data, callback, cookie);
+}
+
+
+status_t
+platform_usb_queue_bulk(usb_pipe pipe, void* data, size_t length,
+	usb_callback_func callback, void* cookie)
+{
+	return gUSBModule->queue_bulk(pipe, data, length, callback, cookie);
+}
+
+
+status_t
+platform_usb_cancel(usb_pipe pipe)
+{
+	return gUSBModule->cancel_queued_transfers(pipe);
+}
+
+
+status_t
+platform_usb_clear_halt(usb_pipe pipe)
+{
+	return gUSBModule->clear_feature(pipe, USB_FEATURE_ENDPOINT_HALT);
+}
+
+
+//	#pragma mark - time
+
+
+bigtime_t
+platform_time()
+{
+	struct timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return (bigtime_t)spec.tv_sec * 1000000 + spec.tv_nsec / 1000;
+}
+
+
+void
+platform_sleep(bigtime_t microseconds)
+{
+	if (microseconds <= 0)
+		return;
+
+	struct timespec spec;
+	timespec_from_time(microseconds, &spec);
+	while (nanosleep(&spec, &spec) != 0)
+		;
+}
+
+
+//	#pragma mark - threads
+
+
+int32
+platform_thread_id()
+{
+	return (int32)syscall(SYS_gettid);
+}
+
+
+//	#pragma mark - semaphores
+
+
+status_t
+platform_sem_create(platform_sem* _sem, int32 count, const char* name)
+{
+	platform_semaphore* sem
+		= (platform_semaphore*)malloc(sizeof(platform_semaphore));
+	if (sem == NULL) {
+		*_sem = NULL;
+		return B_NO_MEMORY;
+	}
+
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&sem->condition, &attributes);
+	pthread_condattr_destroy(&attributes);
+	pthread_mutex_init(&sem->lock, NULL);
+	sem->count = count;
+
+	*_sem = sem;
+	return B_OK;
+}
+
+
+void
+platform_sem_delete(platform_sem sem)
+{
+	if (sem == NULL)
+		return;
+
+	pthread_cond_destroy(&sem->condition);
+	pthread_mutex_destroy(&sem->lock);
+	free(sem);
+}
+
+
+status_t
+platform_sem_acquire(platform_sem sem, int32 count, bigtime_t timeout)
+{
+	if (sem == NULL)
+		return B_BAD_VALUE;
+
+	bigtime_t deadline = timeout != B_INFINITE_TIMEOUT
+		? platform_time() + timeout : B_INFINITE_TIMEOUT;
+
+	pthread_mutex_lock(&sem->lock);
+	while (sem->count < count) {
+		if (deadline == B_INFINITE_TIMEOUT) {
+			pthread_cond_wait(&sem->condition, &sem->lock);
+			continue;
+		}
+
+		if (platform_time() >= deadline) {
+			pthread_mutex_unlock(&sem->lock);
+			return timeout == 0 ? B_WOULD_BLOCK : B_TIMED_OUT;
+		}
+		struct timespec spec;
+		timespec_from_time(deadline, &spec);
+		pthread_cond_timedwait(&sem->condition, &sem->lock, &spec);
+	}
+
+	sem->count -= count;
+	pthread_mutex_unlock(&sem->lock);
+	return B_OK;
+}
+
+
+void
+platform_sem_release(platform_sem sem, int32 count)
+{
+	pthread_mutex_lock(&sem->lock);
+	sem->count += count;
+	pthread_cond_broadcast(&sem->condition);
+	pthread_mutex_unlock(&sem->lock);
+}
+
+
+//	#pragma mark - caller buffers
+
+
+/*!	The host programs call the hooks in place of userland, so their buffers
+	go through user_memcpy() as the ones of a real ioctl() would.
+*/
+status_t
+platform_copy_to_caller(void* to, const void* from, size_t size)
+{
+	if (to == NULL)
+		return B_BAD_ADDRESS;
+	if (!IS_USER_ADDRESS(to)) {
+		memcpy(to, from, size);
+		return B_OK;
+	}
+	return user_memcpy(to, from, size) == B_OK ? B_OK : B_BAD_ADDRESS;
+}
+
+
+status_t
+platform_copy_from_caller(void* to, const void* from, size_t size)
+{
+	if (from == NULL)
+		return B_BAD_ADDRESS;
+	if (!IS_USER_ADDRESS(from)) {
+		memcpy(to, from, size);
+		return B_OK;
+	}
+	return user_memcpy(to, from, size) == B_OK ? B_OK : B_BAD_ADDRESS;
+}
+
+
+//	#pragma mark - areas
+
+
+status_t
+platform_area_create(platform_area* _area, void** _address, size_t size,
+	const char* name)
+{
+	*_area = create_area(name, _address, B_ANY_KERNEL_ADDRESS,
+		(size + B_PAGE_SIZE - 1) & ~(B_PAGE_SIZE - 1), B_FULL_LOCK,
+		B_READ_AREA | B_WRITE_AREA | B_CLONEABLE_AREA);
+	return *_area >= B_OK ? B_OK : *_area;
+}
+
+
+void
+platform_area_delete(platform_area area)
+{
+	delete_area(area);
+}
+
+
+//	#pragma mark - logging, settings and files
+
+
+/*!	Goes to stderr only if RALINK_SIM_TRACE is set in the environment, so
+	that benchmarks are not dominated by the driver traces.
+*/
+void
+platform_log(const char* format, ...)
+{
+	if (sLogOutput < 0)
+		sLogOutput = getenv("RALINK_SIM_TRACE") != NULL ? 1 : 0;
+	if (sLogOutput == 0)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+
+void
+platform_panic(const char* message)
+{
+	fprintf(stderr, "panic: %s\n", message);
+	abort();
+}
+
+
+bool
+platform_get_bool_setting(const char* key, bool defaultValue)
+{
+	// the parameters the tools set with host_set_driver_parameter()
+	void* handle = load_driver_settings(DRIVER_NAME);
+	bool value = get_driver_boolean_parameter(handle, key, defaultValue,
+		true);
+	unload_driver_settings(handle);
+	return value;
+}
+
+
+int32
+platform_get_int_setting(const char* key, int32 defaultValue)
+{
+	void* handle = load_driver_settings(DRIVER_NAME);
+	const char* value = get_driver_parameter(handle, key, NULL, NULL);
+	int32 result = value != NULL ? strtol(value, NULL, 0) : defaultValue;
+	unload_driver_settings(handle);
+	return result;
+}
+
+
+ssize_t
+platform_read_file(const char* path, void* buffer, size_t size)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return B_ENTRY_NOT_FOUND;
+
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (fileSize < 0 || (size_t)fileSize > size) {
+		fclose(file);
+		return fileSize < 0 ? B_IO_ERROR : B_BUFFER_OVERFLOW;
+	}
+
+	size_t bytesRead = fread(buffer, 1, fileSize, file);
+	fclose(file);
+	return bytesRead == (size_t)fileSize ? (ssize_t)bytesRead : B_IO_ERROR;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _PLATFORM_HOST_H_
+#define _PLATFORM_HOST_H_
+
+/*!	Linux implementation of platform.h, see platform_host.cpp. USB goes to
+	the usb_module_info the driver got at init_driver(), which on the host
+	is the simulated bus of usb_sim.cpp.
+*/
+
+
+#include <OS.h>
+#include <SupportDefs.h>
+#include <USB3.h>
+
+#include <sys/types.h>
+
+
+typedef area_id platform_area;
+typedef struct platform_semaphore* platform_sem;
+
+
+const usb_device_descriptor* platform_usb_device_descriptor(usb_device device);
+const usb_configuration_info* platform_usb_configuration(usb_device device,
+					uint32 index);
+status_t		platform_usb_set_configuration(usb_device device,
+					const usb_configuration_info* config);
+status_t		platform_usb_request(usb_device device, uint8 requestType,
+					uint8 request, uint16 value, uint16 index, uint16 length,
+					void* data, size_t* actualLength);
+status_t		platform_usb_queue_request(usb_device device,
+					uint8 requestType, uint8 request, uint16 value,
+					uint16 index, uint16 length, void* data,
+					usb_callback_func callback, void* cookie);
+status_t		platform_usb_queue_bulk(usb_pipe pipe, void* data,
+					size_t length, usb_callback_func callback, void* cookie);
+status_t		platform_usb_cancel(usb_pipe pipe);
+status_t		platform_usb_clear_halt(usb_pipe pipe);
+
+bigtime_t		platform_time();
+void			platform_sleep(bigtime_t microseconds);
+
+int32			platform_thread_id();
+
+status_t		platform_sem_create(platform_sem* sem, int32 count,
+					const char* name);
+void			platform_sem_delete(platform_sem sem);
+status_t		platform_sem_acquire(platform_sem sem, int32 count = 1,
+					bigtime_t timeout = B_INFINITE_TIMEOUT);
+void			platform_sem_release(platform_sem sem, int32 count = 1);
+
+status_t		platform_copy_to_caller(void* to, const void* from,
+					size_t size);
+status_t		platform_copy_from_caller(void* to, const void* from,
+					size_t size);
+
+status_t		platform_area_create(platform_area* _area, void** _address,
+					size_t size, const char* name);
+void			platform_area_delete(platform_area area);
+
+void			platform_log(const char* format, ...)
+					__attribute__((format(printf, 1, 2)));
+void			platform_panic(const char* message)
+					__attribute__((noreturn));
+
+bool			platform_get_bool_setting(const char* key, bool defaultValue);
+int32			platform_get_int_setting(const char* key, int32 defaultValue);
+ssize_t			platform_read_file(const char* path, void* buffer,
+					size_t size);
+
+#endif	// _PLATFORM_HOST_H_
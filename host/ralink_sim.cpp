@@ -0,0 +1,493 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*!	Loads the driver into this process, plugs a simulated RT3070 in and
+	runs it through open, the statistics ioctls, a replug and close.
+*/
+
+
+#include <Drivers.h>
+#include <driver_settings.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "datapath.h"
+#include "ether_driver.h"
+#include "ralink_ioctl.h"
+#include "rt3070_model.h"
+#include "timeline.h"
+#include "timeline_json.h"
+#include "traffic_generator.h"
+#include "usb_sim.h"
+
+
+static const char* kIOTypeNames[RALINK_IO_TYPES] = {
+	"WRITE_2", "WRITE_REGION", "READ_REGION", "EEPROM_READ", "RESET",
+	"BULK_IN", "BULK_OUT"
+};
+
+// spans kept by -j, a session makes a few thousand
+#define TIMELINE_CAPACITY	65536
+
+static const char* kEventNames[] = {
+	"?", "OPEN", "CLOSE", "READ", "WRITE", "CONTROL", "REMOVED", "REATTACH",
+	"REQUEST_ERROR", "POLL", "MICROCODE", "MCU_COMMAND"
+};
+
+
+static void
+usage(const char* program)
+{
+	fprintf(stderr, "usage: %s [-l <control latency us>] "
+		"[-L <bulk latency us>] [-w <bandwidth bytes/s>] [-e] [-r <trace>] "
+		"[-t] [-j <json>] [-f <frames>] [-n <ring size>] [-b] [-m] "
+		"[-g <profile>] [-a] [-A] [-v]\n"
+		"  -e  the simulated device has an EEPROM instead of an eFUSE\n"
+		"  -r  record a USB trace for usb_replay\n"
+		"  -t  dump the driver's trace ring before closing\n"
+		"  -j  write a timeline of the session as trace-event JSON\n"
+		"  -f  read that many frames before and after the replug\n"
+		"  -n  bulk IN transfers the driver keeps queued\n"
+		"  -b  read the frames in batches\n"
+		"  -m  take the frames from the shared rings, and send some\n"
+		"  -g  pin the RX aggregation: 1 for latency, 2 for throughput\n"
+		"  -a  print the driver's allocations per site\n"
+		"  -A  panic on allocations in Read, Write and transfer callbacks\n"
+		"  -v  show the driver traces\n", program);
+	exit(1);
+}
+
+
+static void
+print_bus_stats(const char* phase, bigtime_t elapsed)
+{
+	usb_sim_stats stats;
+	usb_sim_get_stats(&stats);
+	printf("%-10s %8.3f ms  %6llu control transfers  %8llu bytes\n", phase,
+		elapsed / 1000.0, (unsigned long long)stats.control_transfers,
+		(unsigned long long)stats.control_bytes);
+	usb_sim_reset_stats();
+}
+
+
+static void
+print_io_stats(device_hooks* hooks, void* cookie)
+{
+	ralink_io_stats stats;
+	if (hooks->control(cookie, RALINK_GET_IO_STATS, &stats, sizeof(stats))
+			!= B_OK) {
+		fprintf(stderr, "RALINK_GET_IO_STATS failed\n");
+		return;
+	}
+
+	printf("\n%-14s %10s %8s %10s %12s %8s\n", "request", "count", "errors",
+		"bytes", "avg us", "saved");
+	for (int i = 0; i < RALINK_IO_TYPES; i++) {
+		const ralink_io_counter& counter = stats.types[i];
+		if (counter.requests == 0)
+			continue;
+		printf("%-14s %10llu %8llu %10llu %12.1f %8llu\n", kIOTypeNames[i],
+			(unsigned long long)counter.requests,
+			(unsigned long long)counter.errors,
+			(unsigned long long)counter.bytes,
+			(double)counter.total_time / counter.requests,
+			(unsigned long long)counter.saved);
+	}
+}
+
+
+static void
+print_rx_aggregation(device_hooks* hooks, void* cookie)
+{
+	static const char* kProfileNames[] = { "adaptive", "latency",
+		"throughput" };
+
+	ralink_rx_aggregation state;
+	if (hooks->control(cookie, RALINK_GET_RX_AGGREGATION, &state,
+			sizeof(state)) != B_OK) {
+		fprintf(stderr, "RALINK_GET_RX_AGGREGATION failed\n");
+		return;
+	}
+
+	printf("aggregation %s, timeout %u, limit %u kB, %u retunes, "
+		"%.2f frames/transfer, %u%% full, backlog %.2f\n",
+		state.profile < RALINK_RX_AGGREGATION_PROFILES
+			? kProfileNames[state.profile] : "?",
+		state.timeout, state.limit, state.retunes,
+		state.frames_per_transfer / 100.0, state.fill,
+		state.backlog / 100.0);
+}
+
+
+/*!	Reads \a count frames, one per read(), or in batches of whatever fits
+	into 64 kB in RALINK_READ_BATCH mode.
+*/
+static void
+read_frames(device_hooks* hooks, void* cookie, int32 count, bool batch)
+{
+	if (count <= 0)
+		return;
+
+	static uint8 buffer[65536];
+	uint64 bytes = 0;
+	int32 frames = 0;
+	int32 reads = 0;
+	bigtime_t start = system_time();
+	while (frames < count) {
+		size_t length = batch ? sizeof(buffer) : 2048;
+		status_t status = hooks->read(cookie, 0, buffer, &length);
+		if (status != B_OK) {
+			fprintf(stderr, "reading frame %d failed: %#010x\n", (int)frames,
+				status);
+			return;
+		}
+		reads++;
+
+		if (!batch) {
+			bytes += length;
+			frames++;
+			continue;
+		}
+
+		size_t offset = 0;
+		while (offset + sizeof(ralink_rx_header) <= length) {
+			ralink_rx_header header;
+			memcpy(&header, buffer + offset, sizeof(header));
+			bytes += header.length;
+			frames++;
+			offset += sizeof(header) + ((header.length
+				+ RALINK_RX_HEADER_ALIGN - 1) & ~(RALINK_RX_HEADER_ALIGN - 1));
+		}
+	}
+
+	bigtime_t elapsed = system_time() - start;
+	double seconds = elapsed > 0 ? elapsed / 1000000.0 : 1e-6;
+	printf("read       %8.3f ms  %6d frames  %8.0f frames/s  %6.2f MB/s  "
+		"%5.1f frames/read\n", elapsed / 1000.0, (int)frames,
+		frames / seconds, bytes / seconds / 1000000, (double)frames / reads);
+}
+
+
+/*!	Takes \a count frames from the shared RX ring, and sends one frame
+	through the TX ring for every four received.
+*/
+static void
+ring_frames(device_hooks* hooks, void* cookie, ralink_shared_rings* rings,
+	int32 count)
+{
+	if (count <= 0)
+		return;
+
+	uint64 bytes = 0;
+	int32 frames = 0;
+	int32 sent = 0;
+	int32 syncs = 0;
+	bigtime_t start = system_time();
+	while (frames < count) {
+		uint32 flags = RALINK_SYNC_WAIT_RX;
+		status_t status = hooks->control(cookie, RALINK_SYNC_RINGS, &flags,
+			sizeof(flags));
+		if (status != B_OK) {
+			fprintf(stderr, "RALINK_SYNC_RINGS failed: %#010x\n", status);
+			return;
+		}
+		syncs++;
+
+		uint32 tail = rings->rx.tail;
+		uint32 head = rings->rx.head;
+		for (; head != tail && frames < count; head++, frames++) {
+			bytes += rings->rx.slots[head % RALINK_RING_SLOTS].length;
+
+			uint32 txTail = rings->tx.tail;
+			if (frames % 4 != 0 || txTail - rings->tx.head == RALINK_RING_SLOTS)
+				continue;
+
+			// a null data frame to the broadcast address
+			uint8* frame = RALINK_RING_TX_FRAME(rings, txTail);
+			memset(frame, 0, RALINK_WLAN_HEADER_LENGTH);
+			frame[0] = RALINK_FC0_TYPE_DATA | 0x40;
+			memset(frame + 4, 0xff, 6);
+			rings->tx.slots[txTail % RALINK_RING_SLOTS].length
+				= RALINK_WLAN_HEADER_LENGTH;
+			rings->tx.tail = txTail + 1;
+			sent++;
+		}
+		rings->rx.head = head;
+	}
+
+	// hand the last TX slots to the driver, and wait for them
+	uint32 flags = RALINK_SYNC_WAIT_TX;
+	while (rings->tx.head != rings->tx.tail
+		&& hooks->control(cookie, RALINK_SYNC_RINGS, &flags, sizeof(flags))
+			== B_OK) {
+	}
+
+	bigtime_t elapsed = system_time() - start;
+	double seconds = elapsed > 0 ? elapsed / 1000000.0 : 1e-6;
+	printf("rings      %8.3f ms  %6d frames  %8.0f frames/s  %6.2f MB/s  "
+		"%5.1f frames/sync, %d sent\n", elapsed / 1000.0, (int)frames,
+		frames / seconds, bytes / seconds / 1000000, (double)frames / syncs,
+		(int)sent);
+}
+
+
+static void
+print_alloc_stats(device_hooks* hooks, void* cookie)
+{
+	static const char* kSiteNames[RALINK_ALLOC_SITES] = {
+		"untagged", "device", "device name", "firmware", "USB trace",
+		"timeline", "RX ring"
+	};
+
+	ralink_alloc_stats stats;
+	if (hooks->control(cookie, RALINK_GET_ALLOC_STATS, &stats, sizeof(stats))
+			!= B_OK) {
+		fprintf(stderr, "RALINK_GET_ALLOC_STATS failed\n");
+		return;
+	}
+
+	printf("\n%-12s %8s %8s %10s %6s %10s %9s\n", "site", "allocs",
+		"frees", "bytes", "live", "live bytes", "hot path");
+	for (int32 i = 0; i < RALINK_ALLOC_SITES; i++) {
+		const ralink_alloc_site_stats& site = stats.sites[i];
+		printf("%-12s %8llu %8llu %10llu %6lld %10lld %9llu\n",
+			kSiteNames[i], (unsigned long long)site.allocations,
+			(unsigned long long)site.frees, (unsigned long long)site.bytes,
+			(long long)site.live_objects, (long long)site.live_bytes,
+			(unsigned long long)site.hot_path_allocations);
+	}
+}
+
+
+static void
+print_trace_ring(device_hooks* hooks, void* cookie)
+{
+	ralink_trace_dump* dump
+		= (ralink_trace_dump*)malloc(sizeof(ralink_trace_dump));
+	if (dump == NULL || hooks->control(cookie, RALINK_GET_TRACE_RING, dump,
+			sizeof(ralink_trace_dump)) != B_OK) {
+		fprintf(stderr, "RALINK_GET_TRACE_RING failed\n");
+		free(dump);
+		return;
+	}
+
+	printf("\n%u trace records, %u lost\n", dump->count, dump->lost);
+	bigtime_t start = dump->count > 0 ? dump->records[0].time : 0;
+	for (uint32 i = 0; i < dump->count; i++) {
+		const ralink_trace_record& record = dump->records[i];
+		printf("%6u %10.3f ms  %-13s %#x %#x %#x %#x\n", record.sequence,
+			(record.time - start) / 1000.0,
+			record.event < B_COUNT_OF(kEventNames)
+				? kEventNames[record.event] : "?",
+			record.args[0], record.args[1], record.args[2], record.args[3]);
+	}
+	free(dump);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	usb_sim_timing timing;
+	usb_sim_get_timing(&timing);
+	rt3070_model_config config;
+	RT3070Model::DefaultConfig(&config);
+	bool dumpTrace = false;
+	bool dumpAllocations = false;
+	const char* timelinePath = NULL;
+	int32 frames = 0;
+	bool batch = false;
+	bool mapRings = false;
+	uint32 aggregation = RALINK_RX_AGGREGATION_ADAPTIVE;
+
+	int option;
+	while ((option = getopt(argc, argv, "l:L:w:er:tj:f:n:bmg:aAv")) != -1) {
+		switch (option) {
+			case 'l':
+				timing.control_latency = strtoll(optarg, NULL, 0);
+				break;
+			case 'L':
+				timing.bulk_latency = strtoll(optarg, NULL, 0);
+				break;
+			case 'w':
+				timing.bandwidth = strtoul(optarg, NULL, 0);
+				break;
+			case 'e':
+				config.efuse = false;
+				break;
+			case 'r':
+				host_set_driver_parameter("usb_trace", optarg);
+				break;
+			case 't':
+				dumpTrace = true;
+				break;
+			case 'j':
+				timelinePath = optarg;
+				break;
+			case 'f':
+				frames = strtol(optarg, NULL, 0);
+				break;
+			case 'n':
+				host_set_driver_parameter("rx_ring_count", optarg);
+				break;
+			case 'b':
+				batch = true;
+				break;
+			case 'm':
+				mapRings = true;
+				break;
+			case 'g':
+				aggregation = strtoul(optarg, NULL, 0);
+				break;
+			case 'a':
+				dumpAllocations = true;
+				break;
+			case 'A':
+				host_set_driver_parameter("assert_hot_path_allocations",
+					"true");
+				break;
+			case 'v':
+				setenv("RALINK_SIM_TRACE", "1", 1);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	usb_sim_set_timing(&timing);
+
+	printf("control latency %lld us, bulk latency %lld us, %u bytes/s, %s\n",
+		(long long)timing.control_latency, (long long)timing.bulk_latency,
+		timing.bandwidth, config.efuse ? "eFUSE" : "EEPROM");
+
+	if (timelinePath != NULL && timeline_start(TIMELINE_CAPACITY) != B_OK) {
+		fprintf(stderr, "cannot start the timeline\n");
+		return 1;
+	}
+
+	init_hardware();
+	if (init_driver() != B_OK) {
+		fprintf(stderr, "init_driver() failed\n");
+		return 1;
+	}
+
+	RT3070Model model(&config);
+	traffic_profile profile;
+	TrafficGenerator::DefaultProfile(&profile);
+	TrafficGenerator generator(&profile);
+	model.SetTrafficGenerator(&generator);
+
+	bigtime_t start = system_time();
+	usb_device device = usb_sim_attach(&model);
+	print_bus_stats("attach", system_time() - start);
+
+	const char** names = publish_devices();
+	if (device == 0 || names[0] == NULL) {
+		fprintf(stderr, "the driver did not publish the device\n");
+		uninit_driver();
+		return 1;
+	}
+
+	device_hooks* hooks = find_device(names[0]);
+	void* cookie;
+	start = system_time();
+	status_t status = hooks->open(names[0], O_RDWR, &cookie);
+	print_bus_stats("open", system_time() - start);
+	if (status != B_OK) {
+		fprintf(stderr, "opening %s failed: %#010x\n", names[0], status);
+		uninit_driver();
+		return 1;
+	}
+
+	ether_address_t address;
+	hooks->control(cookie, ETHER_GETADDR, &address, sizeof(address));
+	printf("%s: MAC %02x:%02x:%02x:%02x:%02x:%02x, MCU %s\n", names[0],
+		address.ebyte[0], address.ebyte[1], address.ebyte[2],
+		address.ebyte[3], address.ebyte[4], address.ebyte[5],
+		model.MCUReady() ? "ready" : "not ready");
+
+	uint32 mode = batch ? RALINK_READ_BATCH : RALINK_READ_FRAME;
+	hooks->control(cookie, RALINK_SET_READ_MODE, &mode, sizeof(mode));
+	status = hooks->control(cookie, RALINK_SET_RX_AGGREGATION, &aggregation,
+		sizeof(aggregation));
+	if (status != B_OK) {
+		fprintf(stderr, "RALINK_SET_RX_AGGREGATION failed: %#010x\n",
+			status);
+	}
+
+	ralink_shared_rings* rings = NULL;
+	area_id ringsArea = -1;
+	if (mapRings) {
+		ralink_ring_map map;
+		status = hooks->control(cookie, RALINK_MAP_RINGS, &map, sizeof(map));
+		if (status == B_OK) {
+			ringsArea = clone_area("rings", (void**)&rings, B_ANY_ADDRESS,
+				B_READ_AREA | B_WRITE_AREA, map.area);
+		}
+		if (status != B_OK || ringsArea < B_OK) {
+			fprintf(stderr, "mapping the rings failed: %#010x\n",
+				status != B_OK ? status : ringsArea);
+			uninit_driver();
+			return 1;
+		}
+		ring_frames(hooks, cookie, rings, frames);
+	} else
+		read_frames(hooks, cookie, frames, batch);
+	if (frames > 0)
+		print_rx_aggregation(hooks, cookie);
+
+	// unplugging an open device keeps it around for the replug
+	start = system_time();
+	usb_sim_detach(device);
+	device = usb_sim_attach(&model);
+	print_bus_stats("replug", system_time() - start);
+	if (mapRings)
+		ring_frames(hooks, cookie, rings, frames);
+	else
+		read_frames(hooks, cookie, frames, batch);
+	if (frames > 0)
+		print_rx_aggregation(hooks, cookie);
+
+	print_io_stats(hooks, cookie);
+
+	rt3070_model_stats stats;
+	model.GetStats(&stats);
+	printf("\nmodel: %llu register reads, %llu register writes, "
+		"%llu eFUSE kicks, %llu MCU resets, %llu frames sent\n",
+		(unsigned long long)stats.register_reads,
+		(unsigned long long)stats.register_writes,
+		(unsigned long long)stats.efuse_kicks,
+		(unsigned long long)stats.mcu_resets,
+		(unsigned long long)stats.tx_frames);
+
+	if (dumpTrace)
+		print_trace_ring(hooks, cookie);
+	if (dumpAllocations)
+		print_alloc_stats(hooks, cookie);
+
+	hooks->close(cookie);
+	hooks->free(cookie);
+	if (ringsArea >= B_OK)
+		delete_area(ringsArea);
+	usb_sim_detach(device);
+	uninit_driver();
+
+	if (timelinePath != NULL) {
+		timeline_stop();
+		uint32 count;
+		uint32 dropped;
+		timeline_events(&count, &dropped);
+		if (timeline_write_json(timelinePath) != B_OK) {
+			fprintf(stderr, "%s: cannot write the timeline\n", timelinePath);
+			return 1;
+		}
+		printf("\n%u spans written to %s, %u dropped\n", count,
+			timelinePath, dropped);
+	}
+	return 0;
+}
@@ -0,0 +1,519 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+
+#include "rt3070_model.h"
+
+#include <endian.h>
+#include <string.h>
+
+#include "if_runreg.h"
+#include "traffic_generator.h"
+
+
+#define MICROCODE_SIZE		4096
+#define EFUSE_BLOCK_SIZE	16
+#define MAX_PACKET_SIZE		512
+
+
+RT3070Model::RT3070Model(const rt3070_model_config* config)
+	:
+	fMCUReadyTime(0),
+	fEFuseDoneTime(0),
+	fGenerator(NULL)
+{
+	if (config != NULL)
+		fConfig = *config;
+	else
+		DefaultConfig(&fConfig);
+
+	pthread_mutex_init(&fLock, NULL);
+	memset(&fStats, 0, sizeof(fStats));
+
+	_InitROM();
+	_InitDescriptors();
+	_PowerOn();
+}
+
+
+RT3070Model::~RT3070Model()
+{
+	pthread_mutex_destroy(&fLock);
+}
+
+
+void
+RT3070Model::DefaultConfig(rt3070_model_config* config)
+{
+	config->asic_version = 0x30700200;
+	config->product_id = 0x3070;
+	config->efuse = true;
+	config->efuse_size = 0x100;
+	config->mcu_boot_time = 20000;
+	config->efuse_kick_time = 50;
+
+	static const uint8 kAddress[6] = { 0x00, 0x0c, 0x43, 0x30, 0x70, 0x00 };
+	memcpy(config->mac_address, kAddress, sizeof(kAddress));
+}
+
+
+void
+RT3070Model::SetTrafficGenerator(TrafficGenerator* generator)
+{
+	pthread_mutex_lock(&fLock);
+	fGenerator = generator;
+	if (generator != NULL)
+		generator->SetDestination(fConfig.mac_address);
+	pthread_mutex_unlock(&fLock);
+}
+
+
+void
+RT3070Model::PowerCycle()
+{
+	pthread_mutex_lock(&fLock);
+	_PowerOn();
+	pthread_mutex_unlock(&fLock);
+}
+
+
+uint32
+RT3070Model::Register(uint16 reg)
+{
+	pthread_mutex_lock(&fLock);
+	_UpdateTimedState(system_time());
+	uint32 value = _Get(reg);
+	pthread_mutex_unlock(&fLock);
+	return value;
+}
+
+
+void
+RT3070Model::SetRegister(uint16 reg, uint32 value)
+{
+	pthread_mutex_lock(&fLock);
+	_Set(reg, value);
+	pthread_mutex_unlock(&fLock);
+}
+
+
+bool
+RT3070Model::MCUReady()
+{
+	return (Register(RT2860_SYS_CTRL) & RT2860_MCU_READY) != 0;
+}
+
+
+void
+RT3070Model::GetStats(rt3070_model_stats* stats)
+{
+	pthread_mutex_lock(&fLock);
+	*stats = fStats;
+	pthread_mutex_unlock(&fLock);
+}
+
+
+void
+RT3070Model::ResetStats()
+{
+	pthread_mutex_lock(&fLock);
+	memset(&fStats, 0, sizeof(fStats));
+	pthread_mutex_unlock(&fLock);
+}
+
+
+const usb_device_descriptor*
+RT3070Model::DeviceDescriptor()
+{
+	return &fDeviceDescriptor;
+}
+
+
+usb_configuration_info*
+RT3070Model::Configuration()
+{
+	return &fConfiguration;
+}
+
+
+status_t
+RT3070Model::ControlTransfer(uint8 requestType, uint8 request, uint16 value,
+	uint16 index, uint16 length, void* data, size_t* actualLength)
+{
+	// the chip only implements its vendor requests on the default pipe
+	if ((requestType & ~USB_REQTYPE_MASK) != USB_REQTYPE_VENDOR
+		|| (requestType & USB_REQTYPE_MASK & ~USB_REQTYPE_DEVICE_IN) != 0)
+		return B_DEV_STALLED;
+	if (length > 0 && data == NULL)
+		return B_BAD_VALUE;
+
+	bool in = (requestType & USB_REQTYPE_DEVICE_IN) != 0;
+	status_t status = B_OK;
+
+	pthread_mutex_lock(&fLock);
+	_UpdateTimedState(system_time());
+
+	switch (request) {
+		case RT2870_RESET:
+			if (value == 8)
+				_ResetMCU();
+			break;
+
+		case RT2870_WRITE_2:
+		{
+			if (in) {
+				status = B_DEV_STALLED;
+				break;
+			}
+			uint8 bytes[2] = { (uint8)(value & 0xff), (uint8)(value >> 8) };
+			_WriteRegisters(index, bytes, sizeof(bytes));
+			break;
+		}
+
+		case RT2870_WRITE_REGION_1:
+			if (in || (uint32)index + length > sizeof(fRegisters)) {
+				status = B_DEV_STALLED;
+				break;
+			}
+			_WriteRegisters(index, (const uint8*)data, length);
+			*actualLength = length;
+			break;
+
+		case RT2870_READ_REGION_1:
+			if (!in || (uint32)index + length > sizeof(fRegisters)) {
+				status = B_DEV_STALLED;
+				break;
+			}
+			_ReadRegisters(index, (uint8*)data, length);
+			*actualLength = length;
+			break;
+
+		case RT2870_EEPROM_READ:
+		{
+			// there is no EEPROM to read on eFUSE parts
+			if (!in || fConfig.efuse || index >= RT3070_MODEL_ROM_SIZE) {
+				status = B_DEV_STALLED;
+				break;
+			}
+			size_t count = min_c(length, RT3070_MODEL_ROM_SIZE - index);
+			for (size_t i = 0; i < count; i++) {
+				uint16 word = fROM[(index + i) / 2];
+				((uint8*)data)[i] = ((index + i) & 1) ? word >> 8 : word;
+			}
+			*actualLength = count;
+			fStats.eeprom_reads++;
+			break;
+		}
+
+		default:
+			status = B_DEV_STALLED;
+			break;
+	}
+
+	pthread_mutex_unlock(&fLock);
+	return status;
+}
+
+
+status_t
+RT3070Model::BulkOut(uint8 endpoint, const void* data, size_t length)
+{
+	pthread_mutex_lock(&fLock);
+
+	// [TXD][TXWI][802.11 frame][pad], the TXD length covers all but itself
+	rt2870_txd txd;
+	if (length >= sizeof(txd) + sizeof(rt2860_txwi)) {
+		memcpy(&txd, data, sizeof(txd));
+		if (sizeof(txd) + le16toh(txd.len) <= length) {
+			fStats.tx_frames++;
+			fStats.tx_bytes += length;
+		} else
+			fStats.tx_errors++;
+	} else
+		fStats.tx_errors++;
+
+	pthread_mutex_unlock(&fLock);
+	return B_OK;
+}
+
+
+status_t
+RT3070Model::BulkIn(uint8 endpoint, void* data, size_t length,
+	size_t* actualLength, bigtime_t* _retry)
+{
+	pthread_mutex_lock(&fLock);
+
+	bigtime_t now = system_time();
+	uint32 config = _Get(RT2860_USB_DMA_CFG);
+	if (fGenerator == NULL || (config & RT2860_USB_RX_EN) == 0) {
+		// check back later, the host may enable reception in between
+		pthread_mutex_unlock(&fLock);
+		*_retry = now + 1000;
+		return B_WOULD_BLOCK;
+	}
+
+	size_t limit = 0;
+	bigtime_t timeout = 0;
+	if ((config & RT2860_USB_RX_AGG_EN) != 0) {
+		// RX_AGG_LMT counts in 1 KB units, RX_AGG_TO in 33 ns units
+		limit = ((config >> 8) & 0xff) * 1024;
+		if (limit == 0)
+			limit = length;
+		timeout = (config & 0xff) * 33 / 1000;
+	}
+
+	size_t filled = fGenerator->Fill((uint8*)data, length, limit, timeout,
+		_retry);
+	if (filled == 0) {
+		pthread_mutex_unlock(&fLock);
+		return B_WOULD_BLOCK;
+	}
+
+	fStats.rx_transfers++;
+	fStats.rx_bytes += filled;
+	*actualLength = filled;
+	pthread_mutex_unlock(&fLock);
+	return B_OK;
+}
+
+
+void
+RT3070Model::_InitROM()
+{
+	for (int i = 0; i < RT3070_MODEL_ROM_SIZE / 2; i++)
+		fROM[i] = 0xffff;
+
+	const uint8* address = fConfig.mac_address;
+	fROM[0] = fConfig.product_id;
+	fROM[RT2860_EEPROM_VERSION] = 0x0102;
+	fROM[RT2860_EEPROM_MAC01] = address[0] | address[1] << 8;
+	fROM[RT2860_EEPROM_MAC23] = address[2] | address[3] << 8;
+	fROM[RT2860_EEPROM_MAC45] = address[4] | address[5] << 8;
+	// RF3020, 1T1R
+	fROM[RT2860_EEPROM_ANTENNA] = RT3070_RF_3020 << 8 | 1 << 4 | 1;
+	fROM[RT2860_EEPROM_CONFIG] = 0xff00;
+	fROM[RT2860_EEPROM_FREQ_LEDS] = 0x0112;
+	fROM[RT2860_EEPROM_LED1] = 0x5555;
+	fROM[RT2860_EEPROM_LED2] = 0x2221;
+	fROM[RT2860_EEPROM_LED3] = 0x5627;
+	fROM[RT2860_EEPROM_LNA] = 0x0000;
+	fROM[RT2860_EEPROM_RSSI1_2GHZ] = 0x0000;
+	fROM[RT2860_EEPROM_RSSI2_2GHZ] = 0x0000;
+	for (int i = 0; i < 7; i++) {
+		fROM[RT2860_EEPROM_PWR2GHZ_BASE1 + i] = 0x0c0c;
+		fROM[RT2860_EEPROM_PWR2GHZ_BASE2 + i] = 0x0c0c;
+	}
+}
+
+
+void
+RT3070Model::_InitDescriptors()
+{
+	memset(&fDeviceDescriptor, 0, sizeof(fDeviceDescriptor));
+	fDeviceDescriptor.length = sizeof(fDeviceDescriptor);
+	fDeviceDescriptor.descriptor_type = 1;
+	fDeviceDescriptor.usb_version = 0x0200;
+	fDeviceDescriptor.device_class = 0xff;
+	fDeviceDescriptor.max_packet_size_0 = 64;
+	fDeviceDescriptor.vendor_id = 0x148f;
+	fDeviceDescriptor.product_id = fConfig.product_id;
+	fDeviceDescriptor.device_version = 0x0101;
+	fDeviceDescriptor.num_configurations = 1;
+
+	memset(&fConfigDescriptor, 0, sizeof(fConfigDescriptor));
+	fConfigDescriptor.length = sizeof(fConfigDescriptor);
+	fConfigDescriptor.descriptor_type = 2;
+	fConfigDescriptor.number_interfaces = 1;
+	fConfigDescriptor.configuration_value = 1;
+	fConfigDescriptor.attributes = 0x80;
+	fConfigDescriptor.max_power = 225;
+
+	memset(&fInterfaceDescriptor, 0, sizeof(fInterfaceDescriptor));
+	fInterfaceDescriptor.length = sizeof(fInterfaceDescriptor);
+	fInterfaceDescriptor.descriptor_type = 4;
+	fInterfaceDescriptor.num_endpoints = 1 + RT3070_MODEL_OUT_ENDPOINTS;
+	fInterfaceDescriptor.interface_class = 0xff;
+	fInterfaceDescriptor.interface_subclass = 0xff;
+	fInterfaceDescriptor.interface_protocol = 0xff;
+
+	// one bulk IN endpoint for the received frames, one bulk OUT per
+	// access category
+	for (int i = 0; i < 1 + RT3070_MODEL_OUT_ENDPOINTS; i++) {
+		usb_endpoint_descriptor* descr = &fEndpointDescriptors[i];
+		descr->length = sizeof(usb_endpoint_descriptor);
+		descr->descriptor_type = 5;
+		descr->endpoint_address = i == 0 ? USB_ENDPOINT_ADDR_DIR_IN | 1 : i;
+		descr->attributes = USB_ENDPOINT_ATTR_BULK;
+		descr->max_packet_size = MAX_PACKET_SIZE;
+		descr->interval = 0;
+
+		fEndpoints[i].descr = descr;
+		fEndpoints[i].handle = 0;
+	}
+
+	fInterface.descr = &fInterfaceDescriptor;
+	fInterface.handle = 0;
+	fInterface.endpoint_count = 1 + RT3070_MODEL_OUT_ENDPOINTS;
+	fInterface.endpoint = fEndpoints;
+	fInterface.generic_count = 0;
+	fInterface.generic = NULL;
+
+	fInterfaceList.alt_count = 1;
+	fInterfaceList.alt = &fInterface;
+	fInterfaceList.active = &fInterface;
+
+	fConfiguration.descr = &fConfigDescriptor;
+	fConfiguration.interface_count = 1;
+	fConfiguration.interface = &fInterfaceList;
+}
+
+
+void
+RT3070Model::_PowerOn()
+{
+	memset(fRegisters, 0, sizeof(fRegisters));
+	fMCUReadyTime = 0;
+	fEFuseDoneTime = 0;
+
+	_Set(RT2860_ASIC_VER_ID, fConfig.asic_version);
+	_Set(RT3070_EFUSE_CTRL, fConfig.efuse ? RT3070_SEL_EFUSE : 0);
+}
+
+
+/*!	Completes whatever the chip finished by \a now. */
+void
+RT3070Model::_UpdateTimedState(bigtime_t now)
+{
+	if (fMCUReadyTime != 0 && now >= fMCUReadyTime) {
+		_Set(RT2860_SYS_CTRL, _Get(RT2860_SYS_CTRL) | RT2860_MCU_READY);
+		fMCUReadyTime = 0;
+	}
+
+	if (fEFuseDoneTime != 0 && now >= fEFuseDoneTime) {
+		uint32 control = _Get(RT3070_EFUSE_CTRL);
+		uint16 address = (control & RT3070_EFSROM_AIN_MASK)
+			>> RT3070_EFSROM_AIN_SHIFT;
+		address &= ~(EFUSE_BLOCK_SIZE - 1);
+
+		uint32 aout = RT3070_EFUSE_AOUT_MASK;
+		if (address + EFUSE_BLOCK_SIZE
+				<= min_c(fConfig.efuse_size, RT3070_MODEL_ROM_SIZE)) {
+			// DATA3 holds bytes 0-3 of the block, DATA0 bytes 12-15
+			for (int i = 0; i < 4; i++) {
+				uint32 value = 0;
+				for (int b = 0; b < 4; b++) {
+					uint16 offset = address + i * 4 + b;
+					uint16 word = fROM[offset / 2];
+					value |= (uint32)((offset & 1) ? word >> 8 : word & 0xff)
+						<< (b * 8);
+				}
+				_Set(RT3070_EFUSE_DATA3 - i * 4, value);
+			}
+			aout = (address / EFUSE_BLOCK_SIZE) % RT3070_EFUSE_AOUT_MASK;
+		}
+
+		control &= ~(RT3070_EFSROM_KICK | RT3070_EFUSE_AOUT_MASK);
+		_Set(RT3070_EFUSE_CTRL, control | aout);
+		fEFuseDoneTime = 0;
+	}
+}
+
+
+void
+RT3070Model::_ReadRegisters(uint16 reg, uint8* data, size_t length)
+{
+	memcpy(data, fRegisters + reg, length);
+	fStats.register_reads += ((reg & 3) + length + 3) / 4;
+}
+
+
+void
+RT3070Model::_WriteRegisters(uint16 reg, const uint8* data, size_t length)
+{
+	memcpy(fRegisters + reg, data, length);
+
+	uint32 first = reg & ~3;
+	for (uint32 word = first; word < (uint32)reg + length; word += 4) {
+		fStats.register_writes++;
+		_RegisterWritten(word);
+	}
+}
+
+
+/*!	Side effects of writing the 32-bit register at \a reg. */
+void
+RT3070Model::_RegisterWritten(uint16 reg)
+{
+	switch (reg) {
+		case RT2860_ASIC_VER_ID:
+			// read-only
+			_Set(reg, fConfig.asic_version);
+			break;
+
+		case RT2860_HOST_CMD:
+			// the 8051 picks the command up from the mailbox
+			fStats.mcu_commands++;
+			_Set(RT2860_H2M_MAILBOX,
+				_Get(RT2860_H2M_MAILBOX) & ~RT2860_H2M_BUSY);
+			break;
+
+		case RT3070_EFUSE_CTRL:
+		{
+			uint32 control = _Get(reg) & ~RT3070_SEL_EFUSE;
+			if (fConfig.efuse)
+				control |= RT3070_SEL_EFUSE;
+			_Set(reg, control);
+
+			if ((control & RT3070_EFSROM_KICK) != 0) {
+				fStats.efuse_kicks++;
+				bigtime_t now = system_time();
+				fEFuseDoneTime = now + fConfig.efuse_kick_time;
+				if (fConfig.efuse_kick_time == 0)
+					_UpdateTimedState(now);
+			}
+			break;
+		}
+	}
+}
+
+
+/*!	Restarts the 8051, which only comes up if there is microcode to run. */
+void
+RT3070Model::_ResetMCU()
+{
+	fStats.mcu_resets++;
+	_Set(RT2860_SYS_CTRL, _Get(RT2860_SYS_CTRL) & ~RT2860_MCU_READY);
+	fMCUReadyTime = 0;
+	if (_MicrocodePresent())
+		fMCUReadyTime = system_time() + max_c(fConfig.mcu_boot_time, 1);
+}
+
+
+bool
+RT3070Model::_MicrocodePresent() const
+{
+	for (int i = 0; i < MICROCODE_SIZE; i++) {
+		if (fRegisters[RT2870_FW_BASE + i] != 0)
+			return true;
+	}
+	return false;
+}
+
+
+uint32
+RT3070Model::_Get(uint16 reg) const
+{
+	uint32 value;
+	memcpy(&value, fRegisters + reg, sizeof(value));
+	return le32toh(value);
+}
+
+
+void
+RT3070Model::_Set(uint16 reg, uint32 value)
+{
+	value = htole32(value);
+	memcpy(fRegisters + reg, &value, sizeof(value));
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _RT3070_MODEL_H_
+#define _RT3070_MODEL_H_
+
+
+#include <pthread.h>
+
+#include "usb_sim.h"
+
+
+class TrafficGenerator;
+
+#define RT3070_MODEL_ROM_SIZE		512		// bytes of EEPROM/eFUSE
+#define RT3070_MODEL_OUT_ENDPOINTS	4
+
+typedef struct rt3070_model_config {
+	uint32		asic_version;		// RT2860_ASIC_VER_ID contents
+	uint16		product_id;
+	bool		efuse;				// the ROM is an eFUSE, not an EEPROM
+	uint16		efuse_size;			// programmed bytes, the rest reads 0xff
+	bigtime_t	mcu_boot_time;		// MCU reset to MCU_READY
+	bigtime_t	efuse_kick_time;	// EFSROM_KICK to the data being valid
+	uint8		mac_address[6];
+} rt3070_model_config;
+
+typedef struct rt3070_model_stats {
+	uint64		register_reads;		// 32-bit registers read
+	uint64		register_writes;	// 32-bit registers (partially) written
+	uint64		eeprom_reads;
+	uint64		efuse_kicks;
+	uint64		mcu_resets;
+	uint64		mcu_commands;
+	uint64		tx_frames;
+	uint64		tx_bytes;
+	uint64		tx_errors;
+	uint64		rx_transfers;
+	uint64		rx_bytes;
+} rt3070_model_stats;
+
+
+/*!	Behavioural model of the parts of an RT3070 dongle the driver talks to:
+	the register file behind the vendor requests, the EEPROM or eFUSE, the
+	8051 firmware mailbox and MCU_READY, and the bulk endpoints. Everything
+	with a latency on the real chip (MCU boot, eFUSE reads) completes after
+	a configurable time and is polled for, exactly like on the hardware.
+*/
+class RT3070Model : public SimulatedDevice {
+public:
+								RT3070Model(
+									const rt3070_model_config* config = NULL);
+	virtual						~RT3070Model();
+
+	static	void				DefaultConfig(rt3070_model_config* config);
+
+			void				SetTrafficGenerator(
+									TrafficGenerator* generator);
+			// loses the register contents and the microcode, like a dongle
+			// that was unplugged for good
+			void				PowerCycle();
+
+			uint32				Register(uint16 reg);
+			void				SetRegister(uint16 reg, uint32 value);
+			uint16*				ROM() { return fROM; }
+			bool				MCUReady();
+
+			void				GetStats(rt3070_model_stats* stats);
+			void				ResetStats();
+
+	virtual const usb_device_descriptor* DeviceDescriptor();
+	virtual usb_configuration_info* Configuration();
+
+	virtual	status_t			ControlTransfer(uint8 requestType,
+									uint8 request, uint16 value,
+									uint16 index, uint16 length, void* data,
+									size_t* actualLength);
+	virtual	status_t			BulkOut(uint8 endpoint, const void* data,
+									size_t length);
+	virtual	status_t			BulkIn(uint8 endpoint, void* data,
+									size_t length, size_t* actualLength,
+									bigtime_t* _retry);
+
+private:
+			void				_InitROM();
+			void				_InitDescriptors();
+			void				_PowerOn();
+			void				_UpdateTimedState(bigtime_t now);
+			void				_ReadRegisters(uint16 reg, uint8* data,
+									size_t length);
+			void				_WriteRegisters(uint16 reg, const uint8* data,
+									size_t length);
+			void				_RegisterWritten(uint16 reg);
+			void				_ResetMCU();
+			bool				_MicrocodePresent() const;
+
+			uint32				_Get(uint16 reg) const;
+			void				_Set(uint16 reg, uint32 value);
+
+			pthread_mutex_t		fLock;
+			rt3070_model_config	fConfig;
+			rt3070_model_stats	fStats;
+
+			uint8				fRegisters[0x10000];
+			uint16				fROM[RT3070_MODEL_ROM_SIZE / 2];
+			bigtime_t			fMCUReadyTime;
+			bigtime_t			fEFuseDoneTime;
+
+			TrafficGenerator*	fGenerator;
+
+			usb_device_descriptor fDeviceDescriptor;
+			usb_configuration_descriptor fConfigDescriptor;
+			usb_interface_descriptor fInterfaceDescriptor;
+			usb_endpoint_descriptor fEndpointDescriptors[
+									1 + RT3070_MODEL_OUT_ENDPOINTS];
+			usb_endpoint_info	fEndpoints[1 + RT3070_MODEL_OUT_ENDPOINTS];
+			usb_interface_info	fInterface;
+			usb_interface_list	fInterfaceList;
+			usb_configuration_info fConfiguration;
+};
+
+#endif	// _RT3070_MODEL_H_
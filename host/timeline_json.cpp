@@ -0,0 +1,103 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "timeline_json.h"
+
+#include <stdio.h>
+
+#include "timeline.h"
+
+
+static const char* kCategoryNames[TIMELINE_CATEGORIES] = {
+	"control", "bulk", "firmware", "mcu", "poll", "device"
+};
+
+// labels of the span arguments, per category
+static const char* kArgumentNames[TIMELINE_CATEGORIES][4] = {
+	{ "request", "value", "index", "length" },
+	{ "endpoint", "length", "actual", NULL },
+	{ "bytes", NULL, NULL, NULL },
+	{ "command", "argument", NULL, NULL },
+	{ "register", "iterations", NULL, NULL },
+	{ NULL, NULL, NULL, NULL }
+};
+
+
+// distinct tracks named in the output, the rest stay anonymous
+#define MAX_NAMED_TRACKS	256
+
+
+static void
+write_track_name(FILE* file, int32 track)
+{
+	fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		"\"tid\":%d,\"args\":{\"name\":\"", (int)track);
+	if (track >= TIMELINE_TRACK_BULK(0, 0)) {
+		int32 bulk = track - TIMELINE_TRACK_BULK(0, 0);
+		fprintf(file, "bulk 0x%02x buffer %d", (int)(bulk >> 8),
+			(int)(bulk & 0xff));
+	} else if (track >= TIMELINE_TRACK_CONTROL_SLOT(0)) {
+		fprintf(file, "control slot %d",
+			(int)(track - TIMELINE_TRACK_CONTROL_SLOT(0)));
+	} else
+		fprintf(file, "thread %d", (int)track);
+	fprintf(file, "\"}}");
+}
+
+
+status_t
+timeline_write_json(const char* path)
+{
+	uint32 count;
+	uint32 dropped;
+	const timeline_event* events = timeline_events(&count, &dropped);
+
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+		return B_ERROR;
+
+	bigtime_t origin = count > 0 ? events[0].start : 0;
+	for (uint32 i = 1; i < count; i++)
+		origin = min_c(origin, events[i].start);
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"otherData\":"
+		"{\"dropped\":%u},\n\"traceEvents\":[\n", dropped);
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+		"\"args\":{\"name\":\"ralink_usb\"}}");
+
+	int32 tracks[MAX_NAMED_TRACKS];
+	uint32 trackCount = 0;
+	for (uint32 i = 0; i < count && trackCount < MAX_NAMED_TRACKS; i++) {
+		uint32 j = 0;
+		while (j < trackCount && tracks[j] != events[i].track)
+			j++;
+		if (j == trackCount) {
+			tracks[trackCount++] = events[i].track;
+			write_track_name(file, events[i].track);
+		}
+	}
+
+	for (uint32 i = 0; i < count; i++) {
+		const timeline_event& event = events[i];
+		uint8 category = event.category < TIMELINE_CATEGORIES
+			? event.category : TIMELINE_DEVICE;
+
+		fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+			"\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d,"
+			"\"args\":{\"status\":%d", event.name, kCategoryNames[category],
+			(long long)(event.start - origin), (long long)event.duration,
+			(int)event.track, (int)event.status);
+		for (int32 j = 0; j < 4; j++) {
+			if (kArgumentNames[category][j] != NULL) {
+				fprintf(file, ",\"%s\":%u", kArgumentNames[category][j],
+					event.args[j]);
+			}
+		}
+		fprintf(file, "}}");
+	}
+	fprintf(file, "\n]}\n");
+
+	return fclose(file) == 0 ? B_OK : B_IO_ERROR;
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _TIMELINE_JSON_H_
+#define _TIMELINE_JSON_H_
+
+
+#include <SupportDefs.h>
+
+
+/*!	Writes the spans of the last timeline recording (see timeline.h) as
+	Chrome trace-event JSON, for chrome://tracing or Perfetto. Times are
+	relative to the first span.
+*/
+status_t		timeline_write_json(const char* path);
+
+#endif	// _TIMELINE_JSON_H_
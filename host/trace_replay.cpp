@@ -0,0 +1,547 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+
+#include "trace_replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "if_runreg.h"
+
+
+// recorded control transfers a mismatching one is looked for ahead
+#define CONTROL_LOOKAHEAD	8
+
+
+TraceReplayDevice::TraceReplayDevice(SimulatedDevice* descriptors, bool timed)
+	:
+	fDescriptors(descriptors),
+	fTimed(timed),
+	fTrace(NULL),
+	fTraceSize(0),
+	fRecordSize(sizeof(usb_trace_record)),
+	fDropped(0),
+	fTransfers(NULL),
+	fTransferCount(0),
+	fPhases(NULL),
+	fPhaseCount(0),
+	fPhase(0),
+	fServed(0),
+	fDataMismatches(0),
+	fRecordedRetunes(0),
+	fReplayedRetunes(0)
+{
+	pthread_mutex_init(&fLock, NULL);
+	memset(fCursors, 0, sizeof(fCursors));
+}
+
+
+TraceReplayDevice::~TraceReplayDevice()
+{
+	free(fTransfers);
+	free(fPhases);
+	free(fTrace);
+	pthread_mutex_destroy(&fLock);
+}
+
+
+status_t
+TraceReplayDevice::Load(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return B_ENTRY_NOT_FOUND;
+
+	usb_trace_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+		|| header.magic != USB_TRACE_MAGIC
+		|| header.version != USB_TRACE_VERSION
+		|| header.record_size < sizeof(usb_trace_record)) {
+		fclose(file);
+		return B_BAD_DATA;
+	}
+
+	fTrace = (uint8*)malloc(header.size);
+	if (fTrace == NULL) {
+		fclose(file);
+		return B_NO_MEMORY;
+	}
+
+	size_t read = fread(fTrace, 1, header.size, file);
+	fclose(file);
+	if (read != header.size)
+		return B_BAD_DATA;
+
+	fTraceSize = header.size;
+	fDropped = header.dropped;
+	// newer versions may append fields, _Parse() steps over them
+	fRecordSize = header.record_size;
+	return _Parse();
+}
+
+
+void
+TraceReplayDevice::BeginPhase(uint32 index)
+{
+	pthread_mutex_lock(&fLock);
+	fPhase = index;
+	fPhases[index].replay_start = system_time();
+	fPhases[index].replay_end = fPhases[index].replay_start;
+	pthread_mutex_unlock(&fLock);
+}
+
+
+bool
+TraceReplayDevice::WaitForPhase(bigtime_t timeout)
+{
+	uint64 served = ~(uint64)0;
+	bigtime_t lastProgress = system_time();
+
+	while (true) {
+		pthread_mutex_lock(&fLock);
+		bool pending = false;
+		for (int32 i = 0; i < fTransferCount && !pending; i++) {
+			if (fTransfers[i].phase <= fPhase && _Pending(fTransfers[i]))
+				pending = true;
+		}
+		uint64 nowServed = fServed;
+		pthread_mutex_unlock(&fLock);
+
+		if (!pending)
+			return true;
+
+		bigtime_t now = system_time();
+		if (nowServed != served) {
+			served = nowServed;
+			lastProgress = now;
+		} else if (now - lastProgress > timeout)
+			return false;
+
+		snooze(1000);
+	}
+}
+
+
+const usb_device_descriptor*
+TraceReplayDevice::DeviceDescriptor()
+{
+	return fDescriptors->DeviceDescriptor();
+}
+
+
+usb_configuration_info*
+TraceReplayDevice::Configuration()
+{
+	return fDescriptors->Configuration();
+}
+
+
+status_t
+TraceReplayDevice::ControlTransfer(uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data,
+	size_t* actualLength)
+{
+	uint8 setup[8] = {
+		requestType, request, (uint8)(value & 0xff), (uint8)(value >> 8),
+		(uint8)(index & 0xff), (uint8)(index >> 8), (uint8)(length & 0xff),
+		(uint8)(length >> 8)
+	};
+	bool in = (requestType & USB_REQTYPE_DEVICE_IN) != 0;
+
+	pthread_mutex_lock(&fLock);
+
+	int32 match = _Next(0);
+	int32 skipped = 0;
+	while (match >= 0 && skipped < CONTROL_LOOKAHEAD
+		&& memcmp(fTransfers[match].setup, setup, sizeof(setup)) != 0) {
+		match = _Next(0, match + 1);
+		skipped++;
+	}
+	if (match >= 0
+		&& memcmp(fTransfers[match].setup, setup, sizeof(setup)) != 0)
+		match = -1;
+
+	if (match < 0 && _IsRetune(setup)) {
+		// the aggregation retuned at another time than recorded
+		match = _Next(TRACE_REPLAY_RETUNES);
+		if (match < 0) {
+			fReplayedRetunes++;
+			pthread_mutex_unlock(&fLock);
+			*actualLength = 0;
+			return B_OK;
+		}
+	} else if (match < 0) {
+		// nothing like it was recorded, answer like a chip with empty
+		// registers would
+		fPhases[fPhase].diverged++;
+		pthread_mutex_unlock(&fLock);
+		if (in)
+			memset(data, 0, length);
+		*actualLength = length;
+		return B_OK;
+	}
+
+	// the recorded transfers before the match never happened this time
+	for (int32 i = fCursors[0]; !fTransfers[match].retune && i < match;
+			i++) {
+		replay_transfer& skippedTransfer = fTransfers[i];
+		if (_QueueFor(skippedTransfer) != 0 || skippedTransfer.served)
+			continue;
+		skippedTransfer.served = true;
+		fPhases[skippedTransfer.phase].diverged++;
+	}
+
+	replay_transfer& transfer = fTransfers[match];
+	if (in) {
+		size_t copy = min_c((size_t)length, transfer.in_length);
+		memcpy(data, transfer.in_data, copy);
+		*actualLength = transfer.completed ? transfer.actual_length : copy;
+	} else {
+		if (transfer.out_length != length
+			|| memcmp(data, transfer.out_data, length) != 0)
+			fDataMismatches++;
+		*actualLength = length;
+	}
+	_Serve(transfer);
+	status_t status = transfer.completed ? transfer.status : B_OK;
+	pthread_mutex_unlock(&fLock);
+
+	_Delay(transfer);
+	return status;
+}
+
+
+status_t
+TraceReplayDevice::BulkOut(uint8 endpoint, const void* data, size_t length)
+{
+	pthread_mutex_lock(&fLock);
+
+	int32 index = _Next(_BulkQueue(endpoint));
+	if (index < 0) {
+		fPhases[fPhase].diverged++;
+		pthread_mutex_unlock(&fLock);
+		return B_OK;
+	}
+
+	replay_transfer& transfer = fTransfers[index];
+	if (transfer.out_length != length
+		|| memcmp(data, transfer.out_data, length) != 0)
+		fDataMismatches++;
+	_Serve(transfer);
+	status_t status = transfer.completed ? transfer.status : B_OK;
+	pthread_mutex_unlock(&fLock);
+
+	_Delay(transfer);
+	return status;
+}
+
+
+status_t
+TraceReplayDevice::BulkIn(uint8 endpoint, void* data, size_t length,
+	size_t* actualLength, bigtime_t* _retry)
+{
+	pthread_mutex_lock(&fLock);
+
+	int32 index = _Next(_BulkQueue(endpoint));
+	if (index < 0) {
+		pthread_mutex_unlock(&fLock);
+		*_retry = B_INFINITE_TIMEOUT;
+		return B_WOULD_BLOCK;
+	}
+
+	replay_transfer& transfer = fTransfers[index];
+	if (fTimed) {
+		// the data arrives at the same offset into its phase as recorded
+		const replay_phase& phase = fPhases[transfer.phase];
+		bigtime_t due = phase.replay_start
+			+ (transfer.complete_time - phase.recorded_start);
+		if (system_time() < due) {
+			pthread_mutex_unlock(&fLock);
+			*_retry = due;
+			return B_WOULD_BLOCK;
+		}
+	}
+
+	size_t copy = min_c(length, (size_t)transfer.in_length);
+	if (copy < transfer.in_length)
+		fDataMismatches++;
+	memcpy(data, transfer.in_data, copy);
+	*actualLength = copy;
+	_Serve(transfer);
+	status_t status = transfer.status;
+	pthread_mutex_unlock(&fLock);
+	return status;
+}
+
+
+status_t
+TraceReplayDevice::_Parse()
+{
+	// count first, so everything fits into two arrays
+	int32 transferCount = 0;
+	uint32 phaseCount = 1;
+	uint32 maxID = 0;
+	for (size_t offset = 0; offset + fRecordSize <= fTraceSize;) {
+		usb_trace_record record;
+		memcpy(&record, fTrace + offset, sizeof(record));
+		offset += fRecordSize + ((record.payload + 3) & ~3);
+
+		switch (record.type) {
+			case USB_TRACE_SEND_REQUEST:
+			case USB_TRACE_QUEUE_REQUEST:
+			case USB_TRACE_QUEUE_BULK:
+				transferCount++;
+				if (record.id > maxID)
+					maxID = record.id;
+				break;
+			case USB_TRACE_MARK:
+				if (record.setup[0] != USB_TRACE_MARK_READ_DONE
+					&& record.setup[0] != USB_TRACE_MARK_RETUNE)
+					phaseCount++;
+				break;
+		}
+	}
+
+	fTransfers = (replay_transfer*)calloc(transferCount + 1,
+		sizeof(replay_transfer));
+	fPhases = (replay_phase*)calloc(phaseCount, sizeof(replay_phase));
+	int32* transferByID = (int32*)malloc((maxID + 1) * sizeof(int32));
+	if (fTransfers == NULL || fPhases == NULL || transferByID == NULL) {
+		free(transferByID);
+		return B_NO_MEMORY;
+	}
+	memset(transferByID, 0xff, (maxID + 1) * sizeof(int32));
+
+	uint32 phase = 0;
+	bool retune = false;
+	for (size_t offset = 0; offset + fRecordSize <= fTraceSize;) {
+		usb_trace_record record;
+		memcpy(&record, fTrace + offset, sizeof(record));
+		const uint8* payload = fTrace + offset + fRecordSize;
+		offset += fRecordSize + ((record.payload + 3) & ~3);
+		if (offset > fTraceSize)
+			break;
+
+		switch (record.type) {
+			case USB_TRACE_MARK:
+			{
+				if (record.setup[0] == USB_TRACE_MARK_READ_DONE) {
+					// there is only one reader
+					if (fPhases[phase].event == USB_TRACE_MARK_READ
+						&& record.handle == B_OK)
+						fPhases[phase].read_length = record.length;
+					break;
+				}
+				if (record.setup[0] == USB_TRACE_MARK_RETUNE) {
+					// the aggregation's write comes next
+					retune = true;
+					break;
+				}
+
+				replay_phase& next = fPhases[++phase];
+				next.event = record.setup[0];
+				next.handle = record.handle;
+				next.length = record.length;
+				next.recorded_start = record.time;
+				next.recorded_end = record.time;
+				break;
+			}
+
+			case USB_TRACE_SEND_REQUEST:
+			case USB_TRACE_QUEUE_REQUEST:
+			case USB_TRACE_QUEUE_BULK:
+			{
+				replay_transfer& transfer = fTransfers[fTransferCount];
+				transfer.type = record.type;
+				transfer.endpoint = record.endpoint;
+				memcpy(transfer.setup, record.setup, sizeof(transfer.setup));
+				if (retune && record.type == USB_TRACE_QUEUE_REQUEST
+					&& _IsRetune(record.setup)) {
+					transfer.retune = true;
+					fRecordedRetunes++;
+					retune = false;
+				}
+				transfer.phase = phase;
+				transfer.submit_time = record.time;
+				transfer.length = record.length;
+				transfer.out_data = record.payload > 0 ? payload : NULL;
+				transfer.out_length = record.payload;
+				transferByID[record.id] = fTransferCount++;
+				break;
+			}
+
+			case USB_TRACE_COMPLETE:
+			{
+				if (record.id > maxID || transferByID[record.id] < 0)
+					break;
+
+				replay_transfer& transfer
+					= fTransfers[transferByID[record.id]];
+				transfer.completed = true;
+				transfer.complete_time = record.time;
+				transfer.status = record.status;
+				transfer.actual_length = record.length;
+				transfer.in_data = record.payload > 0 ? payload : NULL;
+				transfer.in_length = record.payload;
+				if (record.status == B_CANCELED || transfer.retune)
+					break;
+
+				replay_phase& owner = fPhases[transfer.phase];
+				if (transfer.type != USB_TRACE_QUEUE_BULK)
+					owner.recorded.control_transfers++;
+				else if ((transfer.endpoint & USB_ENDPOINT_ADDR_DIR_IN) != 0)
+					owner.recorded.bulk_in_transfers++;
+				else
+					owner.recorded.bulk_out_transfers++;
+				owner.recorded.bytes += record.length;
+				if (record.time > owner.recorded_end)
+					owner.recorded_end = record.time;
+				break;
+			}
+		}
+	}
+
+	free(transferByID);
+
+	// transfers of a pipe complete in order, so a queued one is only on the
+	// bus from the completion of its predecessor on
+	bigtime_t lastCompletion[TRACE_REPLAY_QUEUES] = {};
+	for (int32 i = 0; i < fTransferCount; i++) {
+		replay_transfer& transfer = fTransfers[i];
+		if (!transfer.completed)
+			continue;
+
+		bigtime_t& last = lastCompletion[_QueueFor(transfer)];
+		bigtime_t start = max_c(transfer.submit_time, last);
+		transfer.service_time = transfer.complete_time > start
+			? transfer.complete_time - start : 0;
+		last = max_c(last, transfer.complete_time);
+	}
+
+	fPhaseCount = phase + 1;
+	return B_OK;
+}
+
+
+/*!	The next recorded transfer of \a queue the driver may use now, starting
+	at \a from or at the queue's cursor. Canceled bulk transfers of earlier
+	phases are passed over, those of the current phase stay pending until
+	the driver cancels its own.
+*/
+int32
+TraceReplayDevice::_Next(int32 queue, int32 from)
+{
+	int32 cursor = fCursors[queue];
+	while (cursor < fTransferCount && (fTransfers[cursor].served
+			|| _QueueFor(fTransfers[cursor]) != queue)) {
+		cursor++;
+	}
+	fCursors[queue] = cursor;
+
+	for (int32 i = max_c(cursor, from); i < fTransferCount; i++) {
+		replay_transfer& transfer = fTransfers[i];
+		if (transfer.served || _QueueFor(transfer) != queue)
+			continue;
+		if (transfer.phase > fPhase)
+			return -1;
+
+		if (queue != 0 && (!transfer.completed
+				|| transfer.status == B_CANCELED)) {
+			if (transfer.phase == fPhase)
+				return -1;
+			transfer.served = true;
+			continue;
+		}
+		return i;
+	}
+	return -1;
+}
+
+
+/*!	Whether the driver still has to ask for \a transfer. A bulk transfer
+	that was queued while the device was being unplugged is not waited for,
+	the replay only unplugs it with the next USB_TRACE_MARK_REMOVED.
+*/
+bool
+TraceReplayDevice::_Pending(const replay_transfer& transfer) const
+{
+	if (transfer.served || transfer.retune)
+		return false;
+	if (transfer.type == USB_TRACE_QUEUE_BULK
+		&& (!transfer.completed || transfer.status == B_CANCELED
+			|| transfer.status == B_DEV_NOT_READY))
+		return false;
+	return true;
+}
+
+
+void
+TraceReplayDevice::_Serve(replay_transfer& transfer)
+{
+	transfer.served = true;
+	fServed++;
+	if (transfer.retune) {
+		fReplayedRetunes++;
+		return;
+	}
+
+	replay_phase& phase = fPhases[transfer.phase];
+	if (transfer.type != USB_TRACE_QUEUE_BULK)
+		phase.replayed.control_transfers++;
+	else if ((transfer.endpoint & USB_ENDPOINT_ADDR_DIR_IN) != 0)
+		phase.replayed.bulk_in_transfers++;
+	else
+		phase.replayed.bulk_out_transfers++;
+	phase.replayed.bytes += transfer.actual_length;
+
+	bigtime_t end = system_time();
+	if (fTimed)
+		end += transfer.service_time;
+	if (end > phase.replay_end)
+		phase.replay_end = end;
+}
+
+
+/*!	In timed mode, holds the bus as long as the recorded transfer took. */
+void
+TraceReplayDevice::_Delay(const replay_transfer& transfer)
+{
+	if (fTimed && transfer.service_time > 0)
+		snooze(transfer.service_time);
+}
+
+
+/*!	Whether \a setup is a write of the RX aggregation, which sets the lower
+	half of USB_DMA_CFG.
+*/
+bool
+TraceReplayDevice::_IsRetune(const uint8* setup)
+{
+	return setup[0] == (USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT)
+		&& setup[1] == RT2870_WRITE_2
+		&& (setup[4] | setup[5] << 8) == RT2860_USB_DMA_CFG
+		&& setup[6] == 0 && setup[7] == 0;
+}
+
+
+int32
+TraceReplayDevice::_QueueFor(const replay_transfer& transfer)
+{
+	if (transfer.retune)
+		return TRACE_REPLAY_RETUNES;
+	if (transfer.type != USB_TRACE_QUEUE_BULK)
+		return 0;
+	return _BulkQueue(transfer.endpoint);
+}
+
+
+int32
+TraceReplayDevice::_BulkQueue(uint8 endpoint)
+{
+	return 1 + ((endpoint & USB_ENDPOINT_ADDR_DIR_IN) != 0 ? 16 : 0)
+		+ (endpoint & 0x0f);
+}
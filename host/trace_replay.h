@@ -0,0 +1,158 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _TRACE_REPLAY_H_
+#define _TRACE_REPLAY_H_
+
+
+#include <pthread.h>
+
+#include "usb_sim.h"
+#include "usb_trace.h"
+
+
+// control pipe plus 16 IN and 16 OUT endpoints, and the RX aggregation's
+// writes to USB_DMA_CFG
+#define TRACE_REPLAY_QUEUES		34
+#define TRACE_REPLAY_RETUNES	(TRACE_REPLAY_QUEUES - 1)
+
+typedef struct replay_counters {
+	uint32		control_transfers;
+	uint32		bulk_in_transfers;
+	uint32		bulk_out_transfers;
+	uint64		bytes;
+} replay_counters;
+
+/*!	One stretch of the trace between two USB_TRACE_MARK records: the driver
+	hook that started it, and what it cost when recorded and when replayed.
+	The busy time runs from the hook to the last transfer of the phase.
+*/
+typedef struct replay_phase {
+	uint8		event;				// USB_TRACE_MARK_*, 0 before the first
+	uint32		handle;
+	uint32		length;
+	uint32		read_length;		// what a USB_TRACE_MARK_READ returned
+	bigtime_t	recorded_start;		// us since the trace was started
+	bigtime_t	recorded_end;
+	replay_counters recorded;
+	bigtime_t	replay_start;
+	bigtime_t	replay_end;
+	replay_counters replayed;
+	uint32		diverged;			// transfers not matching the recording
+} replay_phase;
+
+typedef struct replay_transfer {
+	uint8		type;				// USB_TRACE_SEND_REQUEST...QUEUE_BULK
+	uint8		endpoint;
+	uint8		setup[8];
+	bool		retune;				// after a USB_TRACE_MARK_RETUNE
+	uint32		phase;
+	bigtime_t	submit_time;
+	bigtime_t	complete_time;
+	bigtime_t	service_time;		// without waiting behind earlier ones
+	bool		completed;
+	bool		served;
+	status_t	status;
+	uint32		length;
+	uint32		actual_length;
+	const uint8* out_data;			// recorded with the submission
+	uint32		out_length;
+	const uint8* in_data;			// recorded with the completion
+	uint32		in_length;
+} replay_transfer;
+
+
+/*!	Answers the driver's transfers from a recorded USB trace instead of
+	modelling the chip. Each control and bulk transfer is matched against
+	the next recorded one on the same pipe and gets its recorded status and
+	IN data; a control transfer that does not match is looked for a few
+	transfers ahead before it is counted as a divergence.
+
+	The writes of the adaptive RX aggregation follow the timing of the
+	bulk IN transfers rather than the driver hooks, so they are matched
+	outside that order: a recorded one may go unused, and one more is
+	answered as if it was recorded, without counting a divergence.
+
+	The trace holds no descriptors, those come from \a descriptors, normally
+	a model of the recorded dongle. With \a timed the recorded latency of
+	every transfer is reproduced, and bulk IN data arrives at the recorded
+	offset into its phase; otherwise everything is answered at once and the
+	usb_sim timing applies.
+*/
+class TraceReplayDevice : public SimulatedDevice {
+public:
+								TraceReplayDevice(SimulatedDevice* descriptors,
+									bool timed);
+	virtual						~TraceReplayDevice();
+
+			status_t			Load(const char* path);
+
+			uint32				CountPhases() const { return fPhaseCount; }
+			int32				CountTransfers() const
+									{ return fTransferCount; }
+			const replay_transfer* TransferAt(int32 index) const
+									{ return &fTransfers[index]; }
+			const replay_phase*	Phase(uint32 index) const
+									{ return &fPhases[index]; }
+			uint32				Dropped() const { return fDropped; }
+			uint32				DataMismatches() const
+									{ return fDataMismatches; }
+			uint32				RecordedRetunes() const
+									{ return fRecordedRetunes; }
+			uint32				ReplayedRetunes() const
+									{ return fReplayedRetunes; }
+
+			// replays from here on may use the transfers of phase \a index
+			void				BeginPhase(uint32 index);
+			// waits until the driver used up the transfers recorded so far,
+			// or did not make progress for \a timeout
+			bool				WaitForPhase(bigtime_t timeout);
+
+	virtual const usb_device_descriptor* DeviceDescriptor();
+	virtual usb_configuration_info* Configuration();
+
+	virtual	status_t			ControlTransfer(uint8 requestType,
+									uint8 request, uint16 value,
+									uint16 index, uint16 length, void* data,
+									size_t* actualLength);
+	virtual	status_t			BulkOut(uint8 endpoint, const void* data,
+									size_t length);
+	virtual	status_t			BulkIn(uint8 endpoint, void* data,
+									size_t length, size_t* actualLength,
+									bigtime_t* _retry);
+
+private:
+			status_t			_Parse();
+			int32				_Next(int32 queue, int32 from = 0);
+			bool				_Pending(const replay_transfer& transfer)
+									const;
+			void				_Serve(replay_transfer& transfer);
+			void				_Delay(const replay_transfer& transfer);
+
+	static	bool				_IsRetune(const uint8* setup);
+	static	int32				_QueueFor(const replay_transfer& transfer);
+	static	int32				_BulkQueue(uint8 endpoint);
+
+			pthread_mutex_t		fLock;
+			SimulatedDevice*	fDescriptors;
+			bool				fTimed;
+
+			uint8*				fTrace;
+			size_t				fTraceSize;
+			size_t				fRecordSize;
+			uint32				fDropped;
+
+			replay_transfer*	fTransfers;
+			int32				fTransferCount;
+			int32				fCursors[TRACE_REPLAY_QUEUES];
+			replay_phase*		fPhases;
+			uint32				fPhaseCount;
+			uint32				fPhase;
+			uint64				fServed;
+			uint32				fDataMismatches;
+			uint32				fRecordedRetunes;
+			uint32				fReplayedRetunes;
+};
+
+#endif	// _TRACE_REPLAY_H_
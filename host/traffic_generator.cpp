@@ -0,0 +1,210 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+
+#include "traffic_generator.h"
+
+#include <endian.h>
+#include <string.h>
+
+#include "if_runreg.h"
+
+
+#define WLAN_HEADER_LENGTH		24
+#define LLC_SNAP_LENGTH			8
+
+static const uint8 kBSSID[6] = { 0x00, 0x0c, 0x43, 0x30, 0x70, 0x01 };
+static const uint8 kSource[6] = { 0x00, 0x0c, 0x43, 0x30, 0x70, 0x02 };
+static const uint8 kLLCSNAP[LLC_SNAP_LENGTH] = {
+	0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x08, 0x00
+};
+
+
+/*!	Space one frame of \a length bytes takes in the transfer. */
+static size_t
+aggregate_size(uint16 length)
+{
+	return sizeof(uint32) + ((sizeof(rt2860_rxwi) + length + 3) & ~3)
+		+ sizeof(rt2870_rxd);
+}
+
+
+TrafficGenerator::TrafficGenerator(const traffic_profile* profile)
+	:
+	fProfile(*profile)
+{
+	if (fProfile.min_length < WLAN_HEADER_LENGTH + LLC_SNAP_LENGTH)
+		fProfile.min_length = WLAN_HEADER_LENGTH + LLC_SNAP_LENGTH;
+	if (fProfile.max_length < fProfile.min_length)
+		fProfile.max_length = fProfile.min_length;
+	// the RXWI length field has 12 bits
+	if (fProfile.max_length > 0xfff)
+		fProfile.max_length = 0xfff;
+
+	memset(fDestination, 0xff, sizeof(fDestination));
+	Restart();
+}
+
+
+void
+TrafficGenerator::DefaultProfile(traffic_profile* profile)
+{
+	profile->frames_per_second = 0;
+	profile->min_length = 64;
+	profile->max_length = 1536;
+	profile->seed = 0x3070;
+}
+
+
+void
+TrafficGenerator::SetDestination(const uint8* address)
+{
+	memcpy(fDestination, address, sizeof(fDestination));
+}
+
+
+void
+TrafficGenerator::Restart()
+{
+	fStart = system_time();
+	fRandom = fProfile.seed != 0 ? fProfile.seed : 1;
+	fSequence = 0;
+	fFrames = 0;
+	fBytes = 0;
+	fTransfers = 0;
+	fPendingLength = _NextLength();
+}
+
+
+size_t
+TrafficGenerator::Fill(uint8* buffer, size_t length, size_t aggregationLimit,
+	bigtime_t aggregationTimeout, bigtime_t* _retry)
+{
+	bigtime_t now = system_time();
+	uint64 arrived = _ArrivedFrames(now);
+	if (arrived <= fFrames) {
+		*_retry = _ArrivalTime(fFrames);
+		return 0;
+	}
+
+	size_t limit = length;
+	if (aggregationLimit != 0 && aggregationLimit < limit)
+		limit = aggregationLimit;
+
+	if (aggregationLimit != 0 && fProfile.frames_per_second != 0) {
+		// like the chip, wait for more frames unless the aggregate would be
+		// full anyway or its first frame has waited long enough
+		bigtime_t deadline = _ArrivalTime(fFrames) + aggregationTimeout;
+		size_t worstCase = (arrived - fFrames)
+			* aggregate_size(fProfile.max_length);
+		if (worstCase < limit && now < deadline) {
+			*_retry = min_c(deadline, _ArrivalTime(arrived));
+			return 0;
+		}
+	}
+
+	size_t offset = 0;
+	while (fFrames < arrived) {
+		size_t size = aggregate_size(fPendingLength);
+		// a single frame goes out even if it exceeds the aggregation limit
+		if (offset + size > (offset == 0 ? length : limit))
+			break;
+
+		offset += _BuildFrame(buffer + offset, fPendingLength);
+		fPendingLength = _NextLength();
+		if (aggregationLimit == 0)
+			break;
+	}
+
+	if (offset == 0) {
+		// the host buffer cannot even take one frame, the chip drops it
+		fFrames++;
+		fPendingLength = _NextLength();
+		*_retry = now;
+		return 0;
+	}
+
+	fTransfers++;
+	fBytes += offset;
+	return offset;
+}
+
+
+bigtime_t
+TrafficGenerator::_ArrivalTime(uint64 frame) const
+{
+	if (fProfile.frames_per_second == 0)
+		return fStart;
+	return fStart + (bigtime_t)(frame * 1000000 / fProfile.frames_per_second);
+}
+
+
+uint64
+TrafficGenerator::_ArrivedFrames(bigtime_t now) const
+{
+	if (fProfile.frames_per_second == 0)
+		return fFrames + 1024;
+	return (uint64)(now - fStart) * fProfile.frames_per_second / 1000000 + 1;
+}
+
+
+size_t
+TrafficGenerator::_BuildFrame(uint8* buffer, uint16 length)
+{
+	uint32 dmaLength = (sizeof(rt2860_rxwi) + length + 3) & ~3;
+	uint32 tmp = htole32(dmaLength);
+	memcpy(buffer, &tmp, sizeof(tmp));
+
+	rt2860_rxwi* rxwi = (rt2860_rxwi*)(buffer + sizeof(uint32));
+	memset(rxwi, 0, sizeof(rt2860_rxwi));
+	rxwi->wcid = 0xff;
+	rxwi->len = htole16(length);
+	rxwi->seq = htole16(fSequence);
+	rxwi->phy = htole16(RT2860_PHY_OFDM | (_Random() & 0x7));
+	for (int i = 0; i < 3; i++)
+		rxwi->rssi[i] = 0xc0 + (_Random() & 0x1f);
+	rxwi->snr[0] = 20 + (_Random() & 0xf);
+	rxwi->snr[1] = 20 + (_Random() & 0xf);
+
+	// a FromDS data frame carrying an IPv4 packet
+	uint8* frame = (uint8*)(rxwi + 1);
+	memset(frame, 0, dmaLength - sizeof(rt2860_rxwi));
+	frame[0] = 0x08;
+	frame[1] = 0x02;
+	memcpy(frame + 4, fDestination, 6);
+	memcpy(frame + 10, kBSSID, 6);
+	memcpy(frame + 16, kSource, 6);
+	uint16 sequenceControl = htole16(fSequence << 4);
+	memcpy(frame + 22, &sequenceControl, sizeof(sequenceControl));
+	memcpy(frame + WLAN_HEADER_LENGTH, kLLCSNAP, LLC_SNAP_LENGTH);
+	for (uint16 i = WLAN_HEADER_LENGTH + LLC_SNAP_LENGTH; i < length; i++)
+		frame[i] = (uint8)(fSequence + i);
+
+	tmp = htole32(RT2860_RX_UC2ME | RT2860_RX_MYBSS | RT2860_RX_DATA);
+	memcpy((uint8*)rxwi + dmaLength, &tmp, sizeof(tmp));
+
+	fSequence = (fSequence + 1) & 0xfff;
+	fFrames++;
+	return aggregate_size(length);
+}
+
+
+uint16
+TrafficGenerator::_NextLength()
+{
+	uint32 range = fProfile.max_length - fProfile.min_length + 1;
+	return fProfile.min_length + _Random() % range;
+}
+
+
+/*!	xorshift32, reproducible across platforms and runs. */
+uint32
+TrafficGenerator::_Random()
+{
+	fRandom ^= fRandom << 13;
+	fRandom ^= fRandom >> 17;
+	fRandom ^= fRandom << 5;
+	return fRandom;
+}
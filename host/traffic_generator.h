@@ -0,0 +1,68 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _TRAFFIC_GENERATOR_H_
+#define _TRAFFIC_GENERATOR_H_
+
+
+#include <OS.h>
+
+
+typedef struct traffic_profile {
+	uint32		frames_per_second;	// 0: as fast as the host reads them
+	uint16		min_length;			// 802.11 frame length, header included
+	uint16		max_length;
+	uint32		seed;
+} traffic_profile;
+
+
+/*!	Produces the bulk IN transfers of a receiving RT2870/RT3070: every
+	received 802.11 frame is wrapped as [DMA length][RXWI][frame][pad][RXD],
+	and as many as the USB aggregation settings allow are packed into one
+	transfer. Frame lengths and contents are pseudo-random but reproducible
+	for a given seed.
+*/
+class TrafficGenerator {
+public:
+								TrafficGenerator(
+									const traffic_profile* profile);
+
+	static	void				DefaultProfile(traffic_profile* profile);
+
+			void				SetDestination(const uint8* address);
+			void				Restart();
+
+			// Builds one transfer of at most length bytes. aggregationLimit
+			// caps the bytes packed together (0 disables aggregation), an
+			// incomplete aggregate is held back for up to aggregationTimeout
+			// after its first frame arrived. Returns 0 with the time to try
+			// again in *_retry if nothing is ready.
+			size_t				Fill(uint8* buffer, size_t length,
+									size_t aggregationLimit,
+									bigtime_t aggregationTimeout,
+									bigtime_t* _retry);
+
+			uint64				Frames() const { return fFrames; }
+			uint64				Bytes() const { return fBytes; }
+			uint64				Transfers() const { return fTransfers; }
+
+private:
+			bigtime_t			_ArrivalTime(uint64 frame) const;
+			uint64				_ArrivedFrames(bigtime_t now) const;
+			size_t				_BuildFrame(uint8* buffer, uint16 length);
+			uint16				_NextLength();
+			uint32				_Random();
+
+			traffic_profile		fProfile;
+			uint8				fDestination[6];
+			bigtime_t			fStart;
+			uint32				fRandom;
+			uint16				fPendingLength;
+			uint16				fSequence;
+			uint64				fFrames;
+			uint64				fBytes;
+			uint64				fTransfers;
+};
+
+#endif	// _TRAFFIC_GENERATOR_H_
@@ -0,0 +1,389 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*!	Replays a USB trace recorded with the "usb_trace" driver setting into
+	the driver: the recorded plugs, opens, reads, controls and closes are
+	repeated, and the driver's transfers are answered from the trace. Compares the transfers
+	and the busy time of every phase with the recording, so that two driver
+	versions can be held against the same trace; -o records the replay
+	itself for a closer look.
+*/
+
+
+#include <Drivers.h>
+#include <driver_settings.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "datapath.h"
+#include "driver.h"
+#include "if_runreg.h"
+#include "ralink_ioctl.h"
+#include "rt3070_model.h"
+#include "trace_replay.h"
+#include "usb_sim.h"
+
+
+// how long a phase may go without progress before it is given up on
+#define PHASE_TIMEOUT	1000000
+
+static const char* kEventNames[] = {
+	"start", "added", "removed", "open", "close", "read", "read done",
+	"control"
+};
+
+
+static void
+usage(const char* program)
+{
+	fprintf(stderr, "usage: %s [-t] [-s] [-o <trace>] [-v] <trace>\n"
+		"  -t  reproduce the recorded transfer latencies\n"
+		"  -s  fail if a transfer diverged from the recording\n"
+		"  -o  record the replay into another trace\n"
+		"  -v  show the driver traces\n", program);
+	exit(1);
+}
+
+
+static uint32
+transfers(const replay_counters& counters)
+{
+	return counters.control_transfers + counters.bulk_in_transfers
+		+ counters.bulk_out_transfers;
+}
+
+
+static void
+add_counters(replay_counters& to, const replay_counters& from)
+{
+	to.control_transfers += from.control_transfers;
+	to.bulk_in_transfers += from.bulk_in_transfers;
+	to.bulk_out_transfers += from.bulk_out_transfers;
+	to.bytes += from.bytes;
+}
+
+
+static bool
+is_hook(uint8 event)
+{
+	return event != USB_TRACE_MARK_READ && event != USB_TRACE_MARK_CONTROL;
+}
+
+
+/*!	Repeats a recorded read() with a buffer of the size it filled, so that
+	a batch takes the same frames as recorded. The
+	device is open non-blocking, so a read that finds no frame yet is
+	tried again until the transfers of the phase brought one.
+*/
+static status_t
+replay_read(device_hooks* hooks, void* cookie, usb_device device,
+	size_t length)
+{
+	static uint8 buffer[65536];
+	bigtime_t deadline = system_time() + PHASE_TIMEOUT;
+	while (true) {
+		size_t actualLength = min_c(length, sizeof(buffer));
+		status_t status = hooks->read(cookie, 0, buffer, &actualLength);
+		if (status != B_WOULD_BLOCK || system_time() > deadline)
+			return status;
+
+		if (device != 0)
+			usb_sim_data_ready(device);
+		snooze(1000);
+	}
+}
+
+
+/*!	Puts the frames of the bulk OUT transfers recorded in phase \a index
+	into the TX ring, as the recorded caller did before its
+	RALINK_SYNC_RINGS, and empties the RX ring.
+*/
+static void
+replay_ring_frames(const TraceReplayDevice& replay, uint32 index,
+	ralink_shared_rings* rings)
+{
+	rings->rx.head = rings->rx.tail;
+
+	for (int32 i = 0; i < replay.CountTransfers(); i++) {
+		const replay_transfer* transfer = replay.TransferAt(i);
+		if (transfer->phase != index
+			|| transfer->type != USB_TRACE_QUEUE_BULK
+			|| (transfer->endpoint & USB_ENDPOINT_ADDR_DIR_IN) != 0
+			|| transfer->out_length < RALINK_RING_TX_HEADROOM
+				+ RALINK_WLAN_HEADER_LENGTH)
+			continue;
+
+		uint32 tail = rings->tx.tail;
+		if (tail - rings->tx.head == RALINK_RING_SLOTS)
+			break;
+
+		// the TXWI holds the frame length without the L2 padding, which
+		// the frame header tells, as in datapath_build_tx()
+		const uint8* txwi = transfer->out_data + sizeof(rt2870_txd);
+		const uint8* frame = transfer->out_data + RALINK_RING_TX_HEADROOM;
+		size_t length = txwi[offsetof(rt2860_txwi, len)]
+			| txwi[offsetof(rt2860_txwi, len) + 1] << 8;
+		bool data = (frame[0] & RALINK_FC0_TYPE_MASK) == RALINK_FC0_TYPE_DATA;
+		bool hasQoS = data && (frame[0] & RALINK_FC0_SUBTYPE_QOS) != 0;
+		bool addr4 = (frame[1] & RALINK_FC1_DIR_MASK) == RALINK_FC1_DIR_DSTODS;
+		if (addr4 != hasQoS)
+			length += 2;
+		length = min_c(length, min_c(transfer->out_length
+			- RALINK_RING_TX_HEADROOM, (size_t)RALINK_RING_TX_MAX_FRAME));
+
+		memcpy(RALINK_RING_TX_FRAME(rings, tail), frame, length);
+		rings->tx.slots[tail % RALINK_RING_SLOTS].length = length;
+		rings->tx.tail = tail + 1;
+	}
+}
+
+
+/*!	Prints a line per plug, open, close and removal; the reads and controls
+	after one are added to its line. Returns the diverged transfers.
+*/
+static uint32
+print_results(const TraceReplayDevice& replay)
+{
+	printf("%-3s %-8s %10s %10s %9s %9s %10s %10s %8s\n", "#", "phase",
+		"rec ms", "replay ms", "rec xfers", "xfers", "rec bytes", "bytes",
+		"diverged");
+
+	replay_counters recorded = {};
+	replay_counters replayed = {};
+	bigtime_t recordedTime = 0;
+	bigtime_t replayedTime = 0;
+	uint32 diverged = 0;
+
+	for (uint32 i = 0; i < replay.CountPhases();) {
+		const replay_phase* first = replay.Phase(i);
+		replay_counters rowRecorded = {};
+		replay_counters rowReplayed = {};
+		bigtime_t recordedBusy = 0;
+		bigtime_t replayedBusy = 0;
+		uint32 rowDiverged = 0;
+		uint32 index = i;
+		do {
+			const replay_phase* phase = replay.Phase(i);
+			add_counters(rowRecorded, phase->recorded);
+			add_counters(rowReplayed, phase->replayed);
+			recordedBusy += phase->recorded_end - phase->recorded_start;
+			replayedBusy += phase->replay_end - phase->replay_start;
+			rowDiverged += phase->diverged;
+			i++;
+		} while (i < replay.CountPhases() && !is_hook(replay.Phase(i)->event));
+
+		if (index == 0 && transfers(rowRecorded) == 0)
+			continue;
+
+		printf("%-3u %-8s %10.3f %10.3f %9u %9u %10llu %10llu %8u\n", index,
+			first->event < B_COUNT_OF(kEventNames)
+				? kEventNames[first->event] : "?",
+			recordedBusy / 1000.0, replayedBusy / 1000.0,
+			transfers(rowRecorded), transfers(rowReplayed),
+			(unsigned long long)rowRecorded.bytes,
+			(unsigned long long)rowReplayed.bytes, rowDiverged);
+
+		add_counters(recorded, rowRecorded);
+		add_counters(replayed, rowReplayed);
+		recordedTime += recordedBusy;
+		replayedTime += replayedBusy;
+		diverged += rowDiverged;
+	}
+
+	printf("%-12s %10.3f %10.3f %9u %9u %10llu %10llu %8u\n", "total",
+		recordedTime / 1000.0, replayedTime / 1000.0, transfers(recorded),
+		transfers(replayed), (unsigned long long)recorded.bytes,
+		(unsigned long long)replayed.bytes, diverged);
+	printf("\n%-12s %9s %9s\n", "transfers", "recorded", "replayed");
+	printf("%-12s %9u %9u\n", "control", recorded.control_transfers,
+		replayed.control_transfers);
+	printf("%-12s %9u %9u\n", "bulk in", recorded.bulk_in_transfers,
+		replayed.bulk_in_transfers);
+	printf("%-12s %9u %9u\n", "bulk out", recorded.bulk_out_transfers,
+		replayed.bulk_out_transfers);
+	printf("%-12s %9u %9u\n", "rx retunes", replay.RecordedRetunes(),
+		replay.ReplayedRetunes());
+	printf("\n%u OUT transfers with different data, %u records dropped while "
+		"recording\n", replay.DataMismatches(), replay.Dropped());
+	return diverged;
+}
+
+
+int
+main(int argc, char** argv)
+{
+	bool timed = false;
+	bool strict = false;
+	const char* output = NULL;
+
+	int option;
+	while ((option = getopt(argc, argv, "tso:v")) != -1) {
+		switch (option) {
+			case 't':
+				timed = true;
+				break;
+			case 's':
+				strict = true;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'v':
+				setenv("RALINK_SIM_TRACE", "1", 1);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	// the trace has no descriptors, take those of the dongle it came from
+	RT3070Model model;
+	TraceReplayDevice replay(&model, timed);
+	status_t status = replay.Load(argv[optind]);
+	if (status != B_OK) {
+		fprintf(stderr, "%s: cannot load trace: %s\n", argv[optind],
+			status == B_ENTRY_NOT_FOUND ? "not found" : "invalid");
+		return 1;
+	}
+
+	if (timed) {
+		// the replay holds the bus for the recorded time instead
+		usb_sim_timing timing = { 0, 0, 0 };
+		usb_sim_set_timing(&timing);
+	}
+	if (output != NULL)
+		host_set_driver_parameter("usb_trace", output);
+
+	init_hardware();
+	if (init_driver() != B_OK) {
+		fprintf(stderr, "init_driver() failed\n");
+		return 1;
+	}
+
+	usb_device device = 0;
+	device_hooks* hooks = NULL;
+	void* cookie = NULL;
+	ralink_shared_rings* rings = NULL;
+	area_id ringsArea = -1;
+	bool complete = true;
+
+	replay.BeginPhase(0);
+	for (uint32 i = 1; i < replay.CountPhases(); i++) {
+		const replay_phase* phase = replay.Phase(i);
+		bigtime_t timeout = PHASE_TIMEOUT;
+		if (timed) {
+			const replay_phase* previous = replay.Phase(i - 1);
+			timeout += previous->recorded_end - previous->recorded_start;
+		}
+		if (!replay.WaitForPhase(timeout)) {
+			fprintf(stderr, "phase %u: the driver stopped short of the "
+				"recorded transfers\n", i - 1);
+			complete = false;
+		}
+
+		replay.BeginPhase(i);
+		// bulk IN transfers may be waiting for the data of this phase
+		if (device != 0)
+			usb_sim_data_ready(device);
+
+		switch (phase->event) {
+			case USB_TRACE_MARK_ADDED:
+				if (device == 0)
+					device = usb_sim_attach(&replay);
+				break;
+
+			case USB_TRACE_MARK_REMOVED:
+				if (device != 0)
+					usb_sim_detach(device);
+				device = 0;
+				break;
+
+			case USB_TRACE_MARK_OPEN:
+			{
+				const char** names = publish_devices();
+				if (cookie != NULL || phase->handle >= MAX_DEVICES
+					|| names[phase->handle] == NULL) {
+					fprintf(stderr, "phase %u: no device %u to open\n", i,
+						phase->handle);
+					complete = false;
+					break;
+				}
+				// reads and syncs are tried again instead of waiting
+				hooks = find_device(names[phase->handle]);
+				if (hooks->open(names[phase->handle], O_RDWR | O_NONBLOCK,
+						&cookie) != B_OK) {
+					fprintf(stderr, "phase %u: open failed\n", i);
+					cookie = NULL;
+					complete = false;
+				}
+				break;
+			}
+
+			case USB_TRACE_MARK_CLOSE:
+				if (cookie != NULL) {
+					hooks->close(cookie);
+					hooks->free(cookie);
+					cookie = NULL;
+				}
+				if (ringsArea >= B_OK)
+					delete_area(ringsArea);
+				ringsArea = -1;
+				rings = NULL;
+				break;
+
+			case USB_TRACE_MARK_READ:
+				if (cookie != NULL)
+					replay_read(hooks, cookie, device, phase->read_length > 0
+						? phase->read_length : phase->length);
+				break;
+
+			case USB_TRACE_MARK_CONTROL:
+			{
+				if (cookie == NULL)
+					break;
+
+				uint32 value = phase->length;
+				if (phase->handle == RALINK_MAP_RINGS) {
+					ralink_ring_map map;
+					if (ringsArea < B_OK && hooks->control(cookie,
+							RALINK_MAP_RINGS, &map, sizeof(map)) == B_OK) {
+						ringsArea = clone_area("rings", (void**)&rings,
+							B_ANY_ADDRESS, B_READ_AREA | B_WRITE_AREA,
+							map.area);
+					}
+					break;
+				}
+				if (phase->handle == RALINK_SYNC_RINGS && rings != NULL)
+					replay_ring_frames(replay, i, rings);
+				hooks->control(cookie, phase->handle, &value, sizeof(value));
+				break;
+			}
+		}
+	}
+
+	if (!replay.WaitForPhase(PHASE_TIMEOUT))
+		complete = false;
+
+	if (cookie != NULL) {
+		hooks->close(cookie);
+		hooks->free(cookie);
+	}
+	if (ringsArea >= B_OK)
+		delete_area(ringsArea);
+	if (device != 0)
+		usb_sim_detach(device);
+	uninit_driver();
+
+	uint32 diverged = print_results(replay);
+	if (!complete)
+		return 2;
+	return strict && diverged > 0 ? 3 : 0;
+}
@@ -0,0 +1,924 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+
+#include "usb_sim.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define MAX_SIM_DEVICES		15
+#define MAX_SIM_DRIVERS		4
+#define SIM_PIPES			32		// 16 OUT endpoints, then 16 IN
+
+// usb_device handles carry the slot in the low 4 bits and a generation
+// above it, pipe handles are (device << 8) | endpoint address
+#define DEVICE_SLOT(device)			(((device) & 0xf) - 1)
+#define PIPE_DEVICE(pipe)			((pipe) >> 8)
+#define PIPE_ADDRESS(pipe)			((pipe) & 0xff)
+#define PIPE_INDEX(address)			\
+	(((address) & 0xf) + (((address) & USB_ENDPOINT_ADDR_DIR_IN) ? 16 : 0))
+#define INTERFACE_HANDLE(device)	(((device) << 8) | 0x7f)
+
+enum {
+	SIM_CONTROL,
+	SIM_BULK_IN,
+	SIM_BULK_OUT
+};
+
+typedef struct sim_transfer {
+	sim_transfer*		next;
+	int32				kind;
+	usb_device			device;
+	int32				pipe;
+	uint8				requestType;
+	uint8				request;
+	uint16				value;
+	uint16				index;
+	void*				data;
+	size_t				length;
+	usb_callback_func	callback;
+	void*				cookie;
+	bigtime_t			due;
+	bool				filled;		// bulk IN: data stage in progress
+	bool				waiting;	// bulk IN: waiting for the device
+	bool				synchronous;
+	bool				done;
+	status_t			status;
+	size_t				actualLength;
+} sim_transfer;
+
+typedef struct sim_pipe {
+	sim_transfer*		head;
+	sim_transfer*		tail;
+	bigtime_t			last_due;
+} sim_pipe;
+
+typedef struct sim_device {
+	usb_device			id;
+	SimulatedDevice*	model;
+	bool				present;	// cleared as soon as it is unplugged
+	int32				driver;
+	void*				cookie;
+	sim_pipe			pipes[SIM_PIPES];
+} sim_device;
+
+typedef struct sim_driver {
+	char				name[B_OS_NAME_LENGTH];
+	usb_support_descriptor* descriptors;
+	size_t				count;
+	const usb_notify_hooks* hooks;
+} sim_driver;
+
+
+static pthread_once_t sInitOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sBusCondition;
+static pthread_cond_t sDoneCondition;
+static pthread_t sBusThread;
+static sim_transfer* sCurrent;
+
+static sim_device sDevices[MAX_SIM_DEVICES];
+static sim_driver sDrivers[MAX_SIM_DRIVERS];
+static uint32 sGeneration;
+static usb_sim_timing sTiming = { 250, 250, 1000000 };
+static usb_sim_stats sStats;
+
+
+static bigtime_t
+data_stage_time(size_t length)
+{
+	if (sTiming.bandwidth == 0)
+		return 0;
+	return (bigtime_t)length * 1000000 / sTiming.bandwidth;
+}
+
+
+static sim_device*
+lookup_device(usb_device id)
+{
+	int32 slot = DEVICE_SLOT(id);
+	if (slot < 0 || slot >= MAX_SIM_DEVICES || sDevices[slot].id != id
+		|| sDevices[slot].model == NULL)
+		return NULL;
+	return &sDevices[slot];
+}
+
+
+static void
+wait_until(pthread_cond_t* condition, bigtime_t when)
+{
+	struct timespec spec;
+	spec.tv_sec = when / 1000000;
+	spec.tv_nsec = (when % 1000000) * 1000;
+	pthread_cond_timedwait(condition, &sLock, &spec);
+}
+
+
+static void
+account_transfer(sim_transfer* transfer)
+{
+	if (transfer->status == B_CANCELED) {
+		sStats.canceled_transfers++;
+		return;
+	}
+
+	switch (transfer->kind) {
+		case SIM_CONTROL:
+			sStats.control_transfers++;
+			sStats.control_bytes += transfer->actualLength;
+			break;
+		case SIM_BULK_IN:
+			sStats.bulk_in_transfers++;
+			sStats.bulk_in_bytes += transfer->actualLength;
+			break;
+		case SIM_BULK_OUT:
+			sStats.bulk_out_transfers++;
+			sStats.bulk_out_bytes += transfer->actualLength;
+			break;
+	}
+}
+
+
+/*!	Hands a finished transfer back to its submitter. Must be called without
+	the lock held, as the callbacks may queue new transfers.
+*/
+static void
+finish_transfer(sim_transfer* transfer)
+{
+	pthread_mutex_lock(&sLock);
+	account_transfer(transfer);
+	if (transfer->synchronous) {
+		transfer->done = true;
+		pthread_cond_broadcast(&sDoneCondition);
+		pthread_mutex_unlock(&sLock);
+		return;
+	}
+	pthread_mutex_unlock(&sLock);
+
+	if (transfer->callback != NULL) {
+		transfer->callback(transfer->cookie, transfer->status, transfer->data,
+			transfer->actualLength);
+	}
+	free(transfer);
+}
+
+
+/*!	Appends the transfer to its pipe. Transfers overlap their latency with
+	the ones queued before them, but occupy the pipe one after the other.
+*/
+static status_t
+submit_transfer(sim_transfer* transfer)
+{
+	size_t length = transfer->kind == SIM_BULK_IN ? 0 : transfer->length;
+
+	pthread_mutex_lock(&sLock);
+	sim_device* device = lookup_device(transfer->device);
+	if (device == NULL || !device->present) {
+		pthread_mutex_unlock(&sLock);
+		return B_DEV_NOT_READY;
+	}
+
+	bigtime_t latency = transfer->kind == SIM_CONTROL
+		? sTiming.control_latency : sTiming.bulk_latency;
+	sim_pipe* pipe = &device->pipes[transfer->pipe];
+	bigtime_t start = max_c(system_time() + latency, pipe->last_due);
+	transfer->due = start + data_stage_time(length);
+	pipe->last_due = transfer->due;
+
+	transfer->next = NULL;
+	if (pipe->tail != NULL)
+		pipe->tail->next = transfer;
+	else
+		pipe->head = transfer;
+	pipe->tail = transfer;
+
+	pthread_cond_signal(&sBusCondition);
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+
+static sim_transfer*
+next_transfer()
+{
+	sim_transfer* next = NULL;
+	for (int32 i = 0; i < MAX_SIM_DEVICES; i++) {
+		if (sDevices[i].model == NULL)
+			continue;
+		for (int32 p = 0; p < SIM_PIPES; p++) {
+			sim_transfer* head = sDevices[i].pipes[p].head;
+			if (head != NULL && !head->waiting
+				&& (next == NULL || head->due < next->due))
+				next = head;
+		}
+	}
+	return next;
+}
+
+
+/*!	Runs \a transfer against the device model. Returns false if the transfer
+	is not finished yet and was left at the head of its pipe.
+*/
+static bool
+execute_transfer(sim_transfer* transfer, SimulatedDevice* model)
+{
+	switch (transfer->kind) {
+		case SIM_CONTROL:
+			transfer->actualLength = 0;
+			transfer->status = model->ControlTransfer(transfer->requestType,
+				transfer->request, transfer->value, transfer->index,
+				transfer->length, transfer->data, &transfer->actualLength);
+			return true;
+
+		case SIM_BULK_OUT:
+			transfer->status = model->BulkOut(transfer->pipe & 0xf,
+				transfer->data, transfer->length);
+			transfer->actualLength = transfer->status == B_OK
+				? transfer->length : 0;
+			return true;
+
+		case SIM_BULK_IN:
+		{
+			if (transfer->filled)
+				return true;
+
+			bigtime_t retry = B_INFINITE_TIMEOUT;
+			transfer->actualLength = 0;
+			transfer->status = model->BulkIn(
+				(transfer->pipe & 0xf) | USB_ENDPOINT_ADDR_DIR_IN,
+				transfer->data, transfer->length, &transfer->actualLength,
+				&retry);
+
+			pthread_mutex_lock(&sLock);
+			if (transfer->status == B_WOULD_BLOCK) {
+				if (retry == B_INFINITE_TIMEOUT)
+					transfer->waiting = true;
+				else
+					transfer->due = retry;
+			} else {
+				// the data has to cross the bus before the transfer is done
+				transfer->filled = true;
+				transfer->due = system_time()
+					+ data_stage_time(transfer->actualLength);
+			}
+			pthread_mutex_unlock(&sLock);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static void*
+bus_thread(void*)
+{
+	pthread_mutex_lock(&sLock);
+	while (true) {
+		sim_transfer* transfer = next_transfer();
+		if (transfer == NULL) {
+			pthread_cond_wait(&sBusCondition, &sLock);
+			continue;
+		}
+		if (transfer->due > system_time()) {
+			wait_until(&sBusCondition, transfer->due);
+			continue;
+		}
+
+		SimulatedDevice* model = lookup_device(transfer->device)->model;
+		sCurrent = transfer;
+		pthread_mutex_unlock(&sLock);
+
+		bool finished = execute_transfer(transfer, model);
+
+		pthread_mutex_lock(&sLock);
+		if (finished) {
+			sim_pipe* pipe
+				= &lookup_device(transfer->device)->pipes[transfer->pipe];
+			pipe->head = transfer->next;
+			if (pipe->head == NULL)
+				pipe->tail = NULL;
+			transfer->next = NULL;
+
+			// the next transfer cannot end before this one
+			if (pipe->head != NULL && pipe->head->due < transfer->due)
+				pipe->head->due = transfer->due;
+		} else {
+			sCurrent = NULL;
+			pthread_cond_broadcast(&sDoneCondition);
+			continue;
+		}
+		pthread_mutex_unlock(&sLock);
+
+		finish_transfer(transfer);
+
+		pthread_mutex_lock(&sLock);
+		sCurrent = NULL;
+		pthread_cond_broadcast(&sDoneCondition);
+	}
+	return NULL;
+}
+
+
+static void
+init_bus()
+{
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&sBusCondition, &attributes);
+	pthread_cond_init(&sDoneCondition, &attributes);
+	pthread_condattr_destroy(&attributes);
+
+	pthread_create(&sBusThread, NULL, &bus_thread, NULL);
+}
+
+
+/*!	Removes everything queued on \a pipe and completes it with B_CANCELED.
+	A transfer the bus is currently running or calling back is waited for,
+	unless we are called from the bus thread itself.
+*/
+static void
+cancel_pipe(usb_device id, int32 index)
+{
+	pthread_mutex_lock(&sLock);
+	while (sCurrent != NULL && sCurrent->device == id
+		&& sCurrent->pipe == index
+		&& !pthread_equal(pthread_self(), sBusThread))
+		pthread_cond_wait(&sDoneCondition, &sLock);
+
+	sim_device* device = lookup_device(id);
+	if (device == NULL) {
+		pthread_mutex_unlock(&sLock);
+		return;
+	}
+
+	// the bus takes a transfer off its pipe before calling back, so
+	// everything still queued can go
+	sim_pipe* pipe = &device->pipes[index];
+	sim_transfer* transfer = pipe->head;
+	pipe->head = pipe->tail = NULL;
+	pipe->last_due = 0;
+	pthread_mutex_unlock(&sLock);
+
+	while (transfer != NULL) {
+		sim_transfer* next = transfer->next;
+		transfer->status = B_CANCELED;
+		transfer->actualLength = 0;
+		finish_transfer(transfer);
+		transfer = next;
+	}
+}
+
+
+static bool
+driver_supports(const sim_driver* driver, const usb_device_descriptor* descr)
+{
+	for (size_t i = 0; i < driver->count; i++) {
+		const usb_support_descriptor* support = &driver->descriptors[i];
+		if ((support->dev_class == 0
+				|| support->dev_class == descr->device_class)
+			&& (support->vendor == 0 || support->vendor == descr->vendor_id)
+			&& (support->product == 0
+				|| support->product == descr->product_id))
+			return true;
+	}
+	return false;
+}
+
+
+/*!	Offers the device to the drivers that have their notify hooks installed,
+	the first one accepting it owns it.
+*/
+static void
+probe_device(usb_device id)
+{
+	pthread_mutex_lock(&sLock);
+	sim_device* device = lookup_device(id);
+	if (device == NULL || device->driver >= 0) {
+		pthread_mutex_unlock(&sLock);
+		return;
+	}
+	const usb_device_descriptor* descr = device->model->DeviceDescriptor();
+	pthread_mutex_unlock(&sLock);
+
+	for (int32 i = 0; i < MAX_SIM_DRIVERS; i++) {
+		pthread_mutex_lock(&sLock);
+		const usb_notify_hooks* hooks = sDrivers[i].hooks;
+		bool supported = hooks != NULL
+			&& driver_supports(&sDrivers[i], descr);
+		pthread_mutex_unlock(&sLock);
+		if (!supported)
+			continue;
+
+		void* cookie = NULL;
+		if (hooks->device_added(id, &cookie) != B_OK)
+			continue;
+
+		pthread_mutex_lock(&sLock);
+		device->driver = i;
+		device->cookie = cookie;
+		pthread_mutex_unlock(&sLock);
+		return;
+	}
+}
+
+
+//	#pragma mark - usb_module_info
+
+
+static status_t
+sim_register_driver(const char* driverName,
+	const usb_support_descriptor* supportDescriptors,
+	size_t supportDescriptorCount, const char* optionalRepublishDriverName)
+{
+	pthread_mutex_lock(&sLock);
+	for (int32 i = 0; i < MAX_SIM_DRIVERS; i++) {
+		sim_driver* driver = &sDrivers[i];
+		if (driver->name[0] != '\0' && strcmp(driver->name, driverName) != 0)
+			continue;
+
+		size_t size = supportDescriptorCount * sizeof(usb_support_descriptor);
+		usb_support_descriptor* descriptors
+			= (usb_support_descriptor*)malloc(size);
+		if (descriptors == NULL) {
+			pthread_mutex_unlock(&sLock);
+			return B_NO_MEMORY;
+		}
+		memcpy(descriptors, supportDescriptors, size);
+
+		free(driver->descriptors);
+		snprintf(driver->name, sizeof(driver->name), "%s", driverName);
+		driver->descriptors = descriptors;
+		driver->count = supportDescriptorCount;
+		pthread_mutex_unlock(&sLock);
+		return B_OK;
+	}
+	pthread_mutex_unlock(&sLock);
+	return B_NO_MEMORY;
+}
+
+
+static status_t
+sim_install_notify(const char* driverName, const usb_notify_hooks* hooks)
+{
+	pthread_mutex_lock(&sLock);
+	int32 index = -1;
+	for (int32 i = 0; i < MAX_SIM_DRIVERS; i++) {
+		if (strcmp(sDrivers[i].name, driverName) == 0)
+			index = i;
+	}
+	if (index < 0) {
+		pthread_mutex_unlock(&sLock);
+		return B_NAME_NOT_FOUND;
+	}
+	sDrivers[index].hooks = hooks;
+
+	usb_device present[MAX_SIM_DEVICES];
+	int32 count = 0;
+	for (int32 i = 0; i < MAX_SIM_DEVICES; i++) {
+		if (sDevices[i].model != NULL && sDevices[i].driver < 0)
+			present[count++] = sDevices[i].id;
+	}
+	pthread_mutex_unlock(&sLock);
+
+	// devices plugged in before the driver was loaded
+	for (int32 i = 0; i < count; i++)
+		probe_device(present[i]);
+	return B_OK;
+}
+
+
+static status_t
+sim_uninstall_notify(const char* driverName)
+{
+	for (int32 i = 0; i < MAX_SIM_DEVICES; i++) {
+		pthread_mutex_lock(&sLock);
+		sim_device* device = &sDevices[i];
+		if (device->model == NULL || device->driver < 0
+			|| strcmp(sDrivers[device->driver].name, driverName) != 0) {
+			pthread_mutex_unlock(&sLock);
+			continue;
+		}
+		const usb_notify_hooks* hooks = sDrivers[device->driver].hooks;
+		void* cookie = device->cookie;
+		device->driver = -1;
+		device->cookie = NULL;
+		pthread_mutex_unlock(&sLock);
+
+		hooks->device_removed(cookie);
+	}
+
+	pthread_mutex_lock(&sLock);
+	for (int32 i = 0; i < MAX_SIM_DRIVERS; i++) {
+		if (strcmp(sDrivers[i].name, driverName) == 0)
+			sDrivers[i].hooks = NULL;
+	}
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+
+static const usb_device_descriptor*
+sim_get_device_descriptor(usb_device id)
+{
+	pthread_mutex_lock(&sLock);
+	sim_device* device = lookup_device(id);
+	const usb_device_descriptor* descr
+		= device != NULL ? device->model->DeviceDescriptor() : NULL;
+	pthread_mutex_unlock(&sLock);
+	return descr;
+}
+
+
+static const usb_configuration_info*
+sim_get_configuration(usb_device id)
+{
+	pthread_mutex_lock(&sLock);
+	sim_device* device = lookup_device(id);
+	const usb_configuration_info* config
+		= device != NULL ? device->model->Configuration() : NULL;
+	pthread_mutex_unlock(&sLock);
+	return config;
+}
+
+
+static const usb_configuration_info*
+sim_get_nth_configuration(usb_device id, uint32 cfgNumber)
+{
+	if (cfgNumber != 0)
+		return NULL;
+	return sim_get_configuration(id);
+}
+
+
+static status_t
+sim_set_configuration(usb_device id,
+	const usb_configuration_info* configuration)
+{
+	return sim_get_configuration(id) == configuration ? B_OK : B_BAD_VALUE;
+}
+
+
+static status_t
+sim_set_alt_interface(usb_device id, const usb_interface_info* interface)
+{
+	return B_NOT_SUPPORTED;
+}
+
+
+static status_t
+sim_set_feature(usb_id handle, uint16 selector)
+{
+	return B_OK;
+}
+
+
+static status_t
+sim_clear_feature(usb_id handle, uint16 selector)
+{
+	return B_OK;
+}
+
+
+static status_t
+sim_get_status(usb_id handle, uint16* status)
+{
+	*status = 0;
+	return B_OK;
+}
+
+
+static status_t
+sim_get_descriptor(usb_device id, uint8 descriptorType, uint8 index,
+	uint16 languageID, void* data, size_t dataLength, size_t* actualLength)
+{
+	return B_NOT_SUPPORTED;
+}
+
+
+static sim_transfer*
+create_control_transfer(usb_device device, uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data)
+{
+	sim_transfer* transfer = (sim_transfer*)calloc(1, sizeof(sim_transfer));
+	if (transfer == NULL)
+		return NULL;
+
+	transfer->kind = SIM_CONTROL;
+	transfer->device = device;
+	transfer->pipe = 0;
+	transfer->requestType = requestType;
+	transfer->request = request;
+	transfer->value = value;
+	transfer->index = index;
+	transfer->length = length;
+	transfer->data = data;
+	return transfer;
+}
+
+
+static status_t
+sim_send_request(usb_device device, uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data,
+	size_t* actualLength)
+{
+	sim_transfer* transfer = create_control_transfer(device, requestType,
+		request, value, index, length, data);
+	if (transfer == NULL)
+		return B_NO_MEMORY;
+	transfer->synchronous = true;
+
+	status_t status = submit_transfer(transfer);
+	if (status != B_OK) {
+		free(transfer);
+		return status;
+	}
+
+	pthread_mutex_lock(&sLock);
+	while (!transfer->done)
+		pthread_cond_wait(&sDoneCondition, &sLock);
+	pthread_mutex_unlock(&sLock);
+
+	status = transfer->status;
+	if (actualLength != NULL)
+		*actualLength = transfer->actualLength;
+	free(transfer);
+	return status;
+}
+
+
+static status_t
+sim_queue_interrupt(usb_pipe pipe, void* data, size_t dataLength,
+	usb_callback_func callback, void* callbackCookie)
+{
+	return B_NOT_SUPPORTED;
+}
+
+
+static status_t
+sim_queue_bulk(usb_pipe pipe, void* data, size_t dataLength,
+	usb_callback_func callback, void* callbackCookie)
+{
+	sim_transfer* transfer = (sim_transfer*)calloc(1, sizeof(sim_transfer));
+	if (transfer == NULL)
+		return B_NO_MEMORY;
+
+	uint8 address = PIPE_ADDRESS(pipe);
+	transfer->kind = (address & USB_ENDPOINT_ADDR_DIR_IN) != 0
+		? SIM_BULK_IN : SIM_BULK_OUT;
+	transfer->device = PIPE_DEVICE(pipe);
+	transfer->pipe = PIPE_INDEX(address);
+	transfer->data = data;
+	transfer->length = dataLength;
+	transfer->callback = callback;
+	transfer->cookie = callbackCookie;
+
+	status_t status = submit_transfer(transfer);
+	if (status != B_OK)
+		free(transfer);
+	return status;
+}
+
+
+static status_t
+sim_queue_bulk_v(usb_pipe pipe, struct iovec* vector, size_t vectorCount,
+	usb_callback_func callback, void* callbackCookie)
+{
+	return B_NOT_SUPPORTED;
+}
+
+
+static status_t
+sim_queue_isochronous(usb_pipe pipe, void* data, size_t dataLength,
+	void* packetDesc, uint32 packetCount, uint32* startingFrameNumber,
+	uint32 flags, usb_callback_func callback, void* callbackCookie)
+{
+	return B_NOT_SUPPORTED;
+}
+
+
+static status_t
+sim_queue_request(usb_device device, uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data,
+	usb_callback_func callback, void* callbackCookie)
+{
+	sim_transfer* transfer = create_control_transfer(device, requestType,
+		request, value, index, length, data);
+	if (transfer == NULL)
+		return B_NO_MEMORY;
+	transfer->callback = callback;
+	transfer->cookie = callbackCookie;
+
+	status_t status = submit_transfer(transfer);
+	if (status != B_OK)
+		free(transfer);
+	return status;
+}
+
+
+static status_t
+sim_set_pipe_policy(usb_pipe pipe, uint8 maxNumQueuedPackets,
+	uint16 maxBufferDurationMS, uint16 sampleSize)
+{
+	return B_NOT_SUPPORTED;
+}
+
+
+static status_t
+sim_cancel_queued_transfers(usb_pipe pipe)
+{
+	cancel_pipe(PIPE_DEVICE(pipe), PIPE_INDEX(PIPE_ADDRESS(pipe)));
+	return B_OK;
+}
+
+
+static status_t
+sim_usb_ioctl(uint32 opcode, void* buffer, size_t bufferSize)
+{
+	return B_DEV_INVALID_IOCTL;
+}
+
+
+static usb_module_info sModule = {
+	{ B_USB_MODULE_NAME, 0, NULL },
+
+	&sim_register_driver,
+	&sim_install_notify,
+	&sim_uninstall_notify,
+
+	&sim_get_device_descriptor,
+	&sim_get_nth_configuration,
+	&sim_get_configuration,
+	&sim_set_configuration,
+	&sim_set_alt_interface,
+
+	&sim_set_feature,
+	&sim_clear_feature,
+	&sim_get_status,
+	&sim_get_descriptor,
+
+	&sim_send_request,
+
+	&sim_queue_interrupt,
+	&sim_queue_bulk,
+	&sim_queue_bulk_v,
+	&sim_queue_isochronous,
+	&sim_queue_request,
+
+	&sim_set_pipe_policy,
+	&sim_cancel_queued_transfers,
+
+	&sim_usb_ioctl
+};
+
+
+//	#pragma mark - public API
+
+
+usb_module_info*
+usb_sim_module()
+{
+	pthread_once(&sInitOnce, &init_bus);
+	return &sModule;
+}
+
+
+void
+usb_sim_set_timing(const usb_sim_timing* timing)
+{
+	pthread_mutex_lock(&sLock);
+	sTiming = *timing;
+	pthread_mutex_unlock(&sLock);
+}
+
+
+void
+usb_sim_get_timing(usb_sim_timing* timing)
+{
+	pthread_mutex_lock(&sLock);
+	*timing = sTiming;
+	pthread_mutex_unlock(&sLock);
+}
+
+
+void
+usb_sim_get_stats(usb_sim_stats* stats)
+{
+	pthread_mutex_lock(&sLock);
+	*stats = sStats;
+	pthread_mutex_unlock(&sLock);
+}
+
+
+void
+usb_sim_reset_stats()
+{
+	pthread_mutex_lock(&sLock);
+	memset(&sStats, 0, sizeof(sStats));
+	pthread_mutex_unlock(&sLock);
+}
+
+
+usb_device
+usb_sim_attach(SimulatedDevice* model)
+{
+	pthread_once(&sInitOnce, &init_bus);
+
+	pthread_mutex_lock(&sLock);
+	sim_device* device = NULL;
+	for (int32 i = 0; i < MAX_SIM_DEVICES; i++) {
+		if (sDevices[i].model == NULL) {
+			device = &sDevices[i];
+			device->id = (++sGeneration << 4) | (i + 1);
+			break;
+		}
+	}
+	if (device == NULL) {
+		pthread_mutex_unlock(&sLock);
+		return 0;
+	}
+
+	memset(device->pipes, 0, sizeof(device->pipes));
+	device->model = model;
+	device->present = true;
+	device->driver = -1;
+	device->cookie = NULL;
+
+	usb_configuration_info* config = model->Configuration();
+	for (size_t i = 0; i < config->interface_count; i++) {
+		usb_interface_list* list = &config->interface[i];
+		for (size_t a = 0; a < list->alt_count; a++) {
+			usb_interface_info* interface = &list->alt[a];
+			interface->handle = INTERFACE_HANDLE(device->id);
+			for (size_t e = 0; e < interface->endpoint_count; e++) {
+				interface->endpoint[e].handle = (device->id << 8)
+					| interface->endpoint[e].descr->endpoint_address;
+			}
+		}
+	}
+	usb_device id = device->id;
+	pthread_mutex_unlock(&sLock);
+
+	probe_device(id);
+	return id;
+}
+
+
+void
+usb_sim_detach(usb_device id)
+{
+	pthread_mutex_lock(&sLock);
+	sim_device* device = lookup_device(id);
+	if (device == NULL) {
+		pthread_mutex_unlock(&sLock);
+		return;
+	}
+	device->present = false;
+	pthread_mutex_unlock(&sLock);
+
+	// nothing can be queued anymore, flush what is there
+	for (int32 i = 0; i < SIM_PIPES; i++)
+		cancel_pipe(id, i);
+
+	pthread_mutex_lock(&sLock);
+
+	const usb_notify_hooks* hooks = device->driver >= 0
+		? sDrivers[device->driver].hooks : NULL;
+	void* cookie = device->cookie;
+
+	// from here on the handles are stale
+	device->model = NULL;
+	device->driver = -1;
+	device->cookie = NULL;
+	pthread_mutex_unlock(&sLock);
+
+	if (hooks != NULL)
+		hooks->device_removed(cookie);
+}
+
+
+void
+usb_sim_data_ready(usb_device id)
+{
+	pthread_mutex_lock(&sLock);
+	sim_device* device = lookup_device(id);
+	if (device != NULL) {
+		bigtime_t now = system_time();
+		for (int32 i = 0; i < SIM_PIPES; i++) {
+			sim_transfer* head = device->pipes[i].head;
+			if (head != NULL && head->waiting) {
+				head->waiting = false;
+				head->due = now;
+			}
+		}
+		pthread_cond_signal(&sBusCondition);
+	}
+	pthread_mutex_unlock(&sLock);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _USB_SIM_H_
+#define _USB_SIM_H_
+
+/*!	A simulated USB bus manager: it implements usb_module_info for the
+	driver and forwards every transfer to a SimulatedDevice model, after a
+	configurable latency. Control transfers of a device are serialized like
+	on the default pipe of a real device, bulk transfers per pipe.
+*/
+
+
+#include <USB3.h>
+
+
+class SimulatedDevice {
+public:
+	virtual						~SimulatedDevice() {}
+
+	virtual const usb_device_descriptor* DeviceDescriptor() = 0;
+	// the bus fills in the interface and endpoint handles on attach
+	virtual usb_configuration_info* Configuration() = 0;
+
+	virtual	status_t			ControlTransfer(uint8 requestType,
+									uint8 request, uint16 value,
+									uint16 index, uint16 length, void* data,
+									size_t* actualLength) = 0;
+	virtual	status_t			BulkOut(uint8 endpoint, const void* data,
+									size_t length) = 0;
+	// returns B_WOULD_BLOCK while there is no data, and when to try again
+	// in *_retry (B_INFINITE_TIMEOUT waits for usb_sim_data_ready())
+	virtual	status_t			BulkIn(uint8 endpoint, void* data,
+									size_t length, size_t* actualLength,
+									bigtime_t* _retry) = 0;
+};
+
+
+typedef struct usb_sim_timing {
+	bigtime_t	control_latency;	// per control transfer, in us
+	bigtime_t	bulk_latency;		// per bulk transfer, in us
+	uint32		bandwidth;			// bytes/s of the data stages, 0: no limit
+} usb_sim_timing;
+
+typedef struct usb_sim_stats {
+	uint64		control_transfers;
+	uint64		control_bytes;
+	uint64		bulk_in_transfers;
+	uint64		bulk_in_bytes;
+	uint64		bulk_out_transfers;
+	uint64		bulk_out_bytes;
+	uint64		canceled_transfers;
+} usb_sim_stats;
+
+
+usb_module_info*	usb_sim_module();
+
+void				usb_sim_set_timing(const usb_sim_timing* timing);
+void				usb_sim_get_timing(usb_sim_timing* timing);
+void				usb_sim_get_stats(usb_sim_stats* stats);
+void				usb_sim_reset_stats();
+
+// plugs the device in and calls the device_added hook of a matching driver
+usb_device			usb_sim_attach(SimulatedDevice* device);
+// cancels what is still queued and calls the device_removed hook
+void				usb_sim_detach(usb_device device);
+// retries the bulk IN transfers waiting for data on the device
+void				usb_sim_data_ready(usb_device device);
+
+#endif	// _USB_SIM_H_
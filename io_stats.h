@@ -0,0 +1,79 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include <SupportDefs.h>
+
+#include "ralink_ioctl.h"
+
+
+/*!	Histogram bucket of a latency: bucket n counts latencies in
+	[2^(n-1), 2^n) microseconds, the last one everything above.
+*/
+static inline int32
+io_stats_bucket(bigtime_t elapsed)
+{
+	int32 bucket = 0;
+	for (bigtime_t scaled = elapsed; scaled > 0
+			&& bucket < RALINK_IO_HISTOGRAM_BUCKETS - 1; scaled >>= 1) {
+		bucket++;
+	}
+	return bucket;
+}
+
+
+/*!	Accounts one completed USB transfer of the given RALINK_IO_* type.
+	Only atomic adds are used, so this is safe from completion callbacks.
+*/
+static inline void
+io_stats_record(ralink_io_stats* stats, int32 type, status_t status,
+	size_t bytes, bigtime_t elapsed)
+{
+	if (stats == NULL)
+		return;
+
+	ralink_io_counter* counter = &stats->types[type];
+	int32 bucket = io_stats_bucket(elapsed);
+
+	atomic_add64((int64*)&counter->requests, 1);
+	if (status != B_OK)
+		atomic_add64((int64*)&counter->errors, 1);
+	atomic_add64((int64*)&counter->bytes, bytes);
+	atomic_add64((int64*)&counter->total_time, elapsed);
+	atomic_add((int32*)&counter->histogram[bucket], 1);
+}
+
+/*!	Accounts \a count requests that a successful transfer of the given type
+	made unnecessary, like the WRITE_2 requests a WRITE_REGION_1 replaces.
+*/
+static inline void
+io_stats_record_saved(ralink_io_stats* stats, int32 type, uint32 count)
+{
+	if (stats == NULL || count == 0)
+		return;
+
+	atomic_add64((int64*)&stats->types[type].saved, count);
+}
+
+/*!	Clears all counters. Each is cleared atomically, so that concurrent
+	io_stats_record() calls do not tear it; their updates may be lost.
+*/
+static inline void
+io_stats_reset(ralink_io_stats* stats)
+{
+	for (int32 type = 0; type < RALINK_IO_TYPES; type++) {
+		ralink_io_counter* counter = &stats->types[type];
+		atomic_set64((int64*)&counter->requests, 0);
+		atomic_set64((int64*)&counter->errors, 0);
+		atomic_set64((int64*)&counter->bytes, 0);
+		atomic_set64((int64*)&counter->total_time, 0);
+		atomic_set64((int64*)&counter->saved, 0);
+		for (int32 i = 0; i < RALINK_IO_HISTOGRAM_BUCKETS; i++)
+			atomic_set((int32*)&counter->histogram[i], 0);
+	}
+}
+
+#endif // IO_STATS_H
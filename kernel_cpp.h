@@ -3,9 +3,24 @@
 
 #include <malloc.h>
 
+#include "alloc_accounting.h"
+
+// With RALINK_ALLOC_ACCOUNTING, these count as RALINK_ALLOC_UNTAGGED; the
+// classes the driver allocates have their own operators instead, see
+// alloc_accounting.h.
+#ifdef RALINK_ALLOC_ACCOUNTING
+#	define ACCOUNT_NEW(size)		alloc_accounting_count(size)
+#	define ACCOUNT_DELETE(pointer)	\
+		do { if (pointer != NULL) alloc_accounting_uncount(); } while (0)
+#else
+#	define ACCOUNT_NEW(size)		do {} while (0)
+#	define ACCOUNT_DELETE(pointer)	do {} while (0)
+#endif
+
 inline void *
 operator new(size_t size)
 {
+	ACCOUNT_NEW(size);
 	return malloc(size);
 }
 
@@ -13,6 +28,7 @@ operator new(size_t size)
 inline void *
 operator new[](size_t size)
 {
+	ACCOUNT_NEW(size);
 	return malloc(size);
 }
 
@@ -20,6 +36,7 @@ operator new[](size_t size)
 inline void
 operator delete(void *pointer)
 {
+	ACCOUNT_DELETE(pointer);
 	free(pointer);
 }
 
@@ -27,6 +44,7 @@ operator delete(void *pointer)
 inline void
 operator delete[](void *pointer)
 {
+	ACCOUNT_DELETE(pointer);
 	free(pointer);
 }
 
@@ -5,15 +5,15 @@
 #ifndef _LOCK_H
 #define _LOCK_H_
 
-#include <OS.h>
-#include <KernelExport.h>
 #include <SupportDefs.h>
 
-typedef sem_id mutex;
-#define mutex_init(id, name) *id = create_sem(1, name)
-#define mutex_lock(id) acquire_sem(*id)
-#define mutex_unlock(id) release_sem_etc(*id, 1, B_DO_NOT_RESCHEDULE)
-#define mutex_destroy(id) delete_sem(*id)
+#include "platform.h"
+
+typedef platform_sem mutex;
+#define mutex_init(id, name) platform_sem_create(id, 1, name)
+#define mutex_lock(id) platform_sem_acquire(*id)
+#define mutex_unlock(id) platform_sem_release(*id)
+#define mutex_destroy(id) platform_sem_delete(*id)
 
 class MutexLocker {
 public:
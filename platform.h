@@ -0,0 +1,68 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/*!	The OS services the chip logic (RalinkUSB, ControlQueue and the firmware
+	cache) is written against. driver.cpp and usb_trace.cpp are the Haiku
+	glue around it and use the kernel directly.
+
+	platform_haiku.h implements them on the Haiku kernel; building with
+	RALINK_HOST_PLATFORM picks platform_host.h from host/, which implements
+	them on Linux so that the same sources run in a user process. Both keep
+	the Haiku types (status_t, bigtime_t, usb_device...) and provide:
+
+	USB, on the bus manager of the platform:
+		platform_usb_device_descriptor(device)
+		platform_usb_configuration(device, index)
+		platform_usb_set_configuration(device, config)
+		platform_usb_request(device, requestType, request, value, index,
+			length, data, actualLength)
+		platform_usb_queue_request(device, requestType, request, value, index,
+			length, data, callback, cookie)
+		platform_usb_queue_bulk(pipe, data, length, callback, cookie)
+		platform_usb_cancel(pipe)
+		platform_usb_clear_halt(pipe)
+
+	Time: platform_time(), platform_sleep(microseconds)
+
+	Threads: platform_thread_id(), the ID of the calling thread
+
+	Counting semaphores, which lock.h builds its mutex on:
+		platform_sem_create(&sem, count, name)
+		platform_sem_delete(sem)
+		platform_sem_acquire(sem, count = 1, timeout = B_INFINITE_TIMEOUT)
+		platform_sem_release(sem, count = 1)
+
+	Buffers of the read() and ioctl() callers, which may be in userland:
+		platform_copy_to_caller(to, from, size)
+		platform_copy_from_caller(to, from, size)
+	both return B_BAD_ADDRESS if the caller's buffer cannot be accessed
+
+	Memory shared with userland, which maps it with clone_area():
+		platform_area_create(&area, &address, size, name)
+		platform_area_delete(area)
+
+	Logging: platform_log(format, ...), printf style
+	Fatal errors: platform_panic(message) does not return
+
+	Configuration and files:
+		platform_get_bool_setting(key, defaultValue)
+		platform_get_int_setting(key, defaultValue)
+		platform_read_file(path, buffer, size) returns the file size, or
+			an error; files larger than the buffer are not read
+*/
+
+
+#include <SupportDefs.h>
+#include <USB3.h>
+
+#ifdef RALINK_HOST_PLATFORM
+#	include "platform_host.h"
+#else
+#	include "platform_haiku.h"
+#endif
+
+#endif // PLATFORM_H
@@ -0,0 +1,253 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef PLATFORM_HAIKU_H
+#define PLATFORM_HAIKU_H
+
+/*!	Haiku kernel implementation of platform.h. */
+
+
+#include <KernelExport.h>
+#include <OS.h>
+#include <USB3.h>
+#include <driver_settings.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "driver.h"
+
+
+typedef area_id platform_area;
+typedef sem_id platform_sem;
+
+#define platform_log	dprintf
+
+
+static inline const usb_device_descriptor*
+platform_usb_device_descriptor(usb_device device)
+{
+	return gUSBModule->get_device_descriptor(device);
+}
+
+
+static inline const usb_configuration_info*
+platform_usb_configuration(usb_device device, uint32 index)
+{
+	return gUSBModule->get_nth_configuration(device, index);
+}
+
+
+static inline status_t
+platform_usb_set_configuration(usb_device device,
+	const usb_configuration_info* config)
+{
+	return gUSBModule->set_configuration(device, config);
+}
+
+
+static inline status_t
+platform_usb_request(usb_device device, uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data,
+	size_t* actualLength)
+{
+	return gUSBModule->send_request(device, requestType, request, value,
+		index, length, data, actualLength);
+}
+
+
+static inline status_t
+platform_usb_queue_request(usb_device device, uint8 requestType,
+	uint8 request, uint16 value, uint16 index, uint16 length, void* data,
+	usb_callback_func callback, void* cookie)
+{
+	return gUSBModule->queue_request(device, requestType, request, value,
+		index, length, data, callback, cookie);
+}
+
+
+static inline status_t
+platform_usb_queue_bulk(usb_pipe pipe, void* data, size_t length,
+	usb_callback_func callback, void* cookie)
+{
+	return gUSBModule->queue_bulk(pipe, data, length, callback, cookie);
+}
+
+
+static inline status_t
+platform_usb_cancel(usb_pipe pipe)
+{
+	return gUSBModule->cancel_queued_transfers(pipe);
+}
+
+
+static inline status_t
+platform_usb_clear_halt(usb_pipe pipe)
+{
+	return gUSBModule->clear_feature(pipe, USB_FEATURE_ENDPOINT_HALT);
+}
+
+
+static inline bigtime_t
+platform_time()
+{
+	return system_time();
+}
+
+
+static inline void
+platform_sleep(bigtime_t microseconds)
+{
+	snooze(microseconds);
+}
+
+
+static inline int32
+platform_thread_id()
+{
+	return find_thread(NULL);
+}
+
+
+static inline status_t
+platform_sem_create(platform_sem* sem, int32 count, const char* name)
+{
+	*sem = create_sem(count, name);
+	return *sem >= B_OK ? B_OK : *sem;
+}
+
+
+static inline void
+platform_sem_delete(platform_sem sem)
+{
+	delete_sem(sem);
+}
+
+
+static inline status_t
+platform_sem_acquire(platform_sem sem, int32 count = 1,
+	bigtime_t timeout = B_INFINITE_TIMEOUT)
+{
+	if (timeout == B_INFINITE_TIMEOUT)
+		return acquire_sem_etc(sem, count, 0, 0);
+	return acquire_sem_etc(sem, count, B_RELATIVE_TIMEOUT, timeout);
+}
+
+
+static inline void
+platform_sem_release(platform_sem sem, int32 count = 1)
+{
+	release_sem_etc(sem, count, B_DO_NOT_RESCHEDULE);
+}
+
+
+static inline status_t
+platform_copy_to_caller(void* to, const void* from, size_t size)
+{
+	if (to == NULL)
+		return B_BAD_ADDRESS;
+	if (!IS_USER_ADDRESS(to)) {
+		// a kernel caller, like the network stack
+		memcpy(to, from, size);
+		return B_OK;
+	}
+	return user_memcpy(to, from, size) == B_OK ? B_OK : B_BAD_ADDRESS;
+}
+
+
+static inline status_t
+platform_copy_from_caller(void* to, const void* from, size_t size)
+{
+	if (from == NULL)
+		return B_BAD_ADDRESS;
+	if (!IS_USER_ADDRESS(from)) {
+		memcpy(to, from, size);
+		return B_OK;
+	}
+	return user_memcpy(to, from, size) == B_OK ? B_OK : B_BAD_ADDRESS;
+}
+
+
+static inline status_t
+platform_area_create(platform_area* _area, void** _address, size_t size,
+	const char* name)
+{
+	uint32 protection = B_READ_AREA | B_WRITE_AREA | B_KERNEL_READ_AREA
+		| B_KERNEL_WRITE_AREA;
+#ifdef B_CLONEABLE_AREA
+	protection |= B_CLONEABLE_AREA;
+#endif
+	*_area = create_area(name, _address, B_ANY_KERNEL_ADDRESS,
+		(size + B_PAGE_SIZE - 1) & ~(B_PAGE_SIZE - 1), B_FULL_LOCK,
+		protection);
+	return *_area >= B_OK ? B_OK : *_area;
+}
+
+
+static inline void
+platform_area_delete(platform_area area)
+{
+	delete_area(area);
+}
+
+
+static inline void
+platform_panic(const char* message)
+{
+	panic("%s", message);
+}
+
+
+static inline bool
+platform_get_bool_setting(const char* key, bool defaultValue)
+{
+	void* handle = load_driver_settings(DRIVER_NAME);
+	if (handle == NULL)
+		return defaultValue;
+
+	bool value = get_driver_boolean_parameter(handle, key, defaultValue,
+		true);
+	unload_driver_settings(handle);
+	return value;
+}
+
+
+static inline int32
+platform_get_int_setting(const char* key, int32 defaultValue)
+{
+	void* handle = load_driver_settings(DRIVER_NAME);
+	if (handle == NULL)
+		return defaultValue;
+
+	const char* value = get_driver_parameter(handle, key, NULL, NULL);
+	int32 result = value != NULL ? strtol(value, NULL, 0) : defaultValue;
+	unload_driver_settings(handle);
+	return result;
+}
+
+
+static inline ssize_t
+platform_read_file(const char* path, void* buffer, size_t size)
+{
+	int fd = open(path, B_READ_ONLY);
+	if (fd < 0)
+		return B_ENTRY_NOT_FOUND;
+
+	off_t fileSize = lseek(fd, 0, SEEK_END);
+	lseek(fd, 0, SEEK_SET);
+	if (fileSize < 0 || (size_t)fileSize > size) {
+		close(fd);
+		return fileSize < 0 ? (ssize_t)fileSize : B_BUFFER_OVERFLOW;
+	}
+
+	ssize_t bytesRead = read(fd, buffer, fileSize);
+	close(fd);
+	if (bytesRead >= 0 && bytesRead != fileSize)
+		return B_IO_ERROR;
+	return bytesRead;
+}
+
+#endif // PLATFORM_HAIKU_H
@@ -0,0 +1,306 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef _RALINK_IOCTL_H
+#define _RALINK_IOCTL_H
+
+/*! Private ioctl() interface of the ralink_usb driver */
+
+
+#include <Drivers.h>
+#include <OS.h>
+
+
+/* private ioctl() opcodes, placed well after the ether_driver.h ones */
+enum {
+	RALINK_GET_REGISTER_CACHE_STATS = B_DEVICE_OP_CODES_END + 0x100,
+		/* register shadow cache counters (ralink_register_cache_stats *) */
+	RALINK_GET_EFUSE_STATS,
+		/* eFUSE block cache counters (ralink_efuse_stats *) */
+	RALINK_GET_POLL_STATS,
+		/* register polling counters (ralink_poll_stats *) */
+	RALINK_GET_IO_STATS,
+		/* per request type USB counters (ralink_io_stats *) */
+	RALINK_GET_AND_RESET_IO_STATS,
+		/* same, then clears the counters (ralink_io_stats *) */
+	RALINK_GET_TRACE_RING,
+		/* latest binary trace records (ralink_trace_dump *) */
+	RALINK_GET_DRIVER_LOCK_STATS,
+		/* driver lock contention per hook (ralink_driver_lock_stats *) */
+	RALINK_GET_ALLOC_STATS,
+		/* allocations per site, needs RALINK_ALLOC_ACCOUNTING
+			(ralink_alloc_stats *) */
+	RALINK_GET_DEVICE_STATS,
+		/* frame counters and RX ring state (ralink_device_stats *) */
+	RALINK_SET_READ_MODE,
+		/* frames returned per read() until close (uint32 *, one of the
+			RALINK_READ_* modes) */
+	RALINK_MAP_RINGS,
+		/* shares RX and TX rings with the caller until close, received
+			frames then go to the RX ring instead of read()
+			(ralink_ring_map *) */
+	RALINK_SYNC_RINGS,
+		/* sends the TX slots up to tx.tail, hands back the sent ones
+			in tx.head and waits as asked, unless the handle is
+			non-blocking (uint32 *, RALINK_SYNC_WAIT_* flags, or NULL) */
+	RALINK_SET_RX_AGGREGATION,
+		/* lets the driver tune the bulk IN aggregation, or pins it
+			(uint32 *, one of the RALINK_RX_AGGREGATION_* profiles) */
+	RALINK_GET_RX_AGGREGATION
+		/* the aggregation in use and what it is based on
+			(ralink_rx_aggregation *) */
+};
+
+
+/* RALINK_SET_READ_MODE */
+enum {
+	RALINK_READ_FRAME = 0,	/* one 802.11 frame, cut short if it does not
+							   fit */
+	RALINK_READ_BATCH		/* as many complete frames as fit, each behind
+							   a ralink_rx_header */
+};
+
+
+/* USB transfer types accounted in ralink_io_stats */
+enum {
+	RALINK_IO_WRITE_2 = 0,
+	RALINK_IO_WRITE_REGION,
+	RALINK_IO_READ_REGION,
+	RALINK_IO_EEPROM_READ,
+	RALINK_IO_RESET,
+	RALINK_IO_BULK_IN,
+	RALINK_IO_BULK_OUT,
+	RALINK_IO_TYPES
+};
+
+/* bucket n counts latencies in [2^(n-1), 2^n) us, the last one the rest */
+#define RALINK_IO_HISTOGRAM_BUCKETS		24
+
+/* device hooks serialized by the driver lock */
+enum {
+	RALINK_HOOK_DEVICE_ADDED = 0,
+	RALINK_HOOK_DEVICE_REMOVED,
+	RALINK_HOOK_OPEN,
+	RALINK_HOOK_FREE,
+	RALINK_HOOKS
+};
+
+/* allocation sites accounted in ralink_alloc_stats */
+enum {
+	RALINK_ALLOC_UNTAGGED = 0,	/* plain operator new */
+	RALINK_ALLOC_DEVICE,
+	RALINK_ALLOC_DEVICE_NAME,
+	RALINK_ALLOC_FIRMWARE,
+	RALINK_ALLOC_USB_TRACE,
+	RALINK_ALLOC_TIMELINE,
+	RALINK_ALLOC_RX_RING,
+	RALINK_ALLOC_SITES
+};
+
+
+/* records kept per device by the trace ring, a power of two */
+#define RALINK_TRACE_RING_SIZE			256
+
+/* trace point levels, see RALINK_TRACE_LEVEL in trace_ring.h */
+enum {
+	RALINK_TRACE_NONE = 0,
+	RALINK_TRACE_ERROR,
+	RALINK_TRACE_INFO,
+	RALINK_TRACE_DEBUG
+};
+
+/* trace events and their arguments */
+enum {
+	RALINK_EVENT_OPEN = 1,		/* flags, status */
+	RALINK_EVENT_CLOSE,			/* status */
+	RALINK_EVENT_READ,			/* requested length, status */
+	RALINK_EVENT_WRITE,			/* requested length, status */
+	RALINK_EVENT_CONTROL,		/* op, length */
+	RALINK_EVENT_REMOVED,		/* - */
+	RALINK_EVENT_REATTACH,		/* status */
+	RALINK_EVENT_REQUEST_ERROR,	/* RALINK_IO_* type, request, value, status */
+	RALINK_EVENT_POLL,			/* register, iterations, elapsed us, status */
+	RALINK_EVENT_MICROCODE,		/* uploaded (always 1), status,
+								   requests saved by the upload */
+	RALINK_EVENT_MCU_COMMAND	/* command, argument, status */
+};
+
+
+/* RALINK_GET_REGISTER_CACHE_STATS */
+typedef struct ralink_register_cache_stats {
+	uint32	hits;			/* reads served from the shadow copy */
+	uint32	misses;			/* reads of shadowed registers sent to the chip */
+	uint32	elided_writes;	/* writes dropped because the value was unchanged */
+} ralink_register_cache_stats;
+
+/* RALINK_GET_EFUSE_STATS */
+typedef struct ralink_efuse_stats {
+	uint32	blocks_fetched;	/* 16-byte blocks kicked into EFUSE_DATA0..3 */
+	uint32	words_served;	/* 16-bit words returned by _ReadEFUSE() */
+} ralink_efuse_stats;
+
+/* RALINK_GET_POLL_STATS */
+typedef struct ralink_poll_stats {
+	uint32	waits;			/* calls to _PollRegister() */
+	uint32	iterations;		/* register reads done by all waits */
+	uint32	max_iterations;	/* reads needed by the longest wait */
+	uint32	timeouts;		/* waits that gave up */
+	uint64	wait_time;		/* total time spent waiting (us) */
+} ralink_poll_stats;
+
+/* RALINK_GET_IO_STATS, RALINK_GET_AND_RESET_IO_STATS */
+typedef struct ralink_io_counter {
+	uint64	requests;
+	uint64	errors;
+	uint64	bytes;			/* payload actually transferred */
+	uint64	total_time;		/* sum of the latencies (us) */
+	uint64	saved;			/* WRITE_2 requests these made unnecessary */
+	uint32	histogram[RALINK_IO_HISTOGRAM_BUCKETS];
+} ralink_io_counter;
+
+typedef struct ralink_io_stats {
+	ralink_io_counter	types[RALINK_IO_TYPES];
+} ralink_io_stats;
+
+/* RALINK_GET_TRACE_RING */
+typedef struct ralink_trace_record {
+	int64	time;			/* system_time() of the event */
+	uint32	sequence;		/* 1 for the first event of the device */
+	uint16	event;			/* RALINK_EVENT_* */
+	uint8	level;			/* RALINK_TRACE_* */
+	uint8	reserved;
+	uint32	args[4];		/* see the event list */
+} ralink_trace_record;
+
+typedef struct ralink_trace_dump {
+	uint32	count;			/* valid records, oldest first */
+	uint32	lost;			/* events overwritten, or being written */
+	ralink_trace_record	records[RALINK_TRACE_RING_SIZE];
+} ralink_trace_dump;
+
+/* RALINK_GET_DEVICE_STATS */
+typedef struct ralink_device_stats {
+	uint64	rx_frames;		/* handed to readers */
+	uint64	rx_bytes;
+	uint64	rx_errors;		/* frames dropped: bad CRC, length, no room */
+	uint64	rx_stalls;		/* bulk IN transfers the pipe halted */
+	uint64	tx_frames;
+	uint64	tx_bytes;
+	uint64	tx_errors;
+	uint64	tx_retries;		/* retransmissions counted by the chip */
+	uint32	rx_ring_size;	/* bulk IN transfers of the RX ring */
+	uint32	rx_ring_posted;	/* of them queued on the pipe */
+	uint32	rx_ring_ready;	/* of them completed, waiting for a reader */
+} ralink_device_stats;
+
+/* precedes every frame of a RALINK_READ_BATCH read(); the next header
+   follows the frame, padded to RALINK_RX_HEADER_ALIGN */
+typedef struct ralink_rx_header {
+	uint16	length;			/* of the frame, as copied */
+	uint8	rssi;
+	uint8	antenna;		/* chain with the strongest signal */
+	uint32	flags;			/* RT2860_RX_* of the RXD, RALINK_RX_TRUNCATED */
+} ralink_rx_header;
+
+#define RALINK_RX_HEADER_ALIGN	4
+/* the frame did not fit, only a lone frame is cut short */
+#define RALINK_RX_TRUNCATED		(1U << 31)
+
+/* RALINK_MAP_RINGS: the area holds a ralink_shared_rings, followed by the
+   RX and then the TX buffers, one per slot. Indices run freely, slot i of
+   a ring is i % RALINK_RING_SLOTS; the producer fills slots and advances
+   tail, the consumer empties them and advances head. */
+#define RALINK_RING_SLOTS		256
+#define RALINK_RING_BUFFER_SIZE	2048
+/* the driver builds the TXD and TXWI in front of a TX frame, and pads it */
+#define RALINK_RING_TX_HEADROOM	20
+#define RALINK_RING_TX_MAX_FRAME	(RALINK_RING_BUFFER_SIZE \
+	- RALINK_RING_TX_HEADROOM - 7)
+
+/* the slot did not go out, its frame was invalid or the transfer failed */
+#define RALINK_TX_FAILED		(1U << 31)
+
+typedef struct ralink_ring {
+	volatile uint32		head;
+	volatile uint32		tail;
+	ralink_rx_header	slots[RALINK_RING_SLOTS];
+		/* TX slots only use length, and get RALINK_TX_FAILED */
+} ralink_ring;
+
+typedef struct ralink_shared_rings {
+	ralink_ring	rx;		/* the driver produces, the caller consumes */
+	ralink_ring	tx;		/* the caller produces, the driver consumes */
+} ralink_shared_rings;
+
+#define RALINK_RING_RX_BUFFER(rings, index) \
+	((uint8*)(rings) + sizeof(ralink_shared_rings) \
+		+ ((index) % RALINK_RING_SLOTS) * RALINK_RING_BUFFER_SIZE)
+#define RALINK_RING_TX_BUFFER(rings, index) \
+	((uint8*)(rings) + sizeof(ralink_shared_rings) \
+		+ (RALINK_RING_SLOTS + (index) % RALINK_RING_SLOTS) \
+			* RALINK_RING_BUFFER_SIZE)
+/* where the caller puts a TX frame */
+#define RALINK_RING_TX_FRAME(rings, index) \
+	(RALINK_RING_TX_BUFFER(rings, index) + RALINK_RING_TX_HEADROOM)
+
+typedef struct ralink_ring_map {
+	area_id		area;	/* to clone_area() */
+	uint32		size;
+} ralink_ring_map;
+
+/* RALINK_SYNC_RINGS */
+#define RALINK_SYNC_WAIT_RX		0x01	/* until the RX ring is not empty */
+#define RALINK_SYNC_WAIT_TX		0x02	/* until a TX slot was handed back */
+
+/* RALINK_SET_RX_AGGREGATION */
+enum {
+	RALINK_RX_AGGREGATION_ADAPTIVE = 0,	/* follows the traffic */
+	RALINK_RX_AGGREGATION_LATENCY,		/* hands frames over at once */
+	RALINK_RX_AGGREGATION_THROUGHPUT,	/* packs as many as it can */
+	RALINK_RX_AGGREGATION_PROFILES
+};
+
+/* RALINK_GET_RX_AGGREGATION, the last three over the latest window of
+   bulk IN transfers the adaptive profile looked at */
+typedef struct ralink_rx_aggregation {
+	uint32	profile;		/* RALINK_RX_AGGREGATION_* */
+	uint32	timeout;		/* USB_DMA_CFG RX_AGG_TO, in 33 ns units */
+	uint32	limit;			/* USB_DMA_CFG RX_AGG_LMT, in kB */
+	uint32	retunes;		/* changes written to the chip */
+	uint32	frames_per_transfer;	/* in 1/100 */
+	uint32	fill;			/* transfer length in % of the limit */
+	uint32	backlog;		/* transfers waiting for a reader, in 1/100 */
+} ralink_rx_aggregation;
+
+/* RALINK_GET_DRIVER_LOCK_STATS, shared by all devices of the driver */
+typedef struct ralink_hook_stats {
+	uint64	calls;
+	uint64	wait_time;		/* spent waiting for the lock (us) */
+	uint64	max_wait_time;
+	uint64	hold_time;		/* spent holding it */
+	uint64	max_hold_time;
+	uint64	total_time;		/* from entering the hook until it unlocked */
+	uint64	max_total_time;
+	uint32	histogram[RALINK_IO_HISTOGRAM_BUCKETS];	/* of total_time */
+} ralink_hook_stats;
+
+typedef struct ralink_driver_lock_stats {
+	ralink_hook_stats	hooks[RALINK_HOOKS];
+} ralink_driver_lock_stats;
+
+/* RALINK_GET_ALLOC_STATS, shared by all devices of the driver */
+typedef struct ralink_alloc_site_stats {
+	uint64	allocations;
+	uint64	frees;
+	uint64	bytes;			/* allocated in total */
+	int64	live_objects;
+	int64	live_bytes;		/* not known for untagged allocations */
+	uint64	hot_path_allocations;	/* made in a Read, Write or callback */
+} ralink_alloc_site_stats;
+
+typedef struct ralink_alloc_stats {
+	ralink_alloc_site_stats	sites[RALINK_ALLOC_SITES];
+} ralink_alloc_stats;
+
+#endif	/* _RALINK_IOCTL_H */
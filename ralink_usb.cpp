@@ -20,8 +20,13 @@
  */
 
 #include "driver.h"
+#include "firmware.h"
 #include "if_runreg.h"
+#include "io_stats.h"
+#include "platform.h"
 #include "ralink_usb.h"
+#include "timeline.h"
+#include "usb_trace.h"
 
 #include <ByteOrder.h>
 
@@ -29,20 +34,105 @@
 #include <stdlib.h>
 #include <string.h>
 
+
+/*
+ * Register shadowing policy. Registers not listed here are volatile: the chip
+ * updates them on its own (EFUSE_CTRL kick/AOUT, the GPIO_CTRL input pins,
+ * SYS_CTRL, the H2M mailbox, DMA status...) and every access goes to the
+ * device.
+ */
+enum {
+	REGISTER_VOLATILE = 0,
+	REGISTER_WRITE_THROUGH,	// reads served from the shadow, writes always sent
+	REGISTER_CACHEABLE		// as above, unchanged values are not written again
+};
+
+typedef struct register_policy {
+	uint16	reg;
+	uint8	policy;
+} register_policy;
+
+// Only the registers the driver accesses so far are listed; the ones the
+// run_init() sequences modify get their entries as those are ported.
+// USB_DMA_CFG is left out, RXAggregation rewrites it behind our back.
+static const register_policy sRegisterPolicies[] = {
+	// reset bits trigger an action on every write
+	{ RT2860_MAC_SYS_CTRL,		REGISTER_WRITE_THROUGH }
+};
+
+// ROM words SetupDevice() parses, for when they are read one by one
+typedef struct rom_range {
+	uint16	first;
+	uint16	count;
+} rom_range;
+
+static const rom_range sROMRanges[] = {
+	{ RT2860_EEPROM_VERSION,		4 },	// version, MAC address
+	{ RT2860_EEPROM_ANTENNA,		7 },	// antenna, config ... LED3
+	{ RT2860_EEPROM_PWR2GHZ_BASE1,	14 },	// both 2GHz power tables
+	{ RT2860_EEPROM_BBP_BASE,		10 },
+	{ RT3071_EEPROM_RF_BASE,		10 }
+};
+
+
+// fails to compile when the table and RALINK_SHADOW_REGISTERS disagree
+typedef char register_policy_size_check[
+	sizeof(sRegisterPolicies) / sizeof(sRegisterPolicies[0])
+		== RALINK_SHADOW_REGISTERS ? 1 : -1];
+
+
+static bool
+register_matches(uint32 value, uint32 mask, uint32 expected)
+{
+	return (value & mask) == expected;
+}
+
+
+static bool
+register_settled(uint32 value, uint32 mask, uint32 expected)
+{
+	// the chip reads back all zeroes or all ones until it is up
+	return value != 0 && value != 0xffffffff;
+}
+
+
 RalinkUSB::RalinkUSB(usb_device device)
 	:
 	fDevice(device),
 	fDeviceID(0),
+	fControlQueue(device, &fIOStats),
+	fSharedRings(&fIOStats, &fDeviceStats),
+	fRXAggregation(device, &fIOStats),
+	fRXRing(&fIOStats, &fDeviceStats, &fSharedRings, &fRXAggregation),
 	fStatus(B_ERROR),
 	fOpen(false),
 	fRemoved(false),
 	fNonBlocking(false),
+	fReadMode(RALINK_READ_FRAME),
 	fEFuse(false),
 	fNotifyEndpoint(0),
 	fReadEndpoint(0),
-	fWriteEndpoint(0)
+	fWriteEndpoint(0),
+	fReadEndpointAddress(0),
+	fWriteEndpointAddress(0),
+	fMACVersion(0),
+	fMACRevision(0),
+	fMicrocode(NULL),
+	fShadowValid(0),
+	fEFuseNextBlock(0)
 {
 	memset(&fMACAddress, 0, sizeof(fMACAddress));
+	memset(&fIOStats, 0, sizeof(fIOStats));
+	memset(&fDeviceStats, 0, sizeof(fDeviceStats));
+	trace_ring_init(&fTraceRing);
+	memset(&fShadowStats, 0, sizeof(fShadowStats));
+	memset(&fEFuseStats, 0, sizeof(fEFuseStats));
+	memset(&fPollStats, 0, sizeof(fPollStats));
+	_FlushEFUSECache();
+
+	if (fControlQueue.InitCheck() != B_OK || fRXRing.InitCheck() != B_OK
+		|| fSharedRings.InitCheck() != B_OK)
+		return;
 	
 	if (_SetupEndpoints() != B_OK) {
 		return;
@@ -63,6 +153,8 @@ RalinkUSB::~RalinkUSB()
 		gUSBModule->cancel_queued_transfers(fNotifyEndpoint);
 
 	delete fNotifyData;*/
+	if (fMicrocode != NULL)
+		release_firmware();
 	TRACE("Deleted!\n");
 }
 
@@ -84,9 +176,13 @@ RalinkUSB::Open(uint32 flags)
 	if (fRemoved)
 		return B_ERROR;
 
+	TIMELINE_SCOPE(scope, TIMELINE_DEVICE, "open");
+
 	//_Reset();
 	
 	status_t result = _StartDevice();
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_INFO, RALINK_EVENT_OPEN,
+		flags, result, 0, 0);
 	if (result != B_OK) {
 		return result;
 	}
@@ -102,7 +198,9 @@ status_t
 RalinkUSB::Close()
 {
 	TRACE("usb_ralink: Close()\n");
+	fReadMode = RALINK_READ_FRAME;
 	if (fRemoved) {
+		fSharedRings.Unmap();
 		fOpen = false;
 		return B_OK;
 	}
@@ -113,12 +211,17 @@ RalinkUSB::Close()
 	//while (atomic_add(&fInsideNotify, 0) != 0)
 	//	snooze(100);
 	//gUSBModule->cancel_queued_transfers(fNotifyEndpoint);
-	gUSBModule->cancel_queued_transfers(fReadEndpoint);
-	gUSBModule->cancel_queued_transfers(fWriteEndpoint);
+
+	// the chip stops filling the transfers before they are canceled
+	status_t result = _StopDevice();
+	fRXRing.Stop();
+	platform_usb_cancel(fWriteEndpoint);
+	fSharedRings.Unmap();
 
 	fOpen = false;
 
-	status_t result = B_OK;//_StopDevice();
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_INFO, RALINK_EVENT_CLOSE,
+		result, 0, 0, 0);
 	TRACE(DRIVER_NAME": Closed: %#010x!\n", result);
 	return result;
 }
@@ -136,7 +239,22 @@ status_t
 RalinkUSB::Read(off_t position, void* buffer, size_t*numBytes)
 {
 	TRACE(DRIVER_NAME": Read()\n");
-	return B_ERROR;
+	RALINK_HOT_PATH(hotPath);
+	size_t requested = *numBytes;
+	usb_trace_mark(USB_TRACE_MARK_READ, 0, requested);
+	status_t status = B_FILE_ERROR;
+	if (!fOpen || fRemoved)
+		*numBytes = 0;
+	else if (fReadMode == RALINK_READ_BATCH)
+		status = fRXRing.ReadBatch(buffer, numBytes, fNonBlocking);
+	else
+		status = fRXRing.Read(buffer, numBytes, fNonBlocking);
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_DEBUG, RALINK_EVENT_READ,
+		requested, status, *numBytes, 0);
+	// how many frames a batch took depends on the timing, the replay
+	// takes as many
+	usb_trace_mark(USB_TRACE_MARK_READ_DONE, status, *numBytes);
+	return status;
 }
 	
 
@@ -144,6 +262,9 @@ status_t
 RalinkUSB::Write(off_t position, const void* buffer, size_t* numBytes)
 {
 	TRACE(DRIVER_NAME": Write()\n");
+	RALINK_HOT_PATH(hotPath);
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_DEBUG, RALINK_EVENT_WRITE,
+		*numBytes, B_ERROR, 0, 0);
 	return B_ERROR;
 }
 	
@@ -152,6 +273,8 @@ status_t
 RalinkUSB::Control(uint32 op, void* buffer, size_t length)
 {
 	TRACE(DRIVER_NAME": Control()\n");
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_DEBUG, RALINK_EVENT_CONTROL,
+		op, length, 0, 0);
 	if (fStatus < B_OK)
 		return fStatus;
 		
@@ -163,21 +286,151 @@ RalinkUSB::Control(uint32 op, void* buffer, size_t length)
 
 		case ETHER_GETADDR: {
 			TRACE(DRIVER_NAME": ETHER_GETADDR\n");
-			memcpy(buffer, &fMACAddress, sizeof(fMACAddress));
-			return B_OK;
+			return platform_copy_to_caller(buffer, &fMACAddress,
+				sizeof(fMACAddress));
 		}
 
 		case ETHER_GETFRAMESIZE: {
 			TRACE(DRIVER_NAME": ETHER_GETFRAMESIZE\n");
-			*(uint32 *)buffer = 1500;
-			return B_OK;
+			uint32 frameSize = 1500;
+			return platform_copy_to_caller(buffer, &frameSize,
+				sizeof(frameSize));
 		}
 		
 		case ETHER_GET_LINK_STATE: {
 			// TODO: For now, should avoid dhcp requests
-			memset(buffer, 0, sizeof(ether_link_state));
+			ether_link_state state;
+			memset(&state, 0, sizeof(state));
+			return platform_copy_to_caller(buffer, &state, sizeof(state));
+		}
+
+		case RALINK_GET_REGISTER_CACHE_STATS: {
+			if (length < sizeof(fShadowStats))
+				return B_BAD_VALUE;
+			return platform_copy_to_caller(buffer, &fShadowStats,
+				sizeof(fShadowStats));
+		}
+
+		case RALINK_GET_EFUSE_STATS: {
+			if (length < sizeof(fEFuseStats))
+				return B_BAD_VALUE;
+			return platform_copy_to_caller(buffer, &fEFuseStats,
+				sizeof(fEFuseStats));
+		}
+
+		case RALINK_GET_POLL_STATS: {
+			if (length < sizeof(fPollStats))
+				return B_BAD_VALUE;
+			return platform_copy_to_caller(buffer, &fPollStats,
+				sizeof(fPollStats));
+		}
+
+		case RALINK_GET_IO_STATS:
+		case RALINK_GET_AND_RESET_IO_STATS: {
+			if (length < sizeof(fIOStats))
+				return B_BAD_VALUE;
+			status_t status = platform_copy_to_caller(buffer, &fIOStats,
+				sizeof(fIOStats));
+			// transfers completing in between may be lost, which is fine
+			// for monitoring
+			if (status == B_OK && op == RALINK_GET_AND_RESET_IO_STATS)
+				io_stats_reset(&fIOStats);
+			return status;
+		}
+
+		case RALINK_GET_DEVICE_STATS: {
+			if (length < sizeof(fDeviceStats))
+				return B_BAD_VALUE;
+			// TX_STA_CNT1 clears on read, so its retransmit count is
+			// accumulated here
+			uint32 count;
+			if (fOpen && !fRemoved
+				&& _Read(RT2860_TX_STA_CNT1, &count) == B_OK) {
+				atomic_add64((int64*)&fDeviceStats.tx_retries, count >> 16);
+			}
+			fRXRing.GetState(&fDeviceStats.rx_ring_size,
+				&fDeviceStats.rx_ring_posted, &fDeviceStats.rx_ring_ready);
+			return platform_copy_to_caller(buffer, &fDeviceStats,
+				sizeof(fDeviceStats));
+		}
+
+		case RALINK_SET_READ_MODE: {
+			uint32 mode;
+			if (length < sizeof(mode))
+				return B_BAD_VALUE;
+			status_t status = platform_copy_from_caller(&mode, buffer,
+				sizeof(mode));
+			if (status != B_OK)
+				return status;
+			if (mode != RALINK_READ_FRAME && mode != RALINK_READ_BATCH)
+				return B_BAD_VALUE;
+			usb_trace_mark(USB_TRACE_MARK_CONTROL, op, mode);
+			fReadMode = mode;
 			return B_OK;
 		}
+
+		case RALINK_SET_RX_AGGREGATION: {
+			uint32 profile;
+			if (length < sizeof(profile))
+				return B_BAD_VALUE;
+			status_t status = platform_copy_from_caller(&profile, buffer,
+				sizeof(profile));
+			if (status != B_OK)
+				return status;
+			usb_trace_mark(USB_TRACE_MARK_CONTROL, op, profile);
+			return fRXAggregation.SetProfile(profile, fOpen && !fRemoved);
+		}
+
+		case RALINK_GET_RX_AGGREGATION: {
+			ralink_rx_aggregation state;
+			if (length < sizeof(state))
+				return B_BAD_VALUE;
+			fRXAggregation.GetState(&state);
+			return platform_copy_to_caller(buffer, &state, sizeof(state));
+		}
+
+		case RALINK_MAP_RINGS: {
+			ralink_ring_map map;
+			if (length < sizeof(map))
+				return B_BAD_VALUE;
+			if (!fOpen)
+				return B_FILE_ERROR;
+			usb_trace_mark(USB_TRACE_MARK_CONTROL, op);
+			status_t status = fSharedRings.Map(&map);
+			if (status != B_OK)
+				return status;
+			// the area stays mapped until close either way
+			return platform_copy_to_caller(buffer, &map, sizeof(map));
+		}
+
+		case RALINK_SYNC_RINGS: {
+			uint32 flags = 0;
+			if (buffer != NULL && length >= sizeof(flags)) {
+				status_t status = platform_copy_from_caller(&flags, buffer,
+					sizeof(flags));
+				if (status != B_OK)
+					return status;
+			}
+			if (!fOpen || fRemoved)
+				return B_FILE_ERROR;
+			// the replay hands the TX frames of the next phase over
+			usb_trace_mark(USB_TRACE_MARK_CONTROL, op, flags);
+			// a stalled RX transfer interrupts the wait, to be queued again
+			fRXRing.ClearStall();
+			status_t status = fSharedRings.Sync(fWriteEndpoint,
+				fWriteEndpointAddress, flags, fNonBlocking);
+			while (status == B_INTERRUPTED && fRXRing.ClearStall()) {
+				status = fSharedRings.Sync(fWriteEndpoint,
+					fWriteEndpointAddress, flags, fNonBlocking);
+			}
+			return status;
+		}
+
+		case RALINK_GET_TRACE_RING: {
+			if (length < sizeof(ralink_trace_dump))
+				return B_BAD_VALUE;
+			return trace_ring_dump(&fTraceRing, (ralink_trace_dump*)buffer);
+		}
 		default:
 			TRACE_ALWAYS(DRIVER_NAME": unsupported ioctl 0x%08lx\n", op);
 	}
@@ -191,6 +444,8 @@ RalinkUSB::Removed()
 {
 	fRemoved = true;
 	//fHasConnection = false;
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_INFO, RALINK_EVENT_REMOVED,
+		0, 0, 0, 0);
 
 	// the notify hook is different from the read and write hooks as it does
 	// itself schedule traffic (while the other hooks only release a semaphore
@@ -202,8 +457,9 @@ RalinkUSB::Removed()
 		snooze(100);
 
 	gUSBModule->cancel_queued_transfers(fNotifyEndpoint);*/
-	gUSBModule->cancel_queued_transfers(fReadEndpoint);
-	gUSBModule->cancel_queued_transfers(fWriteEndpoint);
+	fRXRing.Stop();
+	platform_usb_cancel(fWriteEndpoint);
+	fSharedRings.Interrupt();
 
 	/*if (fLinkStateChangeSem >= B_OK)
 		release_sem_etc(fLinkStateChangeSem, 1, B_DO_NOT_RESCHEDULE);*/
@@ -213,33 +469,33 @@ RalinkUSB::Removed()
 status_t
 RalinkUSB::SetupDevice(bool deviceReplugged)
 {
-	status_t status = _LoadMicrocode();
-	if (status < B_OK)
-		return status;
-		
+	TIMELINE_SCOPE(scope, TIMELINE_DEVICE, "setup device");
 	uint32 ver;
-	int ntries;
+
+	// the chip may have been reset or replaced, forget what we knew
+	fShadowValid = 0;
+	_FlushEFUSECache();
 	
 	// RUN_LOCK(sc)
 	/* wait for the chip to settle */
-	for (ntries = 0; ntries < 100; ntries++) {
-		if (_Read(RT2860_ASIC_VER_ID, &ver) != B_OK) {
-			//RUN_UNLOCK(sc);
-			return B_ERROR;
-		}
-		if (ver != 0 && ver != 0xffffffff)
-			break;
-		_Delay(10);
-	}
-	if (ntries == 100) {
+	status_t status = _PollRegister(RT2860_ASIC_VER_ID, 0, 0, 1000000, &ver,
+		register_settled);
+	if (status != B_OK) {
 		TRACE(DRIVER_NAME": timeout waiting for NIC to initialize\n");
 		//RUN_UNLOCK(sc);
-		return B_ERROR;
+		return status;
 	}
 	fMACVersion = ver >> 16;
 	fMACRevision = ver & 0xffff;
 
 	TRACE(DRIVER_NAME": mac_version: 0x%x, revision: %d\n", fMACVersion, fMACRevision);
+
+	// the MAC version selects both the firmware half and the register
+	// write mode, so the microcode can only be loaded once it is known
+	status = _LoadMicrocode();
+	if (status < B_OK)
+		return status;
+
 	if (fMACVersion >= 0x3070) {
 		uint32 tmp;
 		_Read(RT3070_EFUSE_CTRL, &tmp);
@@ -248,9 +504,15 @@ RalinkUSB::SetupDevice(bool deviceReplugged)
 			fEFuse = true;
 	}
 	
-	uint16 value;
-	if (_ReadEEPROM(RT2860_EEPROM_VERSION, &value) == B_OK)
-		TRACE_ALWAYS(DRIVER_NAME": EEPROM rev=%d, FAE=%d\n", value & 0xff, value >> 8);
+	// everything below is parsed from a single snapshot of the ROM
+	status = _ReadROMImage();
+	if (status != B_OK) {
+		TRACE_ALWAYS(DRIVER_NAME": Error reading EEPROM:%#010x\n", status);
+		return status;
+	}
+
+	uint16 value = _ROMWord(RT2860_EEPROM_VERSION);
+	TRACE_ALWAYS(DRIVER_NAME": EEPROM rev=%d, FAE=%d\n", value & 0xff, value >> 8);
 	
 	//device_printf(sc->sc_dev,
 	  //  "MAC/BBP RT%04X (rev 0x%04X), RF %s (MIMO %dT%dR), address %s\n",
@@ -282,9 +544,11 @@ RalinkUSB::SetupDevice(bool deviceReplugged)
 	} else
 		fMACAddress = address;
 	
+#ifdef TRACE_RALINK
+	// the vendor BBP and RF settings are not applied yet, only traced
 	/* read vender BBP settings */
 	for (int i = 0; i < 10; i++) {
-		_ReadEEPROM(RT2860_EEPROM_BBP_BASE + i, &value);
+		value = _ROMWord(RT2860_EEPROM_BBP_BASE + i);
 		uint8 bppVal = value & 0xff;
 		uint8 bppReg = value >> 8;
 		/*sc->bbp[i].val = 
@@ -295,7 +559,7 @@ RalinkUSB::SetupDevice(bool deviceReplugged)
 	if (fMACVersion >= 0x3071) {
 		/* read vendor RF settings */
 		for (int i = 0; i < 10; i++) {
-			_ReadEEPROM(RT3071_EEPROM_RF_BASE + i, &value);
+			value = _ROMWord(RT3071_EEPROM_RF_BASE + i);
 			/*sc->rf[i].val = val & 0xff;
 			sc->rf[i].reg = val >> 8;*/
 			uint8 rfVal = value & 0xff;
@@ -303,18 +567,21 @@ RalinkUSB::SetupDevice(bool deviceReplugged)
 			TRACE(DRIVER_NAME": RF%d=0x%02x\n", rfReg, rfVal);
 		}
 	}
+#endif
 
 	/* read RF frequency offset from EEPROM */
-	_ReadEEPROM(RT2860_EEPROM_FREQ_LEDS, &value);
+	value = _ROMWord(RT2860_EEPROM_FREQ_LEDS);
+#ifdef TRACE_RALINK
 	uint8 freq = ((value & 0xff) != 0xff) ? value & 0xff : 0;
 	TRACE(DRIVER_NAME": EEPROM freq offset %d\n", freq & 0xff);
+#endif
 
 	if (value >> 8 != 0xff) {
 		/* read LEDs operating mode */
 		fLeds = value >> 8;
-		_ReadEEPROM(RT2860_EEPROM_LED1, &fLed[0]);
-		_ReadEEPROM(RT2860_EEPROM_LED2, &fLed[1]);
-		_ReadEEPROM(RT2860_EEPROM_LED3, &fLed[2]);
+		fLed[0] = _ROMWord(RT2860_EEPROM_LED1);
+		fLed[1] = _ROMWord(RT2860_EEPROM_LED2);
+		fLed[2] = _ROMWord(RT2860_EEPROM_LED3);
 	} else {
 		/* broken EEPROM, use default settings */
 		fLeds = 0x01;
@@ -326,7 +593,7 @@ RalinkUSB::SetupDevice(bool deviceReplugged)
 	    fLeds, fLed[0], fLed[1], fLed[2]);
 
 	/* read RF information */
-	_ReadEEPROM(RT2860_EEPROM_ANTENNA, &value);
+	value = _ROMWord(RT2860_EEPROM_ANTENNA);
 	if (value == 0xffff) {
 		TRACE("invalid EEPROM antenna info, using default\n");
 		if (fMACRevision == 0x3572) {
@@ -354,7 +621,7 @@ RalinkUSB::SetupDevice(bool deviceReplugged)
 	    fRFRevision, fTXChainsCount, fRXChainsCount);
 
 	/* check if RF supports automatic Tx access gain control */
-	_ReadEEPROM(RT2860_EEPROM_CONFIG, &value);
+	value = _ROMWord(RT2860_EEPROM_CONFIG);
 	TRACE(DRIVER_NAME": EEPROM CFG 0x%04x\n", value);
 	/* check if driver should patch the DAC issue */
 	if ((value >> 8) != 0xff)
@@ -370,11 +637,11 @@ RalinkUSB::SetupDevice(bool deviceReplugged)
 
 	/* read power settings for 2GHz channels */
 	for (int i = 0; i < 14; i += 2) {
-		_ReadEEPROM(RT2860_EEPROM_PWR2GHZ_BASE1 + i / 2, &value);
+		value = _ROMWord(RT2860_EEPROM_PWR2GHZ_BASE1 + i / 2);
 		fTxPow1[i + 0] = (int8)(value & 0xff);
 		fTxPow1[i + 1] = (int8)(value >> 8);
 
-		_ReadEEPROM(RT2860_EEPROM_PWR2GHZ_BASE2 + i / 2, &value);
+		value = _ROMWord(RT2860_EEPROM_PWR2GHZ_BASE2 + i / 2);
 		fTxPow2[i + 0] = (int8)(value & 0xff);
 		fTxPow2[i + 1] = (int8)(value >> 8);
 	}
@@ -514,9 +781,10 @@ status_t
 RalinkUSB::CompareAndReattach(usb_device device)
 {
 	TRACE_ALWAYS(DRIVER_NAME"::CompareAndReattach()\n");
+	TIMELINE_SCOPE(scope, TIMELINE_DEVICE, "reattach");
 	
 	const usb_device_descriptor *deviceDescriptor
-		= gUSBModule->get_device_descriptor(device);
+		= platform_usb_device_descriptor(device);
 
 	if (deviceDescriptor == NULL) {
 		TRACE_ALWAYS(DRIVER_NAME": Error getting USB device descriptor.\n");
@@ -533,18 +801,18 @@ RalinkUSB::CompareAndReattach(usb_device device)
 	// re-setup the endpoints and transfers and open the device if it was
 	// previously opened
 	fDevice = device;
+	fControlQueue.SetDevice(device);
+	fRXAggregation.SetDevice(device);
 	fRemoved = false;
+	fShadowValid = 0;
+	_FlushEFUSECache();
 	status_t result = _SetupEndpoints();
 	if (result != B_OK) {
 		fRemoved = true;
 		return result;
 	}
 
-	result = _LoadMicrocode();
-	if (result != B_OK)
-		return result;
-		
-	// we need to setup hardware on device replug
+	// we need to setup hardware on device replug, this loads the microcode
 	result = SetupDevice(true);
 	if (result != B_OK) {
 		return result;
@@ -555,6 +823,8 @@ RalinkUSB::CompareAndReattach(usb_device device)
 		result = Open(fNonBlocking ? O_NONBLOCK : 0);
 	}
 
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_INFO, RALINK_EVENT_REATTACH,
+		result, 0, 0, 0);
 	return result;
 }
 
@@ -566,7 +836,45 @@ RalinkUSB::_StartDevice()
 	status_t status = _LoadMicrocode();
 	if (status != B_OK)
 		return status;
-	return B_OK;	
+
+	// enable bulk RX aggregation and the MAC, as run_txrx_enable() does;
+	// fRXAggregation retunes the aggregation from there
+	ControlBatch batch;
+	status = _QueueWrite(batch, RT2860_USB_DMA_CFG, RT2860_USB_TX_EN
+		| RT2860_USB_RX_EN | RT2860_USB_RX_AGG_EN | fRXAggregation.Restart());
+	if (status == B_OK) {
+		status = _QueueWrite(batch, RT2860_MAC_SYS_CTRL,
+			RT2860_MAC_RX_EN | RT2860_MAC_TX_EN);
+	}
+	status_t waitStatus = batch.Wait();
+	if (status == B_OK)
+		status = waitStatus;
+	if (status != B_OK)
+		return status;
+
+	return fRXRing.Start(fReadEndpoint, fReadEndpointAddress, fRXChainsCount,
+		platform_get_int_setting("rx_ring_count", RX_RING_DEFAULT_COUNT));
+}
+
+
+/*!	Undoes what _StartDevice() enabled, as run_stop() does: the MAC stops
+	sending and receiving, and the USB DMA engine stops using the pipes.
+*/
+status_t
+RalinkUSB::_StopDevice()
+{
+	uint32 tmp;
+	status_t status = _Read(RT2860_MAC_SYS_CTRL, &tmp);
+	if (status == B_OK) {
+		status = _Write(RT2860_MAC_SYS_CTRL,
+			tmp & ~(RT2860_MAC_RX_EN | RT2860_MAC_TX_EN));
+	}
+	if (status == B_OK)
+		status = _Write(RT2860_USB_DMA_CFG, 0);
+	if (status != B_OK)
+		TRACE_ALWAYS(DRIVER_NAME": could not stop the device: %s\n",
+			strerror(status));
+	return status;
 }
 
 
@@ -575,7 +883,7 @@ RalinkUSB::_SetupEndpoints()
 {
 	TRACE_ALWAYS(DRIVER_NAME"::_SetupEndpoints()\n");
 	const usb_configuration_info* config
-		= gUSBModule->get_nth_configuration(fDevice, 0);
+		= platform_usb_configuration(fDevice, 0);
 
 	if (config == NULL) {
 		TRACE_ALWAYS(DRIVER_NAME": Error of getting USB device configuration.\n");
@@ -594,7 +902,7 @@ RalinkUSB::_SetupEndpoints()
 		return B_ERROR;
 	}
 
-	gUSBModule->set_configuration(fDevice, config);
+	platform_usb_set_configuration(fDevice, config);
 	
 	int notifyEndpoint = -1;
 	int readEndpoint   = -1;
@@ -603,15 +911,15 @@ RalinkUSB::_SetupEndpoints()
 	for (size_t ep = 0; ep < interface->endpoint_count; ep++) {
 		usb_endpoint_descriptor* epd = interface->endpoint[ep].descr;
 		
-		dprintf("\tlength: %d\n\tdescriptor_type: %d\n\tendpoint_address: %d",
+		TRACE("\tlength: %d\n\tdescriptor_type: %d\n\tendpoint_address: %d",
 			epd->length, epd->descriptor_type, epd->endpoint_address);
-		dprintf("\n\tattributes: %x\n\tmax_packet_size: %d\n\tinterval: %d\n",
+		TRACE("\n\tattributes: %x\n\tmax_packet_size: %d\n\tinterval: %d\n",
 			epd->attributes, epd->max_packet_size, epd->interval);	
 		
 		if ((epd->attributes & USB_ENDPOINT_ATTR_MASK)
 				== USB_ENDPOINT_ATTR_INTERRUPT) {
 			notifyEndpoint = ep;
-			dprintf("nofify endpoint\n");
+			TRACE("nofify endpoint\n");
 			continue;
 		}
 
@@ -625,14 +933,14 @@ RalinkUSB::_SetupEndpoints()
 		if ((epd->endpoint_address & USB_ENDPOINT_ADDR_DIR_IN)
 				== USB_ENDPOINT_ADDR_DIR_IN) {
 			readEndpoint = ep;
-			dprintf("read endpoint\n");
+			TRACE("read endpoint\n");
 			continue;
 		}
 
 		if ((epd->endpoint_address & USB_ENDPOINT_ADDR_DIR_OUT)
 				== USB_ENDPOINT_ADDR_DIR_OUT) {
 			writeEndpoint = ep;
-			dprintf("write endpoint\n");
+			TRACE("write endpoint\n");
 			continue;
 		}
 	}
@@ -645,7 +953,11 @@ RalinkUSB::_SetupEndpoints()
 
 	//fNotifyEndpoint = interface->endpoint[notifyEndpoint].handle;
 	fReadEndpoint = interface->endpoint[readEndpoint].handle;
+	fReadEndpointAddress
+		= interface->endpoint[readEndpoint].descr->endpoint_address;
 	fWriteEndpoint = interface->endpoint[writeEndpoint].handle;
+	fWriteEndpointAddress
+		= interface->endpoint[writeEndpoint].descr->endpoint_address;
 	fMaxTXPacketSize = interface->endpoint[writeEndpoint].descr->max_packet_size;
 
 	return B_OK;
@@ -656,7 +968,7 @@ status_t
 RalinkUSB::_Reset()
 {
 	size_t dummy;
-	return gUSBModule->send_request(fDevice,
+	return _SendRequest(RALINK_IO_RESET,
 		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT,
 		RT2870_RESET, 1, 0, 0, NULL, &dummy);
 }
@@ -665,58 +977,13 @@ RalinkUSB::_Reset()
 status_t
 RalinkUSB::_LoadMicrocode()
 {
-	const char* firmware = "/system/non-packaged/data/firmware/ralink/rt2870.bin";
-			
-	TRACE_ALWAYS(DRIVER_NAME": selected firmware %s\n", firmware);
-	int fd = open(firmware, B_READ_ONLY);
-	if (fd < 0) {
-		TRACE_ALWAYS(DRIVER_NAME": firmware file unavailable\n");
-		close(fd);
-		return B_ERROR;
-	}
+	TIMELINE_SCOPE(scope, TIMELINE_FIRMWARE, "load microcode");
 
-	int32 fileSize = lseek(fd, 0, SEEK_END);
-	lseek(fd, 0, SEEK_SET);
-	if (fileSize <= 0) {
-		TRACE_ALWAYS(DRIVER_NAME": firmware file seems empty\n");
-		close(fd);
-		return B_ERROR;
-	}
-
-	uint8* buffer = (uint8*)malloc(fileSize);
-	if (buffer == NULL) {
-		TRACE_ALWAYS(DRIVER_NAME": no memory for firmware buffer\n");
-		close(fd);
-		return B_NO_MEMORY;
-	}
-
-	ssize_t readCount = read(fd, buffer, fileSize);
-	close(fd);
-
-	if (readCount != 8192) {
-		TRACE_ALWAYS(DRIVER_NAME": invalid firmware size\n");
-		free(buffer);
-		return B_ERROR;
-	}
-	/*
-	 * RT3071/RT3072 use a different firmware
-	 * run-rt2870 (8KB) contains both,
-	 * first half (4KB) is for rt2870,
-	 * last half is for rt3071.
-	 */
-	uint8* firmwareBase = buffer;
-	if (fMACVersion != 0x2860 &&
-	    fMACVersion != 0x2872 &&
-	    fMACVersion != 0x3070) { 
-		firmwareBase += 4096;
-	}
-
-	/* cheap sanity check */
-	int64 bytes = *(int64*)buffer;
-	if (bytes != B_BENDIAN_TO_HOST_INT64(0xffffff0210280210LL)) {
-		TRACE_ALWAYS(DRIVER_NAME": firmware checksum failed\n");
-		free(buffer);
-		return EINVAL;
+	// the image is loaded once and shared with the other devices
+	if (fMicrocode == NULL) {
+		status_t status = acquire_firmware(fMACVersion, &fMicrocode);
+		if (status != B_OK)
+			return status;
 	}
 
 	TRACE_ALWAYS(DRIVER_NAME": loading firmware...\n");
@@ -724,18 +991,27 @@ RalinkUSB::_LoadMicrocode()
 	uint32 tmp;
 	_Read(RT2860_ASIC_VER_ID, &tmp);
 	/* write microcode image */
-	_WriteRegion(RT2870_FW_BASE, firmwareBase, 4096);
-	_Write(RT2860_H2M_MAILBOX_CID, 0xffffffff);
-	_Write(RT2860_H2M_MAILBOX_STATUS, 0xffffffff);
+	// and clear the mailbox, waiting once for the whole sequence
+	uint64 savedBefore = fIOStats.types[RALINK_IO_WRITE_REGION].saved;
+	{
+		TIMELINE_SCOPE(upload, TIMELINE_FIRMWARE, "upload microcode",
+			RALINK_MICROCODE_SIZE);
+		ControlBatch batch;
+		_QueueWriteRegion(batch, RT2870_FW_BASE, fMicrocode,
+			RALINK_MICROCODE_SIZE);
+		_QueueWrite(batch, RT2860_H2M_MAILBOX_CID, 0xffffffff);
+		_QueueWrite(batch, RT2860_H2M_MAILBOX_STATUS, 0xffffffff);
+		batch.Wait();
+	}
+	uint32 saved = fIOStats.types[RALINK_IO_WRITE_REGION].saved - savedBefore;
 
 	TRACE_ALWAYS(DRIVER_NAME": firmware reset...\n");
 	size_t actualLength;
-	status_t status = gUSBModule->send_request(fDevice,
+	status_t status = _SendRequest(RALINK_IO_RESET,
 		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT,
 		RT2870_RESET, 8, 0, 0, NULL, &actualLength);
 	if (status != B_OK)	{
 		TRACE_ALWAYS(DRIVER_NAME": firmware reset failed\n");
-		free(buffer);
 		return status;
 	}
 	
@@ -749,37 +1025,54 @@ RalinkUSB::_LoadMicrocode()
 	
 	TRACE_ALWAYS(DRIVER_NAME": _SendMCUCommand()\n");
 	if ((status = _SendMCUCommand(RT2860_MCU_CMD_RFRESET, 0)) != B_OK) {
-		dprintf("MCU Command Sent\n");
-		free(buffer);
+		TRACE("MCU Command Sent\n");
 		return status;
 	}
 
 	TRACE_ALWAYS(DRIVER_NAME": Wait for microcontroller...\n");
 	/* wait until microcontroller is ready */
-	int ntries;
-	for (ntries = 0; ntries < 1000; ntries++) {
-		if ((status = _Read(RT2860_SYS_CTRL, &tmp)) != B_OK) {
-			free(buffer);
-			return status;
-		}
-		if (tmp & RT2860_MCU_READY)
-			break;
-		_Delay(10);
-	}
-	if (ntries == 1000) {
+	status = _PollRegister(RT2860_SYS_CTRL, RT2860_MCU_READY, RT2860_MCU_READY,
+		10000000);
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_INFO, RALINK_EVENT_MICROCODE,
+		1, status, saved, 0);
+	if (status != B_OK) {
 		TRACE_ALWAYS(DRIVER_NAME": timeout waiting for MCU to initialize\n");
-		free(buffer);
-		return ETIMEDOUT;
+		return status;
 	}
 	TRACE_ALWAYS(DRIVER_NAME": firmware %s ver. %u.%u loaded\n",
-	    (firmwareBase == buffer) ? "RT2870" : "RT3071", 10, 10);
-//	    *(firmwareBase + 4092), *(firmwareBase + 4093));
+	    microcode_name(fMACVersion), 10, 10);
+//	    *(fMicrocode + 4092), *(fMicrocode + 4093));
 
-	free(buffer);
 	return B_OK;
 }
 
 
+/*!	Synchronous vendor request on the default pipe, accounted in fIOStats
+	under \a type.
+*/
+status_t
+RalinkUSB::_SendRequest(int32 type, uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data,
+	size_t* actualLength)
+{
+	bigtime_t start = platform_time();
+	status_t status = platform_usb_request(fDevice, requestType, request,
+		value, index, length, data, actualLength);
+
+	// WRITE_2 carries its payload in the setup packet
+	io_stats_record(&fIOStats, type, status,
+		type == RALINK_IO_WRITE_2 ? sizeof(uint16) : *actualLength,
+		platform_time() - start);
+	TIMELINE_SPAN(TIMELINE_CONTROL, timeline_io_name(type),
+		TIMELINE_TRACK_THREAD, start, status, request, value, index, length);
+	if (status != B_OK) {
+		RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_ERROR,
+			RALINK_EVENT_REQUEST_ERROR, type, request, value, status);
+	}
+	return status;
+}
+
+
 status_t
 RalinkUSB::_EtherInit()
 {
@@ -790,21 +1083,60 @@ RalinkUSB::_EtherInit()
 status_t
 RalinkUSB::_Read(uint16 reg, uint32* val)
 {
+	int32 index = _ShadowIndex(reg);
+	if (index >= 0) {
+		if ((fShadowValid & (1UL << index)) != 0) {
+			fShadowStats.hits++;
+			*val = fShadowValues[index];
+			return B_OK;
+		}
+		fShadowStats.misses++;
+	}
+
 	uint32 tmp;
 	status_t error = _ReadRegion(reg, (uint8*)&tmp, sizeof(tmp));
-	if (error == B_OK)
+	if (error == B_OK) {
 		*val = B_LENDIAN_TO_HOST_INT32(tmp);
-	else
+		if (index >= 0) {
+			fShadowValues[index] = *val;
+			fShadowValid |= 1UL << index;
+		}
+	} else
 		*val = 0xffffffff;
 	return (error);
 }
 
 
+int32
+RalinkUSB::_ShadowIndex(uint16 reg) const
+{
+	for (int32 i = 0; i < RALINK_SHADOW_REGISTERS; i++) {
+		if (sRegisterPolicies[i].reg == reg)
+			return i;
+	}
+	return -1;
+}
+
+
+void
+RalinkUSB::_InvalidateShadow(uint16 reg, uint16 len)
+{
+	if (fShadowValid == 0)
+		return;
+
+	for (int32 i = 0; i < RALINK_SHADOW_REGISTERS; i++) {
+		uint16 shadowed = sRegisterPolicies[i].reg;
+		if (shadowed + 4 > reg && shadowed < reg + len)
+			fShadowValid &= ~(1UL << i);
+	}
+}
+
+
 status_t
 RalinkUSB::_ReadRegion(uint16 reg, uint8* buffer, uint16 size)
 {
 	size_t actualLength = 0;
-	status_t result = gUSBModule->send_request(fDevice,
+	status_t result = _SendRequest(RALINK_IO_READ_REGION,
 		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_IN,
 		RT2870_READ_REGION_1, 0, reg, size, buffer, &actualLength);
 
@@ -820,10 +1152,14 @@ RalinkUSB::_ReadRegion(uint16 reg, uint8* buffer, uint16 size)
 status_t
 RalinkUSB::_Write2(uint16 reg, uint16 val)
 {
+	// a partial update leaves the shadow copy stale; _Write() refreshes it
+	_InvalidateShadow(reg, sizeof(val));
+
+	// the value goes in the setup packet, there is no data stage
 	size_t actualLength = 0;
-	status_t result = gUSBModule->send_request(fDevice,
+	status_t result = _SendRequest(RALINK_IO_WRITE_2,
 		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT,
-		RT2870_WRITE_2, val, reg, sizeof(val), NULL, &actualLength);
+		RT2870_WRITE_2, val, reg, 0, NULL, &actualLength);
 		
 	return result;
 }
@@ -832,66 +1168,246 @@ RalinkUSB::_Write2(uint16 reg, uint16 val)
 status_t
 RalinkUSB::_WriteRegion(uint16 reg, const uint8* buffer, uint16 len)
 {
-#if 1
-	status_t status;
-	/*
-	 * NB: the WRITE_REGION_1 command is not stable on RT2860.
-	 * We thus issue multiple WRITE_2 commands instead.
-	 */
-	dprintf("RalinkUSB::_WriteRegion(%d, %p, len: %u)\n",
-		reg, buffer, len);
-	for (int i = 0; i < len && status == B_OK; i += 2)
-		status = _Write2(reg + i, buffer[i] | buffer[i + 1] << 8);
-	return status;
-#else
-	return gUSBModule->send_request(fDevice,
-		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT
-		RT2870_WRITE_REGION_1, 0, reg, len, buffer, NULL);
+	TRACE("RalinkUSB::_WriteRegion(%d, %p, len: %u)\n", reg, buffer, len);
+
+	if (_UseWriteRegion() && len <= RALINK_MAX_REGION_LENGTH) {
+		// a single request needs no batch
+		_InvalidateShadow(reg, len);
+		size_t actualLength = 0;
+		status_t status = _SendRequest(RALINK_IO_WRITE_REGION,
+			USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT,
+			RT2870_WRITE_REGION_1, 0, reg, len, (void*)buffer, &actualLength);
+		if (status == B_OK) {
+			io_stats_record_saved(&fIOStats, RALINK_IO_WRITE_REGION,
+				(len + 1) / 2 - 1);
+		}
+		return status;
+	}
 
-#endif
+	ControlBatch batch;
+	status_t status = _QueueWriteRegion(batch, reg, buffer, len);
+	status_t waitStatus = batch.Wait();
+	return status != B_OK ? status : waitStatus;
+}
+
+
+/*!	Queues the write of \a len bytes from \a buffer into \a batch, which
+	must be waited for before the buffer goes away.
+*/
+status_t
+RalinkUSB::_QueueWriteRegion(ControlBatch& batch, uint16 reg,
+	const uint8* buffer, uint16 len)
+{
+	status_t status = B_OK;
+	_InvalidateShadow(reg, len);
+
+	if (!_UseWriteRegion()) {
+		/*
+		 * NB: the WRITE_REGION_1 command is not stable on RT2860.
+		 * We thus issue multiple WRITE_2 commands instead, pipelined
+		 * on the control queue rather than one round trip each.
+		 */
+		for (int i = 0; i < len && status == B_OK; i += 2) {
+			status = fControlQueue.QueueWrite2(batch, reg + i,
+				buffer[i] | buffer[i + 1] << 8);
+		}
+		return status;
+	}
+
+	for (uint16 offset = 0; offset < len && status == B_OK;
+			offset += RALINK_MAX_REGION_LENGTH) {
+		status = fControlQueue.QueueWriteRegion(batch, reg + offset,
+			buffer + offset, min_c(len - offset, RALINK_MAX_REGION_LENGTH));
+	}
+	return status;
 }
 
 
 status_t
 RalinkUSB::_Write(uint16 reg, uint32 val)
 {
+	if (_IsRedundantWrite(reg, val))
+		return B_OK;
+
+	// a single register goes out synchronously, batches are for sequences
+	int32 index = _ShadowIndex(reg);
 	status_t status;
-	if ((status = _Write2(reg, val & 0xffff)) == B_OK)
-		status = _Write2(reg + 2, val >> 16);
+	if (_UseWriteRegion()) {
+		uint32 data = B_HOST_TO_LENDIAN_INT32(val);
+		status = _WriteRegion(reg, (const uint8*)&data, sizeof(data));
+	} else {
+		status = _Write2(reg, val & 0xffff);
+		if (status == B_OK)
+			status = _Write2(reg + 2, val >> 16);
+	}
+
+	if (status == B_OK && index >= 0) {
+		fShadowValues[index] = val;
+		fShadowValid |= 1UL << index;
+	}
 	return status;
 }
 
 
+/*!	Queues a register write into \a batch, so that init sequences wait
+	once for all of their writes. Writes the shadow copy says are redundant
+	are elided; the others invalidate it, _Write() refreshes it.
+*/
+status_t
+RalinkUSB::_QueueWrite(ControlBatch& batch, uint16 reg, uint32 val)
+{
+	if (_IsRedundantWrite(reg, val))
+		return B_OK;
+
+	_InvalidateShadow(reg, sizeof(val));
+	if (_UseWriteRegion())
+		return fControlQueue.QueueWrite(batch, reg, val);
+
+	// both halves go out back to back, the ordering is preserved
+	status_t status = fControlQueue.QueueWrite2(batch, reg, val & 0xffff);
+	if (status == B_OK)
+		status = fControlQueue.QueueWrite2(batch, reg + 2, val >> 16);
+	return status;
+}
+
+
+/*!	Returns whether the shadow copy says that \a reg already holds \a val,
+	and counts the write as elided then.
+*/
+bool
+RalinkUSB::_IsRedundantWrite(uint16 reg, uint32 val)
+{
+	int32 index = _ShadowIndex(reg);
+	if (index < 0 || (fShadowValid & (1UL << index)) == 0
+		|| sRegisterPolicies[index].policy != REGISTER_CACHEABLE
+		|| fShadowValues[index] != val)
+		return false;
+
+	fShadowStats.elided_writes++;
+	return true;
+}
+
+
+bool
+RalinkUSB::_UseWriteRegion() const
+{
+	// WRITE_REGION_1 is only reliable from RT3070 onward, and an unknown
+	// (not yet probed) MAC version is treated like the older parts
+	return fMACVersion >= 0x3070;
+}
+
+
 status_t
 RalinkUSB::_ReadMACAddress(ether_address_t *address)
 {
 	uint16 val;
-	memset(address, 0, sizeof(ether_address_t));
-	
+
 	/* read MAC address */
-	status_t result = _ReadEEPROM(RT2860_EEPROM_MAC01, &val);
-	if (result == B_OK) {
-		address->ebyte[0] = val & 0xff;
-		address->ebyte[1] = val >> 8;
-		result = _ReadEEPROM(RT2860_EEPROM_MAC23, &val);
+	val = _ROMWord(RT2860_EEPROM_MAC01);
+	address->ebyte[0] = val & 0xff;
+	address->ebyte[1] = val >> 8;
+
+	val = _ROMWord(RT2860_EEPROM_MAC23);
+	address->ebyte[2] = val & 0xff;
+	address->ebyte[3] = val >> 8;
+
+	val = _ROMWord(RT2860_EEPROM_MAC45);
+	address->ebyte[4] = val & 0xff;
+	address->ebyte[5] = val >> 8;
+
+	return B_OK;
+}
+
+
+/*!	Reads the ROM into fROM. Plain EEPROMs are fetched whole with a single
+	EEPROM_READ request. If the chip refuses it, and on eFUSE parts which
+	have no such request, only the words SetupDevice() parses are read, one
+	by one or through _ReadEFUSE(); the others read as blank (0xffff).
+*/
+status_t
+RalinkUSB::_ReadROMImage()
+{
+	status_t result = B_ERROR;
+	memset(fROM, 0xff, sizeof(fROM));
+
+	if (!fEFuse) {
+		size_t actualLength = 0;
+		result = _SendRequest(RALINK_IO_EEPROM_READ,
+			USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_IN,
+			RT2870_EEPROM_READ, 0, 0, sizeof(fROM), fROM, &actualLength);
+		if (result == B_OK && actualLength == sizeof(fROM)) {
+			for (int i = 0; i < RALINK_ROM_WORDS; i++)
+				fROM[i] = B_LENDIAN_TO_HOST_INT16(fROM[i]);
+			return B_OK;
+		}
+
+		TRACE(DRIVER_NAME": EEPROM block read failed (%#010lx, %lu bytes), "
+			"reading word by word\n", result, actualLength);
 	}
-	
-	if (result == B_OK) {
-		address->ebyte[2] = val & 0xff;
-		address->ebyte[3] = val >> 8;
-		result = _ReadEEPROM(RT2860_EEPROM_MAC45, &val);
+
+	for (size_t i = 0; i < sizeof(sROMRanges) / sizeof(sROMRanges[0]); i++) {
+		const rom_range& range = sROMRanges[i];
+		if (!fEFuse) {
+			if ((result = _ReadROMWords(range.first, range.count)) != B_OK)
+				return result;
+			continue;
+		}
+		for (uint16 word = range.first; word < range.first + range.count;
+				word++) {
+			if ((result = _ReadEEPROM(word, &fROM[word])) != B_OK)
+				return result;
+		}
+	}
+
+	return B_OK;
+}
+
+
+/*!	Reads \a count EEPROM words into fROM, pipelined on the control queue
+	instead of one round trip per word.
+*/
+status_t
+RalinkUSB::_ReadROMWords(uint16 first, uint16 count)
+{
+	control_read reads[CONTROL_QUEUE_DEPTH];
+	status_t result = B_OK;
+
+	while (count > 0 && result == B_OK) {
+		uint16 chunk = min_c(count, CONTROL_QUEUE_DEPTH);
+		ControlBatch batch;
+		uint16 queued = 0;
+		result = batch.InitCheck();
+		while (queued < chunk && result == B_OK) {
+			result = fControlQueue.QueueReadEEPROM(batch, first + queued,
+				&reads[queued]);
+			queued++;
+		}
+
+		// a read that could not be queued is done already
+		for (uint16 i = 0; i < queued; i++) {
+			status_t status = batch.Wait(reads[i]);
+			fROM[first + i] = (uint16)reads[i].value;
+			if (status != B_OK && result == B_OK)
+				result = status;
+		}
+
+		first += chunk;
+		count -= chunk;
 	}
-	
-	if (result == B_OK) {
-		address->ebyte[4] = val & 0xff;
-		address->ebyte[5] = val >> 8;
-	} else
-		TRACE_ALWAYS("Error of reading MAC address:%#010x\n", result);
 
 	return result;
 }
 
 
+uint16
+RalinkUSB::_ROMWord(uint16 addr) const
+{
+	if (addr >= RALINK_ROM_WORDS)
+		return 0xffff;
+	return fROM[addr];
+}
+
+
 status_t
 RalinkUSB::_ReadEEPROM(uint16 reg, uint16* val)
 {
@@ -901,7 +1417,7 @@ RalinkUSB::_ReadEEPROM(uint16 reg, uint16* val)
 	uint16 tmp;
 	size_t actualLength = 0;
 	reg *= 2;
-	status_t result = gUSBModule->send_request(fDevice,
+	status_t result = _SendRequest(RALINK_IO_EEPROM_READ,
 		USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_IN,
 		RT2870_EEPROM_READ, 0, reg, sizeof(tmp), &tmp, &actualLength);
 
@@ -924,16 +1440,48 @@ RalinkUSB::_ReadEEPROM(uint16 reg, uint16* val)
 /* Read 16-bit from eFUSE ROM (RT3070 only.) */
 status_t
 RalinkUSB::_ReadEFUSE(uint16 addr, uint16* val)
+{
+	addr *= 2;
+	uint16 blockAddress = addr & ~0xf;
+
+	efuse_block* block = NULL;
+	for (int i = 0; i < RALINK_EFUSE_CACHE_BLOCKS; i++) {
+		if (fEFuseBlocks[i].valid && fEFuseBlocks[i].address == blockAddress) {
+			block = &fEFuseBlocks[i];
+			break;
+		}
+	}
+
+	if (block == NULL) {
+		// replace the oldest entry
+		block = &fEFuseBlocks[fEFuseNextBlock];
+		fEFuseNextBlock = (fEFuseNextBlock + 1) % RALINK_EFUSE_CACHE_BLOCKS;
+
+		status_t error = _FetchEFUSEBlock(blockAddress, block);
+		if (error != B_OK)
+			return error;
+	}
+
+	fEFuseStats.words_served++;
+	*val = block->words[(addr & 0xf) / 2];
+	return B_OK;
+}
+
+
+/*!	Kicks a read of the 16-byte eFUSE block at \a address and decodes all
+	of it into \a block, so that the neighbouring words come for free.
+*/
+status_t
+RalinkUSB::_FetchEFUSEBlock(uint16 address, efuse_block* block)
 {
 	uint32 tmp;
-	uint16 reg;
 	status_t error;
-	int ntries;
+
+	block->valid = false;
 
 	if ((error = _Read(RT3070_EFUSE_CTRL, &tmp)) != 0)
 		return error;
 
-	addr *= 2;
 	/*-
 	 * Read one 16-byte block into registers EFUSE_DATA[0-3]:
 	 * DATA0: F E D C
@@ -942,50 +1490,125 @@ RalinkUSB::_ReadEFUSE(uint16 addr, uint16* val)
 	 * DATA3: 3 2 1 0
 	 */
 	tmp &= ~(RT3070_EFSROM_MODE_MASK | RT3070_EFSROM_AIN_MASK);
-	tmp |= (addr & ~0xf) << RT3070_EFSROM_AIN_SHIFT | RT3070_EFSROM_KICK;
+	tmp |= address << RT3070_EFSROM_AIN_SHIFT | RT3070_EFSROM_KICK;
 	_Write(RT3070_EFUSE_CTRL, tmp);
-	for (ntries = 0; ntries < 100; ntries++) {
-		if ((error = _Read(RT3070_EFUSE_CTRL, &tmp)) != 0)
-			return error;
-		if (!(tmp & RT3070_EFSROM_KICK))
-			break;
-		_Delay(2);
-	}
-	if (ntries == 100)
-		return ETIMEDOUT;
+	error = _PollRegister(RT3070_EFUSE_CTRL, RT3070_EFSROM_KICK, 0, 200000,
+		&tmp);
+	if (error != B_OK)
+		return error;
+
+	fEFuseStats.blocks_fetched++;
 
 	if ((tmp & RT3070_EFUSE_AOUT_MASK) == RT3070_EFUSE_AOUT_MASK) {
-		*val = 0xffff;	/* address not found */
-		return B_OK;
+		/* address not found */
+		for (int i = 0; i < 8; i++)
+			block->words[i] = 0xffff;
+	} else {
+		/* fetch all four data registers with a single request */
+		uint32 data[4];
+		if ((error = _ReadRegion(RT3070_EFUSE_DATA0, (uint8*)data,
+				sizeof(data))) != B_OK)
+			return error;
+
+		for (int i = 0; i < 8; i++) {
+			/* byte 0 of the block lives in DATA3, byte 0xf in DATA0 */
+			tmp = B_LENDIAN_TO_HOST_INT32(data[3 - i / 2]);
+			block->words[i] = (i & 1) ? tmp >> 16 : tmp & 0xffff;
+		}
 	}
-	/* determine to which 32-bit register our 16-bit word belongs */
-	reg = RT3070_EFUSE_DATA3 - (addr & 0xc);
-	if ((error = _Read(reg, &tmp)) != 0)
-		return error;
 
-	*val = (addr & 2) ? tmp >> 16 : tmp & 0xffff;
+	block->address = address;
+	block->valid = true;
 	return B_OK;
 }
 
 
+void
+RalinkUSB::_FlushEFUSECache()
+{
+	for (int i = 0; i < RALINK_EFUSE_CACHE_BLOCKS; i++)
+		fEFuseBlocks[i].valid = false;
+	fEFuseNextBlock = 0;
+}
+
+
 status_t
 RalinkUSB::_SendMCUCommand(uint8 command, uint16 arg)
 {
+	TIMELINE_SCOPE(scope, TIMELINE_MCU_COMMAND, "MCU command", command, arg);
 	uint32 tmp;
+	status_t status = _PollRegister(RT2860_H2M_MAILBOX, RT2860_H2M_BUSY, 0,
+		100000);
+	if (status != B_OK)
+		return status;
+
+	tmp = RT2860_H2M_BUSY | RT2860_TOKEN_NO_INTR << 16 | arg;
+	ControlBatch batch;
+	if ((status = _QueueWrite(batch, RT2860_H2M_MAILBOX, tmp)) == B_OK)
+		status = _QueueWrite(batch, RT2860_HOST_CMD, command);
+	status_t waitStatus = batch.Wait();
+	if (status == B_OK)
+		status = waitStatus;
+	RALINK_TRACE_POINT(&fTraceRing, RALINK_TRACE_INFO,
+		RALINK_EVENT_MCU_COMMAND, command, arg, status, 0);
+	TIMELINE_SCOPE_STATUS(scope, status);
+	return status;
+}
+
+
+/*!	Reads \a reg until \a condition (by default: the bits in \a mask equal
+	\a expected) holds, sleeping between attempts with an exponential backoff
+	from RALINK_POLL_MIN_DELAY to RALINK_POLL_MAX_DELAY. The register must be
+	volatile, shadowed registers would never change.
+*/
+status_t
+RalinkUSB::_PollRegister(uint16 reg, uint32 mask, uint32 expected,
+	bigtime_t timeout, uint32* _value, register_condition condition)
+{
+	if (condition == NULL)
+		condition = register_matches;
+
+	bigtime_t start = platform_time();
+	bigtime_t delay = RALINK_POLL_MIN_DELAY;
+	uint32 iterations = 0;
 	status_t status;
-	int ntries;
-	for (ntries = 0; ntries < 100; ntries++) {
-		if ((status = _Read(RT2860_H2M_MAILBOX, &tmp)) != B_OK)
-			return status;
-		if (!(tmp & RT2860_H2M_BUSY))
+	uint32 value;
+
+	while (true) {
+		iterations++;
+		if ((status = _Read(reg, &value)) != B_OK)
+			break;
+		if (condition(value, mask, expected))
+			break;
+
+		bigtime_t remaining = start + timeout - platform_time();
+		if (remaining <= 0) {
+			fPollStats.timeouts++;
+			status = B_TIMED_OUT;
 			break;
+		}
+
+		platform_sleep(min_c(delay, remaining));
+		delay = min_c(delay * 2, RALINK_POLL_MAX_DELAY);
 	}
-	if (ntries == 100)
-		return ETIMEDOUT;
 
-	tmp = RT2860_H2M_BUSY | RT2860_TOKEN_NO_INTR << 16 | arg;
-	if ((status = _Write(RT2860_H2M_MAILBOX, tmp)) == B_OK)
-		status = _Write(RT2860_HOST_CMD, command);
+	bigtime_t elapsed = platform_time() - start;
+	fPollStats.waits++;
+	fPollStats.iterations += iterations;
+	fPollStats.wait_time += elapsed;
+	if (iterations > fPollStats.max_iterations)
+		fPollStats.max_iterations = iterations;
+
+	TRACE(DRIVER_NAME": polled register 0x%04x %lu times in %lld us: %s\n",
+		reg, iterations, elapsed, strerror(status));
+	RALINK_TRACE_POINT(&fTraceRing,
+		status == B_OK ? RALINK_TRACE_INFO : RALINK_TRACE_ERROR,
+		RALINK_EVENT_POLL, reg, iterations, elapsed, status);
+	TIMELINE_SPAN(TIMELINE_POLL, "poll register", TIMELINE_TRACK_THREAD, start,
+		status, reg, iterations);
+
+	if (_value != NULL)
+		*_value = value;
 	return status;
 }
 
@@ -993,7 +1616,7 @@ RalinkUSB::_SendMCUCommand(uint8 command, uint16 arg)
 void
 RalinkUSB::_Delay(int ms)
 {
-	spin(ms * 1000);
+	platform_sleep(ms * 1000);
 	//usb_pause_mtx(mtx_owned(&sc->sc_mtx) ? 
 	  //  &sc->sc_mtx : NULL, USB_MS_TO_TICKS(ms));
 }
@@ -6,14 +6,49 @@
 #ifndef RALINK_H
 #define RALINK_H
 
-#include <KernelExport.h>
 #include <USB3.h>
 #include <SupportDefs.h>
 
+#include "alloc_accounting.h"
+#include "control_queue.h"
 #include "ether_driver.h"
+#include "ralink_ioctl.h"
+#include "rx_aggregation.h"
+#include "rx_ring.h"
+#include "shared_rings.h"
+#include "trace_ring.h"
 
 
-class RalinkUSB {
+// largest payload sent with a single WRITE_REGION_1 request
+#define RALINK_MAX_REGION_LENGTH	4096
+
+// size of the EEPROM/eFUSE image snapshot, in 16-bit words; covers every
+// field parsed by SetupDevice() and is a multiple of an eFUSE block
+#define RALINK_ROM_WORDS			0x90
+
+// decoded eFUSE blocks kept around by _ReadEFUSE()
+#define RALINK_EFUSE_CACHE_BLOCKS	2
+
+// sleep bounds of the exponential backoff in _PollRegister() (us)
+#define RALINK_POLL_MIN_DELAY		100
+#define RALINK_POLL_MAX_DELAY		10000
+
+// number of entries in the register policy table (see ralink_usb.cpp)
+#define RALINK_SHADOW_REGISTERS		1
+
+
+// condition a polled register value has to satisfy
+typedef bool (*register_condition)(uint32 value, uint32 mask, uint32 expected);
+
+
+typedef struct efuse_block {
+	uint16	address;	// byte address of the 16-byte block
+	bool	valid;
+	uint16	words[8];
+} efuse_block;
+
+
+class RalinkUSB : public AccountedAllocation<RALINK_ALLOC_DEVICE> {
 public:
 						RalinkUSB(usb_device device);
 						~RalinkUSB();
@@ -43,12 +78,33 @@ private:
 	int32				fDeviceID;
 	usb_device			fDevice;
 	ether_address_t		fMACAddress;
+
+	// USB transfer counters, updated lock-free
+	ralink_io_stats		fIOStats;
+	// frame counters, updated lock-free as well
+	ralink_device_stats	fDeviceStats;
+
+	// latest trace point records, see RALINK_GET_TRACE_RING
+	trace_ring			fTraceRing;
+
+	// pipelined register accesses
+	ControlQueue		fControlQueue;
+
+	// RX and TX rings shared with userland, see RALINK_MAP_RINGS
+	SharedRings			fSharedRings;
+
+	// bulk IN aggregation, see RALINK_SET_RX_AGGREGATION
+	RXAggregation		fRXAggregation;
+
+	// bulk IN transfers kept queued while the device is open
+	RXRing				fRXRing;
 	
 	status_t			fStatus;
 	
 	bool				fOpen;
 	bool				fRemoved;
 	bool				fNonBlocking;
+	uint32				fReadMode;		// RALINK_READ_*, until Close()
 	
 	bool				fEFuse;
 	
@@ -56,10 +112,20 @@ private:
 	usb_pipe			fNotifyEndpoint;
 	usb_pipe			fReadEndpoint;
 	usb_pipe			fWriteEndpoint;
+	uint8				fReadEndpointAddress;
+	uint8				fWriteEndpointAddress;
 	uint16				fMaxTXPacketSize;
 	
 	uint16				fMACVersion;
 	uint16				fMACRevision;
+
+	// shared, read-only microcode for this MAC version (see firmware.h)
+	const uint8*		fMicrocode;
+
+	// host side copy of the registers only the driver modifies
+	uint32				fShadowValues[RALINK_SHADOW_REGISTERS];
+	uint32				fShadowValid;
+	ralink_register_cache_stats	fShadowStats;
 	
 	uint8				fLeds;
 	uint16				fLed[3];
@@ -78,24 +144,57 @@ private:
 	
 	int8				fTxPow1[16];
 	int8				fTxPow2[16];
+
+	// EEPROM/eFUSE contents, read once by _ReadROMImage()
+	uint16				fROM[RALINK_ROM_WORDS];
+
+	efuse_block			fEFuseBlocks[RALINK_EFUSE_CACHE_BLOCKS];
+	uint32				fEFuseNextBlock;
+	ralink_efuse_stats	fEFuseStats;
+
+	ralink_poll_stats	fPollStats;
 	
 	status_t			_StartDevice();
+	status_t			_StopDevice();
 	status_t			_SetupEndpoints();
 	status_t			_Reset();
 	status_t			_LoadMicrocode();
+
+	status_t			_SendRequest(int32 type, uint8 requestType,
+							uint8 request, uint16 value, uint16 index,
+							uint16 length, void* data, size_t* actualLength);
 	status_t			_EtherInit();
 	
 	status_t 			_Write(uint16 reg, uint32 val);
 	status_t 			_Write2(uint16 reg, uint16 val);
 	status_t			_WriteRegion(uint16 reg, const uint8* buffer, uint16 len);
-	
+	status_t			_QueueWrite(ControlBatch& batch, uint16 reg,
+							uint32 val);
+	status_t			_QueueWriteRegion(ControlBatch& batch, uint16 reg,
+							const uint8* buffer, uint16 len);
+	bool				_IsRedundantWrite(uint16 reg, uint32 val);
+	bool				_UseWriteRegion() const;
+
+	int32				_ShadowIndex(uint16 reg) const;
+	void				_InvalidateShadow(uint16 reg, uint16 len);
+
 	status_t			_Read(uint16 reg, uint32* val);
 	status_t			_ReadRegion(uint16 reg, uint8* buffer, uint16 len);
 	status_t			_ReadMACAddress(ether_address_t *address);
+	status_t			_ReadROMImage();
+	status_t			_ReadROMWords(uint16 first, uint16 count);
+	uint16				_ROMWord(uint16 addr) const;
 	status_t			_ReadEEPROM(uint16 addr, uint16* val);
 	status_t			_ReadEFUSE(uint16 addr, uint16* val);
+	status_t			_FetchEFUSEBlock(uint16 address, efuse_block* block);
+	void				_FlushEFUSECache();
 	
 	status_t			_SendMCUCommand(uint8 command, uint16 arg);
+
+	status_t			_PollRegister(uint16 reg, uint32 mask,
+							uint32 expected, bigtime_t timeout,
+							uint32* _value = NULL,
+							register_condition condition = NULL);
 	
 	void				_Delay(int n);
 
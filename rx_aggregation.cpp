@@ -0,0 +1,314 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "rx_aggregation.h"
+
+#include "alloc_accounting.h"
+#include "control_queue.h"
+#include "datapath.h"
+#include "driver.h"
+#include "if_runreg.h"
+#include "io_stats.h"
+#include "timeline.h"
+#include "usb_trace.h"
+
+
+// RX_AGG_TO is 8 bits of 33 ns, if_run.c uses 128 of them
+#define RX_AGGREGATION_TIMEOUT_MIN		16
+#define RX_AGGREGATION_TIMEOUT_DEFAULT	128
+#define RX_AGGREGATION_TIMEOUT_MAX		255
+// RX_AGG_LMT is in kB, if_run.c uses 2; the chip closes a transfer only
+// after the frame that crosses the limit, which has to fit as well
+#define RX_AGGREGATION_LIMIT_MIN		1
+#define RX_AGGREGATION_LIMIT_DEFAULT	2
+#define RX_AGGREGATION_LIMIT_MAX \
+	((RALINK_MAX_RX_TRANSFER - RALINK_MAX_RX_FRAME) / 1024)
+
+// the adaptive profile aggregates more above these, in 1/100 and %
+#define RX_AGGREGATION_BACKLOG_HIGH		200
+#define RX_AGGREGATION_FILL_HIGH		75
+// and less below this one, if no transfer waited for a reader
+#define RX_AGGREGATION_FRAMES_LOW		150
+
+// how long Restart() and the destructor wait for a write in flight
+#define RX_AGGREGATION_DRAIN_TIMEOUT	1000000
+#define RX_AGGREGATION_DRAIN_DELAY		1000
+
+#define RX_AGGREGATION_SETTING(timeout, limit) \
+	(RT2860_USB_RX_AGG_TO(timeout) | RT2860_USB_RX_AGG_LMT(limit))
+#define RX_AGGREGATION_TIMEOUT(setting)	((setting) & 0xff)
+#define RX_AGGREGATION_LIMIT(setting)	(((setting) >> 8) & 0xff)
+
+
+RXAggregation::RXAggregation(usb_device device, ralink_io_stats* stats)
+	:
+	fDevice(device),
+	fStats(stats),
+	fProfile(RALINK_RX_AGGREGATION_ADAPTIVE),
+	fRetunes(0),
+	fTransfers(0),
+	fFrames(0),
+	fBytes(0),
+	fBacklog(0),
+	fFramesPerTransfer(0),
+	fFill(0),
+	fAverageBacklog(0),
+	fWriting(0),
+	fWriteValue(0),
+	fWriteStart(0)
+{
+	fWanted = fApplied = _ProfileSetting(RALINK_RX_AGGREGATION_ADAPTIVE);
+}
+
+
+RXAggregation::~RXAggregation()
+{
+	_AcquireWriter();
+}
+
+
+void
+RXAggregation::SetDevice(usb_device device)
+{
+	fDevice = device;
+}
+
+
+/*!	Starts over from the setting of the profile, before the RX ring is
+	started; the adaptive one begins where if_run.c stays.
+*/
+uint16
+RXAggregation::Restart()
+{
+	// a write still in flight would reach the chip after the caller's, and
+	// its callback would make fApplied the setting from before
+	_AcquireWriter();
+
+	fTransfers = 0;
+	fFrames = 0;
+	fBytes = 0;
+	fBacklog = 0;
+
+	int32 setting = _ProfileSetting(atomic_get(&fProfile));
+	// the caller writes it along with the rest of USB_DMA_CFG
+	atomic_set(&fWanted, setting);
+	atomic_set(&fApplied, setting);
+	atomic_set(&fWriting, 0);
+	return setting;
+}
+
+
+/*!	Switches to \a profile; the setting is written to the chip right away
+	if \a apply is set, otherwise the next Restart() picks it up.
+*/
+status_t
+RXAggregation::SetProfile(uint32 profile, bool apply)
+{
+	if (profile >= RALINK_RX_AGGREGATION_PROFILES)
+		return B_BAD_VALUE;
+
+	atomic_set(&fProfile, profile);
+	// the adaptive profile goes on from the current setting
+	if (profile == RALINK_RX_AGGREGATION_ADAPTIVE)
+		return B_OK;
+
+	atomic_set(&fWanted, _ProfileSetting(profile));
+	if (apply)
+		_Apply();
+	return B_OK;
+}
+
+
+void
+RXAggregation::GetState(ralink_rx_aggregation* state)
+{
+	int32 setting = atomic_get(&fWanted);
+	state->profile = atomic_get(&fProfile);
+	state->timeout = RX_AGGREGATION_TIMEOUT(setting);
+	state->limit = RX_AGGREGATION_LIMIT(setting);
+	state->retunes = atomic_get(&fRetunes);
+	state->frames_per_transfer = fFramesPerTransfer;
+	state->fill = fFill;
+	state->backlog = fAverageBacklog;
+}
+
+
+/*!	Called by the RX ring for every completed bulk IN transfer, with the
+	number of transfers that wait for a reader.
+*/
+void
+RXAggregation::TransferCompleted(int32 frames, size_t length, uint32 backlog)
+{
+	fFrames += frames;
+	fBytes += length;
+	fBacklog += backlog;
+	if (++fTransfers < RX_AGGREGATION_WINDOW)
+		return;
+
+	int32 setting = atomic_get(&fWanted);
+	uint64 limit = RX_AGGREGATION_LIMIT(setting) * 1024;
+	fFramesPerTransfer = fFrames * 100 / fTransfers;
+	fFill = limit > 0 ? fBytes * 100 / (limit * fTransfers) : 0;
+	fAverageBacklog = fBacklog * 100 / fTransfers;
+
+	fTransfers = 0;
+	fFrames = 0;
+	fBytes = 0;
+	fBacklog = 0;
+
+	if (atomic_get(&fProfile) == RALINK_RX_AGGREGATION_ADAPTIVE)
+		_Tune();
+}
+
+
+/*!	Moves the setting one step, first along the timeout and then along the
+	limit, as the previous window asks for.
+*/
+void
+RXAggregation::_Tune()
+{
+	int32 setting = atomic_get(&fWanted);
+	int32 timeout = RX_AGGREGATION_TIMEOUT(setting);
+	int32 limit = RX_AGGREGATION_LIMIT(setting);
+
+	if (fAverageBacklog >= RX_AGGREGATION_BACKLOG_HIGH
+		|| fFill >= RX_AGGREGATION_FILL_HIGH) {
+		// the readers fall behind or the transfers are full: fewer and
+		// larger transfers cost less per frame
+		if (timeout < RX_AGGREGATION_TIMEOUT_MAX)
+			timeout = min_c(timeout * 2, RX_AGGREGATION_TIMEOUT_MAX);
+		else if (limit < RX_AGGREGATION_LIMIT_MAX)
+			limit++;
+	} else if (fFramesPerTransfer < RX_AGGREGATION_FRAMES_LOW
+		&& fAverageBacklog == 0) {
+		// the timeout mostly runs out without another frame, waiting for
+		// one only delays the frame before
+		if (timeout > RX_AGGREGATION_TIMEOUT_MIN)
+			timeout = max_c(timeout / 2, RX_AGGREGATION_TIMEOUT_MIN);
+		else if (limit > RX_AGGREGATION_LIMIT_MIN)
+			limit--;
+	}
+
+	// a profile set in the meantime wins
+	int32 tuned = RX_AGGREGATION_SETTING(timeout, limit);
+	if (tuned != setting
+		&& atomic_test_and_set(&fWanted, tuned, setting) != setting)
+		return;
+
+	// this also retries a write that failed
+	if (tuned != atomic_get(&fApplied))
+		_Apply();
+}
+
+
+int32
+RXAggregation::_ProfileSetting(int32 profile)
+{
+	switch (profile) {
+		case RALINK_RX_AGGREGATION_LATENCY:
+			return RX_AGGREGATION_SETTING(RX_AGGREGATION_TIMEOUT_MIN,
+				RX_AGGREGATION_LIMIT_MIN);
+		case RALINK_RX_AGGREGATION_THROUGHPUT:
+			return RX_AGGREGATION_SETTING(RX_AGGREGATION_TIMEOUT_MAX,
+				RX_AGGREGATION_LIMIT_MAX);
+		default:
+			return RX_AGGREGATION_SETTING(RX_AGGREGATION_TIMEOUT_DEFAULT,
+				RX_AGGREGATION_LIMIT_DEFAULT);
+	}
+}
+
+
+/*!	Waits until no write is in flight, and keeps others from being queued
+	until fWriting is cleared again.
+*/
+void
+RXAggregation::_AcquireWriter()
+{
+	for (bigtime_t waited = 0; atomic_test_and_set(&fWriting, 1, 0) != 0;
+			waited += RX_AGGREGATION_DRAIN_DELAY) {
+		if (waited >= RX_AGGREGATION_DRAIN_TIMEOUT) {
+			// the callback of a canceled transfer is overdue, go on
+			TRACE_ALWAYS(DRIVER_NAME": RX aggregation write did not "
+				"complete\n");
+			atomic_set(&fWriting, 1);
+			return;
+		}
+		platform_sleep(RX_AGGREGATION_DRAIN_DELAY);
+	}
+}
+
+
+/*!	Writes fWanted to the chip, unless a write is in flight already; its
+	callback writes again if fWanted changed since.
+*/
+void
+RXAggregation::_Apply()
+{
+	if (atomic_test_and_set(&fWriting, 1, 0) == 0)
+		_Queue();
+}
+
+
+void
+RXAggregation::_Queue()
+{
+	while (true) {
+		fWriteValue = atomic_get(&fWanted);
+		if (fWriteValue == atomic_get(&fApplied)) {
+			atomic_set(&fWriting, 0);
+			// fWanted may have changed before fWriting was cleared
+			if (atomic_get(&fWanted) == atomic_get(&fApplied)
+				|| atomic_test_and_set(&fWriting, 1, 0) != 0)
+				return;
+			continue;
+		}
+
+		// the write depends on the timing of the transfers, the replay
+		// needs to know it is not part of the ordered register I/O
+		usb_trace_mark(USB_TRACE_MARK_RETUNE, fWriteValue);
+
+		// the value goes in the setup packet, there is no data stage, as
+		// in run_write_2()
+		fWriteStart = platform_time();
+		status_t status = platform_usb_queue_request(fDevice,
+			USB_REQTYPE_VENDOR | USB_REQTYPE_DEVICE_OUT, RT2870_WRITE_2,
+			fWriteValue, RT2860_USB_DMA_CFG, 0, NULL, _Callback, this);
+		if (status == B_OK)
+			return;
+
+		// not retried, the next window tries again
+		io_stats_record(fStats, RALINK_IO_WRITE_2, status,
+			sizeof(fWriteValue), 0);
+		atomic_set(&fWriting, 0);
+		return;
+	}
+}
+
+
+/*static*/ void
+RXAggregation::_Callback(void* cookie, status_t status, void* data,
+	size_t actualLength)
+{
+	RALINK_HOT_PATH(hotPath);
+	RXAggregation* aggregation = (RXAggregation*)cookie;
+
+	// WRITE_2 carries its payload in the setup packet
+	io_stats_record(aggregation->fStats, RALINK_IO_WRITE_2, status,
+		sizeof(aggregation->fWriteValue),
+		platform_time() - aggregation->fWriteStart);
+	TIMELINE_SPAN(TIMELINE_CONTROL, "WRITE_2",
+		TIMELINE_TRACK_CONTROL_SLOT(CONTROL_QUEUE_DEPTH),
+		aggregation->fWriteStart, status, RT2870_WRITE_2,
+		aggregation->fWriteValue, RT2860_USB_DMA_CFG, 0);
+
+	if (status != B_OK) {
+		atomic_set(&aggregation->fWriting, 0);
+		return;
+	}
+
+	atomic_set(&aggregation->fApplied, aggregation->fWriteValue);
+	atomic_add(&aggregation->fRetunes, 1);
+	aggregation->_Queue();
+}
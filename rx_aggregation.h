@@ -0,0 +1,81 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef RX_AGGREGATION_H
+#define RX_AGGREGATION_H
+
+#include <USB3.h>
+#include <SupportDefs.h>
+
+#include "platform.h"
+#include "ralink_ioctl.h"
+
+
+// bulk IN transfers the adaptive profile looks at before deciding
+#define RX_AGGREGATION_WINDOW		32
+
+
+/*!	Tunes the bulk IN aggregation of USB_DMA_CFG (RX_AGG_TO and RX_AGG_LMT)
+	while frames are received. run_txrx_enable() in if_run.c programs a
+	fixed 4 us timeout and 2 kB limit; the adaptive profile starts there,
+	and after every window of transfers moves towards more aggregation when
+	the transfers fill up or wait for the readers, and towards less when
+	they carry single frames only. The other profiles pin the setting.
+
+	TransferCompleted() is called from the RX ring callback, so the new
+	setting is written with an asynchronous WRITE_2 of the lower half of
+	USB_DMA_CFG, which holds both fields; one write is in flight at most.
+*/
+class RXAggregation {
+public:
+						RXAggregation(usb_device device,
+							ralink_io_stats* stats);
+
+						~RXAggregation();
+
+	void				SetDevice(usb_device device);
+
+	// returns the lower half of USB_DMA_CFG for _StartDevice() to write
+	uint16				Restart();
+
+	status_t			SetProfile(uint32 profile, bool apply);
+	void				GetState(ralink_rx_aggregation* state);
+
+	void				TransferCompleted(int32 frames, size_t length,
+							uint32 backlog);
+
+private:
+	static int32		_ProfileSetting(int32 profile);
+	void				_Tune();
+	void				_AcquireWriter();
+	void				_Apply();
+	void				_Queue();
+
+	static void			_Callback(void* cookie, status_t status, void* data,
+							size_t actualLength);
+
+	usb_device			fDevice;
+	ralink_io_stats*	fStats;
+
+	vint32				fProfile;
+	vint32				fRetunes;
+
+	// the current window, only touched by TransferCompleted()
+	int32				fTransfers;
+	int32				fFrames;
+	uint64				fBytes;
+	uint32				fBacklog;
+	// the previous one, for GetState()
+	uint32				fFramesPerTransfer;
+	uint32				fFill;
+	uint32				fAverageBacklog;
+
+	vint32				fWanted;	// the setting to write
+	vint32				fApplied;	// the one last written
+	vint32				fWriting;	// a write is in flight
+	uint16				fWriteValue;
+	bigtime_t			fWriteStart;
+};
+
+#endif // RX_AGGREGATION_H
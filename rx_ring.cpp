@@ -0,0 +1,492 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "rx_ring.h"
+
+#include "alloc_accounting.h"
+#include "driver.h"
+#include "io_stats.h"
+#include "rx_aggregation.h"
+#include "shared_rings.h"
+#include "timeline.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+// how long Start() waits for the transfers and slices of a previous run
+#define RX_RING_DRAIN_TIMEOUT	1000000
+#define RX_RING_DRAIN_DELAY		1000
+
+
+RXRing::RXRing(ralink_io_stats* ioStats, ralink_device_stats* deviceStats,
+	SharedRings* sharedRings, RXAggregation* aggregation)
+	:
+	fIOStats(ioStats),
+	fDeviceStats(deviceStats),
+	fSharedRings(sharedRings),
+	fAggregation(aggregation),
+	fPipe(0),
+	fEndpoint(0),
+	fChains(1),
+	fCount(0),
+	fBuffers(NULL),
+	fData(NULL),
+	fFrames(NULL),
+	fReadyHead(0),
+	fReadyTail(0),
+	fCurrent(NULL),
+	fPosted(0),
+	fSlices(0),
+	fStalled(0),
+	fRecycling(0),
+	fRunning(0)
+{
+	fInitStatus = platform_sem_create(&fReadySem, 0, DRIVER_NAME"_rx_ready");
+	if (fInitStatus != B_OK)
+		return;
+
+	fInitStatus = platform_sem_create(&fReadLock, 1, DRIVER_NAME"_rx_read");
+	if (fInitStatus != B_OK)
+		platform_sem_delete(fReadySem);
+}
+
+
+RXRing::~RXRing()
+{
+	if (fInitStatus == B_OK) {
+		platform_sem_delete(fReadLock);
+		platform_sem_delete(fReadySem);
+	}
+
+	RALINK_FREE(fFrames);
+	RALINK_FREE(fData);
+	RALINK_FREE(fBuffers);
+}
+
+
+status_t
+RXRing::InitCheck() const
+{
+	return fInitStatus;
+}
+
+
+/*!	Queues \a count transfers on \a pipe. The buffers are allocated by the
+	first start, and kept until the ring is deleted; restarting with another
+	count reallocates them.
+*/
+status_t
+RXRing::Start(usb_pipe pipe, uint8 endpoint, uint8 chains, int32 count)
+{
+	if (fInitStatus != B_OK)
+		return fInitStatus;
+	if (count < 1 || count > RX_RING_MAX_COUNT)
+		count = RX_RING_DEFAULT_COUNT;
+
+	// the transfers of the previous run are canceled by now, but their
+	// callbacks may still be running, and its slices still be in use
+	for (bigtime_t waited = 0;
+			atomic_get(&fPosted) != 0 || atomic_get(&fSlices) != 0;
+			waited += RX_RING_DRAIN_DELAY) {
+		if (waited >= RX_RING_DRAIN_TIMEOUT)
+			return B_BUSY;
+		platform_sleep(RX_RING_DRAIN_DELAY);
+	}
+
+	platform_sem_acquire(fReadLock);
+
+	status_t status = B_OK;
+	if (count != fCount)
+		status = _Allocate(count);
+	if (status != B_OK) {
+		platform_sem_release(fReadLock);
+		return status;
+	}
+
+	// forget what the previous run left unread
+	while (platform_sem_acquire(fReadySem, 1, 0) == B_OK)
+		;
+	fReadyHead = 0;
+	fReadyTail = 0;
+	fCurrent = NULL;
+	fStalled = 0;
+
+	for (int32 i = 0; i < fCount; i++)
+		fBuffers[i].references = 0;
+
+	fPipe = pipe;
+	fEndpoint = endpoint;
+	fChains = chains;
+	atomic_set(&fRunning, 1);
+	platform_sem_release(fReadLock);
+
+	for (int32 i = 0; i < fCount; i++) {
+		status = _Post(&fBuffers[i]);
+		if (status != B_OK) {
+			Stop();
+			return status;
+		}
+	}
+
+	TRACE(DRIVER_NAME": RX ring of %" B_PRId32 " transfers started\n",
+		fCount);
+	return B_OK;
+}
+
+
+/*!	Cancels the queued transfers and wakes up the reader waiting for one,
+	further reads fail until the next Start().
+*/
+void
+RXRing::Stop()
+{
+	if (atomic_set(&fRunning, 0) == 0)
+		return;
+
+	platform_usb_cancel(fPipe);
+
+	// a _Recycle() that still saw the ring running may queue its buffer
+	// after the cancel; wait for it, and cancel what it queued
+	if (atomic_get(&fRecycling) != 0) {
+		while (atomic_get(&fRecycling) != 0)
+			platform_sleep(RX_RING_DRAIN_DELAY);
+		platform_usb_cancel(fPipe);
+	}
+
+	platform_sem_release(fReadySem);
+}
+
+
+/*!	Copies the next received 802.11 frame into \a buffer, the read()
+	caller's, cutting it short if it does not fit. Waits for one unless
+	\a nonBlocking is set.
+*/
+status_t
+RXRing::Read(void* buffer, size_t* _length, bool nonBlocking)
+{
+	rx_slice slice;
+	status_t status = _AcquireSlice(&slice,
+		nonBlocking ? 0 : B_INFINITE_TIMEOUT, SIZE_MAX);
+	if (status != B_OK) {
+		*_length = 0;
+		return status;
+	}
+
+	size_t length = min_c(*_length, slice.frame->length);
+	status = platform_copy_to_caller(buffer, slice.frame->data, length);
+	_ReleaseSlice(&slice);
+	if (status != B_OK) {
+		*_length = 0;
+		return status;
+	}
+	*_length = length;
+
+	atomic_add64((int64*)&fDeviceStats->rx_frames, 1);
+	atomic_add64((int64*)&fDeviceStats->rx_bytes, length);
+	return B_OK;
+}
+
+
+/*!	Fills \a buffer with as many complete frames as fit, each behind a
+	ralink_rx_header. Only the first frame is waited for, unless
+	\a nonBlocking is set; it is cut short if it does not fit on its own.
+*/
+status_t
+RXRing::ReadBatch(void* buffer, size_t* _length, bool nonBlocking)
+{
+	uint8* target = (uint8*)buffer;
+	size_t size = *_length;
+	size_t offset = 0;
+	int32 frames = 0;
+	uint64 bytes = 0;
+	status_t status = B_OK;
+
+	while (offset + sizeof(ralink_rx_header) <= size) {
+		size_t available = size - offset - sizeof(ralink_rx_header);
+		rx_slice slice;
+		if (frames == 0) {
+			status = _AcquireSlice(&slice,
+				nonBlocking ? 0 : B_INFINITE_TIMEOUT, SIZE_MAX);
+		} else
+			status = _AcquireSlice(&slice, 0, available);
+		if (status != B_OK)
+			break;
+
+		const ralink_rx_frame& frame = *slice.frame;
+		ralink_rx_header header;
+		header.length = min_c(available, frame.length);
+		header.rssi = frame.rssi;
+		header.antenna = frame.antenna;
+		header.flags = frame.flags;
+		if (header.length < frame.length)
+			header.flags |= RALINK_RX_TRUNCATED;
+
+		status = platform_copy_to_caller(target + offset, &header,
+			sizeof(header));
+		if (status == B_OK) {
+			status = platform_copy_to_caller(target + offset + sizeof(header),
+				frame.data, header.length);
+		}
+		_ReleaseSlice(&slice);
+		if (status != B_OK) {
+			// the frames taken so far are lost along with this one
+			*_length = 0;
+			return status;
+		}
+
+		offset += sizeof(header) + ((header.length + RALINK_RX_HEADER_ALIGN
+			- 1) & ~(RALINK_RX_HEADER_ALIGN - 1));
+		bytes += header.length;
+		frames++;
+	}
+
+	if (frames == 0) {
+		*_length = 0;
+		return status == B_OK ? B_BAD_VALUE : status;
+	}
+
+	*_length = min_c(offset, size);
+	atomic_add64((int64*)&fDeviceStats->rx_frames, frames);
+	atomic_add64((int64*)&fDeviceStats->rx_bytes, bytes);
+	return B_OK;
+}
+
+
+/*!	Clears the halt of the pipe if a transfer stalled, and queues the
+	stalled transfers again. Returns whether there was one.
+*/
+bool
+RXRing::ClearStall()
+{
+	int32 stalled = atomic_and(&fStalled, 0);
+	if (stalled == 0)
+		return false;
+
+	status_t status = platform_usb_clear_halt(fPipe);
+	if (status != B_OK) {
+		TRACE_ALWAYS(DRIVER_NAME": could not clear the RX halt: %s\n",
+			strerror(status));
+	}
+
+	for (int32 i = 0; i < fCount; i++) {
+		if ((stalled & (1 << i)) != 0)
+			_Recycle(&fBuffers[i]);
+	}
+	return true;
+}
+
+
+void
+RXRing::GetState(uint32* _size, uint32* _posted, uint32* _ready)
+{
+	*_size = fCount;
+	*_posted = atomic_get(&fPosted);
+	*_ready = atomic_get(&fReadyTail) - atomic_get(&fReadyHead);
+}
+
+
+/*!	Takes the next frame if it is not larger than \a maxLength, waiting
+	for one up to \a timeout; B_BUFFER_OVERFLOW leaves it for the next
+	call. The slice must be released with _ReleaseSlice().
+*/
+status_t
+RXRing::_AcquireSlice(rx_slice* slice, bigtime_t timeout, size_t maxLength)
+{
+	status_t status = platform_sem_acquire(fReadLock);
+	if (status != B_OK)
+		return status;
+
+	if (atomic_get(&fRunning) == 0) {
+		platform_sem_release(fReadLock);
+		return B_FILE_ERROR;
+	}
+
+	while (fCurrent == NULL) {
+		status = platform_sem_acquire(fReadySem, 1, timeout);
+		// Stop() wakes us up without a buffer
+		if (status == B_OK && atomic_get(&fRunning) == 0)
+			status = B_FILE_ERROR;
+		if (status != B_OK) {
+			platform_sem_release(fReadLock);
+			return status;
+		}
+
+		// so does a stalled transfer
+		ClearStall();
+		if (fReadyHead == atomic_get(&fReadyTail))
+			continue;
+
+		fCurrent = &fBuffers[fReady[fReadyHead % RX_RING_MAX_COUNT]];
+		atomic_add(&fReadyHead, 1);
+	}
+
+	rx_buffer* buffer = fCurrent;
+	if (buffer->frames[buffer->next_frame].length > maxLength) {
+		platform_sem_release(fReadLock);
+		return B_BUFFER_OVERFLOW;
+	}
+
+	slice->buffer = buffer;
+	slice->frame = &buffer->frames[buffer->next_frame++];
+	atomic_add(&buffer->references, 1);
+	atomic_add(&fSlices, 1);
+
+	bool last = buffer->next_frame == buffer->frame_count;
+	if (last)
+		fCurrent = NULL;
+	platform_sem_release(fReadLock);
+
+	if (last) {
+		// drop the reference the ready list held, the slices left keep the
+		// buffer from being queued again
+		if (atomic_add(&buffer->references, -1) == 1)
+			_Recycle(buffer);
+	}
+	return B_OK;
+}
+
+
+void
+RXRing::_ReleaseSlice(rx_slice* slice)
+{
+	rx_buffer* buffer = slice->buffer;
+	slice->buffer = NULL;
+	slice->frame = NULL;
+
+	if (atomic_add(&buffer->references, -1) == 1) {
+		// the chip gets the buffer back right away
+		_Recycle(buffer);
+	}
+	atomic_add(&fSlices, -1);
+}
+
+
+status_t
+RXRing::_Allocate(int32 count)
+{
+	RALINK_FREE(fFrames);
+	RALINK_FREE(fData);
+	RALINK_FREE(fBuffers);
+	fCount = 0;
+
+	fBuffers = (rx_buffer*)RALINK_MALLOC(RALINK_ALLOC_RX_RING,
+		count * sizeof(rx_buffer));
+	fData = (uint8*)RALINK_MALLOC(RALINK_ALLOC_RX_RING,
+		count * RALINK_MAX_RX_TRANSFER);
+	fFrames = (ralink_rx_frame*)RALINK_MALLOC(RALINK_ALLOC_RX_RING,
+		count * RX_RING_MAX_FRAMES * sizeof(ralink_rx_frame));
+	if (fBuffers == NULL || fData == NULL || fFrames == NULL)
+		return B_NO_MEMORY;
+
+	for (int32 i = 0; i < count; i++) {
+		rx_buffer& buffer = fBuffers[i];
+		buffer.ring = this;
+		buffer.index = i;
+		buffer.data = fData + i * RALINK_MAX_RX_TRANSFER;
+		buffer.frames = fFrames + i * RX_RING_MAX_FRAMES;
+		buffer.frame_count = 0;
+		buffer.next_frame = 0;
+	}
+	fCount = count;
+	return B_OK;
+}
+
+
+status_t
+RXRing::_Post(rx_buffer* buffer)
+{
+	buffer->start = platform_time();
+	atomic_add(&fPosted, 1);
+
+	status_t status = platform_usb_queue_bulk(fPipe, buffer->data,
+		RALINK_MAX_RX_TRANSFER, _Callback, buffer);
+	if (status != B_OK) {
+		atomic_add(&fPosted, -1);
+		io_stats_record(fIOStats, RALINK_IO_BULK_IN, status, 0, 0);
+	}
+	return status;
+}
+
+
+/*!	Queues \a buffer on the pipe again, unless the ring was stopped. Its
+	last reference must be gone.
+*/
+void
+RXRing::_Recycle(rx_buffer* buffer)
+{
+	// counted before fRunning is checked, so that Stop() either keeps us
+	// from posting or waits until we are done
+	atomic_add(&fRecycling, 1);
+
+	// a buffer that cannot be queued is lost until the next Start()
+	if (atomic_get(&fRunning) != 0 && _Post(buffer) != B_OK)
+		TRACE_ALWAYS(DRIVER_NAME": could not requeue RX transfer\n");
+
+	atomic_add(&fRecycling, -1);
+}
+
+
+/*static*/ void
+RXRing::_Callback(void* cookie, status_t status, void* data,
+	size_t actualLength)
+{
+	RALINK_HOT_PATH(hotPath);
+	rx_buffer* buffer = (rx_buffer*)cookie;
+	RXRing* ring = buffer->ring;
+
+	// a canceled transfer was only waiting for data, it is not counted
+	if (status != B_CANCELED) {
+		io_stats_record(ring->fIOStats, RALINK_IO_BULK_IN, status,
+			actualLength, platform_time() - buffer->start);
+	}
+	TIMELINE_SPAN(TIMELINE_BULK, "BULK_IN",
+		TIMELINE_TRACK_BULK(ring->fEndpoint, buffer->index), buffer->start,
+		status, ring->fEndpoint, RALINK_MAX_RX_TRANSFER, actualLength);
+	atomic_add(&ring->fPosted, -1);
+
+	if (status == B_CANCELED || atomic_get(&ring->fRunning) == 0)
+		return;
+
+	if (status == B_DEV_STALLED) {
+		// queued again it would only stall again; like if_run.c, the halt
+		// is cleared first, which is left to a reader
+		atomic_add64((int64*)&ring->fDeviceStats->rx_stalls, 1);
+		atomic_or(&ring->fStalled, 1 << buffer->index);
+		platform_sem_release(ring->fReadySem);
+		if (ring->fSharedRings != NULL)
+			ring->fSharedRings->Interrupt();
+		return;
+	}
+
+	buffer->frame_count = 0;
+	buffer->next_frame = 0;
+	if (status == B_OK) {
+		uint32 errors;
+		buffer->frame_count = datapath_deaggregate(buffer->data, actualLength,
+			ring->fChains, buffer->frames, RX_RING_MAX_FRAMES, &errors);
+		if (errors > 0) {
+			atomic_add64((int64*)&ring->fDeviceStats->rx_errors, errors);
+		}
+		if (ring->fAggregation != NULL) {
+			ring->fAggregation->TransferCompleted(buffer->frame_count,
+				actualLength, ring->fReadyTail - ring->fReadyHead);
+		}
+	}
+
+	if (buffer->frame_count == 0 || (ring->fSharedRings != NULL
+			&& ring->fSharedRings->Receive(buffer->frames,
+				buffer->frame_count))) {
+		ring->_Recycle(buffer);
+		return;
+	}
+
+	// only this callback adds to the ready list, which keeps a reference
+	// until the last frame is handed out
+	buffer->references = 1;
+	ring->fReady[ring->fReadyTail % RX_RING_MAX_COUNT] = buffer->index;
+	atomic_add(&ring->fReadyTail, 1);
+	platform_sem_release(ring->fReadySem);
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef RX_RING_H
+#define RX_RING_H
+
+#include <USB3.h>
+#include <SupportDefs.h>
+
+#include "datapath.h"
+#include "platform.h"
+#include "ralink_ioctl.h"
+
+
+// bulk IN transfers kept queued on the read pipe; if_run.c has one
+#define RX_RING_DEFAULT_COUNT	8
+#define RX_RING_MAX_COUNT		32
+// frames one transfer holds at most, the smallest takes 48 bytes
+#define RX_RING_MAX_FRAMES		(RALINK_MAX_RX_TRANSFER / 48)
+
+
+class RXAggregation;
+class RXRing;
+class SharedRings;
+
+typedef struct rx_buffer {
+	RXRing*				ring;
+	int32				index;
+	bigtime_t			start;		// when it was queued
+	uint8*				data;		// RALINK_MAX_RX_TRANSFER bytes
+	ralink_rx_frame*	frames;		// pointing into data
+	int32				frame_count;
+	int32				next_frame;	// the one the next reader gets
+	// slices handed out, plus one until the last frame is handed out
+	vint32				references;
+} rx_buffer;
+
+/*!	A received frame, pointing into the transfer buffer it arrived in; the
+	buffer is not queued again until all its slices are released.
+*/
+typedef struct rx_slice {
+	rx_buffer*				buffer;
+	const ralink_rx_frame*	frame;
+} rx_slice;
+
+
+/*!	Keeps a ring of bulk IN transfers queued on the read pipe, so that the
+	chip always has somewhere to put the next aggregate while the previous
+	ones are being read. A completed transfer is split into its frames in
+	the callback and queued for the readers, which copy its frames to the
+	caller straight from slices of the transfer buffer. Once its last
+	frame is handed out and all slices are released, the buffer is queued
+	on the pipe again. Transfers without frames go straight back to the
+	pipe, as do those whose frames went to the mapped SharedRings.
+	A transfer the pipe halted waits for a reader to clear the halt with
+	ClearStall(), as the callback must not wait for the control transfer.
+*/
+class RXRing {
+public:
+						RXRing(ralink_io_stats* ioStats,
+							ralink_device_stats* deviceStats,
+							SharedRings* sharedRings,
+							RXAggregation* aggregation);
+						~RXRing();
+
+	status_t			InitCheck() const;
+
+	status_t			Start(usb_pipe pipe, uint8 endpoint, uint8 chains,
+							int32 count);
+	void				Stop();
+
+	status_t			Read(void* buffer, size_t* _length,
+							bool nonBlocking);
+	status_t			ReadBatch(void* buffer, size_t* _length,
+							bool nonBlocking);
+
+	bool				ClearStall();
+
+	void				GetState(uint32* _size, uint32* _posted,
+							uint32* _ready);
+
+private:
+	// Read() and ReadBatch() copy the frames out of the slices; nothing
+	// else in the driver keeps a frame, so the slices stay internal
+	status_t			_AcquireSlice(rx_slice* slice, bigtime_t timeout,
+							size_t maxLength);
+	void				_ReleaseSlice(rx_slice* slice);
+	status_t			_Allocate(int32 count);
+	status_t			_Post(rx_buffer* buffer);
+	void				_Recycle(rx_buffer* buffer);
+
+	static void			_Callback(void* cookie, status_t status, void* data,
+							size_t actualLength);
+
+	ralink_io_stats*	fIOStats;
+	ralink_device_stats* fDeviceStats;
+	SharedRings*		fSharedRings;
+	RXAggregation*		fAggregation;
+	status_t			fInitStatus;
+
+	usb_pipe			fPipe;
+	uint8				fEndpoint;
+	uint8				fChains;
+
+	int32				fCount;
+	rx_buffer*			fBuffers;
+	uint8*				fData;
+	ralink_rx_frame*	fFrames;
+
+	// completed buffers, oldest first: the callback adds at the tail, the
+	// reader holding fReadLock takes from the head
+	int32				fReady[RX_RING_MAX_COUNT];
+	vint32				fReadyHead;
+	vint32				fReadyTail;
+	platform_sem		fReadySem;
+	platform_sem		fReadLock;
+	rx_buffer*			fCurrent;	// being read, under fReadLock
+
+	vint32				fPosted;
+	vint32				fSlices;	// not yet released
+	vint32				fStalled;	// buffers the pipe halted, as bits
+	vint32				fRecycling;	// _Recycle() calls posting a buffer
+	vint32				fRunning;
+};
+
+#endif // RX_RING_H
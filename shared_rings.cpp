@@ -0,0 +1,378 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "shared_rings.h"
+
+#include "alloc_accounting.h"
+#include "driver.h"
+#include "if_runreg.h"
+#include "io_stats.h"
+#include "timeline.h"
+
+#include <string.h>
+
+
+// how long Unmap() waits for the TX transfers to be canceled
+#define SHARED_RINGS_DRAIN_TIMEOUT	1000000
+#define SHARED_RINGS_DRAIN_DELAY	1000
+
+// frames of the TX ring are sent like injected ones, as if_run.c sends
+// frames to stations it is not associated with
+#define SHARED_RINGS_TX_WCID		0xff
+#define SHARED_RINGS_RTS_THRESHOLD	2347
+
+
+SharedRings::SharedRings(ralink_io_stats* ioStats,
+	ralink_device_stats* deviceStats)
+	:
+	fIOStats(ioStats),
+	fDeviceStats(deviceStats),
+	fArea(-1),
+	fRings(NULL),
+	fSize(0),
+	fActive(0),
+	fUsers(0),
+	fTXEndpoint(0),
+	fRXTail(0),
+	fTXQueued(0),
+	fTXHead(0),
+	fWaiters(0),
+	fInterrupts(0)
+{
+	memset(&fTXParams, 0, sizeof(fTXParams));
+	fTXParams.rate_index = RT2860_RIDX_CCK1;
+	fTXParams.basic_rate_index = RT2860_RIDX_CCK1;
+	fTXParams.wcid = SHARED_RINGS_TX_WCID;
+	fTXParams.rts_threshold = SHARED_RINGS_RTS_THRESHOLD;
+	fTXParams.station = true;
+
+	for (int32 i = 0; i < RALINK_RING_SLOTS; i++) {
+		fTransfers[i].rings = this;
+		fTransfers[i].done = 1;
+	}
+
+	fInitStatus = platform_sem_create(&fSyncLock, 1, DRIVER_NAME"_rings");
+	if (fInitStatus != B_OK)
+		return;
+
+	fInitStatus = platform_sem_create(&fWakeSem, 0, DRIVER_NAME"_rings_wait");
+	if (fInitStatus != B_OK)
+		platform_sem_delete(fSyncLock);
+}
+
+
+SharedRings::~SharedRings()
+{
+	Unmap();
+
+	if (fInitStatus == B_OK) {
+		platform_sem_delete(fWakeSem);
+		platform_sem_delete(fSyncLock);
+	}
+}
+
+
+status_t
+SharedRings::InitCheck() const
+{
+	return fInitStatus;
+}
+
+
+/*!	Creates the area on the first call, later ones return the same one. */
+status_t
+SharedRings::Map(ralink_ring_map* map)
+{
+	if (fInitStatus != B_OK)
+		return fInitStatus;
+
+	platform_sem_acquire(fSyncLock);
+	if (fRings != NULL && atomic_get(&fActive) == 0) {
+		// an Unmap() gave up waiting for the transfers still using it
+		platform_sem_release(fSyncLock);
+		return B_BUSY;
+	}
+	if (fRings == NULL) {
+		size_t size = sizeof(ralink_shared_rings)
+			+ 2 * RALINK_RING_SLOTS * RALINK_RING_BUFFER_SIZE;
+		void* address;
+		status_t status = platform_area_create(&fArea, &address, size,
+			DRIVER_NAME" rings");
+		if (status != B_OK) {
+			platform_sem_release(fSyncLock);
+			return status;
+		}
+
+		fRings = (ralink_shared_rings*)address;
+		fSize = size;
+		memset(fRings, 0, sizeof(ralink_shared_rings));
+		fRXTail = 0;
+		fTXQueued = 0;
+		fTXHead = 0;
+		atomic_set(&fActive, 1);
+	}
+
+	map->area = fArea;
+	map->size = fSize;
+	platform_sem_release(fSyncLock);
+	return B_OK;
+}
+
+
+/*!	Deletes the area, once the transfers that use it are done; the write
+	pipe must have been canceled before. If they are not done in time, the
+	area is kept, and the next Unmap() tries again.
+*/
+void
+SharedRings::Unmap()
+{
+	if (fRings == NULL)
+		return;
+
+	atomic_set(&fActive, 0);
+	Interrupt();
+
+	platform_sem_acquire(fSyncLock);
+	for (bigtime_t waited = 0; waited < SHARED_RINGS_DRAIN_TIMEOUT;
+			waited += SHARED_RINGS_DRAIN_DELAY) {
+		_ReclaimTX();
+		if (fTXHead == fTXQueued && atomic_get(&fUsers) == 0)
+			break;
+		platform_sleep(SHARED_RINGS_DRAIN_DELAY);
+	}
+	if (fTXHead != fTXQueued || atomic_get(&fUsers) != 0) {
+		// better leak the area than let a transfer write into freed memory,
+		// and a late Receive() still finds fRings
+		TRACE_ALWAYS(DRIVER_NAME": transfers still use the shared rings\n");
+		platform_sem_release(fSyncLock);
+		return;
+	}
+
+	platform_area_delete(fArea);
+	fRings = NULL;
+	fArea = -1;
+	platform_sem_release(fSyncLock);
+}
+
+
+/*!	Puts \a frames into the RX ring, from the RX ring callback. Returns
+	false if the rings are not mapped, the frames are for read() then.
+	Frames that find the ring full are dropped.
+*/
+bool
+SharedRings::Receive(const ralink_rx_frame* frames, int32 count)
+{
+	atomic_add(&fUsers, 1);
+	if (atomic_get(&fActive) == 0) {
+		atomic_add(&fUsers, -1);
+		return false;
+	}
+
+	// Unmap() waits for us before it lets go of the rings
+	ralink_shared_rings* rings = fRings;
+	ralink_ring& ring = rings->rx;
+	uint32 head = ring.head;
+	uint64 bytes = 0;
+	int32 received = 0;
+	for (int32 i = 0; i < count; i++) {
+		if (fRXTail - head >= RALINK_RING_SLOTS)
+			break;
+
+		const ralink_rx_frame& frame = frames[i];
+		ralink_rx_header& slot = ring.slots[fRXTail % RALINK_RING_SLOTS];
+		uint16 length = min_c(frame.length, RALINK_RING_BUFFER_SIZE);
+		memcpy(RALINK_RING_RX_BUFFER(rings, fRXTail), frame.data, length);
+		slot.length = length;
+		slot.rssi = frame.rssi;
+		slot.antenna = frame.antenna;
+		slot.flags = frame.flags;
+		if (length < frame.length)
+			slot.flags |= RALINK_RX_TRUNCATED;
+
+		fRXTail++;
+		bytes += length;
+		received++;
+	}
+	atomic_set((vint32*)&ring.tail, fRXTail);
+
+	atomic_add64((int64*)&fDeviceStats->rx_frames, received);
+	atomic_add64((int64*)&fDeviceStats->rx_bytes, bytes);
+	if (received < count) {
+		atomic_add64((int64*)&fDeviceStats->rx_errors, count - received);
+	}
+
+	_Wake();
+	atomic_add(&fUsers, -1);
+	return true;
+}
+
+
+/*!	Queues the TX slots the caller added on \a pipe, hands back the sent
+	ones, and then waits for what \a flags ask for, unless \a nonBlocking
+	is set.
+*/
+status_t
+SharedRings::Sync(usb_pipe pipe, uint8 endpoint, uint32 flags,
+	bool nonBlocking)
+{
+	status_t status = platform_sem_acquire(fSyncLock);
+	if (status != B_OK)
+		return status;
+
+	if (fRings == NULL || atomic_get(&fActive) == 0) {
+		platform_sem_release(fSyncLock);
+		return B_NOT_ALLOWED;
+	}
+
+	fTXEndpoint = endpoint;
+	uint32 startHead = fTXHead;
+	int32 interrupts = atomic_get(&fInterrupts);
+	status = _QueueTX(pipe);
+	_ReclaimTX();
+
+	while (status == B_OK && !nonBlocking && !_SyncDone(flags, startHead)) {
+		// the interrupt count is checked after registering as a waiter,
+		// so that Interrupt() cannot slip in between
+		atomic_add(&fWaiters, 1);
+		if (atomic_get(&fInterrupts) != interrupts)
+			status = B_INTERRUPTED;
+		else if (!_SyncDone(flags, startHead)) {
+			platform_sem_release(fSyncLock);
+			platform_sem_acquire(fWakeSem);
+			platform_sem_acquire(fSyncLock);
+		}
+		atomic_add(&fWaiters, -1);
+
+		if (fRings == NULL)
+			status = B_INTERRUPTED;
+		else
+			_ReclaimTX();
+	}
+
+	platform_sem_release(fSyncLock);
+	return status;
+}
+
+
+/*!	Wakes up the callers waiting in Sync(), they return B_INTERRUPTED. */
+void
+SharedRings::Interrupt()
+{
+	atomic_add(&fInterrupts, 1);
+	_Wake();
+}
+
+
+status_t
+SharedRings::_QueueTX(usb_pipe pipe)
+{
+	uint32 tail = fRings->tx.tail;
+	// the caller may only add slots, and not more than the ring holds
+	if (tail - fTXHead > RALINK_RING_SLOTS
+		|| tail - fTXHead < fTXQueued - fTXHead)
+		return B_BAD_DATA;
+
+	for (; fTXQueued != tail; fTXQueued++) {
+		uint32 index = fTXQueued;
+		shared_tx_transfer& transfer = fTransfers[index % RALINK_RING_SLOTS];
+		ralink_rx_header& slot = fRings->tx.slots[index % RALINK_RING_SLOTS];
+		uint8* buffer = RALINK_RING_TX_BUFFER(fRings, index);
+
+		transfer.index = index;
+		transfer.slot = &slot;
+		transfer.length = slot.length;
+		transfer.start = platform_time();
+		atomic_set(&transfer.done, 0);
+
+		size_t transferLength;
+		uint8 queue;
+		status_t status = B_BAD_VALUE;
+		if (transfer.length <= RALINK_RING_TX_MAX_FRAME) {
+			status = datapath_build_tx(&fTXParams,
+				buffer + RALINK_RING_TX_HEADROOM, transfer.length, buffer,
+				RALINK_RING_BUFFER_SIZE, &transferLength, &queue);
+		}
+		if (status == B_OK) {
+			slot.flags = 0;
+			atomic_add(&fUsers, 1);
+			status = platform_usb_queue_bulk(pipe, buffer, transferLength,
+				_TXCallback, &transfer);
+			if (status != B_OK)
+				atomic_add(&fUsers, -1);
+		}
+		if (status != B_OK) {
+			slot.flags = RALINK_TX_FAILED;
+			atomic_add64((int64*)&fDeviceStats->tx_errors, 1);
+			atomic_set(&transfer.done, 1);
+		}
+	}
+	return B_OK;
+}
+
+
+/*!	Hands back the slots that are done, in order. */
+void
+SharedRings::_ReclaimTX()
+{
+	while (fTXHead != fTXQueued
+		&& atomic_get(&fTransfers[fTXHead % RALINK_RING_SLOTS].done) != 0)
+		fTXHead++;
+
+	if (fRings != NULL)
+		atomic_set((vint32*)&fRings->tx.head, fTXHead);
+}
+
+
+bool
+SharedRings::_SyncDone(uint32 flags, uint32 startHead)
+{
+	if ((flags & RALINK_SYNC_WAIT_RX) != 0 && fRings->rx.head == fRXTail)
+		return false;
+	if ((flags & RALINK_SYNC_WAIT_TX) != 0 && fTXHead == startHead
+		&& fTXHead != fTXQueued)
+		return false;
+	return true;
+}
+
+
+void
+SharedRings::_Wake()
+{
+	int32 waiters = atomic_get(&fWaiters);
+	if (waiters > 0)
+		platform_sem_release(fWakeSem, waiters);
+}
+
+
+/*static*/ void
+SharedRings::_TXCallback(void* cookie, status_t status, void* data,
+	size_t actualLength)
+{
+	RALINK_HOT_PATH(hotPath);
+	shared_tx_transfer* transfer = (shared_tx_transfer*)cookie;
+	SharedRings* rings = transfer->rings;
+
+	if (status != B_CANCELED) {
+		io_stats_record(rings->fIOStats, RALINK_IO_BULK_OUT, status,
+			actualLength, platform_time() - transfer->start);
+	}
+	TIMELINE_SPAN(TIMELINE_BULK, "BULK_OUT",
+		TIMELINE_TRACK_BULK(rings->fTXEndpoint,
+			transfer->index % RALINK_RING_SLOTS),
+		transfer->start, status, rings->fTXEndpoint, actualLength);
+
+	if (status == B_OK) {
+		atomic_add64((int64*)&rings->fDeviceStats->tx_frames, 1);
+		atomic_add64((int64*)&rings->fDeviceStats->tx_bytes,
+			transfer->length);
+	} else {
+		transfer->slot->flags = RALINK_TX_FAILED;
+		atomic_add64((int64*)&rings->fDeviceStats->tx_errors, 1);
+	}
+
+	atomic_set(&transfer->done, 1);
+	rings->_Wake();
+	atomic_add(&rings->fUsers, -1);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef SHARED_RINGS_H
+#define SHARED_RINGS_H
+
+#include <USB3.h>
+#include <SupportDefs.h>
+
+#include "datapath.h"
+#include "platform.h"
+#include "ralink_ioctl.h"
+
+
+class SharedRings;
+
+typedef struct shared_tx_transfer {
+	SharedRings*		rings;
+	uint32				index;		// of the TX slot
+	ralink_rx_header*	slot;		// in the area
+	uint16				length;		// of its frame
+	bigtime_t			start;
+	vint32				done;		// the slot can be handed back
+} shared_tx_transfer;
+
+
+/*!	The RX and TX rings of RALINK_MAP_RINGS, in an area the caller clones,
+	in the manner of netmap: the RX ring callbacks put received frames
+	straight into the RX slots, and Sync() sends the TX slots from where
+	the caller wrote them, building the TXD and TXWI in their headroom.
+
+	Everything in the area may be changed by the caller at any time, so
+	the driver keeps its own copy of the indices it owns, and reads the
+	caller's ones and the TX lengths only once.
+*/
+class SharedRings {
+public:
+							SharedRings(ralink_io_stats* ioStats,
+								ralink_device_stats* deviceStats);
+							~SharedRings();
+
+	status_t				InitCheck() const;
+
+	status_t				Map(ralink_ring_map* map);
+	void					Unmap();
+	bool					IsMapped() const
+								{ return fRings != NULL; }
+
+	bool					Receive(const ralink_rx_frame* frames,
+								int32 count);
+	status_t				Sync(usb_pipe pipe, uint8 endpoint,
+								uint32 flags, bool nonBlocking);
+	void					Interrupt();
+
+private:
+	status_t				_QueueTX(usb_pipe pipe);
+	void					_ReclaimTX();
+	bool					_SyncDone(uint32 flags, uint32 startHead);
+	void					_Wake();
+
+	static void				_TXCallback(void* cookie, status_t status,
+								void* data, size_t actualLength);
+
+	ralink_io_stats*		fIOStats;
+	ralink_device_stats*	fDeviceStats;
+	status_t				fInitStatus;
+
+	platform_area			fArea;
+	ralink_shared_rings*	fRings;
+	size_t					fSize;
+	// Receive() and the TX callbacks in the area, Unmap() waits for them
+	vint32					fActive;
+	vint32					fUsers;
+
+	ralink_tx_params		fTXParams;
+	uint8					fTXEndpoint;
+
+	// under fSyncLock, except fRXTail which only Receive() touches
+	uint32					fRXTail;
+	uint32					fTXQueued;
+	uint32					fTXHead;
+	shared_tx_transfer		fTransfers[RALINK_RING_SLOTS];
+
+	platform_sem			fSyncLock;
+	platform_sem			fWakeSem;
+	vint32					fWaiters;
+	vint32					fInterrupts;
+};
+
+#endif // SHARED_RINGS_H
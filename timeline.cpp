@@ -0,0 +1,109 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "timeline.h"
+
+#ifdef RALINK_TIMELINE
+
+#include <stdlib.h>
+
+#include "alloc_accounting.h"
+#include "ralink_ioctl.h"
+
+
+static timeline_event* sEvents = NULL;
+static uint32 sCapacity = 0;
+static vint32 sNextEvent = 0;
+static vint32 sRecording = 0;
+
+static const char* kIONames[RALINK_IO_TYPES] = {
+	"WRITE_2", "WRITE_REGION", "READ_REGION", "EEPROM_READ", "RESET",
+	"BULK_IN", "BULK_OUT"
+};
+
+
+/*!	Starts a recording of at most \a capacity spans, dropping the previous
+	one. Spans beyond the capacity are counted, but not kept.
+*/
+status_t
+timeline_start(uint32 capacity)
+{
+	timeline_stop();
+
+	timeline_event* events
+		= (timeline_event*)RALINK_MALLOC(RALINK_ALLOC_TIMELINE,
+			capacity * sizeof(timeline_event));
+	if (events == NULL)
+		return B_NO_MEMORY;
+
+	RALINK_FREE(sEvents);
+	sEvents = events;
+	sCapacity = capacity;
+	atomic_set(&sNextEvent, 0);
+	atomic_set(&sRecording, 1);
+	return B_OK;
+}
+
+
+/*!	Ends the recording. Spans still being recorded by other threads may get
+	lost, so this should be called once the driver is idle.
+*/
+void
+timeline_stop()
+{
+	atomic_set(&sRecording, 0);
+}
+
+
+const timeline_event*
+timeline_events(uint32* _count, uint32* _dropped)
+{
+	uint32 recorded = (uint32)atomic_get(&sNextEvent);
+	*_count = min_c(recorded, sCapacity);
+	*_dropped = recorded - *_count;
+	return sEvents;
+}
+
+
+/*!	Records a span from \a start until now. Lock-free, so it may be called
+	from completion callbacks.
+*/
+void
+timeline_record(uint8 category, const char* name, int32 track,
+	bigtime_t start, status_t status, uint32 arg0, uint32 arg1, uint32 arg2,
+	uint32 arg3)
+{
+	if (atomic_get(&sRecording) == 0)
+		return;
+
+	bigtime_t now = platform_time();
+	uint32 index = (uint32)atomic_add(&sNextEvent, 1);
+	if (index >= sCapacity)
+		return;
+
+	timeline_event* event = &sEvents[index];
+	event->start = start;
+	event->duration = now - start;
+	event->name = name;
+	event->track = track != TIMELINE_TRACK_THREAD
+		? track : platform_thread_id();
+	event->category = category;
+	event->status = status;
+	event->args[0] = arg0;
+	event->args[1] = arg1;
+	event->args[2] = arg2;
+	event->args[3] = arg3;
+}
+
+
+const char*
+timeline_io_name(int32 type)
+{
+	if (type < 0 || type >= RALINK_IO_TYPES)
+		return "?";
+	return kIONames[type];
+}
+
+#endif	// RALINK_TIMELINE
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <SupportDefs.h>
+
+#include "platform.h"
+
+
+/*!	Optional recorder of what the driver spends its time on, as spans with
+	a start and a duration. Only built with RALINK_TIMELINE (the host build
+	defines it), and only records between timeline_start() and
+	timeline_stop(); the host tools turn the recording into Chrome
+	trace-event JSON, see host/timeline_json.h.
+
+	Every span is drawn on a track: the thread that recorded it, or for
+	transfers that complete asynchronously, one of the TIMELINE_TRACK_*
+	tracks, on which spans never overlap.
+*/
+
+
+enum {
+	TIMELINE_CONTROL = 0,	// request, value, index, length
+	TIMELINE_BULK,			// endpoint, length, actual length
+	TIMELINE_FIRMWARE,		// bytes
+	TIMELINE_MCU_COMMAND,	// command, argument
+	TIMELINE_POLL,			// register, iterations
+	TIMELINE_DEVICE,		// -
+	TIMELINE_CATEGORIES
+};
+
+// the calling thread
+#define TIMELINE_TRACK_THREAD				0
+// one track per ControlQueue slot and per bulk buffer
+#define TIMELINE_TRACK_CONTROL_SLOT(slot)	(0x40000000 + (slot))
+#define TIMELINE_TRACK_BULK(endpoint, buffer) \
+	(0x40010000 + ((endpoint) << 8) + (buffer))
+
+
+typedef struct timeline_event {
+	bigtime_t	start;
+	bigtime_t	duration;
+	const char*	name;		// static string
+	int32		track;
+	uint8		category;	// TIMELINE_*
+	status_t	status;
+	uint32		args[4];	// see the categories
+} timeline_event;
+
+
+#ifdef RALINK_TIMELINE
+
+status_t	timeline_start(uint32 capacity);
+void		timeline_stop();
+// only valid after timeline_stop(), until the next timeline_start()
+const timeline_event* timeline_events(uint32* _count, uint32* _dropped);
+
+void		timeline_record(uint8 category, const char* name, int32 track,
+				bigtime_t start, status_t status, uint32 arg0 = 0,
+				uint32 arg1 = 0, uint32 arg2 = 0, uint32 arg3 = 0);
+
+const char*	timeline_io_name(int32 type);
+
+
+/*!	Records the scope it lives in as a span on the calling thread. */
+class TimelineScope {
+public:
+						TimelineScope(uint8 category, const char* name,
+							uint32 arg0 = 0, uint32 arg1 = 0)
+							:
+							fCategory(category),
+							fName(name),
+							fStart(platform_time()),
+							fStatus(B_OK),
+							fArg0(arg0),
+							fArg1(arg1)
+						{
+						}
+
+						~TimelineScope()
+						{
+							timeline_record(fCategory, fName,
+								TIMELINE_TRACK_THREAD, fStart, fStatus, fArg0,
+								fArg1);
+						}
+
+	void				SetStatus(status_t status) { fStatus = status; }
+
+private:
+	uint8				fCategory;
+	const char*			fName;
+	bigtime_t			fStart;
+	status_t			fStatus;
+	uint32				fArg0;
+	uint32				fArg1;
+};
+
+#define TIMELINE_SPAN(category, name, track, start, status, args...) \
+	timeline_record((category), (name), (track), (start), (status), ##args)
+#define TIMELINE_SCOPE(variable, category, name, args...) \
+	TimelineScope variable((category), (name), ##args)
+#define TIMELINE_SCOPE_STATUS(variable, status) \
+	(variable).SetStatus(status)
+
+#else	// !RALINK_TIMELINE
+
+#define TIMELINE_SPAN(category, name, track, start, status, args...) \
+	do {} while (0)
+#define TIMELINE_SCOPE(variable, category, name, args...) \
+	do {} while (0)
+#define TIMELINE_SCOPE_STATUS(variable, status) \
+	do {} while (0)
+
+#endif	// !RALINK_TIMELINE
+
+#endif // TIMELINE_H
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*!	ralink_stat: polls the statistics ioctls of a ralink_usb adapter and
+	prints what happened per second, as a table or as CSV.
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <OS.h>
+
+#include "ralink_ioctl.h"
+
+
+#define DEVICE_BASE_NAME	"/dev/net/usb_ralink/"
+#define HEADER_INTERVAL		20
+
+
+typedef struct sample {
+	bigtime_t			time;
+	ralink_device_stats	device;
+	ralink_io_stats		io;
+} sample;
+
+
+static void
+usage(const char* program)
+{
+	fprintf(stderr, "usage: %s [-i <seconds>] [-n <count>] [-c] "
+		"[<index> | <device>]\n"
+		"  -i  seconds between samples, default 1\n"
+		"  -n  samples to print, default until interrupted\n"
+		"  -c  print CSV instead of a table\n"
+		"The device defaults to " DEVICE_BASE_NAME "0.\n", program);
+	exit(1);
+}
+
+
+static status_t
+take_sample(int fd, sample* sample)
+{
+	if (ioctl(fd, RALINK_GET_DEVICE_STATS, &sample->device,
+			sizeof(sample->device)) != 0
+		|| ioctl(fd, RALINK_GET_IO_STATS, &sample->io,
+			sizeof(sample->io)) != 0)
+		return B_ERROR;
+
+	sample->time = system_time();
+	return B_OK;
+}
+
+
+/*!	Sums the transfers of the given RALINK_IO_* types that completed
+	between two samples.
+*/
+static void
+io_delta(const sample& previous, const sample& current, int32 firstType,
+	int32 lastType, ralink_io_counter* delta)
+{
+	memset(delta, 0, sizeof(*delta));
+	for (int32 type = firstType; type <= lastType; type++) {
+		const ralink_io_counter& before = previous.io.types[type];
+		const ralink_io_counter& after = current.io.types[type];
+		delta->requests += after.requests - before.requests;
+		delta->errors += after.errors - before.errors;
+		delta->bytes += after.bytes - before.bytes;
+		delta->total_time += after.total_time - before.total_time;
+		delta->saved += after.saved - before.saved;
+		for (int32 i = 0; i < RALINK_IO_HISTOGRAM_BUCKETS; i++)
+			delta->histogram[i] += after.histogram[i] - before.histogram[i];
+	}
+}
+
+
+static double
+average_latency(const ralink_io_counter& counter)
+{
+	return counter.requests > 0
+		? (double)counter.total_time / counter.requests : 0;
+}
+
+
+/*!	Upper bound of the histogram bucket the 99th percentile falls in. */
+static uint64
+latency_p99(const ralink_io_counter& counter)
+{
+	uint64 count = 0;
+	for (int32 i = 0; i < RALINK_IO_HISTOGRAM_BUCKETS; i++)
+		count += counter.histogram[i];
+	if (count == 0)
+		return 0;
+
+	uint64 threshold = count - count / 100;
+	uint64 seen = 0;
+	for (int32 i = 0; i < RALINK_IO_HISTOGRAM_BUCKETS; i++) {
+		seen += counter.histogram[i];
+		if (seen >= threshold)
+			return 1ULL << i;
+	}
+	return 1ULL << (RALINK_IO_HISTOGRAM_BUCKETS - 1);
+}
+
+
+static void
+print_header(bool csv)
+{
+	if (csv) {
+		printf("time_s,rx_frames_s,rx_bytes_s,rx_errors_s,tx_frames_s,"
+			"tx_bytes_s,tx_errors_s,tx_retries_s,bulk_in_s,bulk_in_avg_us,"
+			"bulk_in_p99_us,bulk_out_s,bulk_out_avg_us,control_s,"
+			"control_avg_us,control_saved_s,usb_errors_s,rx_ring_size,"
+			"rx_ring_posted,rx_ring_ready\n");
+		return;
+	}
+
+	printf("%7s %8s %8s %6s %8s %8s %6s %6s | %7s %6s %6s %7s %6s %6s "
+		"%6s %6s %5s | %s\n", "time", "rx fr/s", "rx kB/s", "err/s",
+		"tx fr/s", "tx kB/s", "err/s", "rtry/s", "in/s", "avg us", "p99 us",
+		"out/s", "avg us", "ctl/s", "avg us", "sav/s", "err/s", "rx ring");
+}
+
+
+static void
+print_rates(const sample& first, const sample& previous,
+	const sample& current, bool csv)
+{
+	double seconds = (current.time - previous.time) / 1000000.0;
+	if (seconds <= 0)
+		return;
+
+	const ralink_device_stats& before = previous.device;
+	const ralink_device_stats& after = current.device;
+	double rxFrames = (after.rx_frames - before.rx_frames) / seconds;
+	double rxBytes = (after.rx_bytes - before.rx_bytes) / seconds;
+	double rxErrors = (after.rx_errors - before.rx_errors) / seconds;
+	double txFrames = (after.tx_frames - before.tx_frames) / seconds;
+	double txBytes = (after.tx_bytes - before.tx_bytes) / seconds;
+	double txErrors = (after.tx_errors - before.tx_errors) / seconds;
+	double txRetries = (after.tx_retries - before.tx_retries) / seconds;
+
+	ralink_io_counter bulkIn;
+	ralink_io_counter bulkOut;
+	ralink_io_counter control;
+	io_delta(previous, current, RALINK_IO_BULK_IN, RALINK_IO_BULK_IN,
+		&bulkIn);
+	io_delta(previous, current, RALINK_IO_BULK_OUT, RALINK_IO_BULK_OUT,
+		&bulkOut);
+	io_delta(previous, current, RALINK_IO_WRITE_2, RALINK_IO_RESET,
+		&control);
+	double usbErrors = (bulkIn.errors + bulkOut.errors + control.errors)
+		/ seconds;
+	double time = (current.time - first.time) / 1000000.0;
+
+	if (csv) {
+		printf("%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,"
+			"%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%u,%u,%u\n", time, rxFrames,
+			rxBytes, rxErrors, txFrames, txBytes, txErrors, txRetries,
+			bulkIn.requests / seconds, average_latency(bulkIn),
+			(unsigned long long)latency_p99(bulkIn),
+			bulkOut.requests / seconds, average_latency(bulkOut),
+			control.requests / seconds, average_latency(control),
+			control.saved / seconds, usbErrors,
+			after.rx_ring_size, after.rx_ring_posted, after.rx_ring_ready);
+		return;
+	}
+
+	printf("%7.1f %8.0f %8.1f %6.0f %8.0f %8.1f %6.0f %6.0f | %7.0f %6.0f "
+		"%6llu %7.0f %6.0f %6.0f %6.0f %6.0f %5.0f | %u/%u posted, "
+		"%u ready\n", time, rxFrames, rxBytes / 1024, rxErrors, txFrames,
+		txBytes / 1024, txErrors, txRetries, bulkIn.requests / seconds,
+		average_latency(bulkIn), (unsigned long long)latency_p99(bulkIn),
+		bulkOut.requests / seconds, average_latency(bulkOut),
+		control.requests / seconds, average_latency(control),
+		control.saved / seconds, usbErrors,
+		after.rx_ring_posted, after.rx_ring_size, after.rx_ring_ready);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	bigtime_t interval = 1000000;
+	int32 count = -1;
+	bool csv = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "i:n:c")) != -1) {
+		switch (option) {
+			case 'i':
+				interval = (bigtime_t)(strtod(optarg, NULL) * 1000000);
+				break;
+			case 'n':
+				count = strtol(optarg, NULL, 0);
+				break;
+			case 'c':
+				csv = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (interval <= 0 || count == 0 || argc - optind > 1)
+		usage(argv[0]);
+
+	char path[B_PATH_NAME_LENGTH];
+	const char* device = optind < argc ? argv[optind] : "0";
+	if (strchr(device, '/') == NULL)
+		snprintf(path, sizeof(path), DEVICE_BASE_NAME "%s", device);
+	else
+		strlcpy(path, device, sizeof(path));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	sample first;
+	if (take_sample(fd, &first) != B_OK) {
+		fprintf(stderr, "%s: the statistics ioctls failed: %s\n", path,
+			strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	sample previous = first;
+	for (int32 line = 0; count < 0 || line < count; line++) {
+		if (line == 0 || (!csv && line % HEADER_INTERVAL == 0))
+			print_header(csv);
+
+		snooze(interval);
+
+		sample current;
+		if (take_sample(fd, &current) != B_OK) {
+			// the adapter was unplugged
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			close(fd);
+			return 1;
+		}
+
+		print_rates(first, previous, current, csv);
+		fflush(stdout);
+		previous = current;
+	}
+
+	close(fd);
+	return 0;
+}
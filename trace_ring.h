@@ -0,0 +1,113 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include <SupportDefs.h>
+
+#include <string.h>
+
+#include "platform.h"
+#include "ralink_ioctl.h"
+
+
+// trace points above this level are compiled out
+#ifndef RALINK_TRACE_LEVEL
+#define RALINK_TRACE_LEVEL	RALINK_TRACE_INFO
+#endif
+
+#define RALINK_TRACE_POINT(ring, level, event, arg0, arg1, arg2, arg3) \
+	do { \
+		if ((level) <= RALINK_TRACE_LEVEL) { \
+			trace_ring_record((ring), (level), (event), (uint32)(arg0), \
+				(uint32)(arg1), (uint32)(arg2), (uint32)(arg3)); \
+		} \
+	} while (0)
+
+
+typedef struct trace_slot {
+	vint32				sequence;	// 0 while the record is written
+	ralink_trace_record	record;
+} trace_slot;
+
+typedef struct trace_ring {
+	vint32				head;		// sequence of the latest record
+	trace_slot			slots[RALINK_TRACE_RING_SIZE];
+} trace_ring;
+
+
+static inline void
+trace_ring_init(trace_ring* ring)
+{
+	memset(ring, 0, sizeof(trace_ring));
+}
+
+
+/*!	Appends one record, overwriting the oldest. Writers only reserve their
+	slot with an atomic add, so this may be called from any hook or
+	completion callback concurrently.
+*/
+static inline void
+trace_ring_record(trace_ring* ring, uint8 level, uint16 event, uint32 arg0,
+	uint32 arg1, uint32 arg2, uint32 arg3)
+{
+	uint32 sequence = (uint32)atomic_add(&ring->head, 1) + 1;
+	trace_slot* slot = &ring->slots[sequence & (RALINK_TRACE_RING_SIZE - 1)];
+
+	atomic_set(&slot->sequence, 0);
+	slot->record.time = platform_time();
+	slot->record.sequence = sequence;
+	slot->record.event = event;
+	slot->record.level = level;
+	slot->record.reserved = 0;
+	slot->record.args[0] = arg0;
+	slot->record.args[1] = arg1;
+	slot->record.args[2] = arg2;
+	slot->record.args[3] = arg3;
+	atomic_set(&slot->sequence, (int32)sequence);
+}
+
+
+/*!	Copies the records still in the ring to the caller's \a dump, oldest
+	first. A record is only taken if its slot carries the same sequence
+	before and after the copy, records being written or overwritten
+	meanwhile count as lost.
+*/
+static inline status_t
+trace_ring_dump(trace_ring* ring, ralink_trace_dump* dump)
+{
+	uint32 head = (uint32)atomic_get(&ring->head);
+	uint32 first = head > RALINK_TRACE_RING_SIZE
+		? head - RALINK_TRACE_RING_SIZE + 1 : 1;
+
+	uint32 count = 0;
+	for (uint32 sequence = first; sequence <= head && sequence != 0;
+			sequence++) {
+		trace_slot* slot
+			= &ring->slots[sequence & (RALINK_TRACE_RING_SIZE - 1)];
+		if ((uint32)atomic_get(&slot->sequence) != sequence)
+			continue;
+		ralink_trace_record record = slot->record;
+		if ((uint32)atomic_get(&slot->sequence) != sequence)
+			continue;
+
+		status_t status = platform_copy_to_caller(&dump->records[count],
+			&record, sizeof(record));
+		if (status != B_OK)
+			return status;
+		count++;
+	}
+
+	uint32 lost = head - count;
+	status_t status = platform_copy_to_caller(&dump->count, &count,
+		sizeof(count));
+	if (status == B_OK) {
+		status = platform_copy_to_caller(&dump->lost, &lost,
+			sizeof(lost));
+	}
+	return status;
+}
+
+#endif // TRACE_RING_H
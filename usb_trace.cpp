@@ -0,0 +1,485 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "usb_trace.h"
+
+#include "alloc_accounting.h"
+#include "driver.h"
+#include "platform.h"
+
+#include <KernelExport.h>
+#include <driver_settings.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// endpoint handles whose addresses are known from the configurations
+#define USB_TRACE_MAX_PIPES		32
+// transfers that can be traced while in flight; the RX ring, the TX path
+// and the control queue stay well below
+#define USB_TRACE_MAX_TRANSFERS	256
+
+typedef struct trace_transfer {
+	usb_callback_func	callback;
+	void*				cookie;
+	uint32				id;
+	uint32				handle;
+	uint8				endpoint;
+	bool				in;
+} trace_transfer;
+
+typedef struct trace_pipe {
+	usb_pipe			handle;
+	uint8				address;
+} trace_pipe;
+
+
+static usb_module_info* sModule = NULL;
+static usb_module_info sTracingModule;
+static char sPath[B_PATH_NAME_LENGTH];
+static bigtime_t sStart;
+
+// records are appended lock free: a writer reserves its bytes with an
+// atomic add on sUsed; the first reservation that does not fit marks the
+// end of the trace in sEnd
+static uint8* sBuffer = NULL;
+static int32 sCapacity = 0;
+static vint32 sUsed = 0;
+static vint32 sEnd = -1;
+static vint32 sDropped = 0;
+static vint32 sNextID = 0;
+
+static trace_pipe sPipes[USB_TRACE_MAX_PIPES];
+static vint32 sPipeCount = 0;
+
+// transfers in flight come from a pool allocated with the buffer, as the
+// bulk IN transfers are queued again from their completion callbacks; a
+// set bit in sTransferBusy marks a record as taken
+static trace_transfer* sTransfers = NULL;
+static vint32 sTransferBusy[USB_TRACE_MAX_TRANSFERS / 32];
+static vint32 sTransferHint = 0;
+
+
+static void
+trace_record(usb_trace_record* record, const void* payload,
+	size_t payloadLength)
+{
+	if (payload == NULL)
+		payloadLength = 0;
+
+	int32 size = sizeof(usb_trace_record) + ((payloadLength + 3) & ~3);
+	int32 offset = atomic_add(&sUsed, size);
+	if (offset < 0 || offset > sCapacity - size) {
+		atomic_add(&sDropped, 1);
+		int32 end;
+		do {
+			end = atomic_get(&sEnd);
+		} while ((end < 0 || offset < end)
+			&& atomic_test_and_set(&sEnd, offset, end) != end);
+		return;
+	}
+
+	record->time = system_time() - sStart;
+	record->payload = payloadLength;
+	memcpy(sBuffer + offset, record, sizeof(usb_trace_record));
+	if (payloadLength > 0) {
+		memcpy(sBuffer + offset + sizeof(usb_trace_record), payload,
+			payloadLength);
+	}
+}
+
+
+static void
+trace_setup(usb_trace_record* record, uint8 type, uint32 handle,
+	uint8 requestType, uint8 request, uint16 value, uint16 index,
+	uint16 length)
+{
+	memset(record, 0, sizeof(usb_trace_record));
+	record->type = type;
+	record->handle = handle;
+	record->length = length;
+	record->setup[0] = requestType;
+	record->setup[1] = request;
+	record->setup[2] = value & 0xff;
+	record->setup[3] = value >> 8;
+	record->setup[4] = index & 0xff;
+	record->setup[5] = index >> 8;
+	record->setup[6] = length & 0xff;
+	record->setup[7] = length >> 8;
+}
+
+
+static void
+trace_remember_pipes(const usb_configuration_info* config)
+{
+	if (config == NULL)
+		return;
+
+	for (size_t i = 0; i < config->interface_count; i++) {
+		const usb_interface_info* interface = config->interface[i].active;
+		if (interface == NULL)
+			continue;
+
+		for (size_t j = 0; j < interface->endpoint_count; j++) {
+			usb_pipe handle = interface->endpoint[j].handle;
+			uint8 address = interface->endpoint[j].descr->endpoint_address;
+
+			bool known = false;
+			int32 count = atomic_get(&sPipeCount);
+			for (int32 k = 0; k < count; k++) {
+				if (sPipes[k].handle == handle) {
+					sPipes[k].address = address;
+					known = true;
+				}
+			}
+			if (known || count >= USB_TRACE_MAX_PIPES)
+				continue;
+
+			// configurations are looked up under gDriverLock only
+			sPipes[count].handle = handle;
+			sPipes[count].address = address;
+			atomic_add(&sPipeCount, 1);
+		}
+	}
+}
+
+
+static uint8
+trace_endpoint(usb_pipe pipe)
+{
+	int32 count = atomic_get(&sPipeCount);
+	for (int32 i = 0; i < count; i++) {
+		if (sPipes[i].handle == pipe)
+			return sPipes[i].address;
+	}
+	return 0;
+}
+
+
+static void
+trace_complete(uint32 id, uint32 handle, uint8 endpoint, status_t status,
+	const void* inData, size_t actualLength)
+{
+	usb_trace_record record;
+	memset(&record, 0, sizeof(record));
+	record.type = USB_TRACE_COMPLETE;
+	record.endpoint = endpoint;
+	record.id = id;
+	record.handle = handle;
+	record.status = status;
+	record.length = actualLength;
+	trace_record(&record, status == B_OK ? inData : NULL, actualLength);
+}
+
+
+static void
+trace_delete_transfer(trace_transfer* transfer)
+{
+	int32 index = transfer - sTransfers;
+	atomic_and(&sTransferBusy[index / 32], ~(1 << (index % 32)));
+}
+
+
+static void
+trace_callback(void* cookie, status_t status, void* data, size_t actualLength)
+{
+	trace_transfer* transfer = (trace_transfer*)cookie;
+	trace_complete(transfer->id, transfer->handle, transfer->endpoint, status,
+		transfer->in ? data : NULL, actualLength);
+
+	usb_callback_func callback = transfer->callback;
+	void* callbackCookie = transfer->cookie;
+	trace_delete_transfer(transfer);
+	callback(callbackCookie, status, data, actualLength);
+}
+
+
+/*!	Takes a record from the pool, or returns NULL if all are in flight. */
+static trace_transfer*
+trace_create_transfer(usb_callback_func callback, void* cookie,
+	uint32 handle, uint8 endpoint, bool in)
+{
+	trace_transfer* transfer = NULL;
+	int32 first = atomic_add(&sTransferHint, 1);
+	for (int32 i = 0; i < USB_TRACE_MAX_TRANSFERS / 32 && transfer == NULL;
+			i++) {
+		int32 word = (first + i) % (USB_TRACE_MAX_TRANSFERS / 32);
+		int32 busy;
+		while ((busy = atomic_get(&sTransferBusy[word])) != -1) {
+			int32 bit = 0;
+			while ((busy & (1 << bit)) != 0)
+				bit++;
+			if ((atomic_or(&sTransferBusy[word], 1 << bit) & (1 << bit))
+					== 0) {
+				transfer = &sTransfers[word * 32 + bit];
+				break;
+			}
+		}
+	}
+	if (transfer == NULL)
+		return NULL;
+
+	transfer->callback = callback;
+	transfer->cookie = cookie;
+	transfer->id = atomic_add(&sNextID, 1);
+	transfer->handle = handle;
+	transfer->endpoint = endpoint;
+	transfer->in = in;
+	return transfer;
+}
+
+
+//	#pragma mark - recording usb_module_info
+
+
+static const usb_configuration_info*
+trace_get_nth_configuration(usb_device device, uint32 index)
+{
+	const usb_configuration_info* config
+		= sModule->get_nth_configuration(device, index);
+	trace_remember_pipes(config);
+	return config;
+}
+
+
+static const usb_configuration_info*
+trace_get_configuration(usb_device device)
+{
+	const usb_configuration_info* config = sModule->get_configuration(device);
+	trace_remember_pipes(config);
+	return config;
+}
+
+
+static status_t
+trace_send_request(usb_device device, uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data,
+	size_t* actualLength)
+{
+	// recorded like a queued request that completes before returning
+	bool in = (requestType & USB_REQTYPE_DEVICE_IN) != 0;
+	usb_trace_record record;
+	trace_setup(&record, USB_TRACE_SEND_REQUEST, device, requestType,
+		request, value, index, length);
+	record.id = atomic_add(&sNextID, 1);
+	trace_record(&record, in ? NULL : data, length);
+
+	size_t actual = 0;
+	status_t status = sModule->send_request(device, requestType, request,
+		value, index, length, data, &actual);
+	if (actualLength != NULL)
+		*actualLength = actual;
+
+	trace_complete(record.id, device, 0, status, in ? data : NULL, actual);
+	return status;
+}
+
+
+static status_t
+trace_queue_request(usb_device device, uint8 requestType, uint8 request,
+	uint16 value, uint16 index, uint16 length, void* data,
+	usb_callback_func callback, void* callbackCookie)
+{
+	bool in = (requestType & USB_REQTYPE_DEVICE_IN) != 0;
+	trace_transfer* transfer = trace_create_transfer(callback, callbackCookie,
+		device, 0, in);
+	if (transfer == NULL) {
+		atomic_add(&sDropped, 1);
+		return sModule->queue_request(device, requestType, request, value,
+			index, length, data, callback, callbackCookie);
+	}
+
+	usb_trace_record record;
+	trace_setup(&record, USB_TRACE_QUEUE_REQUEST, device, requestType,
+		request, value, index, length);
+	record.id = transfer->id;
+	trace_record(&record, in ? NULL : data, length);
+
+	status_t status = sModule->queue_request(device, requestType, request,
+		value, index, length, data, trace_callback, transfer);
+	if (status != B_OK) {
+		trace_complete(transfer->id, device, 0, status, NULL, 0);
+		trace_delete_transfer(transfer);
+	}
+	return status;
+}
+
+
+static status_t
+trace_queue_bulk(usb_pipe pipe, void* data, size_t dataLength,
+	usb_callback_func callback, void* callbackCookie)
+{
+	uint8 endpoint = trace_endpoint(pipe);
+	bool in = (endpoint & USB_ENDPOINT_ADDR_DIR_IN) != 0;
+	trace_transfer* transfer = trace_create_transfer(callback, callbackCookie,
+		pipe, endpoint, in);
+	if (transfer == NULL) {
+		atomic_add(&sDropped, 1);
+		return sModule->queue_bulk(pipe, data, dataLength, callback,
+			callbackCookie);
+	}
+
+	usb_trace_record record;
+	memset(&record, 0, sizeof(record));
+	record.type = USB_TRACE_QUEUE_BULK;
+	record.endpoint = endpoint;
+	record.id = transfer->id;
+	record.handle = pipe;
+	record.length = dataLength;
+	trace_record(&record, in ? NULL : data, dataLength);
+
+	status_t status = sModule->queue_bulk(pipe, data, dataLength,
+		trace_callback, transfer);
+	if (status != B_OK) {
+		trace_complete(transfer->id, pipe, endpoint, status, NULL, 0);
+		trace_delete_transfer(transfer);
+	}
+	return status;
+}
+
+
+static status_t
+trace_cancel_queued_transfers(usb_pipe pipe)
+{
+	usb_trace_record record;
+	memset(&record, 0, sizeof(record));
+	record.type = USB_TRACE_CANCEL;
+	record.endpoint = trace_endpoint(pipe);
+	record.handle = pipe;
+	record.status = sModule->cancel_queued_transfers(pipe);
+	trace_record(&record, NULL, 0);
+	return record.status;
+}
+
+
+//	#pragma mark -
+
+
+static void
+write_trace()
+{
+	int32 size = atomic_get(&sEnd);
+	if (size < 0)
+		size = min_c(atomic_get(&sUsed), sCapacity);
+
+	int fd = open(sPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		TRACE_ALWAYS(DRIVER_NAME": could not create USB trace %s\n", sPath);
+		return;
+	}
+
+	usb_trace_header header;
+	header.magic = USB_TRACE_MAGIC;
+	header.version = USB_TRACE_VERSION;
+	header.record_size = sizeof(usb_trace_record);
+	header.size = size;
+	header.dropped = atomic_get(&sDropped);
+
+	if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)
+		|| write(fd, sBuffer, size) != size) {
+		TRACE_ALWAYS(DRIVER_NAME": writing USB trace %s failed\n", sPath);
+	} else {
+		TRACE_ALWAYS(DRIVER_NAME": wrote %" B_PRId32 " bytes of USB trace to "
+			"%s, %" B_PRId32 " records dropped\n", size, sPath,
+			header.dropped);
+	}
+	close(fd);
+}
+
+
+/*!	Replaces \a *module with the recording module if the driver settings
+	ask for a trace. Without the setting this does nothing.
+*/
+status_t
+init_usb_trace(usb_module_info** module)
+{
+	void* handle = load_driver_settings(DRIVER_NAME);
+	if (handle == NULL)
+		return B_OK;
+
+	const char* path = get_driver_parameter(handle, "usb_trace", NULL, NULL);
+	const char* size = get_driver_parameter(handle, "usb_trace_size", NULL,
+		NULL);
+	if (path != NULL)
+		snprintf(sPath, sizeof(sPath), "%s", path);
+	sCapacity = size != NULL ? strtol(size, NULL, 0) : USB_TRACE_DEFAULT_SIZE;
+	unload_driver_settings(handle);
+
+	if (path == NULL)
+		return B_OK;
+	if (sCapacity <= 0)
+		return B_BAD_VALUE;
+
+	sBuffer = (uint8*)RALINK_MALLOC(RALINK_ALLOC_USB_TRACE, sCapacity);
+	sTransfers = (trace_transfer*)RALINK_MALLOC(RALINK_ALLOC_USB_TRACE,
+		USB_TRACE_MAX_TRANSFERS * sizeof(trace_transfer));
+	if (sBuffer == NULL || sTransfers == NULL) {
+		RALINK_FREE(sBuffer);
+		RALINK_FREE(sTransfers);
+		sBuffer = NULL;
+		sTransfers = NULL;
+		return B_NO_MEMORY;
+	}
+
+	sUsed = 0;
+	sEnd = -1;
+	sDropped = 0;
+	sNextID = 0;
+	sPipeCount = 0;
+	memset((void*)sTransferBusy, 0, sizeof(sTransferBusy));
+	sStart = system_time();
+
+	sModule = *module;
+	sTracingModule = *sModule;
+	sTracingModule.get_nth_configuration = trace_get_nth_configuration;
+	sTracingModule.get_configuration = trace_get_configuration;
+	sTracingModule.send_request = trace_send_request;
+	sTracingModule.queue_request = trace_queue_request;
+	sTracingModule.queue_bulk = trace_queue_bulk;
+	sTracingModule.cancel_queued_transfers = trace_cancel_queued_transfers;
+	*module = &sTracingModule;
+
+	TRACE_ALWAYS(DRIVER_NAME": recording USB trace to %s\n", sPath);
+	return B_OK;
+}
+
+
+/*!	Writes the trace out. All transfers must have completed by now. */
+void
+uninit_usb_trace()
+{
+	if (sBuffer == NULL)
+		return;
+
+	write_trace();
+	RALINK_FREE(sBuffer);
+	RALINK_FREE(sTransfers);
+	sBuffer = NULL;
+	sTransfers = NULL;
+	sModule = NULL;
+}
+
+
+/*!	Records a driver hook, so that a replay can drive the driver through the
+	same sequence of plugs, opens, reads, controls and closes.
+*/
+void
+usb_trace_mark(uint8 event, uint32 handle, uint32 length)
+{
+	if (sBuffer == NULL)
+		return;
+
+	usb_trace_record record;
+	memset(&record, 0, sizeof(record));
+	record.type = USB_TRACE_MARK;
+	record.handle = handle;
+	record.length = length;
+	record.setup[0] = event;
+	trace_record(&record, NULL, 0);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2014 Stefano Ceccherini <stefano.ceccherini@gmail.com>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef USB_TRACE_H
+#define USB_TRACE_H
+
+#include <SupportDefs.h>
+#include <USB3.h>
+
+
+/*!	USB transaction trace.
+
+	With "usb_trace <path>" in the driver settings, init_usb_trace() puts a
+	recording usb_module_info in front of the bus manager, so every
+	gUSBModule call the driver makes is captured. The records are kept in a
+	buffer of "usb_trace_size" bytes and written to <path> by
+	uninit_usb_trace(); what does not fit is counted, not recorded.
+
+	The file is a usb_trace_header followed by usb_trace_records in host
+	byte order, each followed by usb_trace_record::payload bytes of data,
+	padded to four bytes: the OUT data of a submission, the IN data of a
+	completion.
+*/
+
+
+#define USB_TRACE_MAGIC			'RUTR'
+#define USB_TRACE_VERSION		2
+#define USB_TRACE_DEFAULT_SIZE	(1024 * 1024)
+
+enum {
+	USB_TRACE_SEND_REQUEST = 1,	// synchronous control transfer
+	USB_TRACE_QUEUE_REQUEST,	// asynchronous control transfer submitted
+	USB_TRACE_QUEUE_BULK,		// bulk transfer submitted
+	USB_TRACE_COMPLETE,			// asynchronous transfer completed
+	USB_TRACE_CANCEL,			// cancel_queued_transfers()
+	USB_TRACE_MARK				// driver hook, see USB_TRACE_MARK_*
+};
+
+// usb_trace_record::setup[0] of a USB_TRACE_MARK record, handle and length
+// carry the arguments of the hook
+enum {
+	USB_TRACE_MARK_ADDED = 1,	// handle is the usb_device
+	USB_TRACE_MARK_REMOVED,
+	USB_TRACE_MARK_OPEN,
+	USB_TRACE_MARK_CLOSE,
+	USB_TRACE_MARK_READ,		// length is the size of the buffer
+	USB_TRACE_MARK_READ_DONE,	// handle is the status, length what was
+								// read; amends the read, not a new hook
+	USB_TRACE_MARK_CONTROL,		// handle is the op, length its uint32
+	USB_TRACE_MARK_RETUNE		// handle is the USB_DMA_CFG half the RX
+								// aggregation writes next; not a hook
+};
+
+typedef struct usb_trace_header {
+	uint32	magic;
+	uint16	version;
+	uint16	record_size;		// sizeof(usb_trace_record)
+	uint32	size;				// bytes of records that follow
+	uint32	dropped;			// records that did not fit the buffer
+} usb_trace_header;
+
+typedef struct usb_trace_record {
+	uint8	type;				// USB_TRACE_*
+	uint8	endpoint;			// endpoint address of bulk transfers
+	uint16	reserved;
+	uint32	id;					// pairs a submission with its completion
+	int64	time;				// us since the trace was started
+	uint32	handle;				// usb_device or usb_pipe
+	int32	status;
+	uint32	length;				// requested, or actual on completion
+	uint32	payload;			// bytes of data following the record
+	uint8	setup[8];			// USB setup packet of control transfers
+} usb_trace_record;
+
+
+status_t		init_usb_trace(usb_module_info** module);
+void			uninit_usb_trace();
+
+void			usb_trace_mark(uint8 event, uint32 handle,
+					uint32 length = 0);
+
+#endif // USB_TRACE_H